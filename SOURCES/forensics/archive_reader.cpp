@@ -0,0 +1,944 @@
+/*
+ * =====================================================================================
+ *       Filename:  archive_reader.cpp
+ *    Description:  EVTX logs read straight out of .zip, .tar, .tar.gz, .gz and .zst
+ *
+ *                  The producer thread parses the container and decompresses into
+ *                  the queue blocks themselves: a member is a MemberBegin marker,
+ *                  a 4 KiB header block, 64 KiB chunk blocks and a MemberEnd
+ *                  marker, so every chunk reaches the parser in one piece.  The
+ *                  block handed to the parser is released by its next read.
+ *
+ *                  Zip members are found through the local headers alone, the
+ *                  central directory at the end of the file is never needed.
+ * =====================================================================================
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <utils/win_types.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "archive_reader.h"
+#include "evtx_trace.h"
+
+#define RAW_BUFFER_SIZE		0x40000
+#define MAX_MEMBER_NAME		1024
+#define TAR_BLOCK_SIZE		512
+#define EVTX_FILE_MAGIC		"ElfFile"
+
+#define ZIP_LOCAL_HEADER	0x04034B50
+#define ZIP_CENTRAL_HEADER	0x02014B50
+#define ZIP_END_OF_DIRECTORY	0x06054B50
+#define ZIP64_END_OF_DIRECTORY	0x06064B50
+#define ZIP_DATA_DESCRIPTOR	0x08074B50
+#define ZIP_FLAG_ENCRYPTED	0x0001
+#define ZIP_FLAG_DESCRIPTOR	0x0008
+#define ZIP_METHOD_STORED	0
+#define ZIP_METHOD_DEFLATE	8
+
+typedef enum
+{
+	FormatNone,
+	FormatZip,
+	FormatTar,
+	FormatGzip,
+	FormatZstd
+}
+ArchiveFormat;
+
+typedef enum
+{
+	BlockData,
+	BlockMemberBegin,
+	BlockMemberEnd,
+	BlockArchiveEnd
+}
+BlockKind;
+
+typedef struct
+{
+	BlockKind	kind;
+	uint8_t*	data;
+	size_t		dataLen;
+	char		name[MAX_MEMBER_NAME];
+	uint64_t	size;
+}
+QueueBlock;
+
+typedef struct
+{
+	struct sChunkReader	reader;
+	struct sArchive*	archive;
+	bool			ended;
+}
+MemberReader;
+
+/*  Returns the number of member bytes put into out, 0 at the end */
+typedef size_t	(*MemberReadFunction)(struct sArchive* archive, void* context, uint8_t* out, size_t outLen);
+
+struct sArchive
+{
+	char*		fileName;
+	int		f;
+	ArchiveFormat	format;
+	ArchiveFormat	compression;	/*  of the tar or single log stream */
+
+	/*  producer side */
+	uint8_t*	raw;
+	size_t		rawPos;
+	size_t		rawLen;
+	bool		rawEnd;
+	bool		streamEnd;
+	uint8_t*	scratch;
+#ifdef HAVE_ZLIB
+	z_stream	z;
+	bool		zInitialized;
+#endif
+#ifdef HAVE_ZSTD
+	ZSTD_DStream*	zstd;
+	bool		zstdFrameDone;
+#endif
+
+	pthread_t	thread;
+	bool		threadStarted;
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	QueueBlock	blocks[ARCHIVE_QUEUE_BLOCKS];
+	size_t		head;
+	size_t		count;		/*  filled blocks, including the one the consumer holds */
+	bool		holding;
+	bool		stop;
+	bool		failed;
+
+	/*  consumer side */
+	MemberReader	member;
+	bool		memberActive;
+	bool		archiveEnded;
+	char		memberName[MAX_MEMBER_NAME];
+	uint64_t	memberSize;
+};
+
+static uint16_t	LoadLE16(const uint8_t* p)
+{
+	return (uint16_t)( p[0] | ( p[1] << 8 ) );
+}
+
+static uint32_t	LoadLE32(const uint8_t* p)
+{
+	return (uint32_t)p[0] | ( (uint32_t)p[1] << 8 ) | ( (uint32_t)p[2] << 16 ) | ( (uint32_t)p[3] << 24 );
+}
+
+static uint64_t	LoadLE64(const uint8_t* p)
+{
+	return (uint64_t)LoadLE32(p) | ( (uint64_t)LoadLE32(p + 4) << 32 );
+}
+
+static ArchiveFormat	DetectFormat(const uint8_t* prefix, size_t prefixLen)
+{
+	if ( prefixLen >= 4 && LoadLE32(prefix) == ZIP_LOCAL_HEADER )
+		return FormatZip;
+	if ( prefixLen >= 2 && prefix[0] == 0x1F && prefix[1] == 0x8B )
+		return FormatGzip;
+	if ( prefixLen >= 4 && LoadLE32(prefix) == 0xFD2FB528 )
+		return FormatZstd;
+	if ( prefixLen >= 262 && !memcmp(prefix + 257, "ustar", 5) )
+		return FormatTar;
+	return FormatNone;
+}
+
+bool	ArchiveDetect(const uint8_t* prefix, size_t prefixLen)
+{
+	return ( DetectFormat(prefix, prefixLen) != FormatNone );
+}
+
+/*  Queue, producer side */
+
+static QueueBlock*	AcquireBlock(struct sArchive* archive)
+{
+	QueueBlock*	block	=	NULL;
+
+	pthread_mutex_lock(&archive->lock);
+	while ( archive->count == ARCHIVE_QUEUE_BLOCKS && !archive->stop )
+		pthread_cond_wait(&archive->cond, &archive->lock);
+	if ( !archive->stop )
+		block = &archive->blocks[( archive->head + archive->count ) % ARCHIVE_QUEUE_BLOCKS];
+	pthread_mutex_unlock(&archive->lock);
+
+	return block;
+}
+
+static void	PushBlock(struct sArchive* archive)
+{
+	pthread_mutex_lock(&archive->lock);
+	archive->count++;
+	pthread_cond_broadcast(&archive->cond);
+	pthread_mutex_unlock(&archive->lock);
+}
+
+static bool	PushMarker(struct sArchive* archive, BlockKind kind, const char* name, uint64_t size)
+{
+	QueueBlock*	block	=	AcquireBlock(archive);
+
+	if ( block == NULL )
+		return false;
+	block->kind = kind;
+	block->dataLen = 0;
+	block->size = size;
+	snprintf(block->name, sizeof(block->name), "%s", name != NULL ? name : "");
+	PushBlock(archive);
+	return true;
+}
+
+/*  Queue, consumer side: releases the block held and waits for the next */
+
+static QueueBlock*	TakeBlock(struct sArchive* archive)
+{
+	QueueBlock*	block;
+
+	pthread_mutex_lock(&archive->lock);
+	if ( archive->holding )
+	{
+		archive->head = ( archive->head + 1 ) % ARCHIVE_QUEUE_BLOCKS;
+		archive->count--;
+		archive->holding = false;
+		pthread_cond_broadcast(&archive->cond);
+	}
+	while ( archive->count == 0 )
+		pthread_cond_wait(&archive->cond, &archive->lock);
+	block = &archive->blocks[archive->head];
+	archive->holding = true;
+	pthread_mutex_unlock(&archive->lock);
+
+	return block;
+}
+
+/*  Raw input */
+
+static bool	RawFill(struct sArchive* archive)
+{
+	ssize_t	numRead;
+
+	if ( archive->rawPos < archive->rawLen )
+		return true;
+	if ( archive->rawEnd )
+		return false;
+
+	numRead = read(archive->f, archive->raw, RAW_BUFFER_SIZE);
+	if ( numRead < 0 )
+		archive->failed = true;
+	archive->rawPos = 0;
+	archive->rawLen = numRead > 0 ? (size_t)numRead : 0;
+	archive->rawEnd = ( numRead <= 0 );
+	return ( archive->rawLen > 0 );
+}
+
+static size_t	RawRead(struct sArchive* archive, uint8_t* out, size_t outLen)
+{
+	size_t	done	=	0;
+
+	while ( done < outLen && RawFill(archive) )
+	{
+		size_t	numBytes	=	archive->rawLen - archive->rawPos;
+
+		if ( numBytes > outLen - done )
+			numBytes = outLen - done;
+		if ( out != NULL )
+			memcpy(out + done, archive->raw + archive->rawPos, numBytes);
+		archive->rawPos += numBytes;
+		done += numBytes;
+	}
+	return done;
+}
+
+static bool	RawSkip(struct sArchive* archive, uint64_t numBytes)
+{
+	while ( numBytes > 0 )
+	{
+		size_t	step	=	numBytes > RAW_BUFFER_SIZE ? RAW_BUFFER_SIZE : (size_t)numBytes;
+
+		if ( RawRead(archive, NULL, step) != step )
+			return false;
+		numBytes -= step;
+	}
+	return true;
+}
+
+/*  Decompressed streams */
+
+#ifdef HAVE_ZLIB
+/*  Gzip members follow each other until the input ends, a deflate
+ *  stream in a zip ends the member */
+static size_t	InflateRead(struct sArchive* archive, uint8_t* out, size_t outLen, bool concatenated)
+{
+	z_stream*	z	=	&archive->z;
+
+	z->next_out = out;
+	z->avail_out = (uInt)outLen;
+	while ( z->avail_out > 0 && !archive->streamEnd )
+	{
+		int	ret;
+
+		if ( !RawFill(archive) )
+		{
+			archive->failed = true;		/*  truncated */
+			archive->streamEnd = true;
+			break;
+		}
+		z->next_in = archive->raw + archive->rawPos;
+		z->avail_in = (uInt)( archive->rawLen - archive->rawPos );
+		ret = inflate(z, Z_NO_FLUSH);
+		archive->rawPos = archive->rawLen - z->avail_in;
+
+		if ( ret == Z_STREAM_END )
+		{
+			if ( concatenated && RawFill(archive) )
+				inflateReset(z);
+			else
+				archive->streamEnd = true;
+		}
+		else if ( ret != Z_OK )
+		{
+			archive->failed = true;
+			archive->streamEnd = true;
+		}
+	}
+	return outLen - z->avail_out;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static size_t	ZstdRead(struct sArchive* archive, uint8_t* out, size_t outLen)
+{
+	ZSTD_outBuffer	output	=	{ out, outLen, 0 };
+
+	while ( output.pos < output.size && !archive->streamEnd )
+	{
+		ZSTD_inBuffer	input;
+		size_t		ret;
+
+		if ( !RawFill(archive) )
+		{
+			if ( !archive->zstdFrameDone )
+				archive->failed = true;
+			archive->streamEnd = true;
+			break;
+		}
+		input.src = archive->raw + archive->rawPos;
+		input.size = archive->rawLen - archive->rawPos;
+		input.pos = 0;
+		ret = ZSTD_decompressStream(archive->zstd, &output, &input);
+		archive->rawPos += input.pos;
+		if ( ZSTD_isError(ret) )
+		{
+			archive->failed = true;
+			archive->streamEnd = true;
+		}
+		archive->zstdFrameDone = ( ret == 0 );
+	}
+	return output.pos;
+}
+#endif
+
+static size_t	StreamRead(struct sArchive* archive, uint8_t* out, size_t outLen)
+{
+	switch(archive->compression)
+	{
+#ifdef HAVE_ZLIB
+	case FormatGzip:
+		return InflateRead(archive, out, outLen, true);
+#endif
+#ifdef HAVE_ZSTD
+	case FormatZstd:
+		return ZstdRead(archive, out, outLen);
+#endif
+	default:
+		return RawRead(archive, out, outLen);
+	}
+}
+
+static bool	StreamSkip(struct sArchive* archive, uint64_t numBytes)
+{
+	while ( numBytes > 0 )
+	{
+		size_t	step	=	numBytes > EVTX_CHUNK_SIZE ? EVTX_CHUNK_SIZE : (size_t)numBytes;
+
+		if ( StreamRead(archive, archive->scratch, step) != step )
+			return false;
+		numBytes -= step;
+	}
+	return true;
+}
+
+/*  Members */
+
+static size_t	ReadFull(struct sArchive* archive, MemberReadFunction readFunction, void* context, uint8_t* out, size_t outLen)
+{
+	size_t	done	=	0;
+
+	while ( done < outLen )
+	{
+		size_t	numRead	=	readFunction(archive, context, out + done, outLen - done);
+
+		if ( numRead == 0 )
+			break;
+		done += numRead;
+	}
+	return done;
+}
+
+/*  Queues the member if it is an EVTX log, consumes it either way;
+ *  false when the consumer has gone */
+static bool	CopyMember(struct sArchive* archive, const char* name, uint64_t size, MemberReadFunction readFunction, void* context)
+{
+	uint8_t		header[EVTX_FILE_HEADER_SIZE];
+	size_t		headerLen	=	ReadFull(archive, readFunction, context, header, sizeof(header));
+	QueueBlock*	block;
+
+	if ( headerLen < sizeof(EVTX_FILE_MAGIC) || memcmp(header, EVTX_FILE_MAGIC, sizeof(EVTX_FILE_MAGIC)) )
+	{
+		while ( readFunction(archive, context, archive->scratch, EVTX_CHUNK_SIZE) > 0 )
+			;
+		return true;
+	}
+
+	if ( !PushMarker(archive, BlockMemberBegin, name, size) )
+		return false;
+	block = AcquireBlock(archive);
+	if ( block == NULL )
+		return false;
+	block->kind = BlockData;
+	memcpy(block->data, header, headerLen);
+	block->dataLen = headerLen;
+	PushBlock(archive);
+
+	while ( headerLen == sizeof(header) )
+	{
+		block = AcquireBlock(archive);
+		if ( block == NULL )
+			return false;
+		TRACE_BEGIN(traceStart);
+		block->kind = BlockData;
+		block->dataLen = ReadFull(archive, readFunction, context, block->data, EVTX_CHUNK_SIZE);
+		TRACE_END_ARG("unpack", traceStart, "bytes", block->dataLen);
+		if ( block->dataLen == 0 )
+			break;
+		PushBlock(archive);
+		if ( block->dataLen < EVTX_CHUNK_SIZE )
+			break;
+	}
+	/*  a log longer than its chunks is fine, the rest is not needed */
+	while ( readFunction(archive, context, archive->scratch, EVTX_CHUNK_SIZE) > 0 )
+		;
+
+	return PushMarker(archive, BlockMemberEnd, name, size);
+}
+
+typedef struct
+{
+	uint64_t	remaining;
+	bool		raw;		/*  stored zip member, else a tar member */
+}
+SizedMember;
+
+static size_t	SizedMemberRead(struct sArchive* archive, void* context, uint8_t* out, size_t outLen)
+{
+	SizedMember*	member	=	(SizedMember*)context;
+	size_t		numRead;
+
+	if ( outLen > member->remaining )
+		outLen = (size_t)member->remaining;
+	if ( outLen == 0 )
+		return 0;
+	numRead = member->raw ? RawRead(archive, out, outLen) : StreamRead(archive, out, outLen);
+	if ( numRead == 0 )
+	{
+		archive->failed = true;		/*  truncated */
+		member->remaining = 0;
+	}
+	member->remaining -= numRead;
+	return numRead;
+}
+
+#ifdef HAVE_ZLIB
+static size_t	DeflateMemberRead(struct sArchive* archive, void* context, uint8_t* out, size_t outLen)
+{
+	return InflateRead(archive, out, outLen, false);
+}
+#endif
+
+typedef struct
+{
+	const uint8_t*	pending;	/*  sniffed before the format was known */
+	size_t		pendingLen;
+}
+StreamMember;
+
+static size_t	StreamMemberRead(struct sArchive* archive, void* context, uint8_t* out, size_t outLen)
+{
+	StreamMember*	member	=	(StreamMember*)context;
+
+	if ( member->pendingLen > 0 )
+	{
+		if ( outLen > member->pendingLen )
+			outLen = member->pendingLen;
+		memcpy(out, member->pending, outLen);
+		member->pending += outLen;
+		member->pendingLen -= outLen;
+		return outLen;
+	}
+	return StreamRead(archive, out, outLen);
+}
+
+/*  Zip */
+
+static bool	ParseZip(struct sArchive* archive)
+{
+	uint8_t	header[30];
+	char	name[MAX_MEMBER_NAME];
+
+	for (;;)
+	{
+		uint16_t	flags;
+		uint16_t	method;
+		uint64_t	compressedSize;
+		uint64_t	size;
+		uint16_t	nameLen;
+		uint16_t	extraLen;
+		bool		zip64		=	false;
+		bool		result;
+
+		if ( RawRead(archive, header, 4) != 4 )
+			return true;
+		if ( LoadLE32(header) != ZIP_LOCAL_HEADER )
+		{
+			/*  the members are followed by the central directory */
+			return ( LoadLE32(header) == ZIP_CENTRAL_HEADER || LoadLE32(header) == ZIP_END_OF_DIRECTORY ||
+					LoadLE32(header) == ZIP64_END_OF_DIRECTORY );
+		}
+		if ( RawRead(archive, header + 4, sizeof(header) - 4) != sizeof(header) - 4 )
+			return false;
+
+		flags = LoadLE16(header + 6);
+		method = LoadLE16(header + 8);
+		compressedSize = LoadLE32(header + 18);
+		size = LoadLE32(header + 22);
+		nameLen = LoadLE16(header + 26);
+		extraLen = LoadLE16(header + 28);
+
+		if ( RawRead(archive, archive->scratch, nameLen) != nameLen )
+			return false;
+		snprintf(name, sizeof(name), "%.*s", (int)nameLen, (const char*)archive->scratch);
+
+		if ( RawRead(archive, archive->scratch, extraLen) != extraLen )
+			return false;
+		for (size_t pos = 0; pos + 4 <= extraLen; )
+		{
+			uint16_t	id		=	LoadLE16(archive->scratch + pos);
+			uint16_t	fieldLen	=	LoadLE16(archive->scratch + pos + 2);
+			const uint8_t*	field		=	archive->scratch + pos + 4;
+
+			if ( pos + 4 + fieldLen > extraLen )
+				break;
+			if ( id == 0x0001 )
+			{
+				size_t	fieldPos	=	0;
+
+				zip64 = true;
+				if ( size == 0xFFFFFFFF && fieldPos + 8 <= fieldLen )
+				{
+					size = LoadLE64(field + fieldPos);
+					fieldPos += 8;
+				}
+				if ( compressedSize == 0xFFFFFFFF && fieldPos + 8 <= fieldLen )
+					compressedSize = LoadLE64(field + fieldPos);
+			}
+			pos += 4 + fieldLen;
+		}
+
+		if ( method == ZIP_METHOD_STORED && !( flags & ZIP_FLAG_ENCRYPTED ) && !( flags & ZIP_FLAG_DESCRIPTOR ) )
+		{
+			SizedMember	member	=	{ compressedSize, true };
+
+			result = CopyMember(archive, name, size, SizedMemberRead, &member);
+		}
+#ifdef HAVE_ZLIB
+		else if ( method == ZIP_METHOD_DEFLATE && !( flags & ZIP_FLAG_ENCRYPTED ) )
+		{
+			inflateReset(&archive->z);
+			archive->streamEnd = false;
+			result = CopyMember(archive, name, size, DeflateMemberRead, NULL);
+		}
+#endif
+		else if ( !( flags & ZIP_FLAG_DESCRIPTOR ) )
+		{
+			printf("Skipped %s in %s, unsupported compression or encryption\n", name, archive->fileName);
+			result = RawSkip(archive, compressedSize);
+		}
+		else
+		{
+			/*  the end of the member is only known to its decompressor */
+			printf("Cannot read past %s in %s\n", name, archive->fileName);
+			return false;
+		}
+		if ( !result || archive->failed )
+			return false;
+
+		if ( flags & ZIP_FLAG_DESCRIPTOR )
+		{
+			uint8_t	descriptor[24];
+			size_t	descriptorLen	=	zip64 ? 20 : 12;
+
+			if ( RawRead(archive, descriptor, 4) != 4 )
+				return false;
+			if ( LoadLE32(descriptor) != ZIP_DATA_DESCRIPTOR )
+				descriptorLen -= 4;	/*  the signature is optional, that was the CRC */
+			if ( RawRead(archive, descriptor + 4, descriptorLen) != descriptorLen )
+				return false;
+		}
+	}
+}
+
+/*  Tar */
+
+static uint64_t	TarNumber(const uint8_t* field, size_t fieldLen)
+{
+	uint64_t	value	=	0;
+	size_t		idx	=	0;
+
+	if ( field[0] & 0x80 )
+	{
+		/*  GNU base-256 for sizes beyond 8 GiB */
+		for (idx = 1; idx < fieldLen; idx++)
+			value = ( value << 8 ) | field[idx];
+		return value;
+	}
+	while ( idx < fieldLen && ( field[idx] == ' ' || field[idx] == 0 ) )
+		idx++;
+	for (; idx < fieldLen && field[idx] >= '0' && field[idx] <= '7'; idx++)
+		value = ( value << 3 ) | (uint64_t)( field[idx] - '0' );
+	return value;
+}
+
+/*  Takes "path=" out of pax extended header records ("<len> <key>=<value>\n") */
+static void	PaxPath(const char* records, size_t recordsLen, char* name, size_t nameSize)
+{
+	size_t	pos	=	0;
+
+	while ( pos < recordsLen )
+	{
+		char*		end;
+		unsigned long	recordLen	=	strtoul(records + pos, &end, 10);
+		const char*	key		=	end + 1;
+
+		if ( recordLen == 0 || pos + recordLen > recordsLen || *end != ' ' )
+			return;
+		if ( !strncmp(key, "path=", 5) )
+		{
+			const char*	value		=	key + 5;
+			size_t		valueLen	=	records + pos + recordLen - 1 - value;
+
+			snprintf(name, nameSize, "%.*s", (int)valueLen, value);
+		}
+		pos += recordLen;
+	}
+}
+
+static bool	ParseTar(struct sArchive* archive, const uint8_t* firstHeader)
+{
+	uint8_t	header[TAR_BLOCK_SIZE];
+	char	name[MAX_MEMBER_NAME];
+	bool	haveLongName	=	false;
+
+	memcpy(header, firstHeader, sizeof(header));
+	for (;;)
+	{
+		uint64_t	size		=	TarNumber(header + 124, 12);
+		uint64_t	paddedSize	=	( size + TAR_BLOCK_SIZE - 1 ) & ~(uint64_t)( TAR_BLOCK_SIZE - 1 );
+		uint8_t		type		=	header[156];
+		size_t		zeroIdx;
+
+		for (zeroIdx = 0; zeroIdx < sizeof(header) && header[zeroIdx] == 0; zeroIdx++)
+			;
+		if ( zeroIdx == sizeof(header) )
+			return true;
+
+		if ( !haveLongName )
+		{
+			if ( !memcmp(header + 257, "ustar", 5) && header[345] != 0 )
+				snprintf(name, sizeof(name), "%.155s/%.100s", (const char*)header + 345, (const char*)header);
+			else
+				snprintf(name, sizeof(name), "%.100s", (const char*)header);
+		}
+
+		if ( ( type == 'L' || type == 'x' ) && size < EVTX_CHUNK_SIZE )
+		{
+			if ( StreamRead(archive, archive->scratch, (size_t)paddedSize) != paddedSize )
+				return false;
+			archive->scratch[size] = 0;
+			if ( type == 'L' )
+				snprintf(name, sizeof(name), "%s", (const char*)archive->scratch);
+			else
+				PaxPath((const char*)archive->scratch, (size_t)size, name, sizeof(name));
+			haveLongName = true;
+		}
+		else
+		{
+			uint64_t	skipSize	=	paddedSize;
+
+			if ( type == '0' || type == 0 || type == '7' )
+			{
+				SizedMember	member	=	{ size, false };
+
+				if ( !CopyMember(archive, name, size, SizedMemberRead, &member) )
+					return false;
+				skipSize -= size;
+			}
+			if ( !StreamSkip(archive, skipSize) )
+				return false;
+			haveLongName = false;
+		}
+		if ( archive->failed )
+			return false;
+
+		if ( StreamRead(archive, header, sizeof(header)) != sizeof(header) )
+			return !archive->failed;	/*  the end of archive blocks are often left out */
+	}
+}
+
+/*  A compressed tar or a single compressed log */
+static bool	ParseStream(struct sArchive* archive)
+{
+	uint8_t		prefix[TAR_BLOCK_SIZE];
+	size_t		prefixLen	=	StreamRead(archive, prefix, sizeof(prefix));
+	StreamMember	member		=	{ prefix, prefixLen };
+	const char*	baseName	=	strrchr(archive->fileName, '/');
+	char		name[MAX_MEMBER_NAME];
+	char*		extension;
+
+	if ( prefixLen == sizeof(prefix) && DetectFormat(prefix, prefixLen) == FormatTar )
+		return ParseTar(archive, prefix);
+
+	snprintf(name, sizeof(name), "%s", baseName != NULL ? baseName + 1 : archive->fileName);
+	extension = strrchr(name, '.');
+	if ( extension != NULL && ( !strcmp(extension, ".gz") || !strcmp(extension, ".zst") ) )
+		*extension = 0;
+	return ( CopyMember(archive, name, 0, StreamMemberRead, &member) && !archive->failed );
+}
+
+static void*	ArchiveThread(void* arg)
+{
+	struct sArchive*	archive	=	(struct sArchive*)arg;
+	bool			result	=	false;
+
+	EvtxTraceThreadName("archive reader");
+	switch(archive->format)
+	{
+	case FormatZip:
+		result = ParseZip(archive);
+		break;
+	case FormatTar:
+		result = ParseStream(archive);
+		break;
+	case FormatGzip:
+#ifdef HAVE_ZLIB
+		archive->streamEnd = false;
+		result = ParseStream(archive);
+#else
+		printf("%s: built without zlib\n", archive->fileName);
+#endif
+		break;
+	case FormatZstd:
+#ifdef HAVE_ZSTD
+		archive->streamEnd = false;
+		result = ParseStream(archive);
+#else
+		printf("%s: built without libzstd\n", archive->fileName);
+#endif
+		break;
+	default:
+		break;
+	}
+
+	if ( !result )
+		archive->failed = true;
+	PushMarker(archive, BlockArchiveEnd, NULL, 0);
+	return NULL;
+}
+
+/*  Member reader */
+
+static bool	MemberRead(struct sChunkReader* reader, size_t size, const uint8_t** data, size_t* dataLen)
+{
+	MemberReader*		member	=	(MemberReader*)reader;
+	struct sArchive*	archive	=	member->archive;
+	QueueBlock*		block;
+
+	*data = NULL;
+	*dataLen = 0;
+	if ( member->ended || archive->archiveEnded )
+		return true;
+
+	block = TakeBlock(archive);
+	if ( block->kind != BlockData )
+	{
+		member->ended = true;
+		archive->archiveEnded = ( block->kind == BlockArchiveEnd );
+		return true;
+	}
+	if ( block->dataLen > size )
+		return false;
+
+	*data = block->data;
+	*dataLen = block->dataLen;
+	reader->offset += block->dataLen;
+	return true;
+}
+
+static void	MemberClose(struct sChunkReader* reader)
+{
+	/*  owned by the archive */
+}
+
+struct sChunkReader*	ArchiveNextMember(struct sArchive* archive, const char** memberName, uint64_t* memberSize)
+{
+	const uint8_t*	data;
+	size_t		dataLen;
+
+	if ( archive->memberActive )
+	{
+		while ( !archive->member.ended && MemberRead(&archive->member.reader, EVTX_CHUNK_SIZE, &data, &dataLen) )
+			;
+		archive->memberActive = false;
+	}
+
+	while ( !archive->archiveEnded )
+	{
+		QueueBlock*	block	=	TakeBlock(archive);
+
+		if ( block->kind == BlockArchiveEnd )
+		{
+			archive->archiveEnded = true;
+			break;
+		}
+		if ( block->kind != BlockMemberBegin )
+			continue;
+
+		snprintf(archive->memberName, sizeof(archive->memberName), "%s", block->name);
+		archive->memberSize = block->size;
+		archive->member.ended = false;
+		archive->member.reader.offset = 0;
+		archive->memberActive = true;
+		*memberName = archive->memberName;
+		*memberSize = archive->memberSize;
+		return &archive->member.reader;
+	}
+	return NULL;
+}
+
+bool	ArchiveFailed(const struct sArchive* archive)
+{
+	return archive->failed;
+}
+
+struct sArchive*	ArchiveOpen(const char* fileName, int f, const uint8_t* prefix, size_t prefixLen)
+{
+	struct sArchive*	archive	=	(struct sArchive*)calloc(1, sizeof(*archive));
+	bool			result	=	( archive != NULL );
+
+	if ( !result )
+	{
+		close(f);
+		return NULL;
+	}
+
+	archive->f = f;
+	archive->format = DetectFormat(prefix, prefixLen);
+	archive->compression = archive->format;
+	archive->fileName = strdup(fileName);
+	archive->raw = (uint8_t*)malloc(RAW_BUFFER_SIZE);
+	archive->scratch = (uint8_t*)malloc(EVTX_CHUNK_SIZE + 1);
+	pthread_mutex_init(&archive->lock, NULL);
+	pthread_cond_init(&archive->cond, NULL);
+	archive->member.reader.read = MemberRead;
+	archive->member.reader.seek = NULL;
+	archive->member.reader.close = MemberClose;
+	archive->member.archive = archive;
+	result = ( archive->fileName != NULL && archive->raw != NULL && archive->scratch != NULL && prefixLen <= RAW_BUFFER_SIZE );
+	for (size_t idx = 0; result && idx < ARCHIVE_QUEUE_BLOCKS; idx++)
+	{
+		archive->blocks[idx].data = (uint8_t*)malloc(EVTX_CHUNK_SIZE);
+		result = ( archive->blocks[idx].data != NULL );
+	}
+
+	if ( result )
+	{
+		memcpy(archive->raw, prefix, prefixLen);
+		archive->rawLen = prefixLen;
+#ifdef HAVE_ZLIB
+		if ( archive->format == FormatZip || archive->format == FormatGzip )
+		{
+			/*  raw deflate in zip members, gzip framing otherwise */
+			result = ( inflateInit2(&archive->z, archive->format == FormatZip ? -MAX_WBITS : MAX_WBITS + 16) == Z_OK );
+			archive->zInitialized = result;
+		}
+#endif
+#ifdef HAVE_ZSTD
+		if ( archive->format == FormatZstd )
+		{
+			archive->zstd = ZSTD_createDStream();
+			result = ( archive->zstd != NULL && !ZSTD_isError(ZSTD_initDStream(archive->zstd)) );
+		}
+#endif
+	}
+	if ( result )
+	{
+		result = ( pthread_create(&archive->thread, NULL, ArchiveThread, archive) == 0 );
+		archive->threadStarted = result;
+	}
+
+	if ( !result )
+	{
+		ArchiveClose(archive);
+		return NULL;
+	}
+	return archive;
+}
+
+void	ArchiveClose(struct sArchive* archive)
+{
+	if ( archive == NULL )
+		return;
+
+	if ( archive->threadStarted )
+	{
+		pthread_mutex_lock(&archive->lock);
+		archive->stop = true;
+		pthread_cond_broadcast(&archive->cond);
+		pthread_mutex_unlock(&archive->lock);
+		pthread_join(archive->thread, NULL);
+	}
+#ifdef HAVE_ZLIB
+	if ( archive->zInitialized )
+		inflateEnd(&archive->z);
+#endif
+#ifdef HAVE_ZSTD
+	ZSTD_freeDStream(archive->zstd);
+#endif
+	for (size_t idx = 0; idx < ARCHIVE_QUEUE_BLOCKS; idx++)
+		free(archive->blocks[idx].data);
+	pthread_mutex_destroy(&archive->lock);
+	pthread_cond_destroy(&archive->cond);
+	close(archive->f);
+	free(archive->raw);
+	free(archive->scratch);
+	free(archive->fileName);
+	free(archive);
+}
@@ -0,0 +1,40 @@
+/*
+ * =====================================================================================
+ *       Filename:  archive_reader.h
+ *    Description:  EVTX logs read straight out of .zip, .tar, .tar.gz, .gz and .zst
+ *
+ *                  The archive is read front to back, never seeked, and decompressed
+ *                  on a thread of its own that hands the members to the parser as
+ *                  header and chunk blocks through a bounded queue.  Members are
+ *                  recognized by the EVTX file magic, not by their names.
+ *                  Deflate needs zlib, Zstandard needs libzstd at build time.
+ * =====================================================================================
+ */
+
+#ifndef archive_reader_h_included
+#define archive_reader_h_included
+
+#include <stdint.h>
+#include <stddef.h>
+#include "chunk_reader.h"
+
+#define ARCHIVE_SNIFF_SIZE	512
+#define ARCHIVE_QUEUE_BLOCKS	8
+
+/*  Checks the first bytes of a file for a container or compression magic */
+bool	ArchiveDetect(const uint8_t* prefix, size_t prefixLen);
+
+struct sArchive;
+
+/*  Takes over f; prefix holds the bytes already read from it */
+struct sArchive*	ArchiveOpen(const char* fileName, int f, const uint8_t* prefix, size_t prefixLen);
+/*  Closes f and stops the decompression */
+void	ArchiveClose(struct sArchive* archive);
+
+/*  Skips the rest of the current member and waits for the next one; the
+ *  reader is valid until the next call, NULL after the last member */
+struct sChunkReader*	ArchiveNextMember(struct sArchive* archive, const char** memberName, uint64_t* memberSize);
+/*  True when the archive was damaged or could not be decompressed */
+bool	ArchiveFailed(const struct sArchive* archive);
+
+#endif
@@ -0,0 +1,656 @@
+/*
+ * =====================================================================================
+ *       Filename:  async_reader.cpp
+ *    Description:  Log files read ahead of the parser with asynchronous I/O
+ *
+ *                  A reader owns depth slots used as a ring: the slot at the head
+ *                  holds the block handed to the parser, the ones after it are
+ *                  being read.  A read releases the head slot, starts reads into
+ *                  the free slots up to the end of the file and waits for the new
+ *                  head.  Slot buffers come from a pool whose first depth blocks
+ *                  are one region registered with io_uring for fixed-buffer reads;
+ *                  blocks added later for more readers use plain vectored reads.
+ *                  The ring is driven from the parser thread with raw syscalls,
+ *                  there is no liburing dependency.
+ * =====================================================================================
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(__linux__) && defined(HAVE_IO_URING)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#define USE_IO_URING
+#endif
+#include <utils/win_types.h>
+#include "async_reader.h"
+#include "evtx_trace.h"
+
+#define URING_ENTRIES	256
+
+typedef struct sAsyncRequest
+{
+	int			f;
+	uint64_t		offset;
+	size_t			size;
+	uint8_t*		buffer;
+	int			bufferIndex;	/*  in the registered region, -1 for other blocks */
+	ssize_t			result;		/*  bytes read or -errno */
+	bool			done;
+	struct sAsyncRequest*	next;		/*  in the queue of the I/O thread */
+#ifdef USE_IO_URING
+	struct iovec		iov;
+#endif
+}
+AsyncRequest;
+
+typedef struct
+{
+	struct sChunkReader	reader;
+	int			f;
+	uint64_t		fileSize;
+	AsyncRequest*		slots;
+	size_t			head;		/*  slot of the block at reader.offset */
+	size_t			count;		/*  slots in flight or read, including the one held */
+	bool			holding;
+	uint64_t		nextOffset;	/*  of the next read to start */
+}
+AsyncReader;
+
+typedef struct
+{
+	uint8_t*	data;
+	int		index;		/*  in the region, -1 for blocks allocated later */
+}
+PoolBlock;
+
+static unsigned int	ioDepth		=	0;
+static bool		ioActive	=	false;
+static bool		useUringReads	=	false;
+
+static uint8_t*		poolRegion	=	NULL;
+static bool		poolRegistered	=	false;
+static PoolBlock*	poolFree	=	NULL;
+static size_t		numFree		=	0;
+static size_t		maxFree		=	0;
+
+/*  I/O thread */
+static pthread_t	ioThread;
+static bool		ioThreadStarted	=	false;
+static pthread_mutex_t	ioLock		=	PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	ioCond		=	PTHREAD_COND_INITIALIZER;
+static AsyncRequest*	queueHead	=	NULL;
+static AsyncRequest*	queueTail	=	NULL;
+static bool		stopIo		=	false;
+
+static ssize_t	ReadAt(int f, uint8_t* buffer, size_t size, uint64_t offset)
+{
+	size_t	done	=	0;
+
+	while ( done < size )
+	{
+#ifdef _WIN32
+		ssize_t	numRead	=	-1;
+
+		if ( _lseeki64(f, (__int64)( offset + done ), SEEK_SET) >= 0 )
+			numRead = read(f, buffer + done, size - done);
+#else
+		ssize_t	numRead	=	pread(f, buffer + done, size - done, (off_t)( offset + done ));
+#endif
+
+		if ( numRead < 0 && errno == EINTR )
+			continue;
+		if ( numRead < 0 )
+			return -errno;
+		if ( numRead == 0 )
+			break;
+		done += numRead;
+	}
+	return (ssize_t)done;
+}
+
+/*  Buffer pool */
+
+static bool	PushFree(uint8_t* data, int index)
+{
+	if ( numFree >= maxFree )
+	{
+		size_t		newMax	=	maxFree == 0 ? 16 : maxFree * 2;
+		PoolBlock*	newFree	=	(PoolBlock*)realloc(poolFree, sizeof(*newFree) * newMax);
+
+		if ( newFree == NULL )
+			return false;
+		poolFree = newFree;
+		maxFree = newMax;
+	}
+	poolFree[numFree].data = data;
+	poolFree[numFree].index = index;
+	numFree++;
+	return true;
+}
+
+static bool	AcquireBuffer(AsyncRequest* request)
+{
+	if ( numFree == 0 )
+	{
+		uint8_t*	data	=	(uint8_t*)malloc(EVTX_CHUNK_SIZE);
+
+		if ( data == NULL || !PushFree(data, -1) )
+		{
+			free(data);
+			return false;
+		}
+	}
+	numFree--;
+	request->buffer = poolFree[numFree].data;
+	request->bufferIndex = poolRegistered ? poolFree[numFree].index : -1;
+	return true;
+}
+
+static void	ReleaseBuffer(AsyncRequest* request)
+{
+	int	index	=	-1;
+
+	if ( request->buffer >= poolRegion && request->buffer < poolRegion + (size_t)ioDepth * EVTX_CHUNK_SIZE )
+		index = (int)( ( request->buffer - poolRegion ) / EVTX_CHUNK_SIZE );
+	/*  the stack was sized for every block when it was taken */
+	PushFree(request->buffer, index);
+	request->buffer = NULL;
+}
+
+/*  io_uring */
+
+#ifdef USE_IO_URING
+
+static int			ringFd		=	-1;
+static void*			sqRing		=	MAP_FAILED;
+static size_t			sqRingSize	=	0;
+static void*			cqRing		=	MAP_FAILED;
+static size_t			cqRingSize	=	0;
+static struct io_uring_sqe*	sqes		=	(struct io_uring_sqe*)MAP_FAILED;
+static size_t			sqesSize	=	0;
+static unsigned*		sqHead;
+static unsigned*		sqTail;
+static unsigned			sqMask;
+static unsigned			sqEntries;
+static unsigned*		sqArray;
+static unsigned*		cqHead;
+static unsigned*		cqTail;
+static unsigned			cqMask;
+static struct io_uring_cqe*	cqes;
+static unsigned			toSubmit	=	0;
+
+static void	UringTeardown(void)
+{
+	if ( sqes != MAP_FAILED )
+		munmap(sqes, sqesSize);
+	if ( cqRing != MAP_FAILED )
+		munmap(cqRing, cqRingSize);
+	if ( sqRing != MAP_FAILED )
+		munmap(sqRing, sqRingSize);
+	if ( ringFd >= 0 )
+		close(ringFd);
+	sqes = (struct io_uring_sqe*)MAP_FAILED;
+	cqRing = MAP_FAILED;
+	sqRing = MAP_FAILED;
+	ringFd = -1;
+	toSubmit = 0;
+}
+
+static bool	UringSetup(unsigned int entries)
+{
+	struct io_uring_params	params;
+
+	memset(&params, 0, sizeof(params));
+	ringFd = (int)syscall(__NR_io_uring_setup, entries, &params);
+	if ( ringFd < 0 )
+		return false;
+
+	sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	sqRing = mmap(NULL, sqRingSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+	cqRing = mmap(NULL, cqRingSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+	sqes = (struct io_uring_sqe*)mmap(NULL, sqesSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ringFd, IORING_OFF_SQES);
+	if ( sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqes == MAP_FAILED )
+	{
+		UringTeardown();
+		return false;
+	}
+
+	sqHead = (unsigned*)( (uint8_t*)sqRing + params.sq_off.head );
+	sqTail = (unsigned*)( (uint8_t*)sqRing + params.sq_off.tail );
+	sqMask = *(unsigned*)( (uint8_t*)sqRing + params.sq_off.ring_mask );
+	sqEntries = *(unsigned*)( (uint8_t*)sqRing + params.sq_off.ring_entries );
+	sqArray = (unsigned*)( (uint8_t*)sqRing + params.sq_off.array );
+	cqHead = (unsigned*)( (uint8_t*)cqRing + params.cq_off.head );
+	cqTail = (unsigned*)( (uint8_t*)cqRing + params.cq_off.tail );
+	cqMask = *(unsigned*)( (uint8_t*)cqRing + params.cq_off.ring_mask );
+	cqes = (struct io_uring_cqe*)( (uint8_t*)cqRing + params.cq_off.cqes );
+	return true;
+}
+
+/*  The region stays usable with vectored reads when the kernel refuses it */
+static void	UringRegisterBuffers(void)
+{
+	struct iovec*	iovecs	=	(struct iovec*)malloc(sizeof(*iovecs) * ioDepth);
+
+	if ( iovecs == NULL )
+		return;
+	for (unsigned int idx = 0; idx < ioDepth; idx++)
+	{
+		iovecs[idx].iov_base = poolRegion + (size_t)idx * EVTX_CHUNK_SIZE;
+		iovecs[idx].iov_len = EVTX_CHUNK_SIZE;
+	}
+	poolRegistered = ( syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_BUFFERS, iovecs, ioDepth) == 0 );
+	free(iovecs);
+}
+
+static bool	UringEnter(unsigned int minComplete)
+{
+	for (;;)
+	{
+		int	numSubmitted	=	(int)syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete,
+								minComplete > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+
+		if ( numSubmitted >= 0 )
+		{
+			toSubmit = (unsigned int)numSubmitted < toSubmit ? toSubmit - (unsigned int)numSubmitted : 0;
+			return true;
+		}
+		/*  busy with completions not reaped yet */
+		if ( errno == EAGAIN || errno == EBUSY )
+			return true;
+		if ( errno != EINTR )
+			return false;
+	}
+}
+
+static void	UringReap(void)
+{
+	unsigned	head	=	*cqHead;
+	unsigned	tail	=	__atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+
+	while ( head != tail )
+	{
+		struct io_uring_cqe*	cqe		=	&cqes[head & cqMask];
+		AsyncRequest*		request		=	(AsyncRequest*)(uintptr_t)cqe->user_data;
+
+		request->result = cqe->res;
+		request->done = true;
+		head++;
+	}
+	__atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+}
+
+static bool	UringSubmit(AsyncRequest* request)
+{
+	unsigned		tail	=	*sqTail;
+	unsigned		index;
+	struct io_uring_sqe*	sqe;
+
+	if ( tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries )
+	{
+		if ( !UringEnter(0) || tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries )
+			return false;
+	}
+
+	index = tail & sqMask;
+	sqe = &sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->fd = request->f;
+	sqe->off = request->offset;
+	sqe->user_data = (uint64_t)(uintptr_t)request;
+	if ( request->bufferIndex >= 0 )
+	{
+		sqe->opcode = IORING_OP_READ_FIXED;
+		sqe->addr = (uint64_t)(uintptr_t)request->buffer;
+		sqe->len = (uint32_t)request->size;
+		sqe->buf_index = (uint16_t)request->bufferIndex;
+	}
+	else
+	{
+		request->iov.iov_base = request->buffer;
+		request->iov.iov_len = request->size;
+		sqe->opcode = IORING_OP_READV;
+		sqe->addr = (uint64_t)(uintptr_t)&request->iov;
+		sqe->len = 1;
+	}
+	sqArray[index] = index;
+	__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+	toSubmit++;
+	return true;
+}
+
+static void	UringWait(AsyncRequest* request)
+{
+	for (;;)
+	{
+		UringReap();
+		if ( request->done )
+			return;
+		if ( !UringEnter(1) )
+		{
+			request->result = -EIO;
+			request->done = true;
+			return;
+		}
+	}
+}
+
+#endif
+
+/*  I/O thread */
+
+static void*	IoThread(void* arg)
+{
+	(void)arg;
+
+	EvtxTraceThreadName("async I/O");
+	pthread_mutex_lock(&ioLock);
+	for (;;)
+	{
+		AsyncRequest*	request;
+		ssize_t		result;
+
+		while ( !stopIo && queueHead == NULL )
+			pthread_cond_wait(&ioCond, &ioLock);
+		if ( queueHead == NULL )
+			break;
+
+		request = queueHead;
+		queueHead = request->next;
+		if ( queueHead == NULL )
+			queueTail = NULL;
+		pthread_mutex_unlock(&ioLock);
+
+		TRACE_BEGIN(traceStart);
+		result = ReadAt(request->f, request->buffer, request->size, request->offset);
+		TRACE_END_ARG("pread", traceStart, "bytes", result);
+
+		pthread_mutex_lock(&ioLock);
+		request->result = result;
+		request->done = true;
+		pthread_cond_broadcast(&ioCond);
+	}
+	pthread_mutex_unlock(&ioLock);
+	return NULL;
+}
+
+/*  Requests */
+
+static void	SubmitRequest(AsyncRequest* request)
+{
+	request->done = false;
+	request->result = 0;
+	request->next = NULL;
+
+#ifdef USE_IO_URING
+	if ( useUringReads )
+	{
+		if ( !UringSubmit(request) )
+		{
+			request->result = ReadAt(request->f, request->buffer, request->size, request->offset);
+			request->done = true;
+		}
+		return;
+	}
+#endif
+
+	pthread_mutex_lock(&ioLock);
+	if ( queueTail != NULL )
+		queueTail->next = request;
+	else
+		queueHead = request;
+	queueTail = request;
+	pthread_cond_broadcast(&ioCond);
+	pthread_mutex_unlock(&ioLock);
+}
+
+static void	FlushRequests(void)
+{
+#ifdef USE_IO_URING
+	if ( useUringReads && toSubmit > 0 )
+		UringEnter(0);
+#endif
+}
+
+static void	WaitRequest(AsyncRequest* request)
+{
+#ifdef USE_IO_URING
+	if ( useUringReads )
+	{
+		UringWait(request);
+		return;
+	}
+#endif
+
+	pthread_mutex_lock(&ioLock);
+	while ( !request->done )
+		pthread_cond_wait(&ioCond, &ioLock);
+	pthread_mutex_unlock(&ioLock);
+}
+
+/*  Readers */
+
+static void	AsyncFill(AsyncReader* asyncReader)
+{
+	while ( asyncReader->count < ioDepth && asyncReader->nextOffset < asyncReader->fileSize )
+	{
+		AsyncRequest*	slot	=	&asyncReader->slots[( asyncReader->head + asyncReader->count ) % ioDepth];
+
+		slot->f = asyncReader->f;
+		slot->offset = asyncReader->nextOffset;
+		slot->size = asyncReader->nextOffset == 0 ? EVTX_FILE_HEADER_SIZE : EVTX_CHUNK_SIZE;
+		SubmitRequest(slot);
+		asyncReader->nextOffset += slot->size;
+		asyncReader->count++;
+	}
+	FlushRequests();
+	TRACE_COUNTER("reads in flight", "reads", asyncReader->count);
+}
+
+/*  Waits for every read started, their buffers may be reused after */
+static void	AsyncDrain(AsyncReader* asyncReader)
+{
+	for (size_t idx = 0; idx < asyncReader->count; idx++)
+		WaitRequest(&asyncReader->slots[( asyncReader->head + idx ) % ioDepth]);
+	asyncReader->count = 0;
+	asyncReader->holding = false;
+}
+
+static bool	AsyncRead(struct sChunkReader* reader, size_t size, const uint8_t** data, size_t* dataLen)
+{
+	AsyncReader*	asyncReader	=	(AsyncReader*)reader;
+	AsyncRequest*	slot;
+	size_t		blockLen;
+
+	*data = NULL;
+	*dataLen = 0;
+
+	if ( asyncReader->holding )
+	{
+		asyncReader->head = ( asyncReader->head + 1 ) % ioDepth;
+		asyncReader->count--;
+		asyncReader->holding = false;
+	}
+	AsyncFill(asyncReader);
+	if ( asyncReader->count == 0 )
+		return true;
+
+	slot = &asyncReader->slots[asyncReader->head];
+	if ( size != slot->size )
+		return false;
+	WaitRequest(slot);
+	asyncReader->holding = true;
+	if ( slot->result < 0 )
+		return false;
+
+	/*  a short read before the end of the file is finished here */
+	blockLen = (size_t)slot->result;
+	if ( blockLen < size && slot->offset + blockLen < asyncReader->fileSize )
+	{
+		ssize_t	numRead	=	ReadAt(slot->f, slot->buffer + blockLen, size - blockLen, slot->offset + blockLen);
+
+		if ( numRead < 0 )
+			return false;
+		blockLen += numRead;
+	}
+
+	*data = slot->buffer;
+	*dataLen = blockLen;
+	reader->offset = slot->offset + blockLen;
+	return true;
+}
+
+static bool	AsyncSeek(struct sChunkReader* reader, uint64_t offset)
+{
+	AsyncReader*	asyncReader	=	(AsyncReader*)reader;
+
+	AsyncDrain(asyncReader);
+	asyncReader->nextOffset = offset;
+	reader->offset = offset;
+	return true;
+}
+
+static void	AsyncClose(struct sChunkReader* reader)
+{
+	AsyncReader*	asyncReader	=	(AsyncReader*)reader;
+
+	AsyncDrain(asyncReader);
+	for (unsigned int idx = 0; idx < ioDepth; idx++)
+	{
+		if ( asyncReader->slots[idx].buffer != NULL )
+			ReleaseBuffer(&asyncReader->slots[idx]);
+	}
+	free(asyncReader->slots);
+	free(asyncReader);
+}
+
+struct sChunkReader*	ChunkReaderOpenAsync(int f)
+{
+	AsyncReader*	asyncReader;
+	uint64_t	fileSize;
+
+	if ( !ioActive || !ChunkReaderFileSize(f, &fileSize) )
+		return NULL;
+	asyncReader = (AsyncReader*)calloc(1, sizeof(*asyncReader));
+	if ( asyncReader == NULL )
+		return NULL;
+
+	asyncReader->reader.read = AsyncRead;
+	asyncReader->reader.seek = AsyncSeek;
+	asyncReader->reader.close = AsyncClose;
+	asyncReader->reader.offset = 0;
+	asyncReader->f = f;
+	asyncReader->fileSize = fileSize;
+	asyncReader->slots = (AsyncRequest*)calloc(ioDepth, sizeof(*asyncReader->slots));
+	if ( asyncReader->slots == NULL )
+	{
+		free(asyncReader);
+		return NULL;
+	}
+	for (unsigned int idx = 0; idx < ioDepth; idx++)
+	{
+		if ( !AcquireBuffer(&asyncReader->slots[idx]) )
+		{
+			AsyncClose(&asyncReader->reader);
+			return NULL;
+		}
+	}
+	return &asyncReader->reader;
+}
+
+bool	AsyncIoStart(unsigned int depth, bool useUring)
+{
+	if ( depth == 0 )
+		depth = 1;
+	if ( depth > MAX_ASYNC_IO_DEPTH )
+		depth = MAX_ASYNC_IO_DEPTH;
+	ioDepth = depth;
+
+	poolRegion = (uint8_t*)malloc((size_t)ioDepth * EVTX_CHUNK_SIZE);
+	if ( poolRegion == NULL )
+		return false;
+	for (unsigned int idx = ioDepth; idx > 0; idx--)
+	{
+		if ( !PushFree(poolRegion + (size_t)( idx - 1 ) * EVTX_CHUNK_SIZE, (int)idx - 1) )
+		{
+			AsyncIoStop();
+			return false;
+		}
+	}
+
+#ifdef USE_IO_URING
+	if ( useUring && UringSetup(URING_ENTRIES) )
+	{
+		UringRegisterBuffers();
+		useUringReads = true;
+	}
+#else
+	(void)useUring;
+#endif
+	if ( !useUringReads )
+	{
+		stopIo = false;
+		ioThreadStarted = ( pthread_create(&ioThread, NULL, IoThread, NULL) == 0 );
+		if ( !ioThreadStarted )
+		{
+			AsyncIoStop();
+			return false;
+		}
+	}
+
+	ioActive = true;
+	return true;
+}
+
+void	AsyncIoStop(void)
+{
+	if ( ioThreadStarted )
+	{
+		pthread_mutex_lock(&ioLock);
+		stopIo = true;
+		pthread_cond_broadcast(&ioCond);
+		pthread_mutex_unlock(&ioLock);
+		pthread_join(ioThread, NULL);
+		ioThreadStarted = false;
+	}
+#ifdef USE_IO_URING
+	if ( useUringReads )
+		UringTeardown();
+#endif
+
+	for (size_t idx = 0; idx < numFree; idx++)
+	{
+		if ( poolFree[idx].index < 0 )
+			free(poolFree[idx].data);
+	}
+	free(poolFree);
+	free(poolRegion);
+	poolFree = NULL;
+	numFree = 0;
+	maxFree = 0;
+	poolRegion = NULL;
+	poolRegistered = false;
+	useUringReads = false;
+	ioActive = false;
+}
+
+bool	AsyncIoActive(void)
+{
+	return ioActive;
+}
+
+const char*	AsyncIoImplementation(void)
+{
+	return useUringReads ? "io_uring" : "thread";
+}
@@ -0,0 +1,36 @@
+/*
+ * =====================================================================================
+ *       Filename:  async_reader.h
+ *    Description:  Log files read ahead of the parser with asynchronous I/O
+ *
+ *                  Each reader keeps up to depth blocks (the file header, then
+ *                  64 KiB chunks) being read while the parser decodes the block
+ *                  it was handed.  The reads go through io_uring on Linux, into
+ *                  buffers registered with the kernel once, and through a single
+ *                  I/O thread elsewhere or when io_uring is not available.
+ *                  Readers must all be used from the same thread.
+ * =====================================================================================
+ */
+
+#ifndef async_reader_h_included
+#define async_reader_h_included
+
+#include <stdint.h>
+#include <stddef.h>
+#include "chunk_reader.h"
+
+#define DEFAULT_ASYNC_IO_DEPTH	8
+#define MAX_ASYNC_IO_DEPTH	64
+
+/*  depth is the number of reads in flight per file; useUring false forces the I/O thread */
+bool	AsyncIoStart(unsigned int depth, bool useUring);
+/*  All readers must be closed before */
+void	AsyncIoStop(void);
+bool	AsyncIoActive(void);
+/*  "io_uring" or "thread" */
+const char*	AsyncIoImplementation(void);
+
+/*  Reads the regular file f from the start; the reader does not own f */
+struct sChunkReader*	ChunkReaderOpenAsync(int f);
+
+#endif
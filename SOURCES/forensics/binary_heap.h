@@ -0,0 +1,54 @@
+/*
+ * =====================================================================================
+ *       Filename:  binary_heap.h
+ *    Description:  Binary min-heap over a plain array
+ * =====================================================================================
+ */
+
+#ifndef binary_heap_h_included
+#define binary_heap_h_included
+
+#include <stddef.h>
+
+template<class c, class Less>
+static void	HeapPush(c* heap, size_t* count, const c& item, Less less)
+{
+	size_t	pos	=	(*count)++;
+
+	while ( pos > 0 )
+	{
+		size_t	parent	=	( pos - 1 ) / 2;
+		if ( !less(item, heap[parent]) )
+			break;
+		heap[pos] = heap[parent];
+		pos = parent;
+	}
+	heap[pos] = item;
+}
+
+template<class c, class Less>
+static void	HeapPop(c* heap, size_t* count, Less less)
+{
+	c	item;
+	size_t	pos	=	0;
+
+	if ( --(*count) == 0 )
+		return;
+	item = heap[*count];
+
+	for (;;)
+	{
+		size_t	child	=	pos * 2 + 1;
+		if ( child >= *count )
+			break;
+		if ( child + 1 < *count && less(heap[child + 1], heap[child]) )
+			child++;
+		if ( !less(heap[child], item) )
+			break;
+		heap[pos] = heap[child];
+		pos = child;
+	}
+	heap[pos] = item;
+}
+
+#endif
@@ -0,0 +1,362 @@
+/*
+ * =====================================================================================
+ *       Filename:  chunk_cache.cpp
+ *    Description:  On-disk cache of formatted records keyed by chunk contents
+ *
+ *                  The key is an xxh64 style 4 lane hash of the chunk, finished
+ *                  twice with different lane mixes into 128 bits.  Entries are
+ *                  written to a temporary name and renamed, a reader never sees a
+ *                  partial entry.  A hit refreshes the modification time.
+ * =====================================================================================
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "chunk_cache.h"
+
+#define CACHE_KEY_SEED		0x45565458434348ULL
+#define CACHE_KEY_NAME_LEN	32
+
+#define PRIME64_1	0x9E3779B185EBCA87ULL
+#define PRIME64_2	0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3	0x165667B19E3779F9ULL
+#define PRIME64_4	0x85EBCA77C2B2AE63ULL
+
+typedef struct
+{
+	char		name[CACHE_KEY_NAME_LEN + 1];
+	uint64_t	size;
+	time_t		lastUse;
+}
+CacheEntry;
+
+static char*		cacheDirectory	=	NULL;
+static uint64_t		cacheMaxBytes	=	0;
+static uint64_t		cacheBytes	=	0;	/*  as of the last scan plus the entries stored since */
+static uint64_t		cacheSeed	=	CACHE_KEY_SEED;
+
+static uint64_t		numHits		=	0;
+static uint64_t		numMisses	=	0;
+static uint64_t		numStored	=	0;
+static uint64_t		numEvicted	=	0;
+static uint64_t		bytesReplayed	=	0;
+static uint64_t		bytesStored	=	0;
+
+static uint64_t	RotateLeft(uint64_t v, unsigned int bits)
+{
+	return ( v << bits ) | ( v >> ( 64 - bits ) );
+}
+
+static uint64_t	Avalanche(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+void	ChunkCacheKeyOf(const uint8_t* chunk, size_t chunkLen, ChunkCacheKey* key)
+{
+	uint64_t	v[4]	=	{ cacheSeed + PRIME64_1 + PRIME64_2, cacheSeed + PRIME64_2,
+					  cacheSeed, cacheSeed - PRIME64_1 };
+	size_t		pos	=	0;
+	uint64_t	tail	=	0;
+
+	for (; pos + 32 <= chunkLen; pos += 32)
+	{
+		for (size_t lane = 0; lane < 4; lane++)
+		{
+			uint64_t	w;
+
+			memcpy(&w, chunk + pos + lane * 8, sizeof(w));
+			v[lane] = RotateLeft(v[lane] + w * PRIME64_2, 31) * PRIME64_1;
+		}
+	}
+	for (; pos < chunkLen; pos++)
+		tail = ( tail ^ chunk[pos] ) * PRIME64_1;
+
+	key->low = Avalanche(RotateLeft(v[0], 1) + RotateLeft(v[1], 7) + RotateLeft(v[2], 12) + RotateLeft(v[3], 18) +
+			tail + chunkLen);
+	key->high = Avalanche(( v[0] * PRIME64_4 ) ^ RotateLeft(v[1] * PRIME64_3, 27) ^
+			RotateLeft(v[2] * PRIME64_2, 41) ^ RotateLeft(v[3], 53) ^ ( tail * PRIME64_4 ) ^ chunkLen);
+}
+
+static void	EntryPath(const char* name, char* path, size_t pathSize)
+{
+	snprintf(path, pathSize, "%s/%s", cacheDirectory, name);
+}
+
+static void	KeyName(const ChunkCacheKey* key, char* name)
+{
+	snprintf(name, CACHE_KEY_NAME_LEN + 1, "%016" PRIx64 "%016" PRIx64, key->high, key->low);
+}
+
+static bool	IsEntryName(const char* name)
+{
+	size_t	idx;
+
+	for (idx = 0; name[idx] != 0; idx++)
+	{
+		if ( !( ( name[idx] >= '0' && name[idx] <= '9' ) || ( name[idx] >= 'a' && name[idx] <= 'f' ) ) )
+			return false;
+	}
+	return ( idx == CACHE_KEY_NAME_LEN );
+}
+
+static int	CompareLastUse(const void* a, const void* b)
+{
+	const CacheEntry*	entryA	=	(const CacheEntry*)a;
+	const CacheEntry*	entryB	=	(const CacheEntry*)b;
+
+	if ( entryA->lastUse != entryB->lastUse )
+		return ( entryA->lastUse < entryB->lastUse ) ? -1 : 1;
+	return strcmp(entryA->name, entryB->name);
+}
+
+/*  Rescans the directory and removes the oldest entries above targetBytes */
+static void	Evict(uint64_t targetBytes)
+{
+	DIR*		dir	=	opendir(cacheDirectory);
+	struct dirent*	dirEntry;
+	CacheEntry*	entries	=	NULL;
+	size_t		numEntries	=	0;
+	size_t		maxEntries	=	0;
+	char		path[4096];
+
+	if ( dir == NULL )
+		return;
+
+	cacheBytes = 0;
+	while ( ( dirEntry = readdir(dir) ) != NULL )
+	{
+		struct stat	st;
+
+		if ( !IsEntryName(dirEntry->d_name) )
+			continue;
+		EntryPath(dirEntry->d_name, path, sizeof(path));
+		if ( stat(path, &st) != 0 )
+			continue;
+		if ( numEntries >= maxEntries )
+		{
+			size_t		newMax		=	maxEntries == 0 ? 1024 : maxEntries * 2;
+			CacheEntry*	newEntries	=	(CacheEntry*)realloc(entries, sizeof(*newEntries) * newMax);
+			if ( newEntries == NULL )
+				break;
+			entries = newEntries;
+			maxEntries = newMax;
+		}
+		memcpy(entries[numEntries].name, dirEntry->d_name, CACHE_KEY_NAME_LEN + 1);
+		entries[numEntries].size = (uint64_t)st.st_size;
+		entries[numEntries].lastUse = st.st_mtime;
+		cacheBytes += (uint64_t)st.st_size;
+		numEntries++;
+	}
+	closedir(dir);
+
+	if ( cacheBytes > targetBytes )
+	{
+		qsort(entries, numEntries, sizeof(*entries), CompareLastUse);
+		for (size_t idx = 0; idx < numEntries && cacheBytes > targetBytes; idx++)
+		{
+			EntryPath(entries[idx].name, path, sizeof(path));
+			if ( remove(path) != 0 )
+				continue;
+			cacheBytes -= entries[idx].size;
+			numEvicted++;
+		}
+	}
+	free(entries);
+}
+
+bool	ChunkCacheOpen(const char* directory, uint64_t maxBytes, uint32_t textVersion)
+{
+	struct stat	st;
+
+	cacheSeed = CACHE_KEY_SEED ^ Avalanche(textVersion + PRIME64_4);
+
+	if ( stat(directory, &st) != 0 )
+	{
+#ifdef _WIN32
+		mkdir(directory);
+#else
+		mkdir(directory, 0755);
+#endif
+	}
+	if ( stat(directory, &st) != 0 || !S_ISDIR(st.st_mode) )
+	{
+		printf("Cannot use %s as the chunk cache\n", directory);
+		return false;
+	}
+
+	cacheDirectory = strdup(directory);
+	if ( cacheDirectory == NULL )
+		return false;
+	cacheMaxBytes = maxBytes;
+	Evict(cacheMaxBytes);
+	return true;
+}
+
+void	ChunkCacheClose(void)
+{
+	if ( cacheDirectory == NULL )
+		return;
+	Evict(cacheMaxBytes);
+	free(cacheDirectory);
+	cacheDirectory = NULL;
+}
+
+bool	ChunkCacheEnabled(void)
+{
+	return ( cacheDirectory != NULL );
+}
+
+static bool	ReadEntry(FILE* f, RecordBatch* batch)
+{
+	ChunkCacheHeader	header;
+	ChunkCacheRecord*	records;
+	size_t			textBase	=	batch->textUsed;
+	bool			result;
+
+	if ( fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, CHUNK_CACHE_MAGIC, sizeof(header.magic)) )
+		return false;
+
+	records = (ChunkCacheRecord*)malloc(sizeof(*records) * ( header.numRecords + 1 ));
+	if ( records == NULL )
+		return false;
+	result = ( fread(records, sizeof(*records), header.numRecords, f) == header.numRecords &&
+		ReserveBatchText(batch, header.textSize) &&
+		fread(batch->text + batch->textUsed, 1, header.textSize, f) == header.textSize );
+
+	for (uint32_t idx = 0; result && idx < header.numRecords; idx++)
+	{
+		if ( records[idx].textOffset > header.textSize || header.textSize - records[idx].textOffset < records[idx].textLen ||
+			!BatchBeginRecord(batch, records[idx].number, records[idx].timestamp) )
+		{
+			result = false;
+			break;
+		}
+		batch->records[batch->numRecords - 1].textOffset = textBase + records[idx].textOffset;
+		batch->records[batch->numRecords - 1].textLen = records[idx].textLen;
+	}
+	if ( result )
+		batch->textUsed += header.textSize;
+	free(records);
+
+	return result;
+}
+
+bool	ChunkCacheLoad(const ChunkCacheKey* key, RecordBatch* batch)
+{
+	char	name[CACHE_KEY_NAME_LEN + 1];
+	char	path[4096];
+	FILE*	f;
+	size_t	firstRecord	=	batch->numRecords;
+	size_t	textUsed	=	batch->textUsed;
+
+	KeyName(key, name);
+	EntryPath(name, path, sizeof(path));
+	f = fopen(path, "rb");
+	if ( f == NULL )
+	{
+		numMisses++;
+		return false;
+	}
+
+	if ( !ReadEntry(f, batch) )
+	{
+		/*  a damaged entry is dropped and rebuilt */
+		fclose(f);
+		remove(path);
+		batch->numRecords = firstRecord;
+		batch->textUsed = textUsed;
+		numMisses++;
+		return false;
+	}
+	fclose(f);
+
+	utime(path, NULL);
+	numHits++;
+	bytesReplayed += batch->textUsed - textUsed;
+	return true;
+}
+
+bool	ChunkCacheStore(const ChunkCacheKey* key, const RecordBatch* batch)
+{
+	ChunkCacheHeader	header;
+	char			name[CACHE_KEY_NAME_LEN + 1];
+	char			path[4096];
+	char			tempPath[4096 + 32];
+	FILE*			f;
+	bool			result		=	true;
+	size_t			textBase	=	batch->numRecords > 0 ? batch->records[0].textOffset : 0;
+	uint64_t		entrySize;
+
+	/*  records of a chunk are captured back to back */
+	if ( batch->textUsed - textBase > UINT32_MAX )
+		return false;
+
+	KeyName(key, name);
+	EntryPath(name, path, sizeof(path));
+	snprintf(tempPath, sizeof(tempPath), "%s.%d.tmp", path, (int)getpid());
+
+	f = fopen(tempPath, "wb");
+	if ( f == NULL )
+		return false;
+
+	memcpy(header.magic, CHUNK_CACHE_MAGIC, sizeof(header.magic));
+	header.numRecords = (uint32_t)batch->numRecords;
+	header.textSize = (uint32_t)( batch->textUsed - textBase );
+	result = ( fwrite(&header, sizeof(header), 1, f) == 1 );
+	for (size_t idx = 0; result && idx < batch->numRecords; idx++)
+	{
+		ChunkCacheRecord	record;
+
+		record.timestamp = batch->records[idx].timestamp;
+		record.number = batch->records[idx].number;
+		record.textOffset = (uint32_t)( batch->records[idx].textOffset - textBase );
+		record.textLen = (uint32_t)batch->records[idx].textLen;
+		result = ( fwrite(&record, sizeof(record), 1, f) == 1 );
+	}
+	if ( result )
+		result = ( fwrite(batch->text + textBase, 1, header.textSize, f) == header.textSize );
+	if ( fclose(f) != 0 )
+		result = false;
+
+	entrySize = sizeof(header) + sizeof(ChunkCacheRecord) * (uint64_t)header.numRecords + header.textSize;
+	if ( result )
+	{
+		remove(path);
+		result = ( rename(tempPath, path) == 0 );
+	}
+	if ( !result )
+	{
+		remove(tempPath);
+		return false;
+	}
+
+	numStored++;
+	bytesStored += entrySize;
+	cacheBytes += entrySize;
+	/*  evict in batches rather than per entry */
+	if ( cacheBytes > cacheMaxBytes + cacheMaxBytes / 8 )
+		Evict(cacheMaxBytes - cacheMaxBytes / 8);
+	return true;
+}
+
+void	ChunkCachePrintStats(FILE* f)
+{
+	uint64_t	lookups	=	numHits + numMisses;
+
+	fprintf(f, "Chunk cache: %" PRIu64 " hits, %" PRIu64 " misses (%.1f%% hit rate), %" PRIu64 " stored (%" PRIu64 " bytes), "
+			"%" PRIu64 " bytes replayed, %" PRIu64 " evicted, %" PRIu64 " bytes in cache\n",
+			numHits, numMisses, lookups > 0 ? 100.0 * numHits / lookups : 0.0, numStored, bytesStored,
+			bytesReplayed, numEvicted, cacheBytes);
+}
@@ -0,0 +1,69 @@
+/*
+ * =====================================================================================
+ *       Filename:  chunk_cache.h
+ *    Description:  On-disk cache of formatted records keyed by chunk contents
+ *
+ *                  Every entry is one file named after the 128 bit hash of the raw
+ *                  chunk, holding the records as a RecordBatch image:
+ *
+ *                      ChunkCacheHeader
+ *                      ChunkCacheRecord  [numRecords]
+ *                      text              [textSize]
+ *
+ *                  File modification times give the LRU order, so several runs
+ *                  may share one cache directory.  The text version of the caller
+ *                  is part of the key: entries formatted by an older build are
+ *                  never found again and age out.
+ *
+ *                  The entries hold the text as printed, about twice the size of
+ *                  the chunk, rather than a compact form of the decoded values: a
+ *                  hit is only worth it when it skips the formatting as well.
+ * =====================================================================================
+ */
+
+#ifndef chunk_cache_h_included
+#define chunk_cache_h_included
+
+#include "record_batch.h"
+
+#define CHUNK_CACHE_MAGIC	"EVTXCCH1"
+#define DEFAULT_CHUNK_CACHE_MB	1024
+
+typedef struct
+{
+	char		magic[8];
+	uint32_t	numRecords;
+	uint32_t	textSize;
+}
+ChunkCacheHeader;
+
+typedef struct
+{
+	uint64_t	timestamp;
+	uint64_t	number;
+	uint32_t	textOffset;
+	uint32_t	textLen;
+}
+ChunkCacheRecord;
+
+typedef struct
+{
+	uint64_t	low;
+	uint64_t	high;
+}
+ChunkCacheKey;
+
+/*  textVersion identifies the format of the cached text */
+bool	ChunkCacheOpen(const char* directory, uint64_t maxBytes, uint32_t textVersion);
+/*  Evicts the least recently used entries down to the size limit */
+void	ChunkCacheClose(void);
+bool	ChunkCacheEnabled(void);
+
+void	ChunkCacheKeyOf(const uint8_t* chunk, size_t chunkLen, ChunkCacheKey* key);
+/*  Appends the cached records to batch, false on a miss */
+bool	ChunkCacheLoad(const ChunkCacheKey* key, RecordBatch* batch);
+bool	ChunkCacheStore(const ChunkCacheKey* key, const RecordBatch* batch);
+
+void	ChunkCachePrintStats(FILE* f);
+
+#endif
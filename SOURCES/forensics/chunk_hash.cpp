@@ -0,0 +1,307 @@
+/*
+ * =====================================================================================
+ *       Filename:  chunk_hash.cpp
+ *    Description:  SHA-256 of every chunk and record, computed on worker threads
+ *
+ *                  Item 0 of a job is the whole chunk, the records follow in file
+ *                  order and are taken in that order, so the digests become ready
+ *                  about as the decoder reaches them.  Up to HASH_QUEUE_CHUNKS
+ *                  chunks are copied into jobs, so the workers finish one chunk
+ *                  while the next one is decoded.
+ * =====================================================================================
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include "chunk_hash.h"
+
+#define MAX_HASH_THREADS	16
+#define HASH_QUEUE_CHUNKS	2	/*  hashed or waiting, the decoder waits for the oldest beyond */
+
+typedef struct
+{
+	HashSpan	span;
+	bool		done;
+	uint8_t		digest[SHA256_DIGEST_SIZE];
+}
+HashItem;
+
+typedef struct
+{
+	uint8_t*	chunk;		/*  a copy, the reader may reuse its block */
+	size_t		chunkSize;
+	HashItem*	items;
+	size_t		maxItems;
+	size_t		numItems;
+	size_t		nextItem;
+	size_t		numDone;
+	char*		fileName;	/*  set by HashChunkEnd() */
+	uint64_t	chunkOffset;
+}
+HashJob;
+
+static pthread_t	workers[MAX_HASH_THREADS];
+static unsigned int	numWorkers	=	0;
+static pthread_mutex_t	hashLock	=	PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	workCond	=	PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	doneCond	=	PTHREAD_COND_INITIALIZER;
+static bool		stopWorkers	=	false;
+
+/*  a ring of chunks in file order, the oldest is written to the manifest first */
+static HashJob		jobs[HASH_QUEUE_CHUNKS];
+static size_t		firstJob	=	0;
+static size_t		numJobs		=	0;
+static HashJob*		currentJob	=	NULL;	/*  being decoded, NULL when it could not be queued */
+
+static FILE*		manifest	=	NULL;
+
+/*  The first job in the queue with an item left, under hashLock */
+static HashJob*	NextJob(void)
+{
+	for (size_t idx = 0; idx < numJobs; idx++)
+	{
+		HashJob*	job	=	&jobs[( firstJob + idx ) % HASH_QUEUE_CHUNKS];
+
+		if ( job->nextItem < job->numItems )
+			return job;
+	}
+	return NULL;
+}
+
+static void*	HashWorker(void* arg)
+{
+	pthread_mutex_lock(&hashLock);
+	for (;;)
+	{
+		HashJob*	job;
+		HashItem*	item;
+
+		while ( !stopWorkers && ( job = NextJob() ) == NULL )
+			pthread_cond_wait(&workCond, &hashLock);
+		if ( stopWorkers )
+			break;
+
+		item = &job->items[job->nextItem++];
+		pthread_mutex_unlock(&hashLock);
+
+		Sha256(job->chunk + item->span.offset, item->span.size, item->digest);
+
+		pthread_mutex_lock(&hashLock);
+		item->done = true;
+		job->numDone++;
+		pthread_cond_broadcast(&doneCond);
+	}
+	pthread_mutex_unlock(&hashLock);
+	return NULL;
+}
+
+/*  Waits for the oldest chunk, adds it to the manifest and frees its slot */
+static void	RetireJob(void)
+{
+	HashJob*	job	=	&jobs[firstJob];
+	char		hex[SHA256_HEX_SIZE];
+
+	pthread_mutex_lock(&hashLock);
+	while ( job->numDone < job->numItems )
+		pthread_cond_wait(&doneCond, &hashLock);
+	pthread_mutex_unlock(&hashLock);
+
+	if ( manifest != NULL && job->numItems > 0 && job->fileName != NULL )
+	{
+		Sha256ToHex(job->items[0].digest, hex);
+		fprintf(manifest, "chunk\t%s\t%" PRIu64 "\t%s\n", hex, job->chunkOffset, job->fileName);
+		for (size_t idx = 1; idx < job->numItems; idx++)
+		{
+			Sha256ToHex(job->items[idx].digest, hex);
+			fprintf(manifest, "record\t%s\t%" PRIu64 "\t%" PRIu64 "\t%s\n", hex,
+					job->chunkOffset + job->items[idx].span.offset, job->items[idx].span.number, job->fileName);
+		}
+	}
+
+	pthread_mutex_lock(&hashLock);
+	if ( currentJob == job )
+		currentJob = NULL;
+	free(job->fileName);
+	job->fileName = NULL;
+	job->numItems = 0;
+	job->nextItem = 0;
+	job->numDone = 0;
+	firstJob = ( firstJob + 1 ) % HASH_QUEUE_CHUNKS;
+	numJobs--;
+	pthread_mutex_unlock(&hashLock);
+}
+
+bool	HashStart(unsigned int numThreads, const char* manifestName)
+{
+	if ( numThreads == 0 )
+		numThreads = 1;
+	if ( numThreads > MAX_HASH_THREADS )
+		numThreads = MAX_HASH_THREADS;
+
+	if ( manifestName != NULL )
+	{
+		manifest = fopen(manifestName, "w");
+		if ( manifest == NULL )
+		{
+			printf("Cannot create %s\n", manifestName);
+			return false;
+		}
+		fprintf(manifest, "# parse_evtx SHA-256 manifest of the raw chunk and record bytes (%s)\n", Sha256Implementation());
+	}
+	else
+	{
+		/*  detects the CPU tier before the workers race for it */
+		Sha256Implementation();
+	}
+
+	stopWorkers = false;
+	for (numWorkers = 0; numWorkers < numThreads; numWorkers++)
+	{
+		if ( pthread_create(&workers[numWorkers], NULL, HashWorker, NULL) != 0 )
+			break;
+	}
+	if ( numWorkers == 0 )
+	{
+		HashStop();
+		return false;
+	}
+	return true;
+}
+
+bool	HashStop(void)
+{
+	bool	result	=	true;
+
+	/*  the queued chunks go to the manifest before the workers stop */
+	while ( numJobs > 0 && numWorkers > 0 )
+		RetireJob();
+
+	pthread_mutex_lock(&hashLock);
+	stopWorkers = true;
+	pthread_cond_broadcast(&workCond);
+	pthread_mutex_unlock(&hashLock);
+	for (unsigned int idx = 0; idx < numWorkers; idx++)
+		pthread_join(workers[idx], NULL);
+	numWorkers = 0;
+
+	for (size_t idx = 0; idx < HASH_QUEUE_CHUNKS; idx++)
+	{
+		free(jobs[idx].chunk);
+		free(jobs[idx].items);
+		free(jobs[idx].fileName);
+		memset(&jobs[idx], 0, sizeof(jobs[idx]));
+	}
+	firstJob = 0;
+	numJobs = 0;
+	currentJob = NULL;
+	if ( manifest != NULL )
+	{
+		result = ( ferror(manifest) == 0 );
+		result = ( fclose(manifest) == 0 && result );
+		manifest = NULL;
+	}
+	return result;
+}
+
+void	HashChunkBegin(const uint8_t* chunk, size_t chunkLen, const HashSpan* records, size_t numRecords)
+{
+	HashJob*	job;
+
+	if ( numJobs == HASH_QUEUE_CHUNKS )
+		RetireJob();
+	job = &jobs[( firstJob + numJobs ) % HASH_QUEUE_CHUNKS];
+	currentJob = NULL;
+
+	/*  the slot is not queued, the workers do not look at it */
+	if ( chunkLen > job->chunkSize )
+	{
+		uint8_t*	newChunk	=	(uint8_t*)realloc(job->chunk, chunkLen);
+
+		if ( newChunk == NULL )
+			return;
+		job->chunk = newChunk;
+		job->chunkSize = chunkLen;
+	}
+	if ( numRecords + 1 > job->maxItems )
+	{
+		HashItem*	newItems	=	(HashItem*)realloc(job->items, sizeof(*newItems) * ( numRecords + 1 ));
+
+		if ( newItems == NULL )
+		{
+			if ( job->maxItems == 0 )
+				return;
+			numRecords = job->maxItems - 1;
+		}
+		else
+		{
+			job->items = newItems;
+			job->maxItems = numRecords + 1;
+		}
+	}
+
+	memcpy(job->chunk, chunk, chunkLen);
+	job->items[0].span.offset = 0;
+	job->items[0].span.size = (uint32_t)chunkLen;
+	job->items[0].span.number = 0;
+	job->items[0].done = false;
+	for (size_t idx = 0; idx < numRecords; idx++)
+	{
+		job->items[idx + 1].span = records[idx];
+		job->items[idx + 1].done = false;
+	}
+	job->nextItem = 0;
+	job->numDone = 0;
+	job->fileName = NULL;
+
+	pthread_mutex_lock(&hashLock);
+	job->numItems = numRecords + 1;
+	numJobs++;
+	currentJob = job;
+	pthread_cond_broadcast(&workCond);
+	pthread_mutex_unlock(&hashLock);
+}
+
+bool	HashRecordDigest(uint64_t inChunkOffset, uint8_t digest[SHA256_DIGEST_SIZE])
+{
+	HashJob*	job	=	currentJob;
+	size_t		low	=	1;
+	size_t		high;
+
+	if ( job == NULL )
+		return false;
+
+	/*  records are in offset order */
+	high = job->numItems;
+	while ( low < high )
+	{
+		size_t	mid	=	low + ( high - low ) / 2;
+
+		if ( job->items[mid].span.offset < inChunkOffset )
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	if ( low >= job->numItems || job->items[low].span.offset != inChunkOffset )
+		return false;
+
+	pthread_mutex_lock(&hashLock);
+	while ( !job->items[low].done )
+		pthread_cond_wait(&doneCond, &hashLock);
+	memcpy(digest, job->items[low].digest, SHA256_DIGEST_SIZE);
+	pthread_mutex_unlock(&hashLock);
+	return true;
+}
+
+void	HashChunkEnd(const char* fileName, uint64_t chunkOffset)
+{
+	HashJob*	job	=	currentJob;
+
+	if ( job == NULL )
+		return;
+	/*  the name may not outlive the file, the chunk may still be hashed */
+	job->fileName = strdup(fileName);
+	job->chunkOffset = chunkOffset;
+	currentJob = NULL;
+}
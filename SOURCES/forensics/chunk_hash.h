@@ -0,0 +1,43 @@
+/*
+ * =====================================================================================
+ *       Filename:  chunk_hash.h
+ *    Description:  SHA-256 of every chunk and record, computed on worker threads
+ *
+ *                  Workers hash the raw bytes of a chunk and of its records while
+ *                  the chunk is being decoded and the next ones are read; the
+ *                  decoder only waits when it gets to a record whose digest is not
+ *                  ready or when too many chunks are queued.  The manifest lists:
+ *
+ *                      chunk   <sha256> <chunk offset> <file>
+ *                      record  <sha256> <record offset> <record number> <file>
+ * =====================================================================================
+ */
+
+#ifndef chunk_hash_h_included
+#define chunk_hash_h_included
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sha256.h"
+
+typedef struct
+{
+	uint32_t	offset;		/*  in the chunk */
+	uint32_t	size;
+	uint64_t	number;
+}
+HashSpan;
+
+/*  manifestName may be NULL */
+bool	HashStart(unsigned int numThreads, const char* manifestName);
+/*  False when the manifest could not be written */
+bool	HashStop(void);
+
+/*  Queues a copy of the chunk, waiting for the oldest queued one when full */
+void	HashChunkBegin(const uint8_t* chunk, size_t chunkLen, const HashSpan* records, size_t numRecords);
+/*  Waits for the digest, false when no record starts at inChunkOffset */
+bool	HashRecordDigest(uint64_t inChunkOffset, uint8_t digest[SHA256_DIGEST_SIZE]);
+/*  The chunk goes to the manifest once hashed, at the latest in HashStop() */
+void	HashChunkEnd(const char* fileName, uint64_t chunkOffset);
+
+#endif
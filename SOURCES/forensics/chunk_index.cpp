@@ -0,0 +1,479 @@
+/*
+ * =====================================================================================
+ *       Filename:  chunk_index.cpp
+ *    Description:  Per-chunk Bloom filter index over selected field values
+ *
+ *                  2 KiB filters with 5 hashes keep false positives near 0.1% for
+ *                  a thousand values per chunk, at 3% of the log size.  Bit
+ *                  positions come from double hashing of one 64 bit hash.
+ * =====================================================================================
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "chunk_index.h"
+#include "mapped_file.h"
+
+#define MAX_INDEX_FIELDS	64
+#define MAX_VALUE_SIZE		1024
+
+typedef struct
+{
+	char*		name;
+	uint64_t	fileSize;
+	uint32_t	firstChunk;
+	uint32_t	numChunks;
+}
+BuilderFile;
+
+struct sChunkIndex
+{
+	MappedFile			mapped;
+	const ChunkIndexHeader*		header;
+	const ChunkIndexFile*		files;
+	const ChunkIndexChunk*		chunks;
+	const uint8_t*			blooms;
+	const char*			strings;
+};
+
+static char*		fieldList			=	NULL;	/*  as given, stored in the index */
+static char*		fieldBuffer			=	NULL;	/*  split into fieldNames */
+static const char*	fieldNames[MAX_INDEX_FIELDS];
+static size_t		numFields			=	0;
+
+static BuilderFile*	builderFiles	=	NULL;
+static size_t		numBuilderFiles	=	0;
+static size_t		maxBuilderFiles	=	0;
+static ChunkIndexChunk*	builderChunks	=	NULL;
+static uint8_t*		builderBlooms	=	NULL;
+static size_t		numBuilderChunks	=	0;
+static size_t		maxBuilderChunks	=	0;
+static FILE*		builderIndex	=	NULL;
+static char*		builderIndexName	=	NULL;
+
+bool	ChunkIndexSetFields(const char* fields)
+{
+	char*	ptr;
+
+	free(fieldList);
+	free(fieldBuffer);
+	numFields = 0;
+	fieldList = strdup(fields);
+	fieldBuffer = strdup(fields);
+	if ( fieldList == NULL || fieldBuffer == NULL )
+		return false;
+
+	ptr = fieldBuffer;
+	while ( *ptr != 0 && numFields < MAX_INDEX_FIELDS )
+	{
+		char*	end	=	strchr(ptr, ',');
+
+		if ( end != NULL )
+			*end = 0;
+		if ( *ptr != 0 )
+			fieldNames[numFields++] = ptr;
+		if ( end == NULL )
+			break;
+		ptr = end + 1;
+	}
+
+	return ( numFields > 0 );
+}
+
+bool	ChunkIndexIsIndexedField(const char* key)
+{
+	if ( fieldList == NULL )
+		ChunkIndexSetFields(DEFAULT_INDEX_FIELDS);
+	for (size_t idx = 0; idx < numFields; idx++)
+	{
+		if ( !strcmp(fieldNames[idx], key) )
+			return true;
+	}
+	return false;
+}
+
+const char*	ChunkIndexFields(void)
+{
+	if ( fieldList == NULL )
+		ChunkIndexSetFields(DEFAULT_INDEX_FIELDS);
+	return fieldList;
+}
+
+static uint8_t	FoldByte(uint8_t c)
+{
+	if ( c >= 'A' && c <= 'Z' )
+		return c + ( 'a' - 'A' );
+	return c;
+}
+
+uint64_t	ChunkIndexHashValue(const char* value)
+{
+	uint64_t	h	=	0xCBF29CE484222325ULL;
+
+	for (; *value != 0; value++)
+	{
+		h ^= FoldByte((uint8_t)*value);
+		h *= 0x100000001B3ULL;
+	}
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static void	BloomAdd(uint8_t* bloom, size_t bloomBytes, uint32_t numHashes, uint64_t valueHash)
+{
+	uint32_t	h1	=	(uint32_t)valueHash;
+	uint32_t	h2	=	(uint32_t)( valueHash >> 32 ) | 1;
+	size_t		bits	=	bloomBytes * 8;
+
+	for (uint32_t idx = 0; idx < numHashes; idx++)
+	{
+		size_t	bit	=	( h1 + idx * h2 ) % bits;
+		bloom[bit >> 3] |= (uint8_t)( 1 << ( bit & 7 ) );
+	}
+}
+
+static bool	BloomMayContain(const uint8_t* bloom, size_t bloomBytes, uint32_t numHashes, uint64_t valueHash)
+{
+	uint32_t	h1	=	(uint32_t)valueHash;
+	uint32_t	h2	=	(uint32_t)( valueHash >> 32 ) | 1;
+	size_t		bits	=	bloomBytes * 8;
+
+	for (uint32_t idx = 0; idx < numHashes; idx++)
+	{
+		size_t	bit	=	( h1 + idx * h2 ) % bits;
+		if ( !( bloom[bit >> 3] & ( 1 << ( bit & 7 ) ) ) )
+			return false;
+	}
+	return true;
+}
+
+bool	ChunkIndexBeginFile(const char* fileName, uint64_t fileSize)
+{
+	BuilderFile*	file;
+
+	if ( numBuilderFiles >= maxBuilderFiles )
+	{
+		size_t		newMax		=	maxBuilderFiles == 0 ? 64 : maxBuilderFiles * 2;
+		BuilderFile*	newFiles	=	(BuilderFile*)realloc(builderFiles, sizeof(*newFiles) * newMax);
+		if ( newFiles == NULL )
+			return false;
+		builderFiles = newFiles;
+		maxBuilderFiles = newMax;
+	}
+
+	file = &builderFiles[numBuilderFiles];
+	file->name = strdup(fileName);
+	if ( file->name == NULL )
+		return false;
+	file->fileSize = fileSize;
+	file->firstChunk = (uint32_t)numBuilderChunks;
+	file->numChunks = 0;
+	numBuilderFiles++;
+	return true;
+}
+
+bool	ChunkIndexBeginChunk(uint64_t offset)
+{
+	ChunkIndexChunk*	chunk;
+
+	if ( numBuilderFiles == 0 )
+		return false;
+	if ( numBuilderChunks >= maxBuilderChunks )
+	{
+		size_t			newMax		=	maxBuilderChunks == 0 ? 1024 : maxBuilderChunks * 2;
+		ChunkIndexChunk*	newChunks	=	(ChunkIndexChunk*)realloc(builderChunks, sizeof(*newChunks) * newMax);
+		uint8_t*		newBlooms;
+
+		if ( newChunks == NULL )
+			return false;
+		builderChunks = newChunks;
+		newBlooms = (uint8_t*)realloc(builderBlooms, CHUNK_BLOOM_BYTES * newMax);
+		if ( newBlooms == NULL )
+			return false;
+		builderBlooms = newBlooms;
+		maxBuilderChunks = newMax;
+	}
+
+	chunk = &builderChunks[numBuilderChunks];
+	chunk->offset = offset;
+	chunk->fileIdx = (uint32_t)( numBuilderFiles - 1 );
+	chunk->numValues = 0;
+	memset(builderBlooms + CHUNK_BLOOM_BYTES * numBuilderChunks, 0, CHUNK_BLOOM_BYTES);
+	numBuilderChunks++;
+	builderFiles[numBuilderFiles - 1].numChunks++;
+	return true;
+}
+
+void	ChunkIndexAddRecord(const EvtxRecord* record)
+{
+	ChunkIndexChunk*	chunk;
+	uint8_t*		bloom;
+	char			value[MAX_VALUE_SIZE];
+
+	if ( numBuilderChunks == 0 )
+		return;
+	chunk = &builderChunks[numBuilderChunks - 1];
+	bloom = builderBlooms + CHUNK_BLOOM_BYTES * ( numBuilderChunks - 1 );
+
+	for (size_t idx = 0; idx < record->numFields; idx++)
+	{
+		const EvtxField*	field	=	&record->fields[idx];
+
+		if ( !ChunkIndexIsIndexedField(field->key) )
+			continue;
+		if ( !FormatFieldValue(field, value, sizeof(value)) || value[0] == 0 )
+			continue;
+		BloomAdd(bloom, CHUNK_BLOOM_BYTES, CHUNK_BLOOM_HASHES, ChunkIndexHashValue(value));
+		chunk->numValues++;
+	}
+}
+
+static void	FreeBuilder(void)
+{
+	if ( builderIndex != NULL )
+		fclose(builderIndex);
+	free(builderIndexName);
+	builderIndex = NULL;
+	builderIndexName = NULL;
+	for (size_t idx = 0; idx < numBuilderFiles; idx++)
+		free(builderFiles[idx].name);
+	free(builderFiles);
+	free(builderChunks);
+	free(builderBlooms);
+	builderFiles = NULL;
+	builderChunks = NULL;
+	builderBlooms = NULL;
+	numBuilderFiles = maxBuilderFiles = 0;
+	numBuilderChunks = maxBuilderChunks = 0;
+}
+
+bool	ChunkIndexBuildBegin(const char* indexName)
+{
+	builderIndex = fopen(indexName, "wb");
+	if ( builderIndex == NULL )
+	{
+		printf("Cannot create %s\n", indexName);
+		return false;
+	}
+	builderIndexName = strdup(indexName);
+	if ( builderIndexName == NULL )
+	{
+		FreeBuilder();
+		return false;
+	}
+	return true;
+}
+
+bool	ChunkIndexWrite(void)
+{
+	ChunkIndexHeader	header;
+	FILE*			f		=	builderIndex;
+	bool			result		=	true;
+	uint64_t		stringsSize	=	0;
+
+	if ( fieldList == NULL )
+		ChunkIndexSetFields(DEFAULT_INDEX_FIELDS);
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CHUNK_INDEX_MAGIC, sizeof(header.magic));
+	header.version = CHUNK_INDEX_VERSION;
+	header.bloomBytes = CHUNK_BLOOM_BYTES;
+	header.numHashes = CHUNK_BLOOM_HASHES;
+	header.numFiles = (uint32_t)numBuilderFiles;
+	header.numChunks = numBuilderChunks;
+	header.filesOffset = sizeof(header);
+	header.chunksOffset = header.filesOffset + sizeof(ChunkIndexFile) * numBuilderFiles;
+	header.bloomsOffset = header.chunksOffset + sizeof(ChunkIndexChunk) * numBuilderChunks;
+	header.stringsOffset = header.bloomsOffset + (uint64_t)CHUNK_BLOOM_BYTES * numBuilderChunks;
+	for (size_t idx = 0; idx < numBuilderFiles; idx++)
+		stringsSize += strlen(builderFiles[idx].name) + 1;
+	header.fieldsOffset = stringsSize;
+	header.stringsSize = stringsSize + strlen(fieldList) + 1;
+
+	if ( f == NULL )
+		return false;
+
+	result = ( fwrite(&header, sizeof(header), 1, f) == 1 );
+	stringsSize = 0;
+	for (size_t idx = 0; result && idx < numBuilderFiles; idx++)
+	{
+		ChunkIndexFile	file;
+
+		memset(&file, 0, sizeof(file));
+		file.nameOffset = stringsSize;
+		file.fileSize = builderFiles[idx].fileSize;
+		file.firstChunk = builderFiles[idx].firstChunk;
+		file.numChunks = builderFiles[idx].numChunks;
+		stringsSize += strlen(builderFiles[idx].name) + 1;
+		result = ( fwrite(&file, sizeof(file), 1, f) == 1 );
+	}
+	if ( result && numBuilderChunks > 0 )
+	{
+		result = ( fwrite(builderChunks, sizeof(*builderChunks), numBuilderChunks, f) == numBuilderChunks &&
+			fwrite(builderBlooms, CHUNK_BLOOM_BYTES, numBuilderChunks, f) == numBuilderChunks );
+	}
+	for (size_t idx = 0; result && idx < numBuilderFiles; idx++)
+		result = ( fwrite(builderFiles[idx].name, strlen(builderFiles[idx].name) + 1, 1, f) == 1 );
+	if ( result )
+		result = ( fwrite(fieldList, strlen(fieldList) + 1, 1, f) == 1 );
+
+	builderIndex = NULL;
+	if ( fclose(f) != 0 )
+		result = false;
+	if ( !result )
+		printf("Failed to write %s\n", builderIndexName);
+
+	FreeBuilder();
+	return result;
+}
+
+static bool	ValidateIndex(struct sChunkIndex* index)
+{
+	const ChunkIndexHeader*	header	=	(const ChunkIndexHeader*)index->mapped.data;
+
+	if ( index->mapped.dataSize < sizeof(*header) ||
+		memcmp(header->magic, CHUNK_INDEX_MAGIC, sizeof(header->magic)) ||
+		header->version != CHUNK_INDEX_VERSION ||
+		header->bloomBytes == 0 || header->numHashes == 0 )
+	{
+		return false;
+	}
+	if ( header->filesOffset > index->mapped.dataSize ||
+		( index->mapped.dataSize - header->filesOffset ) / sizeof(ChunkIndexFile) < header->numFiles ||
+		header->chunksOffset > index->mapped.dataSize ||
+		( index->mapped.dataSize - header->chunksOffset ) / sizeof(ChunkIndexChunk) < header->numChunks ||
+		header->bloomsOffset > index->mapped.dataSize ||
+		( index->mapped.dataSize - header->bloomsOffset ) / header->bloomBytes < header->numChunks ||
+		header->stringsOffset > index->mapped.dataSize ||
+		index->mapped.dataSize - header->stringsOffset < header->stringsSize ||
+		header->stringsSize == 0 || header->fieldsOffset >= header->stringsSize )
+	{
+		return false;
+	}
+
+	index->header = header;
+	index->files = (const ChunkIndexFile*)( index->mapped.data + header->filesOffset );
+	index->chunks = (const ChunkIndexChunk*)( index->mapped.data + header->chunksOffset );
+	index->blooms = index->mapped.data + header->bloomsOffset;
+	index->strings = (const char*)( index->mapped.data + header->stringsOffset );
+
+	if ( index->strings[header->stringsSize - 1] != 0 )
+		return false;
+	for (uint32_t idx = 0; idx < header->numFiles; idx++)
+	{
+		const ChunkIndexFile*	file	=	&index->files[idx];
+
+		if ( file->nameOffset >= header->stringsSize ||
+			file->firstChunk > header->numChunks ||
+			file->numChunks > header->numChunks - file->firstChunk )
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+struct sChunkIndex*	ChunkIndexOpen(const char* indexName)
+{
+	struct sChunkIndex*	index	=	(struct sChunkIndex*)calloc(1, sizeof(*index));
+
+	if ( index == NULL )
+		return NULL;
+	if ( !MapFile(indexName, &index->mapped) || !ValidateIndex(index) ||
+		!ChunkIndexSetFields(index->strings + index->header->fieldsOffset) )
+	{
+		printf("Invalid index %s\n", indexName);
+		ChunkIndexClose(index);
+		return NULL;
+	}
+
+	return index;
+}
+
+void	ChunkIndexClose(struct sChunkIndex* index)
+{
+	if ( index == NULL )
+		return;
+	UnmapFile(&index->mapped);
+	free(index);
+}
+
+uint32_t	ChunkIndexNumFiles(const struct sChunkIndex* index)
+{
+	return index->header->numFiles;
+}
+
+const char*	ChunkIndexFileName(const struct sChunkIndex* index, uint32_t fileIdx)
+{
+	return index->strings + index->files[fileIdx].nameOffset;
+}
+
+int	ChunkIndexFindFile(const struct sChunkIndex* index, const char* fileName, uint64_t fileSize)
+{
+	for (uint32_t idx = 0; idx < index->header->numFiles; idx++)
+	{
+		if ( index->files[idx].fileSize == fileSize && !strcmp(ChunkIndexFileName(index, idx), fileName) )
+			return (int)idx;
+	}
+	return -1;
+}
+
+bool	ChunkIndexFileMayContain(const struct sChunkIndex* index, uint32_t fileIdx, uint64_t valueHash)
+{
+	const ChunkIndexFile*	file	=	&index->files[fileIdx];
+
+	for (uint32_t idx = file->firstChunk; idx < file->firstChunk + file->numChunks; idx++)
+	{
+		if ( BloomMayContain(index->blooms + (size_t)index->header->bloomBytes * idx,
+				index->header->bloomBytes, index->header->numHashes, valueHash) )
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool	ChunkIndexChunkMayContain(const struct sChunkIndex* index, uint32_t fileIdx, uint64_t offset, uint64_t valueHash)
+{
+	const ChunkIndexFile*	file	=	&index->files[fileIdx];
+	uint32_t		low	=	file->firstChunk;
+	uint32_t		high	=	file->firstChunk + file->numChunks;
+
+	/*  chunks of a file are stored by increasing offset */
+	while ( low < high )
+	{
+		uint32_t	mid	=	low + ( high - low ) / 2;
+
+		if ( index->chunks[mid].offset < offset )
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	if ( low >= file->firstChunk + file->numChunks || index->chunks[low].offset != offset )
+		return true;
+
+	return BloomMayContain(index->blooms + (size_t)index->header->bloomBytes * low,
+			index->header->bloomBytes, index->header->numHashes, valueHash);
+}
+
+bool	ChunkIndexRecordMatches(const EvtxRecord* record, const char* value)
+{
+	char	fieldValue[MAX_VALUE_SIZE];
+
+	for (size_t idx = 0; idx < record->numFields; idx++)
+	{
+		const EvtxField*	field	=	&record->fields[idx];
+		size_t			pos;
+
+		if ( !ChunkIndexIsIndexedField(field->key) || !FormatFieldValue(field, fieldValue, sizeof(fieldValue)) )
+			continue;
+		for (pos = 0; fieldValue[pos] != 0 && FoldByte(fieldValue[pos]) == FoldByte(value[pos]); pos++)
+			;
+		if ( fieldValue[pos] == 0 && value[pos] == 0 )
+			return true;
+	}
+	return false;
+}
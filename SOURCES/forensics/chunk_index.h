@@ -0,0 +1,103 @@
+/*
+ * =====================================================================================
+ *       Filename:  chunk_index.h
+ *    Description:  Per-chunk Bloom filter index over selected field values
+ *
+ *                  The index file is a single little endian block meant to be
+ *                  mapped as is:
+ *
+ *                      ChunkIndexHeader
+ *                      ChunkIndexFile    [numFiles]
+ *                      ChunkIndexChunk   [numChunks]
+ *                      Bloom filters     [numChunks][bloomBytes]
+ *                      strings           (file names, the field list)
+ *
+ *                  Values are hashed as FormatFieldValue() text with ASCII case
+ *                  folded: strings as parse_evtx prints them, but integers without
+ *                  the leading zeros of the output, so a query gives LogonType 2,
+ *                  not the 00000002 printed.
+ * =====================================================================================
+ */
+
+#ifndef chunk_index_h_included
+#define chunk_index_h_included
+
+#include "evtx_record.h"
+
+#define CHUNK_INDEX_MAGIC		"EVTXCIDX"
+#define CHUNK_INDEX_VERSION		1
+#define CHUNK_BLOOM_BYTES		2048
+#define CHUNK_BLOOM_HASHES		5
+
+#define DEFAULT_INDEX_FIELDS	"TargetUserName,SubjectUserName,TargetDomainName,SubjectDomainName,TargetUserSid,SubjectUserSid," \
+				"IpAddress,WorkstationName,Computer,ProcessName,NewProcessName,ParentProcessName,Image,ParentImage," \
+				"ServiceName,ShareName,User"
+
+typedef struct
+{
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	bloomBytes;
+	uint32_t	numHashes;
+	uint32_t	numFiles;
+	uint64_t	numChunks;
+	uint64_t	filesOffset;
+	uint64_t	chunksOffset;
+	uint64_t	bloomsOffset;
+	uint64_t	stringsOffset;
+	uint64_t	stringsSize;
+	uint64_t	fieldsOffset;	/*  comma separated, relative to the strings */
+}
+ChunkIndexHeader;
+
+typedef struct
+{
+	uint64_t	nameOffset;	/*  zero terminated, relative to the strings */
+	uint64_t	fileSize;
+	uint32_t	firstChunk;
+	uint32_t	numChunks;
+}
+ChunkIndexFile;
+
+typedef struct
+{
+	uint64_t	offset;		/*  of the chunk in the file */
+	uint32_t	fileIdx;
+	uint32_t	numValues;
+}
+ChunkIndexChunk;
+
+/*  Comma separated field names, DEFAULT_INDEX_FIELDS when never set */
+bool	ChunkIndexSetFields(const char* fields);
+bool	ChunkIndexIsIndexedField(const char* key);
+const char*	ChunkIndexFields(void);
+
+/*  Creates the index file before the logs are parsed, so a bad path fails
+ *  at once */
+bool	ChunkIndexBuildBegin(const char* indexName);
+bool	ChunkIndexBeginFile(const char* fileName, uint64_t fileSize);
+bool	ChunkIndexBeginChunk(uint64_t offset);
+void	ChunkIndexAddRecord(const EvtxRecord* record);
+/*  Writes the index and releases the builder */
+bool	ChunkIndexWrite(void);
+
+struct sChunkIndex;
+
+/*  Also makes the field list of the index the current one */
+struct sChunkIndex*	ChunkIndexOpen(const char* indexName);
+void	ChunkIndexClose(struct sChunkIndex* index);
+
+uint64_t	ChunkIndexHashValue(const char* value);
+
+uint32_t	ChunkIndexNumFiles(const struct sChunkIndex* index);
+const char*	ChunkIndexFileName(const struct sChunkIndex* index, uint32_t fileIdx);
+/*  Returns -1 for files not in the index or changed since */
+int	ChunkIndexFindFile(const struct sChunkIndex* index, const char* fileName, uint64_t fileSize);
+bool	ChunkIndexFileMayContain(const struct sChunkIndex* index, uint32_t fileIdx, uint64_t valueHash);
+/*  Chunks that were not indexed may contain anything */
+bool	ChunkIndexChunkMayContain(const struct sChunkIndex* index, uint32_t fileIdx, uint64_t offset, uint64_t valueHash);
+
+/*  Exact check of the indexed fields of a decoded record */
+bool	ChunkIndexRecordMatches(const EvtxRecord* record, const char* value);
+
+#endif
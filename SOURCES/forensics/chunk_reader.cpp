@@ -0,0 +1,468 @@
+/*
+ * =====================================================================================
+ *       Filename:  chunk_reader.cpp
+ *    Description:  Sources of EVTX logs read block by block: files, mapped files, pipes,
+ *                  archive members
+ * =====================================================================================
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#else
+#include <io.h>
+#endif
+#include <utils/win_types.h>
+#include "chunk_reader.h"
+#include "evtx_trace.h"
+
+typedef struct
+{
+	struct sChunkReader	reader;
+	int			f;
+	uint8_t			buffer[EVTX_CHUNK_SIZE];
+}
+FileReader;
+
+static bool	FileRead(struct sChunkReader* reader, size_t size, const uint8_t** data, size_t* dataLen)
+{
+	FileReader*	fileReader	=	(FileReader*)reader;
+	ssize_t		numRead;
+
+	*data = fileReader->buffer;
+	*dataLen = 0;
+	if ( size > sizeof(fileReader->buffer) )
+		return false;
+#ifdef _WIN32
+	if ( _lseeki64(fileReader->f, (__int64)reader->offset, SEEK_SET) != (__int64)reader->offset )
+		return false;
+#else
+	if ( lseek(fileReader->f, (off_t)reader->offset, SEEK_SET) != (off_t)reader->offset )
+		return false;
+#endif
+
+	while ( *dataLen < size )
+	{
+		numRead = read(fileReader->f, fileReader->buffer + *dataLen, size - *dataLen);
+		if ( numRead < 0 )
+			return false;
+		if ( numRead == 0 )
+			break;
+		*dataLen += numRead;
+	}
+	reader->offset += *dataLen;
+	return true;
+}
+
+static bool	FileSeek(struct sChunkReader* reader, uint64_t offset)
+{
+	reader->offset = offset;
+	return true;
+}
+
+static void	FileClose(struct sChunkReader* reader)
+{
+	free(reader);
+}
+
+struct sChunkReader*	ChunkReaderOpenFile(int f)
+{
+	FileReader*	fileReader	=	(FileReader*)malloc(sizeof(*fileReader));
+
+	if ( fileReader == NULL )
+		return NULL;
+	fileReader->reader.read = FileRead;
+	fileReader->reader.seek = FileSeek;
+	fileReader->reader.close = FileClose;
+	fileReader->reader.offset = 0;
+	fileReader->f = f;
+	return &fileReader->reader;
+}
+
+/*  Mapped files: a view of windowSize bytes is mapped around the block
+ *  read and moved forward with the parse, so a file of any size takes a
+ *  bounded part of the address space.  Views start on the allocation
+ *  granularity, the chunks are handed out in place. */
+
+typedef struct
+{
+	struct sChunkReader	reader;
+	int			f;
+	uint64_t		fileSize;
+	uint64_t		granularity;
+	size_t			windowSize;
+	uint8_t*		view;
+	uint64_t		viewOffset;
+	size_t			viewSize;
+#ifdef _WIN32
+	HANDLE			mapping;
+#endif
+}
+MappedReader;
+
+static void	UnmapView(MappedReader* mappedReader)
+{
+	if ( mappedReader->view != NULL )
+	{
+#ifndef _WIN32
+		munmap(mappedReader->view, mappedReader->viewSize);
+#else
+		UnmapViewOfFile(mappedReader->view);
+#endif
+	}
+	mappedReader->view = NULL;
+	mappedReader->viewSize = 0;
+}
+
+static bool	MapView(MappedReader* mappedReader, uint64_t offset, size_t size)
+{
+	uint64_t	viewOffset	=	offset - offset % mappedReader->granularity;
+	uint64_t	viewEnd		=	viewOffset + mappedReader->windowSize;
+
+	if ( viewEnd < offset + size )
+		viewEnd = offset + size;
+	if ( viewEnd > mappedReader->fileSize )
+		viewEnd = mappedReader->fileSize;
+
+	UnmapView(mappedReader);
+#ifndef _WIN32
+	mappedReader->view = (uint8_t*)mmap(NULL, (size_t)( viewEnd - viewOffset ), PROT_READ, MAP_SHARED, mappedReader->f, (off_t)viewOffset);
+	if ( mappedReader->view == MAP_FAILED )
+		mappedReader->view = NULL;
+#else
+	mappedReader->view = (uint8_t*)MapViewOfFile(mappedReader->mapping, FILE_MAP_READ, (DWORD)( viewOffset >> 32 ), (DWORD)viewOffset, (SIZE_T)( viewEnd - viewOffset ));
+#endif
+	if ( mappedReader->view == NULL )
+		return false;
+	mappedReader->viewOffset = viewOffset;
+	mappedReader->viewSize = (size_t)( viewEnd - viewOffset );
+	return true;
+}
+
+static bool	MappedRead(struct sChunkReader* reader, size_t size, const uint8_t** data, size_t* dataLen)
+{
+	MappedReader*	mappedReader	=	(MappedReader*)reader;
+
+	*data = NULL;
+	*dataLen = 0;
+	if ( reader->offset >= mappedReader->fileSize )
+		return true;
+	if ( size > mappedReader->fileSize - reader->offset )
+		size = (size_t)( mappedReader->fileSize - reader->offset );
+
+	if ( mappedReader->view == NULL || reader->offset < mappedReader->viewOffset ||
+		reader->offset + size > mappedReader->viewOffset + mappedReader->viewSize )
+	{
+		if ( !MapView(mappedReader, reader->offset, size) )
+			return false;
+	}
+
+	*data = mappedReader->view + ( reader->offset - mappedReader->viewOffset );
+	*dataLen = size;
+	reader->offset += size;
+	return true;
+}
+
+static bool	MappedSeek(struct sChunkReader* reader, uint64_t offset)
+{
+	reader->offset = offset;
+	return true;
+}
+
+static void	MappedClose(struct sChunkReader* reader)
+{
+	MappedReader*	mappedReader	=	(MappedReader*)reader;
+
+	UnmapView(mappedReader);
+#ifdef _WIN32
+	if ( mappedReader->mapping != NULL )
+		CloseHandle(mappedReader->mapping);
+#endif
+	free(mappedReader);
+}
+
+struct sChunkReader*	ChunkReaderOpenMapped(int f, unsigned int windowChunks)
+{
+	MappedReader*	mappedReader;
+	uint64_t	fileSize;
+
+	if ( !ChunkReaderFileSize(f, &fileSize) || fileSize == 0 )
+		return NULL;
+	mappedReader = (MappedReader*)calloc(1, sizeof(*mappedReader));
+	if ( mappedReader == NULL )
+		return NULL;
+
+	mappedReader->reader.read = MappedRead;
+	mappedReader->reader.seek = MappedSeek;
+	mappedReader->reader.close = MappedClose;
+	mappedReader->reader.offset = 0;
+	mappedReader->f = f;
+	mappedReader->fileSize = fileSize;
+	mappedReader->windowSize = (size_t)( windowChunks > 0 ? windowChunks : 1 ) * EVTX_CHUNK_SIZE;
+#ifndef _WIN32
+	mappedReader->granularity = (uint64_t)sysconf(_SC_PAGESIZE);
+#else
+	{
+		SYSTEM_INFO	systemInfo;
+
+		GetSystemInfo(&systemInfo);
+		mappedReader->granularity = systemInfo.dwAllocationGranularity;
+	}
+	mappedReader->mapping = CreateFileMapping((HANDLE)_get_osfhandle(f), NULL, PAGE_READONLY, 0, 0, NULL);
+	if ( mappedReader->mapping == NULL )
+	{
+		free(mappedReader);
+		return NULL;
+	}
+#endif
+	return &mappedReader->reader;
+}
+
+/*  Pipes and sockets: a thread reads the stream front to back into a ring
+ *  of blocks, the 4 KiB header first and 64 KiB chunks after it, while the
+ *  parser decodes the block before.  The block handed out is released by
+ *  the next read. */
+
+typedef struct
+{
+	uint8_t		data[EVTX_CHUNK_SIZE];
+	size_t		dataLen;
+}
+StreamBlock;
+
+typedef struct
+{
+	struct sChunkReader	reader;
+	int			f;
+	uint8_t			prefix[EVTX_FILE_HEADER_SIZE];
+	size_t			prefixLen;
+	uint64_t		blocksRead;	/*  producer side */
+
+	pthread_t		thread;
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	StreamBlock		blocks[CHUNK_READER_PREFETCH_BLOCKS];
+	size_t			head;
+	size_t			count;		/*  filled blocks, including the one the consumer holds */
+	bool			holding;
+	bool			ended;
+	bool			failed;
+	bool			stop;
+}
+StreamReader;
+
+static size_t	StreamBlockSize(uint64_t blockIdx)
+{
+	return blockIdx == 0 ? EVTX_FILE_HEADER_SIZE : EVTX_CHUNK_SIZE;
+}
+
+static bool	StreamFill(StreamReader* streamReader, StreamBlock* block, size_t size)
+{
+	size_t	prefixLen	=	streamReader->prefixLen < size ? streamReader->prefixLen : size;
+
+	memcpy(block->data, streamReader->prefix, prefixLen);
+	memmove(streamReader->prefix, streamReader->prefix + prefixLen, streamReader->prefixLen - prefixLen);
+	streamReader->prefixLen -= prefixLen;
+	block->dataLen = prefixLen;
+
+	while ( block->dataLen < size )
+	{
+		ssize_t	numRead	=	read(streamReader->f, block->data + block->dataLen, size - block->dataLen);
+
+		if ( numRead < 0 && errno == EINTR )
+			continue;
+		if ( numRead < 0 )
+			return false;
+		if ( numRead == 0 )
+			break;
+		block->dataLen += numRead;
+	}
+	return true;
+}
+
+static void*	StreamThread(void* arg)
+{
+	StreamReader*	streamReader	=	(StreamReader*)arg;
+	bool		ended		=	false;
+	bool		failed		=	false;
+
+	EvtxTraceThreadName("stream reader");
+	while ( !ended )
+	{
+		StreamBlock*	block;
+		size_t		size	=	StreamBlockSize(streamReader->blocksRead);
+
+		pthread_mutex_lock(&streamReader->lock);
+		while ( streamReader->count == CHUNK_READER_PREFETCH_BLOCKS && !streamReader->stop )
+			pthread_cond_wait(&streamReader->cond, &streamReader->lock);
+		block = &streamReader->blocks[( streamReader->head + streamReader->count ) % CHUNK_READER_PREFETCH_BLOCKS];
+		ended = streamReader->stop;
+		pthread_mutex_unlock(&streamReader->lock);
+		if ( ended )
+			break;
+
+		TRACE_BEGIN(traceStart);
+		failed = !StreamFill(streamReader, block, size);
+		TRACE_END_ARG("stream read", traceStart, "bytes", block->dataLen);
+		ended = ( failed || block->dataLen < size );
+		streamReader->blocksRead++;
+
+		pthread_mutex_lock(&streamReader->lock);
+		if ( !failed && block->dataLen > 0 )
+			streamReader->count++;
+		TRACE_COUNTER("stream blocks", "blocks", streamReader->count);
+		streamReader->ended = ended;
+		streamReader->failed = failed;
+		pthread_cond_broadcast(&streamReader->cond);
+		pthread_mutex_unlock(&streamReader->lock);
+	}
+	return NULL;
+}
+
+static bool	StreamRead(struct sChunkReader* reader, size_t size, const uint8_t** data, size_t* dataLen)
+{
+	StreamReader*	streamReader	=	(StreamReader*)reader;
+	StreamBlock*	block		=	NULL;
+	bool		result		=	true;
+
+	*data = NULL;
+	*dataLen = 0;
+
+	pthread_mutex_lock(&streamReader->lock);
+	if ( streamReader->holding )
+	{
+		streamReader->head = ( streamReader->head + 1 ) % CHUNK_READER_PREFETCH_BLOCKS;
+		streamReader->count--;
+		streamReader->holding = false;
+		pthread_cond_broadcast(&streamReader->cond);
+	}
+	while ( streamReader->count == 0 && !streamReader->ended )
+		pthread_cond_wait(&streamReader->cond, &streamReader->lock);
+	if ( streamReader->count > 0 )
+	{
+		block = &streamReader->blocks[streamReader->head];
+		streamReader->holding = true;
+	}
+	else
+	{
+		result = !streamReader->failed;
+	}
+	pthread_mutex_unlock(&streamReader->lock);
+
+	if ( block == NULL )
+		return result;
+	/*  blocks are cut for the header and chunk sizes only */
+	if ( size != ( reader->offset == 0 ? EVTX_FILE_HEADER_SIZE : EVTX_CHUNK_SIZE ) )
+		return false;
+
+	*data = block->data;
+	*dataLen = block->dataLen;
+	reader->offset += block->dataLen;
+	return true;
+}
+
+static void	StreamClose(struct sChunkReader* reader)
+{
+	StreamReader*	streamReader	=	(StreamReader*)reader;
+
+	pthread_mutex_lock(&streamReader->lock);
+	streamReader->stop = true;
+	pthread_cond_broadcast(&streamReader->cond);
+	pthread_mutex_unlock(&streamReader->lock);
+	pthread_join(streamReader->thread, NULL);
+
+	pthread_mutex_destroy(&streamReader->lock);
+	pthread_cond_destroy(&streamReader->cond);
+	free(streamReader);
+}
+
+struct sChunkReader*	ChunkReaderOpenStream(int f, const uint8_t* prefix, size_t prefixLen)
+{
+	StreamReader*	streamReader;
+
+	if ( prefixLen > EVTX_FILE_HEADER_SIZE )
+		return NULL;
+	streamReader = (StreamReader*)calloc(1, sizeof(*streamReader));
+	if ( streamReader == NULL )
+		return NULL;
+
+	streamReader->reader.read = StreamRead;
+	streamReader->reader.seek = NULL;
+	streamReader->reader.close = StreamClose;
+	streamReader->reader.offset = 0;
+	streamReader->f = f;
+	memcpy(streamReader->prefix, prefix, prefixLen);
+	streamReader->prefixLen = prefixLen;
+	pthread_mutex_init(&streamReader->lock, NULL);
+	pthread_cond_init(&streamReader->cond, NULL);
+
+	if ( pthread_create(&streamReader->thread, NULL, StreamThread, streamReader) != 0 )
+	{
+		pthread_mutex_destroy(&streamReader->lock);
+		pthread_cond_destroy(&streamReader->cond);
+		free(streamReader);
+		return NULL;
+	}
+	return &streamReader->reader;
+}
+
+bool	ChunkReaderFileSize(int f, uint64_t* size)
+{
+#ifdef _WIN32
+	/*  st_size of struct stat is 32-bit on 32-bit Mingw-w64 */
+	struct _stati64	st;
+
+	if ( _fstati64(f, &st) != 0 || st.st_size < 0 )
+		return false;
+#else
+	struct stat	st;
+
+	if ( fstat(f, &st) != 0 || st.st_size < 0 )
+		return false;
+#endif
+	*size = (uint64_t)st.st_size;
+	return true;
+}
+
+bool	ChunkReaderSeekable(int f)
+{
+	return ( lseek(f, 0, SEEK_CUR) >= 0 );
+}
+
+void	ChunkReaderClose(struct sChunkReader* reader)
+{
+	if ( reader != NULL )
+		reader->close(reader);
+}
+
+bool	ChunkReaderReadHeader(struct sChunkReader* reader, const uint8_t** header)
+{
+	size_t	headerLen;
+
+	return ( reader->read(reader, EVTX_FILE_HEADER_SIZE, header, &headerLen) && headerLen == EVTX_FILE_HEADER_SIZE );
+}
+
+bool	ChunkReaderNextChunk(struct sChunkReader* reader, const uint8_t** chunk, bool* endOfFile)
+{
+	size_t	chunkLen;
+
+	*endOfFile = false;
+	if ( !reader->read(reader, EVTX_CHUNK_SIZE, chunk, &chunkLen) )
+		return false;
+	*endOfFile = ( chunkLen != EVTX_CHUNK_SIZE );
+	return true;
+}
+
+bool	ChunkReaderSeek(struct sChunkReader* reader, uint64_t offset)
+{
+	if ( reader->seek == NULL )
+		return false;
+	return reader->seek(reader, offset);
+}
@@ -0,0 +1,57 @@
+/*
+ * =====================================================================================
+ *       Filename:  chunk_reader.h
+ *    Description:  Sources of EVTX logs read block by block: files, mapped files, pipes,
+ *                  archive members
+ *
+ *                  A log is read as the 4 KiB file header followed by the 64 KiB
+ *                  chunks, in file order.  The block returned by a read stays
+ *                  valid until the next read from the same reader.
+ * =====================================================================================
+ */
+
+#ifndef chunk_reader_h_included
+#define chunk_reader_h_included
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define EVTX_FILE_HEADER_SIZE	0x1000
+#define EVTX_CHUNK_SIZE		0x10000
+
+#define CHUNK_READER_PREFETCH_BLOCKS	4
+#define DEFAULT_MAP_WINDOW_CHUNKS	16
+
+struct sChunkReader
+{
+	/*  Reads the next size bytes, a short block means the end of the log */
+	bool	(*read)(struct sChunkReader* reader, size_t size, const uint8_t** data, size_t* dataLen);
+	/*  NULL for sequential sources */
+	bool	(*seek)(struct sChunkReader* reader, uint64_t offset);
+	void	(*close)(struct sChunkReader* reader);
+	uint64_t	offset;		/*  of the next block */
+};
+
+/*  Reads the file with lseek() and read(); the reader does not own f */
+struct sChunkReader*	ChunkReaderOpenFile(int f);
+/*  Maps windowChunks chunks of the file at a time, moving the view along with
+ *  the reads; blocks are returned in place.  Offsets are 64-bit on 32-bit
+ *  builds as well.  The reader does not own f. */
+struct sChunkReader*	ChunkReaderOpenMapped(int f, unsigned int windowChunks);
+/*  Reads a pipe, socket or terminal front to back, never seeking, with up to
+ *  CHUNK_READER_PREFETCH_BLOCKS blocks read ahead on a thread; prefix holds
+ *  the bytes already read from f.  The reader does not own f. */
+struct sChunkReader*	ChunkReaderOpenStream(int f, const uint8_t* prefix, size_t prefixLen);
+/*  The size of the open file, 64-bit on 32-bit builds as well */
+bool	ChunkReaderFileSize(int f, uint64_t* size);
+/*  False for pipes and sockets, which need ChunkReaderOpenStream() */
+bool	ChunkReaderSeekable(int f);
+void	ChunkReaderClose(struct sChunkReader* reader);
+
+bool	ChunkReaderReadHeader(struct sChunkReader* reader, const uint8_t** header);
+/*  A short chunk sets *endOfFile */
+bool	ChunkReaderNextChunk(struct sChunkReader* reader, const uint8_t** chunk, bool* endOfFile);
+/*  Moves to the chunk at offset, false for sequential sources */
+bool	ChunkReaderSeek(struct sChunkReader* reader, uint64_t offset);
+
+#endif
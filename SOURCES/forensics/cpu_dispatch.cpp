@@ -0,0 +1,180 @@
+/*
+ * =====================================================================================
+ *       Filename:  cpu_dispatch.cpp
+ *    Description:  CPU features from cpuid and the tier the kernels run at
+ * =====================================================================================
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "cpu_dispatch.h"
+
+#ifdef HAVE_X86_KERNELS
+#include <cpuid.h>
+#endif
+
+CpuTier		cpuTier		=	CpuTierUnknown;
+
+static uint32_t	cpuFeatures	=	0;
+static CpuTier	bestTier	=	CpuTierUnknown;
+
+static const char*	tierNames[NUM_CPU_TIERS]	=	{ "scalar", "sse2", "sse4", "avx2", "avx512" };
+
+static const struct
+{
+	uint32_t	feature;
+	const char*	name;
+}
+featureNames[]	=
+{
+	{ CPU_FEATURE_SSE2,	"sse2" },
+	{ CPU_FEATURE_SSSE3,	"ssse3" },
+	{ CPU_FEATURE_SSE41,	"sse4.1" },
+	{ CPU_FEATURE_SSE42,	"sse4.2" },
+	{ CPU_FEATURE_POPCNT,	"popcnt" },
+	{ CPU_FEATURE_AVX,	"avx" },
+	{ CPU_FEATURE_AVX2,	"avx2" },
+	{ CPU_FEATURE_BMI2,	"bmi2" },
+	{ CPU_FEATURE_AVX512F,	"avx512f" },
+	{ CPU_FEATURE_AVX512BW,	"avx512bw" },
+	{ CPU_FEATURE_SHA,	"sha" },
+};
+
+#ifdef HAVE_X86_KERNELS
+
+/*  The register state the OS saves on context switches (XCR0) */
+static uint64_t	ReadXcr0(void)
+{
+	uint32_t	eax;
+	uint32_t	edx;
+
+	__asm__ volatile ( "xgetbv" : "=a" (eax), "=d" (edx) : "c" (0) );
+	return ( (uint64_t)edx << 32 ) | eax;
+}
+
+static uint32_t	DetectFeatures(void)
+{
+	unsigned int	eax;
+	unsigned int	ebx;
+	unsigned int	ecx;
+	unsigned int	edx;
+	uint32_t	features	=	0;
+	uint64_t	xcr0		=	0;
+
+	if ( !__get_cpuid(1, &eax, &ebx, &ecx, &edx) )
+		return 0;
+	if ( edx & bit_SSE2 )
+		features |= CPU_FEATURE_SSE2;
+	if ( ecx & bit_SSSE3 )
+		features |= CPU_FEATURE_SSSE3;
+	if ( ecx & bit_SSE4_1 )
+		features |= CPU_FEATURE_SSE41;
+	if ( ecx & bit_SSE4_2 )
+		features |= CPU_FEATURE_SSE42;
+	if ( ecx & bit_POPCNT )
+		features |= CPU_FEATURE_POPCNT;
+	if ( ecx & bit_OSXSAVE )
+		xcr0 = ReadXcr0();
+	/*  xmm and ymm state */
+	if ( ( ecx & bit_AVX ) && ( xcr0 & 0x06 ) == 0x06 )
+		features |= CPU_FEATURE_AVX;
+
+	if ( !__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) )
+		return features;
+	if ( ( features & CPU_FEATURE_AVX ) && ( ebx & ( 1u << 5 ) ) )
+		features |= CPU_FEATURE_AVX2;
+	if ( ebx & ( 1u << 8 ) )
+		features |= CPU_FEATURE_BMI2;
+	/*  and the opmask and zmm state */
+	if ( ( features & CPU_FEATURE_AVX ) && ( xcr0 & 0xE6 ) == 0xE6 )
+	{
+		if ( ebx & ( 1u << 16 ) )
+			features |= CPU_FEATURE_AVX512F;
+		if ( ebx & ( 1u << 30 ) )
+			features |= CPU_FEATURE_AVX512BW;
+	}
+	if ( ebx & ( 1u << 29 ) )
+		features |= CPU_FEATURE_SHA;
+	return features;
+}
+
+#else
+
+static uint32_t	DetectFeatures(void)
+{
+	return 0;
+}
+
+#endif
+
+void	CpuDetect(void)
+{
+	const uint32_t	sse4	=	CPU_FEATURE_SSE2 | CPU_FEATURE_SSSE3 | CPU_FEATURE_SSE41 | CPU_FEATURE_SSE42 | CPU_FEATURE_POPCNT;
+	const uint32_t	avx2	=	sse4 | CPU_FEATURE_AVX | CPU_FEATURE_AVX2;
+	const uint32_t	avx512	=	avx2 | CPU_FEATURE_AVX512F | CPU_FEATURE_AVX512BW;
+	uint32_t	features	=	DetectFeatures();
+	CpuTier		tier		=	CpuTierScalar;
+
+	if ( ( features & avx512 ) == avx512 )
+		tier = CpuTierAVX512;
+	else if ( ( features & avx2 ) == avx2 )
+		tier = CpuTierAVX2;
+	else if ( ( features & sse4 ) == sse4 )
+		tier = CpuTierSSE4;
+	else if ( features & CPU_FEATURE_SSE2 )
+		tier = CpuTierSSE2;
+
+	cpuFeatures = features;
+	bestTier = tier;
+	if ( cpuTier == CpuTierUnknown )
+		cpuTier = tier;
+}
+
+uint32_t	CpuFeatures(void)
+{
+	if ( bestTier == CpuTierUnknown )
+		CpuDetect();
+	return cpuFeatures;
+}
+
+CpuTier	CpuBestTier(void)
+{
+	if ( bestTier == CpuTierUnknown )
+		CpuDetect();
+	return bestTier;
+}
+
+const char*	CpuTierName(CpuTier tier)
+{
+	return ( tier < NUM_CPU_TIERS ) ? tierNames[tier] : "unknown";
+}
+
+bool	CpuSetTier(const char* name)
+{
+	for (int tier = CpuTierScalar; tier < NUM_CPU_TIERS; tier++)
+	{
+		if ( strcmp(name, tierNames[tier]) )
+			continue;
+		if ( tier > CpuBestTier() )
+			return false;
+		cpuTier = (CpuTier)tier;
+		return true;
+	}
+	return false;
+}
+
+void	CpuPrintFeatures(FILE* f)
+{
+	uint32_t	features	=	CpuFeatures();
+
+	fprintf(f, "features:");
+	for (size_t idx = 0; idx < sizeof(featureNames) / sizeof(featureNames[0]); idx++)
+	{
+		if ( features & featureNames[idx].feature )
+			fprintf(f, " %s", featureNames[idx].name);
+	}
+	fprintf(f, "\ntiers:   ");
+	for (int tier = CpuTierScalar; tier <= CpuBestTier(); tier++)
+		fprintf(f, " %s", tierNames[tier]);
+	fprintf(f, "\nactive:   %s\n", CpuTierName(CpuActiveTier()));
+}
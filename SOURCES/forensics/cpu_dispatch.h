@@ -0,0 +1,75 @@
+/*
+ * =====================================================================================
+ *       Filename:  cpu_dispatch.h
+ *    Description:  CPU features from cpuid and the instruction set tier the hot
+ *                  kernels run at (libevtxparse)
+ *
+ *                  The binaries are built for a baseline CPU; the kernels that
+ *                  gain from wider vectors are compiled for every tier with
+ *                  target attributes and pick their version from CpuActiveTier()
+ *                  on every call, so CpuSetTier() takes effect at once.  The
+ *                  tier is detected on first use, the OS must save the vector
+ *                  registers for AVX2 and AVX-512 to count.
+ * =====================================================================================
+ */
+
+#ifndef cpu_dispatch_h_included
+#define cpu_dispatch_h_included
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_KERNELS
+#endif
+
+typedef enum
+{
+	CpuTierScalar,
+	CpuTierSSE2,
+	CpuTierSSE4,		/*  SSSE3, SSE4.1, SSE4.2 and POPCNT */
+	CpuTierAVX2,
+	CpuTierAVX512,		/*  AVX-512 F and BW */
+	NUM_CPU_TIERS,
+	CpuTierUnknown		=	NUM_CPU_TIERS
+}
+CpuTier;
+
+#define CPU_FEATURE_SSE2	0x0001
+#define CPU_FEATURE_SSSE3	0x0002
+#define CPU_FEATURE_SSE41	0x0004
+#define CPU_FEATURE_SSE42	0x0008
+#define CPU_FEATURE_POPCNT	0x0010
+#define CPU_FEATURE_AVX		0x0020	/*  with the ymm state saved by the OS */
+#define CPU_FEATURE_AVX2	0x0040
+#define CPU_FEATURE_BMI2	0x0080
+#define CPU_FEATURE_AVX512F	0x0100	/*  with the zmm state saved by the OS */
+#define CPU_FEATURE_AVX512BW	0x0200
+#define CPU_FEATURE_SHA		0x0400
+
+extern CpuTier	cpuTier;
+
+void	CpuDetect(void);
+
+static inline CpuTier	CpuActiveTier(void)
+{
+	/*  racing threads detect the same tier */
+	if ( cpuTier == CpuTierUnknown )
+		CpuDetect();
+	return cpuTier;
+}
+
+/*  CPU_FEATURE_* */
+uint32_t	CpuFeatures(void);
+/*  The best tier of this CPU */
+CpuTier	CpuBestTier(void);
+/*  "scalar", "sse2", "sse4", "avx2" or "avx512" */
+const char*	CpuTierName(CpuTier tier);
+/*  Runs the kernels at a lower tier, for tests and comparisons; false for
+ *  unknown names and tiers this CPU does not have */
+bool	CpuSetTier(const char* name);
+/*  The features, the tiers of this CPU and the active one */
+void	CpuPrintFeatures(FILE* f);
+
+#endif
@@ -0,0 +1,746 @@
+/*
+ * =====================================================================================
+ *       Filename:  detection_rules.cpp
+ *    Description:  Detection rules compiled against templates and evaluated inline
+ *
+ *                  Predicates are shared between rules.  When a template is defined
+ *                  in a chunk every predicate is resolved against it once: fields
+ *                  fixed in the template become constants, substituted fields become
+ *                  argument indices and missing fields are constant false.  Records
+ *                  of templates no rule can match carry a NULL table and cost nothing.
+ * =====================================================================================
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include "detection_rules.h"
+#include "threshold_windows.h"
+#include "output_sink.h"
+
+typedef enum
+{
+	RuleOpEqual		=	1,
+	RuleOpNotEqual		=	2,
+	RuleOpContains		=	3,
+	RuleOpStartsWith	=	4,
+	RuleOpEndsWith		=	5,
+	RuleOpGreater		=	6,
+	RuleOpLess		=	7,
+	RuleOpGreaterOrEqual	=	8,
+	RuleOpLessOrEqual	=	9,
+}
+RuleOp;
+
+typedef struct
+{
+	char*		field;
+	char*		value;
+	RuleOp		op;
+	uint8_t*	units;		/*  ASCII case folded UTF-16LE */
+	size_t		numUnits;
+	uint32_t	hash;		/*  over the folded units */
+	bool		isNumber;
+	uint64_t	number;
+}
+RulePredicate;
+
+typedef struct
+{
+	size_t		ruleIdx;
+	size_t		firstRef;
+	size_t		numRefs;
+}
+RuleAlternative;
+
+typedef struct
+{
+	uint32_t	predicateIdx;
+	uint16_t	argIdx;
+}
+CompiledPredicate;
+
+typedef struct
+{
+	uint32_t	ruleIdx;
+	uint32_t	firstSlot;
+	uint32_t	numSlots;
+}
+CompiledRule;
+
+struct sCompiledRules
+{
+	size_t			numPredicates;
+	CompiledPredicate*	predicates;	/*  sorted by argIdx */
+	size_t			numRules;
+	CompiledRule*		rules;
+	uint32_t*		slots;		/*  indices into predicates */
+};
+
+#define RESOLVED_FALSE		0
+#define RESOLVED_TRUE		1
+#define RESOLVED_RUNTIME	2
+
+#define MAX_RULE_LINE		4096
+#define MAX_VALUE_UNITS		1024
+
+static RulePredicate*	predicates		=	NULL;
+static size_t		numPredicates		=	0;
+static char**		ruleIds			=	NULL;
+static ThresholdWindow**	ruleWindows		=	NULL;	/*  per rule, NULL for plain rules */
+static size_t		numRules		=	0;
+static RuleAlternative*	alternatives		=	NULL;
+static size_t		numAlternatives		=	0;
+static uint32_t*	predicateRefs		=	NULL;
+static size_t		numPredicateRefs	=	0;
+
+/*  scratch state, sized on load */
+static uint8_t*		resolved		=	NULL;
+static uint32_t*	runtimeSlot		=	NULL;
+static uint8_t*		results			=	NULL;
+static uint8_t*		ruleHit			=	NULL;
+static uint32_t*	hitList			=	NULL;
+static size_t		numHits			=	0;
+
+template<class c>
+static bool	Append(c** array, size_t* count, const c& item)
+{
+	/*  grow in powers of two */
+	if ( ( *count & ( *count - 1 ) ) == 0 )
+	{
+		c*	newArray	=	(c*)realloc(*array, sizeof(c) * ( *count == 0 ? 1 : *count * 2 ));
+		if ( newArray == NULL )
+			return false;
+		*array = newArray;
+	}
+	(*array)[(*count)++] = item;
+	return true;
+}
+
+static uint16_t	FoldUnit(uint16_t w)
+{
+	if ( w >= 'A' && w <= 'Z' )
+		return w + ( 'a' - 'A' );
+	return w;
+}
+
+static uint16_t	GetUnit(const uint8_t* raw, size_t idx)
+{
+	return raw[idx*2] | ( raw[idx*2 + 1] << 8 );
+}
+
+static uint32_t	HashUnits(const uint8_t* raw, size_t numUnits)
+{
+	uint32_t	hash	=	0x811C9DC5;
+
+	for (size_t idx = 0; idx < numUnits; idx++)
+	{
+		hash ^= FoldUnit(GetUnit(raw, idx));
+		hash *= 0x01000193;
+	}
+	return hash;
+}
+
+/*  UTF-8 to UTF-16LE, BMP only; returns the number of units */
+static size_t	Utf8ToUnits(const char* str, uint8_t* units, size_t maxUnits)
+{
+	const uint8_t*	ptr		=	(const uint8_t*)str;
+	size_t		numUnits	=	0;
+
+	while ( *ptr != 0 && numUnits < maxUnits )
+	{
+		uint32_t	w	=	*ptr++;
+
+		if ( ( w & 0xE0 ) == 0xC0 && ( ptr[0] & 0xC0 ) == 0x80 )
+		{
+			w = ( ( w & 0x1F ) << 6 ) | ( ptr[0] & 0x3F );
+			ptr += 1;
+		}
+		else if ( ( w & 0xF0 ) == 0xE0 && ( ptr[0] & 0xC0 ) == 0x80 && ( ptr[1] & 0xC0 ) == 0x80 )
+		{
+			w = ( ( w & 0x0F ) << 12 ) | ( ( ptr[0] & 0x3F ) << 6 ) | ( ptr[1] & 0x3F );
+			ptr += 2;
+		}
+		units[numUnits*2] = w & 0xFF;
+		units[numUnits*2 + 1] = w >> 8;
+		numUnits++;
+	}
+	return numUnits;
+}
+
+static bool	UnitsEqualAt(const RulePredicate* p, const uint8_t* raw, size_t offset)
+{
+	for (size_t idx = 0; idx < p->numUnits; idx++)
+	{
+		if ( FoldUnit(GetUnit(raw, offset + idx)) != GetUnit(p->units, idx) )
+			return false;
+	}
+	return true;
+}
+
+static bool	MatchUnits(const RulePredicate* p, const uint8_t* raw, size_t numUnits)
+{
+	/*  values are often stored with a terminating zero */
+	while ( numUnits > 0 && GetUnit(raw, numUnits - 1) == 0 )
+		numUnits--;
+
+	switch(p->op)
+	{
+	case RuleOpEqual:
+		return ( numUnits == p->numUnits && HashUnits(raw, numUnits) == p->hash && UnitsEqualAt(p, raw, 0) );
+	case RuleOpNotEqual:
+		return !( numUnits == p->numUnits && HashUnits(raw, numUnits) == p->hash && UnitsEqualAt(p, raw, 0) );
+	case RuleOpStartsWith:
+		return ( numUnits >= p->numUnits && UnitsEqualAt(p, raw, 0) );
+	case RuleOpEndsWith:
+		return ( numUnits >= p->numUnits && UnitsEqualAt(p, raw, numUnits - p->numUnits) );
+	case RuleOpContains:
+		for (size_t offset = 0; offset + p->numUnits <= numUnits; offset++)
+		{
+			if ( UnitsEqualAt(p, raw, offset) )
+				return true;
+		}
+		return false;
+	default:
+		return false;
+	}
+}
+
+static bool	MatchNumber(const RulePredicate* p, uint64_t v)
+{
+	switch(p->op)
+	{
+	case RuleOpEqual:		return ( v == p->number );
+	case RuleOpNotEqual:		return ( v != p->number );
+	case RuleOpGreater:		return ( v > p->number );
+	case RuleOpLess:		return ( v < p->number );
+	case RuleOpGreaterOrEqual:	return ( v >= p->number );
+	case RuleOpLessOrEqual:		return ( v <= p->number );
+	default:			return false;
+	}
+}
+
+static bool	MatchText(const RulePredicate* p, const char* text)
+{
+	uint8_t		units[MAX_VALUE_UNITS*2];
+	size_t		numUnits	=	Utf8ToUnits(text, units, MAX_VALUE_UNITS);
+
+	return MatchUnits(p, units, numUnits);
+}
+
+static bool	EvaluatePredicate(const RulePredicate* p, const EvtxField* field)
+{
+	uint64_t	v_q;
+	char		text[MAX_VALUE_UNITS];
+
+	switch(field->type)
+	{
+	case EVTX_TYPE_STRING:
+		return MatchUnits(p, field->data, field->dataLen / 2);
+	case EVTX_TYPE_ANSI_STRING:
+		if ( p->isNumber && p->op != RuleOpContains && p->op != RuleOpStartsWith && p->op != RuleOpEndsWith &&
+				FieldToUInt64(field, &v_q) )
+		{
+			return MatchNumber(p, v_q);
+		}
+		return MatchText(p, (const char*)field->data);
+	case EVTX_TYPE_UINT8:
+	case EVTX_TYPE_UINT16:
+	case EVTX_TYPE_UINT32:
+	case EVTX_TYPE_UINT64:
+	case EVTX_TYPE_HEXINT32:
+	case EVTX_TYPE_HEXINT64:
+		if ( p->isNumber && FieldToUInt64(field, &v_q) )
+			return MatchNumber(p, v_q);
+		break;
+	default:
+		break;
+	}
+
+	if ( !FormatFieldValue(field, text, sizeof(text)) )
+		return false;
+	return MatchText(p, text);
+}
+
+static char*	Trim(char* str)
+{
+	char*	end;
+
+	while ( isspace((uint8_t)*str) )
+		str++;
+	end = str + strlen(str);
+	while ( end > str && isspace((uint8_t)end[-1]) )
+		end--;
+	*end = 0;
+
+	if ( end - str >= 2 && ( ( str[0] == '\'' && end[-1] == '\'' ) || ( str[0] == '"' && end[-1] == '"' ) ) )
+	{
+		end[-1] = 0;
+		str++;
+	}
+	return str;
+}
+
+static bool	ParseCondition(char* condition, RulePredicate* p)
+{
+	char*	opPtr	=	strpbrk(condition, "=<>");
+	char*	valuePtr;
+
+	if ( opPtr == NULL || opPtr == condition )
+		return false;
+
+	valuePtr = opPtr + 1;
+	if ( *opPtr == '=' )
+	{
+		switch(opPtr[-1])
+		{
+		case '!':	p->op = RuleOpNotEqual;		opPtr--;	break;
+		case '*':	p->op = RuleOpContains;		opPtr--;	break;
+		case '^':	p->op = RuleOpStartsWith;	opPtr--;	break;
+		case '$':	p->op = RuleOpEndsWith;		opPtr--;	break;
+		default:	p->op = RuleOpEqual;				break;
+		}
+	}
+	else if ( *valuePtr == '=' )
+	{
+		p->op = ( *opPtr == '>' ) ? RuleOpGreaterOrEqual : RuleOpLessOrEqual;
+		valuePtr++;
+	}
+	else
+	{
+		p->op = ( *opPtr == '>' ) ? RuleOpGreater : RuleOpLess;
+	}
+	*opPtr = 0;
+
+	p->field = strdup(Trim(condition));
+	p->value = strdup(Trim(valuePtr));
+	if ( p->field == NULL || p->value == NULL || p->field[0] == 0 )
+		return false;
+
+	return true;
+}
+
+static bool	SamePredicate(const RulePredicate* a, const RulePredicate* b)
+{
+	return ( a->op == b->op && !strcmp(a->field, b->field) && !strcmp(a->value, b->value) );
+}
+
+static bool	PreparePredicate(RulePredicate* p)
+{
+	uint8_t		units[MAX_VALUE_UNITS*2];
+	char*		endPtr	=	NULL;
+
+	p->numUnits = Utf8ToUnits(p->value, units, MAX_VALUE_UNITS);
+	for (size_t idx = 0; idx < p->numUnits; idx++)
+	{
+		uint16_t	w	=	FoldUnit(GetUnit(units, idx));
+		units[idx*2] = w & 0xFF;
+		units[idx*2 + 1] = w >> 8;
+	}
+	p->units = (uint8_t*)malloc(p->numUnits*2 + 1);
+	if ( p->units == NULL )
+		return false;
+	memcpy(p->units, units, p->numUnits*2);
+	p->hash = HashUnits(p->units, p->numUnits);
+
+	p->number = strtoull(p->value, &endPtr, 0);
+	p->isNumber = ( p->value[0] != 0 && endPtr != NULL && *endPtr == 0 );
+
+	return true;
+}
+
+static bool	AddRuleLine(char* line, size_t lineNumber)
+{
+	char*		id;
+	char*		conditions;
+	char*		aggregation;
+	char*		next;
+	RuleAlternative	alternative;
+	size_t		ruleIdx;
+
+	id = line;
+	while ( isspace((uint8_t)*id) )
+		id++;
+	if ( *id == 0 || *id == '#' )
+		return true;
+
+	conditions = id;
+	while ( *conditions != 0 && !isspace((uint8_t)*conditions) )
+		conditions++;
+	if ( *conditions == 0 )
+	{
+		printf("Rule without conditions at line %zu\n", lineNumber);
+		return false;
+	}
+	*conditions++ = 0;
+
+	aggregation = strchr(conditions, '|');
+	if ( aggregation != NULL )
+		*aggregation++ = 0;
+
+	for (ruleIdx = 0; ruleIdx < numRules; ruleIdx++)
+	{
+		if ( !strcmp(ruleIds[ruleIdx], id) )
+			break;
+	}
+	if ( ruleIdx == numRules )
+	{
+		char*			idCopy		=	strdup(id);
+		ThresholdWindow*	noWindow	=	NULL;
+		size_t			numWindows	=	numRules;
+
+		if ( idCopy == NULL || !Append(&ruleWindows, &numWindows, noWindow) || !Append(&ruleIds, &numRules, idCopy) )
+			return false;
+	}
+
+	if ( aggregation != NULL )
+	{
+		ThresholdFree(ruleWindows[ruleIdx]);
+		ruleWindows[ruleIdx] = ThresholdParse(aggregation);
+		if ( ruleWindows[ruleIdx] == NULL )
+			return false;
+	}
+
+	alternative.ruleIdx = ruleIdx;
+	alternative.firstRef = numPredicateRefs;
+	alternative.numRefs = 0;
+
+	for (; conditions != NULL; conditions = next)
+	{
+		RulePredicate	p;
+		uint32_t	predicateIdx;
+
+		next = strstr(conditions, "&&");
+		if ( next != NULL )
+		{
+			*next = 0;
+			next += 2;
+		}
+
+		memset(&p, 0, sizeof(p));
+		if ( !ParseCondition(conditions, &p) )
+		{
+			printf("Bad condition at line %zu\n", lineNumber);
+			free(p.field);
+			free(p.value);
+			return false;
+		}
+
+		for (predicateIdx = 0; predicateIdx < numPredicates; predicateIdx++)
+		{
+			if ( SamePredicate(&predicates[predicateIdx], &p) )
+				break;
+		}
+
+		if ( predicateIdx < numPredicates )
+		{
+			free(p.field);
+			free(p.value);
+		}
+		else if ( !PreparePredicate(&p) || !Append(&predicates, &numPredicates, p) )
+		{
+			return false;
+		}
+
+		if ( !Append(&predicateRefs, &numPredicateRefs, predicateIdx) )
+			return false;
+		alternative.numRefs++;
+	}
+
+	return Append(&alternatives, &numAlternatives, alternative);
+}
+
+bool	RulesLoad(const char* fileName)
+{
+	FILE*	f	=	fopen(fileName, "r");
+	char	line[MAX_RULE_LINE];
+	size_t	lineNumber	=	0;
+	bool	result		=	true;
+
+	if ( f == NULL )
+	{
+		printf("Cannot open rule file %s\n", fileName);
+		return false;
+	}
+
+	while ( result && fgets(line, sizeof(line), f) != NULL )
+	{
+		lineNumber++;
+		line[strcspn(line, "\r\n")] = 0;
+		result = AddRuleLine(line, lineNumber);
+	}
+	fclose(f);
+
+	if ( !result )
+		return false;
+
+	resolved = (uint8_t*)malloc(numPredicates + 1);
+	runtimeSlot = (uint32_t*)malloc(sizeof(*runtimeSlot) * ( numPredicates + 1 ));
+	results = (uint8_t*)malloc(numPredicates + 1);
+	ruleHit = (uint8_t*)calloc(numRules + 1, 1);
+	hitList = (uint32_t*)malloc(sizeof(*hitList) * ( numRules + 1 ));
+
+	return ( resolved != NULL && runtimeSlot != NULL && results != NULL && ruleHit != NULL && hitList != NULL );
+}
+
+bool	RulesLoaded(void)
+{
+	return ( numAlternatives > 0 );
+}
+
+void	RulesFree(void)
+{
+	for (size_t idx = 0; idx < numPredicates; idx++)
+	{
+		free(predicates[idx].field);
+		free(predicates[idx].value);
+		free(predicates[idx].units);
+	}
+	for (size_t idx = 0; idx < numRules; idx++)
+	{
+		free(ruleIds[idx]);
+		ThresholdFree(ruleWindows[idx]);
+	}
+
+	free(predicates);
+	free(ruleIds);
+	free(ruleWindows);
+	free(alternatives);
+	free(predicateRefs);
+	free(resolved);
+	free(runtimeSlot);
+	free(results);
+	free(ruleHit);
+	free(hitList);
+
+	predicates = NULL;
+	ruleIds = NULL;
+	ruleWindows = NULL;
+	alternatives = NULL;
+	predicateRefs = NULL;
+	resolved = NULL;
+	runtimeSlot = NULL;
+	results = NULL;
+	ruleHit = NULL;
+	hitList = NULL;
+	numPredicates = numRules = numAlternatives = numPredicateRefs = numHits = 0;
+}
+
+static int	CompareCompiledPredicates(const void* a, const void* b)
+{
+	const CompiledPredicate*	pa	=	(const CompiledPredicate*)a;
+	const CompiledPredicate*	pb	=	(const CompiledPredicate*)b;
+
+	return (int)pa->argIdx - (int)pb->argIdx;
+}
+
+struct sCompiledRules*	RulesCompileTemplate(const TemplateDescription* description)
+{
+	struct sCompiledRules*	compiled;
+	size_t			numRuntime	=	0;
+	size_t			numSlots	=	0;
+	size_t			numCompiledRules	=	0;
+
+	if ( !RulesLoaded() )
+		return NULL;
+
+	/*  resolve every predicate against the template */
+	for (size_t idx = 0; idx < numPredicates; idx++)
+	{
+		const RulePredicate*	p	=	&predicates[idx];
+
+		bool			isFixed	=	false;
+
+		resolved[idx] = RESOLVED_FALSE;
+
+		for ( TemplateFixedPair* ptr = description->fixedRoot.next; ptr != NULL; ptr = ptr->next )
+		{
+			if ( !strcmp(ptr->key, p->field) )
+			{
+				EvtxField	field	=	{ ptr->key, EVTX_TYPE_ANSI_STRING, (const uint8_t*)ptr->value, strlen(ptr->value) };
+				resolved[idx] = EvaluatePredicate(p, &field) ? RESOLVED_TRUE : RESOLVED_FALSE;
+				isFixed = true;
+				break;
+			}
+		}
+		if ( isFixed )
+			continue;
+
+		for ( TemplateArgPair* ptr = description->argsRoot.next; ptr != NULL; ptr = ptr->next )
+		{
+			if ( !strcmp(ptr->key, p->field) )
+			{
+				resolved[idx] = RESOLVED_RUNTIME;
+				runtimeSlot[idx] = ptr->argIdx;
+				break;
+			}
+		}
+	}
+
+	/*  size the tables */
+	for (size_t altIdx = 0; altIdx < numAlternatives; altIdx++)
+	{
+		const RuleAlternative*	alt	=	&alternatives[altIdx];
+		bool			possible	=	true;
+
+		for (size_t ref = 0; ref < alt->numRefs && possible; ref++)
+			possible = ( resolved[predicateRefs[alt->firstRef + ref]] != RESOLVED_FALSE );
+		if ( !possible )
+			continue;
+
+		numCompiledRules++;
+		for (size_t ref = 0; ref < alt->numRefs; ref++)
+		{
+			if ( resolved[predicateRefs[alt->firstRef + ref]] == RESOLVED_RUNTIME )
+				numSlots++;
+		}
+	}
+
+	if ( numCompiledRules == 0 )
+		return NULL;
+
+	compiled = (struct sCompiledRules*)calloc(1, sizeof(*compiled));
+	if ( compiled == NULL )
+		return NULL;
+	compiled->predicates = (CompiledPredicate*)malloc(sizeof(*compiled->predicates) * ( numPredicates + 1 ));
+	compiled->rules = (CompiledRule*)malloc(sizeof(*compiled->rules) * numCompiledRules);
+	compiled->slots = (uint32_t*)malloc(sizeof(*compiled->slots) * ( numSlots + 1 ));
+	if ( compiled->predicates == NULL || compiled->rules == NULL || compiled->slots == NULL )
+	{
+		RulesFreeCompiled(compiled);
+		return NULL;
+	}
+
+	/*  shared predicates are evaluated once per record, in argument order */
+	for (size_t idx = 0; idx < numPredicates; idx++)
+	{
+		if ( resolved[idx] != RESOLVED_RUNTIME )
+			continue;
+		compiled->predicates[numRuntime].predicateIdx = idx;
+		compiled->predicates[numRuntime].argIdx = runtimeSlot[idx];
+		numRuntime++;
+	}
+	qsort(compiled->predicates, numRuntime, sizeof(*compiled->predicates), CompareCompiledPredicates);
+	for (size_t idx = 0; idx < numRuntime; idx++)
+		runtimeSlot[compiled->predicates[idx].predicateIdx] = idx;
+	compiled->numPredicates = numRuntime;
+
+	numSlots = 0;
+	for (size_t altIdx = 0; altIdx < numAlternatives; altIdx++)
+	{
+		const RuleAlternative*	alt	=	&alternatives[altIdx];
+		CompiledRule*		rule;
+		bool			possible	=	true;
+
+		for (size_t ref = 0; ref < alt->numRefs && possible; ref++)
+			possible = ( resolved[predicateRefs[alt->firstRef + ref]] != RESOLVED_FALSE );
+		if ( !possible )
+			continue;
+
+		rule = &compiled->rules[compiled->numRules++];
+		rule->ruleIdx = alt->ruleIdx;
+		rule->firstSlot = numSlots;
+		rule->numSlots = 0;
+		for (size_t ref = 0; ref < alt->numRefs; ref++)
+		{
+			uint32_t	predicateIdx	=	predicateRefs[alt->firstRef + ref];
+			if ( resolved[predicateIdx] != RESOLVED_RUNTIME )
+				continue;
+			compiled->slots[numSlots++] = runtimeSlot[predicateIdx];
+			rule->numSlots++;
+		}
+	}
+
+	return compiled;
+}
+
+void	RulesFreeCompiled(struct sCompiledRules* compiled)
+{
+	if ( compiled == NULL )
+		return;
+	free(compiled->predicates);
+	free(compiled->rules);
+	free(compiled->slots);
+	free(compiled);
+}
+
+void	RulesEvaluate(const struct sCompiledRules* compiled, const uint8_t* argData, size_t argDataLen, const uint16_t* argumentMap, uint32_t numArguments)
+{
+	size_t		argOffset	=	0;
+	uint32_t	argIdx		=	0;
+
+	for (size_t idx = 0; idx < compiled->numPredicates; idx++)
+	{
+		const CompiledPredicate*	cp	=	&compiled->predicates[idx];
+		EvtxField			field;
+
+		results[idx] = 0;
+
+		while ( argIdx < cp->argIdx && argIdx < numArguments )
+		{
+			size_t	numBytes;
+
+			/*  the parser fails the record here as well, it never gets its hits */
+			if ( !ArgumentSize(argumentMap[argIdx*2 + 1], argumentMap[argIdx*2], &numBytes) )
+				return;
+			argOffset += numBytes;
+			argIdx++;
+		}
+		if ( argIdx != cp->argIdx || argIdx >= numArguments )
+			continue;
+
+		field.key = predicates[cp->predicateIdx].field;
+		field.type = argumentMap[argIdx*2 + 1];
+		field.data = argData + argOffset;
+		field.dataLen = argumentMap[argIdx*2];
+		if ( argOffset + field.dataLen > argDataLen )
+			continue;
+
+		results[idx] = EvaluatePredicate(&predicates[cp->predicateIdx], &field);
+	}
+
+	for (size_t idx = 0; idx < compiled->numRules; idx++)
+	{
+		const CompiledRule*	rule	=	&compiled->rules[idx];
+		bool			hit	=	true;
+
+		if ( ruleHit[rule->ruleIdx] )
+			continue;
+		for (uint32_t slot = 0; slot < rule->numSlots && hit; slot++)
+			hit = results[compiled->slots[rule->firstSlot + slot]];
+		if ( !hit )
+			continue;
+
+		ruleHit[rule->ruleIdx] = 1;
+		hitList[numHits++] = rule->ruleIdx;
+	}
+}
+
+void	RulesBeginRecord(void)
+{
+	for (size_t idx = 0; idx < numHits; idx++)
+		ruleHit[hitList[idx]] = 0;
+	numHits = 0;
+}
+
+void	RulesEmitHits(const EvtxRecord* record)
+{
+	char	timeBuffer[32];
+
+	if ( numHits == 0 )
+		return;
+
+	FormatFileTime(record->timestamp, timeBuffer, sizeof(timeBuffer));
+	for (size_t idx = 0; idx < numHits; idx++)
+	{
+		if ( ruleWindows[hitList[idx]] != NULL )
+			ThresholdOnRecord(ruleWindows[hitList[idx]], ruleIds[hitList[idx]], record);
+		else
+		{
+			SinkPrintf("Record #%" PRIu64 " %s 'Rule':'%s'\n", record->number, timeBuffer, ruleIds[hitList[idx]]);
+			SinkEndRecord();
+		}
+	}
+
+	RulesBeginRecord();
+}
@@ -0,0 +1,40 @@
+/*
+ * =====================================================================================
+ *       Filename:  detection_rules.h
+ *    Description:  Detection rules compiled against templates and evaluated inline
+ *
+ *                  Rule file format, one alternative per line:
+ *
+ *                      <rule-id> <field><op><value> [&& <field><op><value> ...]
+ *
+ *                  op is one of  =  !=  *= (contains)  ^= (starts with)  $= (ends with)
+ *                  >  <  >=  <=.  String comparison ignores ASCII case.  Several lines
+ *                  with the same rule id are alternatives of one rule.  Lines starting
+ *                  with '#' are comments.  A rule may end with '| <aggregation>' to
+ *                  turn it into a sliding window threshold, see threshold_windows.h.
+ * =====================================================================================
+ */
+
+#ifndef detection_rules_h_included
+#define detection_rules_h_included
+
+#include "evtx_record.h"
+#include "evtx_template.h"
+
+struct sCompiledRules;
+
+bool	RulesLoad(const char* fileName);
+void	RulesFree(void);
+bool	RulesLoaded(void);
+
+/*  Returns NULL when no rule can ever match records of the template */
+struct sCompiledRules*	RulesCompileTemplate(const TemplateDescription* description);
+void	RulesFreeCompiled(struct sCompiledRules* compiled);
+
+/*  argumentMap holds (length, type) pairs as stored in the template instance */
+void	RulesEvaluate(const struct sCompiledRules* compiled, const uint8_t* argData, size_t argDataLen, const uint16_t* argumentMap, uint32_t numArguments);
+
+void	RulesBeginRecord(void);
+void	RulesEmitHits(const EvtxRecord* record);
+
+#endif
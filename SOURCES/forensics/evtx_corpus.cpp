@@ -0,0 +1,894 @@
+/*
+ * =====================================================================================
+ *       Filename:  evtx_corpus.cpp
+ *    Description:  Synthetic EVTX logs for benchmarks
+ *
+ *                  A record is built in buffers[0] at its place in the chunk; the
+ *                  values of a template instance go to the buffer one level up
+ *                  first, since the argument map with their sizes comes before
+ *                  them, and that buffer knows where it will land so the nested
+ *                  fragments can point at their template definitions.  A record
+ *                  that does not fit closes the chunk and is built again in the
+ *                  next one, where nothing is defined yet.
+ * =====================================================================================
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include "evtx_parser.h"
+#include "evtx_corpus.h"
+
+#define CORPUS_FIRST_TEMPLATE_ID	0x1000
+#define CORPUS_NESTED_TEMPLATE_ID	0x7FFF0000
+#define CORPUS_FIRST_EVENT_ID		1000
+#define CORPUS_FIRST_FIELD_ARG		18	/*  the System values come before */
+#define CORPUS_START_TIME		0x01DA3C4F4F4C8000ULL	/*  2024.01.01 */
+#define CORPUS_LEVELS			3	/*  record, its values, the values of nested fragments */
+#define MAX_CORPUS_ARGS			( CORPUS_FIRST_FIELD_ARG + MAX_CORPUS_FIELDS )
+
+typedef enum
+{
+	NameEvent, NameXmlns, NameSystem, NameProvider, NameName, NameGuid, NameEventID, NameVersion,
+	NameLevel, NameTask, NameOpcode, NameKeywords, NameTimeCreated, NameSystemTime, NameEventRecordID,
+	NameCorrelation, NameActivityID, NameExecution, NameProcessID, NameThreadID, NameChannel,
+	NameComputer, NameSecurity, NameEventData, NameData, NameUserData, NameDetail, NameCode,
+	NameFirstParam
+}
+CorpusNameId;
+
+static const char*	fixedNames[NameFirstParam]	=
+{
+	"Event", "xmlns", "System", "Provider", "Name", "Guid", "EventID", "Version",
+	"Level", "Task", "Opcode", "Keywords", "TimeCreated", "SystemTime", "EventRecordID",
+	"Correlation", "ActivityID", "Execution", "ProcessID", "ThreadID", "Channel",
+	"Computer", "Security", "EventData", "Data", "UserData", "Detail", "Code"
+};
+
+typedef struct
+{
+	char		text[32];
+	uint64_t	chunk;		/*  the name is defined in, 0 for none */
+	uint32_t	offset;
+}
+CorpusName;
+
+typedef struct
+{
+	uint64_t	chunk;		/*  the definition is in, 0 for none */
+	uint32_t	offset;
+	uint8_t		types[MAX_CORPUS_FIELDS];
+}
+CorpusTemplate;
+
+typedef struct
+{
+	uint8_t*	data;
+	size_t		len;
+	size_t		size;
+	uint32_t	base;		/*  chunk offset of data[0] */
+	bool		failed;
+}
+CorpusBuffer;
+
+typedef struct
+{
+	const CorpusOptions*	options;
+	uint64_t		random;
+	uint8_t			chunk[EVTX_CHUNK_SIZE];
+	size_t			chunkLen;
+	uint64_t		chunkNumber;	/*  from 1 */
+	uint64_t		firstRecord;
+	uint64_t		lastRecord;
+	uint32_t		lastRecordOffset;
+	uint64_t		timestamp;
+	CorpusName		names[NameFirstParam + MAX_CORPUS_FIELDS];
+	CorpusTemplate*		templates;	/*  numTemplates, then the nested one */
+	CorpusBuffer		buffers[CORPUS_LEVELS];
+}
+CorpusGenerator;
+
+static uint32_t	crcTable[256];
+static bool	crcTableReady	=	false;
+
+static uint32_t	Crc32(const uint8_t* data, size_t len, uint32_t crc)
+{
+	if ( !crcTableReady )
+	{
+		for (uint32_t idx = 0; idx < 256; idx++)
+		{
+			uint32_t	c	=	idx;
+
+			for (int bit = 0; bit < 8; bit++)
+				c = ( c & 1 ) ? 0xEDB88320 ^ ( c >> 1 ) : c >> 1;
+			crcTable[idx] = c;
+		}
+		crcTableReady = true;
+	}
+	crc = ~crc;
+	for (size_t idx = 0; idx < len; idx++)
+		crc = crcTable[( crc ^ data[idx] ) & 0xFF] ^ ( crc >> 8 );
+	return ~crc;
+}
+
+static uint64_t	Random(CorpusGenerator* gen)
+{
+	/*  xorshift64*, the same numbers on every platform */
+	gen->random ^= gen->random >> 12;
+	gen->random ^= gen->random << 25;
+	gen->random ^= gen->random >> 27;
+	return gen->random * 0x2545F4914F6CDD1DULL;
+}
+
+static uint64_t	RandomBelow(CorpusGenerator* gen, uint64_t limit)
+{
+	return limit > 0 ? Random(gen) % limit : 0;
+}
+
+/*  Buffers */
+
+static void	Put(CorpusBuffer* buffer, const void* data, size_t len)
+{
+	if ( buffer->len + len > buffer->size )
+	{
+		size_t		newSize	=	( buffer->len + len ) * 2;
+		uint8_t*	newData	=	(uint8_t*)realloc(buffer->data, newSize);
+
+		if ( newData == NULL )
+		{
+			buffer->failed = true;
+			return;
+		}
+		buffer->data = newData;
+		buffer->size = newSize;
+	}
+	memcpy(buffer->data + buffer->len, data, len);
+	buffer->len += len;
+}
+
+static void	Put8(CorpusBuffer* buffer, uint8_t value)
+{
+	Put(buffer, &value, sizeof(value));
+}
+
+static void	Put16(CorpusBuffer* buffer, uint16_t value)
+{
+	Put(buffer, &value, sizeof(value));
+}
+
+static void	Put32(CorpusBuffer* buffer, uint32_t value)
+{
+	Put(buffer, &value, sizeof(value));
+}
+
+static void	Put64(CorpusBuffer* buffer, uint64_t value)
+{
+	Put(buffer, &value, sizeof(value));
+}
+
+static void	Patch32(CorpusBuffer* buffer, size_t at, uint32_t value)
+{
+	if ( !buffer->failed )
+		memcpy(buffer->data + at, &value, sizeof(value));
+}
+
+static uint32_t	Position(const CorpusBuffer* buffer)
+{
+	return buffer->base + (uint32_t)buffer->len;
+}
+
+static void	PutAsciiUTF16(CorpusBuffer* buffer, const char* text)
+{
+	for (; *text != 0; text++)
+		Put16(buffer, (uint8_t)*text);
+}
+
+/*  BinXml */
+
+static void	PutName(CorpusGenerator* gen, CorpusBuffer* buffer, unsigned int nameId)
+{
+	CorpusName*	name	=	&gen->names[nameId];
+	uint16_t	hash	=	0;
+
+	if ( name->chunk == gen->chunkNumber )
+	{
+		Put32(buffer, name->offset);
+		return;
+	}
+	/*  defined in place, the next references point here */
+	name->chunk = gen->chunkNumber;
+	name->offset = Position(buffer) + sizeof(uint32_t);
+	Put32(buffer, name->offset);
+	for (const char* c = name->text; *c != 0; c++)
+		hash = (uint16_t)( hash * 65599 + (uint8_t)*c );
+	Put32(buffer, 0);
+	Put16(buffer, hash);
+	Put16(buffer, (uint16_t)strlen(name->text));
+	PutAsciiUTF16(buffer, name->text);
+	Put16(buffer, 0);
+}
+
+/*  Returns where the size of the element goes */
+static size_t	OpenElement(CorpusGenerator* gen, CorpusBuffer* buffer, unsigned int nameId, bool hasAttributes)
+{
+	size_t	sizeAt;
+
+	Put8(buffer, hasAttributes ? 0x41 : 0x01);
+	Put16(buffer, 0xFFFF);
+	sizeAt = buffer->len;
+	Put32(buffer, 0);
+	PutName(gen, buffer, nameId);
+	return sizeAt;
+}
+
+static void	CloseElement(CorpusBuffer* buffer, size_t sizeAt, bool empty)
+{
+	Put8(buffer, empty ? 0x03 : 0x04);
+	Patch32(buffer, sizeAt, (uint32_t)( buffer->len - sizeAt - sizeof(uint32_t) ));
+}
+
+static void	PutSubstitution(CorpusBuffer* buffer, uint16_t argIdx, uint8_t type)
+{
+	Put8(buffer, 0x0E);
+	Put16(buffer, argIdx);
+	Put8(buffer, type);
+}
+
+static void	PutValueText(CorpusBuffer* buffer, const char* text)
+{
+	Put8(buffer, 0x05);
+	Put8(buffer, EVTX_TYPE_STRING);
+	Put16(buffer, (uint16_t)strlen(text));
+	PutAsciiUTF16(buffer, text);
+}
+
+/*  <name>substitution</name> */
+static void	PutValueElement(CorpusGenerator* gen, CorpusBuffer* buffer, unsigned int nameId, uint16_t argIdx, uint8_t type)
+{
+	size_t	sizeAt	=	OpenElement(gen, buffer, nameId, false);
+
+	Put8(buffer, 0x02);
+	PutSubstitution(buffer, argIdx, type);
+	CloseElement(buffer, sizeAt, false);
+}
+
+/*  <name>text</name> */
+static void	PutTextElement(CorpusGenerator* gen, CorpusBuffer* buffer, unsigned int nameId, const char* text)
+{
+	size_t	sizeAt	=	OpenElement(gen, buffer, nameId, false);
+
+	Put8(buffer, 0x02);
+	PutValueText(buffer, text);
+	CloseElement(buffer, sizeAt, false);
+}
+
+/*  Attributes of an element just opened with hasAttributes, texts or substitutions */
+typedef struct
+{
+	unsigned int	nameId;
+	const char*	text;
+	uint16_t	argIdx;
+	uint8_t		type;
+}
+CorpusAttribute;
+
+static void	PutEmptyElement(CorpusGenerator* gen, CorpusBuffer* buffer, unsigned int nameId,
+				const CorpusAttribute* attributes, size_t numAttributes)
+{
+	size_t	sizeAt		=	OpenElement(gen, buffer, nameId, numAttributes > 0);
+	size_t	listSizeAt	=	buffer->len;
+
+	if ( numAttributes > 0 )
+	{
+		Put32(buffer, 0);
+		for (size_t idx = 0; idx < numAttributes; idx++)
+		{
+			Put8(buffer, idx + 1 < numAttributes ? 0x46 : 0x06);
+			PutName(gen, buffer, attributes[idx].nameId);
+			if ( attributes[idx].text != NULL )
+				PutValueText(buffer, attributes[idx].text);
+			else
+				PutSubstitution(buffer, attributes[idx].argIdx, attributes[idx].type);
+		}
+		Patch32(buffer, listSizeAt, (uint32_t)( buffer->len - listSizeAt - sizeof(uint32_t) ));
+	}
+	CloseElement(buffer, sizeAt, true);
+}
+
+static void	PutFragmentHeader(CorpusBuffer* buffer)
+{
+	Put8(buffer, 0x0F);
+	Put8(buffer, 1);
+	Put8(buffer, 1);
+	Put8(buffer, 0);
+}
+
+static void	PutEventBody(CorpusGenerator* gen, CorpusBuffer* buffer, const CorpusTemplate* tmpl)
+{
+	static const CorpusAttribute	provider[2]	=	{ { NameName, "Benchmark-Corpus", 0, 0 },
+								  { NameGuid, "{5C2D8B4E-6F1A-4E27-9B0D-3A8C71E2F456}", 0, 0 } };
+	static const CorpusAttribute	timeCreated[1]	=	{ { NameSystemTime, NULL, 6, EVTX_TYPE_FILETIME } };
+	static const CorpusAttribute	correlation[1]	=	{ { NameActivityID, NULL, 7, EVTX_TYPE_GUID } };
+	static const CorpusAttribute	execution[2]	=	{ { NameProcessID, NULL, 8, EVTX_TYPE_UINT32 },
+								  { NameThreadID, NULL, 9, EVTX_TYPE_UINT32 } };
+	static const CorpusAttribute	xmlns[1]	=	{ { NameXmlns, "http://schemas.microsoft.com/win/2004/08/events/event", 0, 0 } };
+	size_t				eventAt;
+	size_t				systemAt;
+	size_t				dataAt;
+
+	PutFragmentHeader(buffer);
+	eventAt = OpenElement(gen, buffer, NameEvent, true);
+	{
+		size_t	listSizeAt	=	buffer->len;
+
+		Put32(buffer, 0);
+		Put8(buffer, 0x06);
+		PutName(gen, buffer, xmlns[0].nameId);
+		PutValueText(buffer, xmlns[0].text);
+		Patch32(buffer, listSizeAt, (uint32_t)( buffer->len - listSizeAt - sizeof(uint32_t) ));
+	}
+	Put8(buffer, 0x02);
+
+	systemAt = OpenElement(gen, buffer, NameSystem, false);
+	Put8(buffer, 0x02);
+	PutEmptyElement(gen, buffer, NameProvider, provider, 2);
+	PutValueElement(gen, buffer, NameEventID, 3, EVTX_TYPE_UINT16);
+	PutValueElement(gen, buffer, NameVersion, 4, EVTX_TYPE_UINT8);
+	PutValueElement(gen, buffer, NameLevel, 0, EVTX_TYPE_UINT8);
+	PutValueElement(gen, buffer, NameTask, 2, EVTX_TYPE_UINT16);
+	PutValueElement(gen, buffer, NameOpcode, 1, EVTX_TYPE_UINT8);
+	PutValueElement(gen, buffer, NameKeywords, 5, EVTX_TYPE_HEXINT64);
+	PutEmptyElement(gen, buffer, NameTimeCreated, timeCreated, 1);
+	PutValueElement(gen, buffer, NameEventRecordID, 10, EVTX_TYPE_UINT64);
+	PutEmptyElement(gen, buffer, NameCorrelation, correlation, 1);
+	PutEmptyElement(gen, buffer, NameExecution, execution, 2);
+	PutTextElement(gen, buffer, NameChannel, "Benchmark");
+	PutTextElement(gen, buffer, NameComputer, "BENCH-HOST");
+	PutEmptyElement(gen, buffer, NameSecurity, NULL, 0);
+	CloseElement(buffer, systemAt, false);
+
+	dataAt = OpenElement(gen, buffer, NameEventData, false);
+	Put8(buffer, 0x02);
+	for (unsigned int field = 0; field < gen->options->fieldsPerTemplate; field++)
+	{
+		size_t	fieldAt	=	OpenElement(gen, buffer, NameData, true);
+		size_t	listSizeAt	=	buffer->len;
+
+		Put32(buffer, 0);
+		Put8(buffer, 0x06);
+		PutName(gen, buffer, NameName);
+		PutValueText(buffer, gen->names[NameFirstParam + field].text);
+		Patch32(buffer, listSizeAt, (uint32_t)( buffer->len - listSizeAt - sizeof(uint32_t) ));
+		Put8(buffer, 0x02);
+		PutSubstitution(buffer, (uint16_t)( CORPUS_FIRST_FIELD_ARG + field ), tmpl->types[field]);
+		CloseElement(buffer, fieldAt, false);
+	}
+	CloseElement(buffer, dataAt, false);
+
+	CloseElement(buffer, eventAt, false);
+	Put8(buffer, 0x00);
+}
+
+/*  <UserData><Detail>string</Detail><Code>UInt32</Code></UserData> */
+static void	PutNestedBody(CorpusGenerator* gen, CorpusBuffer* buffer)
+{
+	size_t	userDataAt;
+
+	PutFragmentHeader(buffer);
+	userDataAt = OpenElement(gen, buffer, NameUserData, false);
+	Put8(buffer, 0x02);
+	PutValueElement(gen, buffer, NameDetail, 0, EVTX_TYPE_STRING);
+	PutValueElement(gen, buffer, NameCode, 1, EVTX_TYPE_UINT32);
+	CloseElement(buffer, userDataAt, false);
+	Put8(buffer, 0x00);
+}
+
+/*  Values */
+
+static void	PutRandomString(CorpusGenerator* gen, CorpusBuffer* buffer)
+{
+	static const char	letters[]	=	"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 .-_\\";
+	const CorpusOptions*	options		=	gen->options;
+	uint64_t		length		=	options->minStringLength +
+							RandomBelow(gen, options->maxStringLength - options->minStringLength + 1);
+
+	for (uint64_t idx = 0; idx < length; idx++)
+	{
+		uint64_t	r	=	Random(gen);
+
+		/*  some characters take 2 and 3 bytes in UTF-8 */
+		if ( ( r & 0x3F ) == 0 )
+			Put16(buffer, ( r & 0x40 ) ? 0x00E9 : 0x0436);
+		else
+			Put16(buffer, (uint8_t)letters[( r >> 8 ) % ( sizeof(letters) - 1 )]);
+	}
+}
+
+static void	PutRandomBytes(CorpusGenerator* gen, CorpusBuffer* buffer, size_t len)
+{
+	for (size_t idx = 0; idx < len; idx++)
+		Put8(buffer, (uint8_t)( Random(gen) >> 24 ));
+}
+
+static void	PutSid(CorpusGenerator* gen, CorpusBuffer* buffer)
+{
+	static const uint8_t	authority[6]	=	{ 0, 0, 0, 0, 0, 5 };
+
+	/*  S-1-5-21-x-y-z-rid */
+	Put8(buffer, 1);
+	Put8(buffer, 5);
+	Put(buffer, authority, sizeof(authority));
+	Put32(buffer, 21);
+	Put32(buffer, 1111111111);
+	Put32(buffer, 2222222222U);
+	Put32(buffer, 333333333);
+	Put32(buffer, (uint32_t)( 1000 + RandomBelow(gen, 5000) ));
+}
+
+static bool	PutTemplateInstance(CorpusGenerator* gen, unsigned int level, unsigned int templateIdx, uint64_t recordNumber);
+
+static void	PutValue(CorpusGenerator* gen, unsigned int level, uint8_t type, uint64_t recordNumber)
+{
+	CorpusBuffer*	buffer	=	&gen->buffers[level];
+
+	switch(type)
+	{
+	case EVTX_TYPE_STRING:
+		PutRandomString(gen, buffer);
+		break;
+	case EVTX_TYPE_SID:
+		PutSid(gen, buffer);
+		break;
+	case EVTX_TYPE_GUID:
+		PutRandomBytes(gen, buffer, 16);
+		break;
+	case EVTX_TYPE_FILETIME:
+		Put64(buffer, gen->timestamp - RandomBelow(gen, 36000000000ULL));
+		break;
+	case EVTX_TYPE_BINARY:
+		PutRandomBytes(gen, buffer, gen->options->minStringLength +
+				RandomBelow(gen, gen->options->maxStringLength - gen->options->minStringLength + 1));
+		break;
+	case EVTX_TYPE_UINT32:
+	case EVTX_TYPE_HEXINT32:
+		Put32(buffer, (uint32_t)Random(gen));
+		break;
+	case EVTX_TYPE_UINT64:
+	case EVTX_TYPE_HEXINT64:
+		Put64(buffer, Random(gen));
+		break;
+	case EVTX_TYPE_BINXML:
+		PutTemplateInstance(gen, level, gen->options->numTemplates, recordNumber);
+		break;
+	default:
+		break;
+	}
+}
+
+/*  The instance goes to buffers[level], its values through buffers[level + 1] */
+static bool	PutTemplateInstance(CorpusGenerator* gen, unsigned int level, unsigned int templateIdx, uint64_t recordNumber)
+{
+	CorpusBuffer*	buffer		=	&gen->buffers[level];
+	CorpusBuffer*	values		=	&gen->buffers[level + 1];
+	CorpusTemplate*	tmpl		=	&gen->templates[templateIdx];
+	bool		nested		=	( templateIdx == gen->options->numTemplates );
+	uint32_t	templateId	=	nested ? CORPUS_NESTED_TEMPLATE_ID : CORPUS_FIRST_TEMPLATE_ID + templateIdx;
+	uint8_t		types[MAX_CORPUS_ARGS];
+	uint16_t	lengths[MAX_CORPUS_ARGS];
+	uint32_t	numArgs;
+
+	if ( level + 1 >= CORPUS_LEVELS )
+		return false;
+
+	Put8(buffer, 0x0C);
+	Put8(buffer, 0x01);
+	Put32(buffer, templateId);
+	if ( tmpl->chunk == gen->chunkNumber )
+	{
+		Put32(buffer, tmpl->offset);
+	}
+	else
+	{
+		uint8_t	guid[16];
+		size_t	lengthAt;
+
+		tmpl->chunk = gen->chunkNumber;
+		tmpl->offset = Position(buffer) + sizeof(uint32_t);
+		Put32(buffer, tmpl->offset);
+		Put32(buffer, 0);		/*  next definition */
+		memset(guid, 0, sizeof(guid));
+		memcpy(guid, &templateId, sizeof(templateId));
+		Put(buffer, guid, sizeof(guid));
+		lengthAt = buffer->len;
+		Put32(buffer, 0);
+		if ( nested )
+			PutNestedBody(gen, buffer);
+		else
+			PutEventBody(gen, buffer, tmpl);
+		Patch32(buffer, lengthAt, (uint32_t)( buffer->len - lengthAt - sizeof(uint32_t) ));
+	}
+
+	if ( nested )
+	{
+		numArgs = 2;
+		types[0] = EVTX_TYPE_STRING;
+		types[1] = EVTX_TYPE_UINT32;
+	}
+	else
+	{
+		static const uint8_t	systemTypes[CORPUS_FIRST_FIELD_ARG]	=
+		{
+			EVTX_TYPE_UINT8, EVTX_TYPE_UINT8, EVTX_TYPE_UINT16, EVTX_TYPE_UINT16, EVTX_TYPE_UINT8,
+			EVTX_TYPE_HEXINT64, EVTX_TYPE_FILETIME, EVTX_TYPE_GUID, EVTX_TYPE_UINT32, EVTX_TYPE_UINT32,
+			EVTX_TYPE_UINT64
+		};
+
+		numArgs = CORPUS_FIRST_FIELD_ARG + gen->options->fieldsPerTemplate;
+		memcpy(types, systemTypes, sizeof(systemTypes));
+		memcpy(types + CORPUS_FIRST_FIELD_ARG, tmpl->types, gen->options->fieldsPerTemplate);
+	}
+
+	/*  the values land after the count and the argument map */
+	values->len = 0;
+	values->base = Position(buffer) + sizeof(uint32_t) + numArgs * 2 * sizeof(uint16_t);
+	for (uint32_t argIdx = 0; argIdx < numArgs; argIdx++)
+	{
+		size_t	start	=	values->len;
+
+		if ( nested )
+		{
+			if ( argIdx == 0 )
+				PutRandomString(gen, values);
+			else
+				Put32(values, (uint32_t)RandomBelow(gen, 100000));
+		}
+		else
+		{
+			switch(argIdx)
+			{
+			case 0:
+				Put8(values, (uint8_t)( 1 + RandomBelow(gen, 4) ));
+				break;
+			case 1:
+				Put8(values, 0);
+				break;
+			case 2:
+				Put16(values, (uint16_t)( 12544 + RandomBelow(gen, 16) ));
+				break;
+			case 3:
+				Put16(values, (uint16_t)( CORPUS_FIRST_EVENT_ID + templateIdx ));
+				break;
+			case 4:
+				Put8(values, (uint8_t)RandomBelow(gen, 3));
+				break;
+			case 5:
+				Put64(values, 0x8020000000000000ULL);
+				break;
+			case 6:
+				Put64(values, gen->timestamp);
+				break;
+			case 7:
+				PutRandomBytes(gen, values, 16);
+				break;
+			case 8:
+			case 9:
+				Put32(values, (uint32_t)( 4 + RandomBelow(gen, 20000) ));
+				break;
+			case 10:
+				Put64(values, recordNumber);
+				break;
+			default:
+				PutValue(gen, level + 1, types[argIdx], recordNumber);
+				break;
+			}
+		}
+		if ( values->len - start > 0xFFFF )
+			return false;
+		lengths[argIdx] = (uint16_t)( values->len - start );
+		if ( lengths[argIdx] == 0 )
+			types[argIdx] = EVTX_TYPE_NULL;
+	}
+
+	Put32(buffer, numArgs);
+	for (uint32_t argIdx = 0; argIdx < numArgs; argIdx++)
+	{
+		Put16(buffer, lengths[argIdx]);
+		Put8(buffer, types[argIdx]);
+		Put8(buffer, 0);
+	}
+	Put(buffer, values->data, values->len);
+	return !values->failed;
+}
+
+/*  Chunks and file */
+
+static void	StartChunk(CorpusGenerator* gen)
+{
+	memset(gen->chunk, 0, sizeof(gen->chunk));
+	gen->chunkLen = sizeof(EvtxChunkHeader);
+	gen->chunkNumber++;
+	gen->firstRecord = 0;
+	gen->lastRecord = 0;
+	gen->lastRecordOffset = 0;
+}
+
+static void	Store32(uint8_t* at, uint32_t value)
+{
+	memcpy(at, &value, sizeof(value));
+}
+
+static void	Store64(uint8_t* at, uint64_t value)
+{
+	memcpy(at, &value, sizeof(value));
+}
+
+static bool	WriteChunk(CorpusGenerator* gen, FILE* f)
+{
+	uint8_t*	header	=	gen->chunk;
+	uint32_t	crc;
+
+	memcpy(header, EVTX_CHUNK_HEADER_MAGIC, sizeof(EVTX_CHUNK_HEADER_MAGIC));
+	Store64(header + 0x08, gen->firstRecord);
+	Store64(header + 0x10, gen->lastRecord);
+	Store64(header + 0x18, gen->firstRecord);
+	Store64(header + 0x20, gen->lastRecord);
+	Store32(header + 0x28, 0x80);
+	Store32(header + 0x2C, gen->lastRecordOffset);
+	Store32(header + 0x30, (uint32_t)gen->chunkLen);
+	Store32(header + 0x34, Crc32(gen->chunk + sizeof(EvtxChunkHeader), gen->chunkLen - sizeof(EvtxChunkHeader), 0));
+	/*  the header checksum skips its flags and itself */
+	crc = Crc32(header, 0x78, 0);
+	crc = Crc32(header + 0x80, sizeof(EvtxChunkHeader) - 0x80, crc);
+	Store32(header + 0x7C, crc);
+	return ( fwrite(gen->chunk, 1, sizeof(gen->chunk), f) == sizeof(gen->chunk) );
+}
+
+static bool	WriteFileHeader(FILE* f, uint64_t numChunks, uint64_t nextRecord)
+{
+	uint8_t	header[EVTX_FILE_HEADER_SIZE];
+
+	memset(header, 0, sizeof(header));
+	memcpy(header, EVTX_HEADER_MAGIC, sizeof(EVTX_HEADER_MAGIC));
+	Store64(header + 0x08, 0);
+	Store64(header + 0x10, numChunks > 0 ? numChunks - 1 : 0);
+	Store64(header + 0x18, nextRecord);
+	Store32(header + 0x20, 0x80);
+	Store32(header + 0x24, 0x00030001);	/*  3.1 */
+	header[0x28] = 0x00;			/*  header block size 0x1000 */
+	header[0x29] = 0x10;
+	header[0x2A] = (uint8_t)numChunks;
+	header[0x2B] = (uint8_t)( numChunks >> 8 );
+	Store32(header + 0x7C, Crc32(header, 0x78, 0));
+	return ( fseek(f, 0, SEEK_SET) == 0 && fwrite(header, 1, sizeof(header), f) == sizeof(header) );
+}
+
+/*  Builds the record in buffers[0] for the end of the chunk, size included */
+static bool	BuildRecord(CorpusGenerator* gen, unsigned int templateIdx, uint64_t recordNumber, uint32_t* size)
+{
+	CorpusBuffer*		record	=	&gen->buffers[0];
+	EvtxRecordHeader	header;
+
+	record->len = 0;
+	record->base = (uint32_t)gen->chunkLen;
+	memset(&header, 0, sizeof(header));
+	Put(record, &header, sizeof(header));
+	if ( !PutTemplateInstance(gen, 0, templateIdx, recordNumber) )
+		return false;
+	Put8(record, 0x00);
+	if ( record->failed )
+		return false;
+	*size = (uint32_t)( record->len + sizeof(uint32_t) );
+	return true;
+}
+
+static void	AppendRecord(CorpusGenerator* gen, uint64_t recordNumber, uint32_t size)
+{
+	CorpusBuffer*		record	=	&gen->buffers[0];
+	EvtxRecordHeader	header;
+
+	header.magic = EVTX_RECORD_MAGIC;
+	header.size = size;
+	header.number = recordNumber;
+	header.timestamp = gen->timestamp;
+	memcpy(record->data, &header, sizeof(header));
+	memcpy(gen->chunk + gen->chunkLen, record->data, record->len);
+	memcpy(gen->chunk + gen->chunkLen + record->len, &size, sizeof(size));
+	if ( gen->firstRecord == 0 )
+		gen->firstRecord = recordNumber;
+	gen->lastRecord = recordNumber;
+	gen->lastRecordOffset = (uint32_t)gen->chunkLen;
+	gen->chunkLen += size;
+}
+
+void	CorpusDefaultOptions(CorpusOptions* options)
+{
+	memset(options, 0, sizeof(*options));
+	options->numRecords = 100000;
+	options->numTemplates = 32;
+	options->fieldsPerTemplate = 8;
+	options->typeMask = CORPUS_TYPE_ALL;
+	options->minStringLength = 4;
+	options->maxStringLength = 48;
+	options->seed = 1;
+}
+
+bool	CorpusParseTypes(const char* list, unsigned int* typeMask)
+{
+	static const struct
+	{
+		const char*	name;
+		unsigned int	mask;
+	}
+	types[]	=
+	{
+		{ "string", CORPUS_TYPE_STRING }, { "sid", CORPUS_TYPE_SID }, { "guid", CORPUS_TYPE_GUID },
+		{ "filetime", CORPUS_TYPE_FILETIME }, { "binary", CORPUS_TYPE_BINARY }, { "binxml", CORPUS_TYPE_BINXML },
+		{ "int", CORPUS_TYPE_INTEGER }, { "all", CORPUS_TYPE_ALL }
+	};
+
+	*typeMask = 0;
+	while ( *list != 0 )
+	{
+		size_t	len	=	strcspn(list, ",");
+		bool	found	=	false;
+
+		for (size_t idx = 0; idx < sizeof(types) / sizeof(types[0]); idx++)
+		{
+			if ( strlen(types[idx].name) == len && !strncmp(list, types[idx].name, len) )
+			{
+				*typeMask |= types[idx].mask;
+				found = true;
+			}
+		}
+		if ( !found )
+			return false;
+		list += len;
+		if ( *list == ',' )
+			list++;
+	}
+	return ( *typeMask != 0 );
+}
+
+/*  Draws the EventData types of every template */
+static void	ChooseTypes(CorpusGenerator* gen)
+{
+	static const uint8_t	integers[4]	=	{ EVTX_TYPE_UINT32, EVTX_TYPE_UINT64, EVTX_TYPE_HEXINT32, EVTX_TYPE_HEXINT64 };
+	uint8_t			choices[8];
+	size_t			numChoices	=	0;
+
+	if ( gen->options->typeMask & CORPUS_TYPE_STRING )
+		choices[numChoices++] = EVTX_TYPE_STRING;
+	if ( gen->options->typeMask & CORPUS_TYPE_SID )
+		choices[numChoices++] = EVTX_TYPE_SID;
+	if ( gen->options->typeMask & CORPUS_TYPE_GUID )
+		choices[numChoices++] = EVTX_TYPE_GUID;
+	if ( gen->options->typeMask & CORPUS_TYPE_FILETIME )
+		choices[numChoices++] = EVTX_TYPE_FILETIME;
+	if ( gen->options->typeMask & CORPUS_TYPE_BINARY )
+		choices[numChoices++] = EVTX_TYPE_BINARY;
+	if ( gen->options->typeMask & CORPUS_TYPE_BINXML )
+		choices[numChoices++] = EVTX_TYPE_BINXML;
+	if ( gen->options->typeMask & CORPUS_TYPE_INTEGER )
+		choices[numChoices++] = EVTX_TYPE_UINT32;
+
+	for (unsigned int templateIdx = 0; templateIdx < gen->options->numTemplates; templateIdx++)
+	{
+		for (unsigned int field = 0; field < gen->options->fieldsPerTemplate; field++)
+		{
+			uint8_t	type	=	choices[RandomBelow(gen, numChoices)];
+
+			if ( type == EVTX_TYPE_UINT32 )
+				type = integers[RandomBelow(gen, 4)];
+			gen->templates[templateIdx].types[field] = type;
+		}
+	}
+}
+
+static bool	CheckOptions(const CorpusOptions* options)
+{
+	if ( options->numRecords == 0 && options->fileSize == 0 )
+		return false;
+	if ( options->numTemplates == 0 || options->numTemplates > 0xFFFF - CORPUS_FIRST_EVENT_ID )
+		return false;
+	if ( options->fieldsPerTemplate == 0 || options->fieldsPerTemplate > MAX_CORPUS_FIELDS )
+		return false;
+	if ( ( options->typeMask & CORPUS_TYPE_ALL ) == 0 )
+		return false;
+	return ( options->minStringLength <= options->maxStringLength && options->maxStringLength <= MAX_CORPUS_STRING );
+}
+
+bool	CorpusWriteFile(const char* fileName, const CorpusOptions* options, CorpusSummary* summary)
+{
+	CorpusGenerator*	gen;
+	FILE*			f;
+	uint64_t		numChunks	=	0;
+	uint64_t		recordNumber	=	1;
+	bool			result		=	true;
+
+	if ( !CheckOptions(options) )
+	{
+		printf("Invalid corpus options\n");
+		return false;
+	}
+	gen = (CorpusGenerator*)calloc(1, sizeof(*gen));
+	if ( gen == NULL )
+		return false;
+	gen->options = options;
+	gen->random = options->seed != 0 ? options->seed : 1;
+	gen->timestamp = CORPUS_START_TIME;
+	gen->templates = (CorpusTemplate*)calloc(options->numTemplates + 1, sizeof(*gen->templates));
+	for (unsigned int idx = 0; idx < NameFirstParam; idx++)
+		snprintf(gen->names[idx].text, sizeof(gen->names[idx].text), "%s", fixedNames[idx]);
+	for (unsigned int idx = 0; idx < MAX_CORPUS_FIELDS; idx++)
+		snprintf(gen->names[NameFirstParam + idx].text, sizeof(gen->names[NameFirstParam + idx].text), "Param%u", idx + 1);
+
+	f = fopen(fileName, "wb");
+	if ( gen->templates == NULL || f == NULL )
+	{
+		printf("Cannot create %s\n", fileName);
+		if ( f != NULL )
+			fclose(f);
+		free(gen->templates);
+		free(gen);
+		return false;
+	}
+	ChooseTypes(gen);
+
+	/*  the header is written last, with the counts */
+	result = WriteFileHeader(f, 0, 1);
+	StartChunk(gen);
+	while ( result && ( options->numRecords == 0 || recordNumber <= options->numRecords ) )
+	{
+		unsigned int	templateIdx	=	(unsigned int)RandomBelow(gen, options->numTemplates);
+		uint64_t	state;
+		uint32_t	size;
+
+		gen->timestamp += RandomBelow(gen, 20000000);
+		state = gen->random;
+		result = BuildRecord(gen, templateIdx, recordNumber, &size);
+		if ( result && gen->chunkLen + size > EVTX_CHUNK_SIZE )
+		{
+			/*  the chunk is full, the record is drawn again the same way in the next */
+			result = WriteChunk(gen, f);
+			numChunks++;
+			StartChunk(gen);
+			if ( options->fileSize != 0 && EVTX_FILE_HEADER_SIZE + ( numChunks + 1 ) * EVTX_CHUNK_SIZE > options->fileSize )
+				break;
+			gen->random = state;
+			result = result && BuildRecord(gen, templateIdx, recordNumber, &size);
+			if ( result && gen->chunkLen + size > EVTX_CHUNK_SIZE )
+			{
+				printf("A record of %u bytes does not fit in a chunk\n", size);
+				result = false;
+			}
+		}
+		if ( !result )
+			break;
+		AppendRecord(gen, recordNumber, size);
+		recordNumber++;
+	}
+	if ( result && gen->firstRecord != 0 )
+	{
+		result = WriteChunk(gen, f);
+		numChunks++;
+	}
+	if ( result )
+		result = WriteFileHeader(f, numChunks, recordNumber);
+	if ( fclose(f) != 0 )
+		result = false;
+	if ( !result )
+		printf("Failed on %s\n", fileName);
+
+	if ( summary != NULL )
+	{
+		summary->numRecords = recordNumber - 1;
+		summary->numChunks = numChunks;
+		summary->fileSize = EVTX_FILE_HEADER_SIZE + numChunks * EVTX_CHUNK_SIZE;
+	}
+	for (size_t level = 0; level < CORPUS_LEVELS; level++)
+		free(gen->buffers[level].data);
+	free(gen->templates);
+	free(gen);
+	return result;
+}
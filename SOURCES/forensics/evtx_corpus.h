@@ -0,0 +1,61 @@
+/*
+ * =====================================================================================
+ *       Filename:  evtx_corpus.h
+ *    Description:  Synthetic EVTX logs for benchmarks: valid files with a chosen
+ *                  number of templates, argument types and string lengths
+ *
+ *                  Every template is an event of its own, System like Windows
+ *                  writes it and EventData with fieldsPerTemplate values whose
+ *                  types are drawn from typeMask.  Templates and names are
+ *                  defined again in every chunk they are used in, the chunk
+ *                  and file header checksums are set.  The same options and
+ *                  seed give the same file.
+ * =====================================================================================
+ */
+
+#ifndef evtx_corpus_h_included
+#define evtx_corpus_h_included
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CORPUS_TYPE_STRING	0x01
+#define CORPUS_TYPE_SID		0x02
+#define CORPUS_TYPE_GUID	0x04
+#define CORPUS_TYPE_FILETIME	0x08
+#define CORPUS_TYPE_BINARY	0x10
+#define CORPUS_TYPE_BINXML	0x20	/*  a nested fragment with a template of its own */
+#define CORPUS_TYPE_INTEGER	0x40	/*  UInt32, UInt64 and their hex forms */
+#define CORPUS_TYPE_ALL		0x7F
+
+#define MAX_CORPUS_FIELDS	64
+#define MAX_CORPUS_STRING	8192	/*  characters, a record must fit in a chunk */
+
+typedef struct
+{
+	uint64_t	numRecords;		/*  0: up to fileSize */
+	uint64_t	fileSize;		/*  bytes, 0: numRecords decides */
+	unsigned int	numTemplates;
+	unsigned int	fieldsPerTemplate;
+	unsigned int	typeMask;		/*  CORPUS_TYPE_* */
+	unsigned int	minStringLength;	/*  characters, bytes for binary values */
+	unsigned int	maxStringLength;
+	uint64_t	seed;
+}
+CorpusOptions;
+
+typedef struct
+{
+	uint64_t	numRecords;
+	uint64_t	numChunks;
+	uint64_t	fileSize;
+}
+CorpusSummary;
+
+void	CorpusDefaultOptions(CorpusOptions* options);
+/*  Comma separated: string, sid, guid, filetime, binary, binxml, int or all */
+bool	CorpusParseTypes(const char* list, unsigned int* typeMask);
+/*  Errors are printed; summary may be NULL */
+bool	CorpusWriteFile(const char* fileName, const CorpusOptions* options, CorpusSummary* summary);
+
+#endif
@@ -0,0 +1,290 @@
+/*
+ * =====================================================================================
+ *       Filename:  evtx_cursor.cpp
+ *    Description:  EVTX records pulled one at a time (libevtxparse)
+ *
+ *                  The cursor drives the parser one record per call; the visitor
+ *                  only takes note of the record decoded.  Templates defined by
+ *                  records that were skipped are found by their chunk offset, so
+ *                  a walk can start at any record of a chunk.
+ * =====================================================================================
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include "evtx_parser.h"
+#include "evtx_cursor.h"
+
+struct sEvtxCursor
+{
+	struct sChunkReader*	reader;
+	struct sEvtxParser*	parser;
+	const uint8_t*		chunk;		/*  at chunkOffset, NULL until it is read */
+	uint64_t		chunkOffset;	/*  of the next record */
+	uint32_t		recordOffset;
+	const EvtxRecord*	record;		/*  set by the visitor */
+	bool			endOfLog;
+	bool			failed;
+	uint64_t		numBroken;
+};
+
+void	EvtxPositionFormat(const EvtxPosition* position, char* buffer, size_t bufferSize)
+{
+	snprintf(buffer, bufferSize, "%" PRIu64 ":%" PRIu32 ":%" PRIu64,
+			position->chunkOffset, position->recordOffset, position->recordNumber);
+}
+
+bool	EvtxPositionParse(const char* text, EvtxPosition* position)
+{
+	char	tail;
+
+	return ( sscanf(text, "%" SCNu64 ":%" SCNu32 ":%" SCNu64 "%c",
+			&position->chunkOffset, &position->recordOffset, &position->recordNumber, &tail) == 3 );
+}
+
+static void	OnRecord(void* context, const EvtxRecord* record, uint64_t chunkOffset, uint32_t inChunkOffset)
+{
+	((struct sEvtxCursor*)context)->record = record;
+}
+
+static bool	Fail(struct sEvtxCursor* cursor)
+{
+	cursor->chunk = NULL;
+	cursor->failed = true;
+	return false;
+}
+
+/*  Makes the chunk at chunkOffset current, sets endOfLog past the last one;
+ *  the parser starts the chunk afresh, also when it is the current one */
+static bool	LoadChunk(struct sEvtxCursor* cursor, uint64_t chunkOffset)
+{
+	struct sChunkReader*	reader		=	cursor->reader;
+	const uint8_t*		chunk;
+	bool			endOfFile	=	false;
+
+	if ( cursor->chunk != NULL && cursor->chunkOffset == chunkOffset )
+	{
+		/*  the templates of the records parsed since would be defined twice */
+		EvtxParserBeginChunk(cursor->parser);
+		return true;
+	}
+
+	cursor->chunk = NULL;
+	cursor->chunkOffset = chunkOffset;
+	cursor->recordOffset = sizeof(EvtxChunkHeader);
+
+	if ( reader->offset != chunkOffset )
+	{
+		if ( reader->seek != NULL )
+		{
+			if ( !ChunkReaderSeek(reader, chunkOffset) )
+				return Fail(cursor);
+		}
+		else
+		{
+			/*  sequential sources can only skip ahead */
+			while ( reader->offset < chunkOffset && !endOfFile )
+			{
+				if ( !ChunkReaderNextChunk(reader, &chunk, &endOfFile) )
+					return Fail(cursor);
+			}
+			if ( endOfFile )
+			{
+				cursor->endOfLog = true;
+				return true;
+			}
+			if ( reader->offset != chunkOffset )
+				return Fail(cursor);
+		}
+	}
+
+	if ( !EvtxReadChunk(reader, &chunk, &endOfFile) )
+		return Fail(cursor);
+	if ( endOfFile )
+	{
+		cursor->endOfLog = true;
+		return true;
+	}
+	cursor->chunk = chunk;
+	EvtxParserBeginChunk(cursor->parser);
+	return true;
+}
+
+static void	NextChunk(struct sEvtxCursor* cursor)
+{
+	cursor->chunk = NULL;
+	cursor->chunkOffset += EVTX_CHUNK_SIZE;
+	cursor->recordOffset = sizeof(EvtxChunkHeader);
+}
+
+/*  The header of the record at the position in the current chunk, NULL when there is none */
+static const EvtxRecordHeader*	CurrentRecordHeader(const struct sEvtxCursor* cursor)
+{
+	const EvtxRecordHeader*	recordHeader;
+
+	if ( cursor->chunk == NULL || cursor->recordOffset + sizeof(*recordHeader) > EVTX_CHUNK_SIZE )
+		return NULL;
+	recordHeader = (const EvtxRecordHeader*)(cursor->chunk + cursor->recordOffset);
+	if ( recordHeader->magic != EVTX_RECORD_MAGIC )
+		return NULL;
+	return recordHeader;
+}
+
+struct sEvtxCursor*	EvtxCursorOpen(struct sChunkReader* reader)
+{
+	struct sEvtxCursor*	cursor	=	(struct sEvtxCursor*)calloc(1, sizeof(*cursor));
+	EvtxVisitor		visitor;
+
+	if ( cursor == NULL )
+		return NULL;
+
+	memset(&visitor, 0, sizeof(visitor));
+	visitor.context = cursor;
+	visitor.record = OnRecord;
+
+	cursor->reader = reader;
+	cursor->parser = EvtxParserCreate(&visitor);
+	if ( cursor->parser == NULL || !EvtxReadFileHeader(reader) )
+	{
+		EvtxCursorClose(cursor);
+		return NULL;
+	}
+	cursor->chunkOffset = reader->offset;
+	cursor->recordOffset = sizeof(EvtxChunkHeader);
+	return cursor;
+}
+
+void	EvtxCursorClose(struct sEvtxCursor* cursor)
+{
+	if ( cursor == NULL )
+		return;
+	EvtxParserFree(cursor->parser);
+	free(cursor);
+}
+
+const EvtxRecord*	EvtxCursorNext(struct sEvtxCursor* cursor)
+{
+	while ( !cursor->endOfLog && !cursor->failed )
+	{
+		const EvtxRecordHeader*	recordHeader;
+		EvtxRecordResult	result;
+
+		if ( cursor->chunk == NULL )
+		{
+			LoadChunk(cursor, cursor->chunkOffset);
+			continue;
+		}
+
+		cursor->record = NULL;
+		result = EvtxParseRecord(cursor->parser, cursor->chunk, cursor->chunkOffset, cursor->recordOffset);
+		if ( result != EvtxRecordParsed )
+		{
+			if ( result == EvtxRecordFailed )
+				cursor->numBroken++;
+			NextChunk(cursor);
+			continue;
+		}
+
+		recordHeader = (const EvtxRecordHeader*)(cursor->chunk + cursor->recordOffset);
+		if ( recordHeader->size < sizeof(*recordHeader) || recordHeader->size > EVTX_CHUNK_SIZE - cursor->recordOffset )
+			NextChunk(cursor);
+		else
+			cursor->recordOffset += recordHeader->size;
+
+		/*  the chunk stays readable until the next call */
+		return cursor->record;
+	}
+	return NULL;
+}
+
+void	EvtxCursorTell(const struct sEvtxCursor* cursor, EvtxPosition* position)
+{
+	const EvtxRecordHeader*	recordHeader	=	CurrentRecordHeader(cursor);
+
+	position->chunkOffset = cursor->chunkOffset;
+	position->recordOffset = cursor->recordOffset;
+	position->recordNumber = ( recordHeader != NULL ) ? recordHeader->number : 0;
+	/*  past the last record of the chunk, which may end at the very end of
+	 *  it: the walk goes on with the next chunk */
+	if ( cursor->chunk != NULL && recordHeader == NULL )
+	{
+		position->chunkOffset += EVTX_CHUNK_SIZE;
+		position->recordOffset = sizeof(EvtxChunkHeader);
+	}
+}
+
+bool	EvtxCursorSeek(struct sEvtxCursor* cursor, const EvtxPosition* position)
+{
+	const EvtxRecordHeader*	recordHeader;
+	uint64_t		chunkOffset	=	position->chunkOffset;
+	uint32_t		recordOffset	=	position->recordOffset;
+
+	if ( chunkOffset < EVTX_FILE_HEADER_SIZE ||
+		( chunkOffset - EVTX_FILE_HEADER_SIZE ) % EVTX_CHUNK_SIZE != 0 ||
+		recordOffset < sizeof(EvtxChunkHeader) ||
+		recordOffset > EVTX_CHUNK_SIZE )
+	{
+		return false;
+	}
+	/*  the end of a full chunk, as saved before Tell moved such positions on */
+	if ( recordOffset == EVTX_CHUNK_SIZE )
+	{
+		chunkOffset += EVTX_CHUNK_SIZE;
+		recordOffset = sizeof(EvtxChunkHeader);
+	}
+
+	cursor->endOfLog = false;
+	cursor->failed = false;
+	if ( !LoadChunk(cursor, chunkOffset) )
+		return false;
+	cursor->recordOffset = recordOffset;
+	if ( position->recordNumber == 0 )
+		return true;
+
+	recordHeader = CurrentRecordHeader(cursor);
+	return ( recordHeader != NULL && recordHeader->number == position->recordNumber );
+}
+
+bool	EvtxCursorSeekRecord(struct sEvtxCursor* cursor, uint64_t recordNumber)
+{
+	uint64_t	chunkOffset	=	( cursor->reader->seek != NULL ) ? EVTX_FILE_HEADER_SIZE : cursor->chunkOffset;
+
+	cursor->endOfLog = false;
+	cursor->failed = false;
+	for (;; chunkOffset += EVTX_CHUNK_SIZE)
+	{
+		const EvtxChunkHeader*	chunkHeader;
+
+		if ( !LoadChunk(cursor, chunkOffset) || cursor->endOfLog )
+			return false;
+
+		chunkHeader = (const EvtxChunkHeader*)cursor->chunk;
+		if ( recordNumber < chunkHeader->firstRecordNumber || recordNumber > chunkHeader->lastRecordNumber )
+			continue;
+
+		/*  walk the record headers, nothing is decoded */
+		cursor->recordOffset = sizeof(EvtxChunkHeader);
+		for (const EvtxRecordHeader* recordHeader = CurrentRecordHeader(cursor);
+			recordHeader != NULL;
+			recordHeader = CurrentRecordHeader(cursor))
+		{
+			if ( recordHeader->number == recordNumber )
+				return true;
+			if ( recordHeader->size < sizeof(*recordHeader) || recordHeader->size > EVTX_CHUNK_SIZE )
+				break;
+			cursor->recordOffset += recordHeader->size;
+		}
+	}
+}
+
+bool	EvtxCursorFailed(const struct sEvtxCursor* cursor)
+{
+	return cursor->failed;
+}
+
+uint64_t	EvtxCursorBrokenRecords(const struct sEvtxCursor* cursor)
+{
+	return cursor->numBroken;
+}
@@ -0,0 +1,62 @@
+/*
+ * =====================================================================================
+ *       Filename:  evtx_cursor.h
+ *    Description:  EVTX records pulled one at a time (libevtxparse)
+ *
+ *                  A cursor walks a log record by record at the pace of the
+ *                  caller.  Only the chunk being read and its templates are kept,
+ *                  so the memory does not grow with the log.  A position names a
+ *                  record by chunk and offset and can be saved as text to resume
+ *                  the walk later, in this process or another one.
+ * =====================================================================================
+ */
+
+#ifndef evtx_cursor_h_included
+#define evtx_cursor_h_included
+
+#include <stdint.h>
+#include <stddef.h>
+#include "evtx_record.h"
+#include "chunk_reader.h"
+
+typedef struct
+{
+	uint64_t	chunkOffset;	/*  of the chunk in the log */
+	uint32_t	recordOffset;	/*  of the record in the chunk */
+	uint64_t	recordNumber;	/*  checked when seeking unless 0 */
+}
+EvtxPosition;
+
+#define EVTX_POSITION_TEXT_SIZE	64
+
+/*  "chunkOffset:recordOffset:recordNumber" */
+void	EvtxPositionFormat(const EvtxPosition* position, char* buffer, size_t bufferSize);
+bool	EvtxPositionParse(const char* text, EvtxPosition* position);
+
+struct sEvtxCursor;
+
+/*  Reads the file header; the cursor does not own reader, which must not be
+ *  read from elsewhere while the cursor is open */
+struct sEvtxCursor*	EvtxCursorOpen(struct sChunkReader* reader);
+void	EvtxCursorClose(struct sEvtxCursor* cursor);
+
+/*  The next record, NULL at the end of the log or on I/O errors.  The record
+ *  and its fields are valid until the next call on the cursor.  Records that
+ *  cannot be decoded are skipped with the rest of their chunk, as parse_evtx
+ *  does, and counted. */
+const EvtxRecord*	EvtxCursorNext(struct sEvtxCursor* cursor);
+/*  The position of the record EvtxCursorNext() returns next; past the last
+ *  record of a chunk it is the start of the next chunk */
+void	EvtxCursorTell(const struct sEvtxCursor* cursor, EvtxPosition* position);
+/*  Sequential sources can only move forward.  Fails when the record at the
+ *  position does not have the saved number, e.g. the log wrapped around. */
+bool	EvtxCursorSeek(struct sEvtxCursor* cursor, const EvtxPosition* position);
+/*  Looks for the record in the chunk headers, from the start of the log or,
+ *  for sequential sources, from the current chunk on */
+bool	EvtxCursorSeekRecord(struct sEvtxCursor* cursor, uint64_t recordNumber);
+
+/*  True after NULL from EvtxCursorNext() when it was not the end of the log */
+bool	EvtxCursorFailed(const struct sEvtxCursor* cursor);
+uint64_t	EvtxCursorBrokenRecords(const struct sEvtxCursor* cursor);
+
+#endif
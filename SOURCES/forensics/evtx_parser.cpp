@@ -0,0 +1,949 @@
+/*
+ * =====================================================================================
+ *       Filename:  evtx_parser.cpp
+ *    Description:  EVTX decoding library (libevtxparse): BinXml, templates, records
+ *
+ *                  Template definitions are turned into lists of fixed key/value
+ *                  pairs and substitution slots; a record then is a template
+ *                  instance whose values are matched to the slots.  All the state
+ *                  lives in the parser, several parsers can run side by side.
+ * =====================================================================================
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <utils/win_types.h>
+#include "evtx_parser.h"
+#include "evtx_stats.h"
+#include "evtx_trace.h"
+
+// #define PRINT_TAGS
+
+#define MAX_IDS			256
+#define MAX_NUM_ARGS		256
+#define INVALID_TEMPLATE_IDX	((unsigned int)-1)
+
+#define MAX_NAME_STACK_DEPTH	20
+#define INVALID_STACK_DEPTH 	((ssize_t)-1)
+
+typedef struct
+{
+	char	name[256];
+}
+NameStackElement;
+
+struct sEvtxParser
+{
+	EvtxVisitor		visitor;
+	uint32_t		knownIDs[MAX_IDS];
+	TemplateDescription	templates[MAX_IDS];
+	unsigned int		numIDs;
+	ssize_t			nameStackPtr;
+	NameStackElement	nameStack[MAX_NAME_STACK_DEPTH];
+	EvtxRecord		record;		/*  the one being decoded */
+	EvtxParseError		error;		/*  of the record that failed */
+	uint64_t		visitorTime;	/*  ns in the callbacks of the chunk, for --trace */
+};
+
+typedef struct
+{
+	uint32_t	d1;
+	uint16_t	w1;
+	uint16_t	w2;
+	uint8_t		b1[8];
+}
+EvtxGUID;
+
+typedef enum
+{
+	StateNormal		=	1,
+	StateInAttribute	=	2,
+}
+XmlParseState;
+
+typedef struct sParseContext
+{
+	struct sEvtxParser*	parser;
+	sParseContext*	chunkContext;
+	const uint8_t*	data;
+	size_t		dataLen;
+	size_t		offset;
+	size_t		offsetFromChunkStart;
+	XmlParseState	state;
+	unsigned int	currentTemplateIdx;
+	char		cachedValue[256];
+}
+ParseContext;
+
+static bool	ParseBinXml(ParseContext* ctx, size_t inFileOffset);
+
+static bool	HaveEnoughData(ParseContext* ctx, size_t numBytes)
+{
+	return ( ctx->offset + numBytes <= ctx->dataLen );
+}
+
+static void	SkipBytes(ParseContext* ctx, size_t numBytes)
+{
+	ctx->offset += numBytes;
+}
+
+template<class c>
+static bool	ReadData(ParseContext* ctx, c* result, size_t count = 1)
+{
+	if ( !HaveEnoughData(ctx, sizeof(*result) * count) )
+		return false;
+	for (size_t idx = 0; idx < count; idx++)
+	{
+		result[idx] = *(c*)(ctx->data + ctx->offset);
+		ctx->offset += sizeof(*result);
+	}
+	return true;
+}
+
+template <class c>
+static void InitRoot(c* root)
+{
+	root->next = NULL;
+}
+
+template<class c>
+static c* AddPair(c* root)
+{
+	c*	item	=	(c*)malloc(sizeof(c));
+	if ( item != NULL )
+	{
+		item->next = root->next;
+		root->next = item;
+	}
+	return item;
+}
+
+static void	FreePair(TemplateFixedPair* item)
+{
+	free(item->key);
+	free(item->value);
+	free(item);
+}
+
+static void	FreePair(TemplateArgPair* item)
+{
+	free(item->key);
+	free(item);
+}
+
+template <class c>
+static void ResetRoot(c* root)
+{
+	c*	nextItem	=	NULL;
+
+	for (c* ptr = root->next; ptr != NULL; ptr = nextItem)
+	{
+		nextItem = ptr->next;
+		FreePair(ptr);
+	}
+
+	root->next = NULL;
+}
+
+static void InitTemplateDescription(TemplateDescription* item)
+{
+	InitRoot(&item->fixedRoot);
+	InitRoot(&item->argsRoot);
+	item->shortID = 0;
+	item->compiled = NULL;
+}
+
+static void ResetTemplateDescription(struct sEvtxParser* parser, TemplateDescription* item)
+{
+	ResetRoot(&item->fixedRoot);
+	ResetRoot(&item->argsRoot);
+	item->shortID = 0;
+	if ( item->compiled != NULL && parser->visitor.releaseTemplate != NULL )
+		parser->visitor.releaseTemplate(parser->visitor.context, item->compiled);
+	item->compiled = NULL;
+}
+
+static void	RegisterFixedPair(struct sEvtxParser* parser, unsigned int templateIdx, const char* key, const char* value)
+{
+	TemplateFixedPair*	newPair	=	AddPair(&parser->templates[templateIdx].fixedRoot);
+	if ( newPair == NULL )
+		return;
+	newPair->key = strdup(key);
+	newPair->value = strdup(value);
+}
+
+
+static void	RegisterArgPair(struct sEvtxParser* parser, unsigned int templateIdx, const char* key, uint16_t type, uint16_t argIdx)
+{
+	TemplateArgPair*	newPair	=	AddPair(&parser->templates[templateIdx].argsRoot);
+	if ( newPair == NULL )
+		return;
+	// broken record 3420028194 (security.evtx)
+	newPair->key = strdup(key == NULL ? "" : key);
+	newPair->type = type;
+	newPair->argIdx = argIdx;
+}
+
+
+static void	PushName(struct sEvtxParser* parser, const char* name)
+{
+	if ( parser->nameStackPtr >= MAX_NAME_STACK_DEPTH - 1 )
+		return;
+	parser->nameStackPtr++;
+	strncpy(parser->nameStack[parser->nameStackPtr].name, name, sizeof(parser->nameStack[parser->nameStackPtr].name));
+	parser->nameStack[parser->nameStackPtr].name[ sizeof(parser->nameStack[parser->nameStackPtr].name) - 1 ]  = 0;
+}
+
+static void	PopName(struct sEvtxParser* parser)
+{
+	if ( parser->nameStackPtr > INVALID_STACK_DEPTH )
+		parser->nameStackPtr--;
+}
+
+static const char*	GetName(struct sEvtxParser* parser)
+{
+	if ( parser->nameStackPtr <= INVALID_STACK_DEPTH )
+		return NULL;
+	return parser->nameStack[parser->nameStackPtr].name;
+}
+
+
+static const char*	GetUpperName(struct sEvtxParser* parser)
+{
+	if ( parser->nameStackPtr <= INVALID_STACK_DEPTH )
+		return NULL;
+	if ( parser->nameStackPtr < 1 )
+		return NULL;
+
+	return parser->nameStack[parser->nameStackPtr - 1].name;
+}
+
+static bool	IsKnownID(struct sEvtxParser* parser, uint32_t id, unsigned int* templateIdx)
+{
+	for (unsigned int idx = 0; idx < parser->numIDs; idx++)
+	{
+		if ( parser->knownIDs[idx] == id )
+		{
+			if ( templateIdx != NULL )
+				*templateIdx = idx;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool	RegisterID(struct sEvtxParser* parser, uint32_t id, unsigned int* templateIdx)
+{
+	if ( parser->numIDs >= MAX_IDS )
+		return false;
+	parser->knownIDs[parser->numIDs] = id;
+	parser->templates[parser->numIDs].shortID = id;
+	*templateIdx = parser->numIDs;
+	parser->numIDs++;
+	return true;
+}
+
+static void	ResetTemplates(struct sEvtxParser* parser)
+{
+	for (size_t idx = 0; idx < parser->numIDs; idx++)
+		ResetTemplateDescription(parser, &parser->templates[idx]);
+
+	parser->numIDs = 0;
+}
+
+static void	SetState(ParseContext* ctx, XmlParseState newState)
+{
+	if ( newState == ctx->state )
+		return;
+
+	if ( ctx->state == StateInAttribute )
+		PopName(ctx->parser);
+
+	ctx->state = newState;
+}
+
+static bool	ReadPrefixedUnicodeString(ParseContext* ctx, char* nameBuffer, size_t nameBufferSize, bool isNullTerminated)
+{
+	uint16_t	nameCharCnt;
+	size_t		nameBufferUsed	=	0;
+	size_t		idx		=	0;
+
+	if ( !ReadData(ctx, &nameCharCnt) )
+		return false;
+
+	// TODO : convert UTF-16 to UTF-8
+	for (idx = 0; idx < nameCharCnt && idx*2 < ( nameBufferSize - 1 ) ; idx ++)
+	{
+		uint16_t	w;
+
+		if ( !ReadData(ctx, &w) )
+			return false;
+		UTF16ToUTF8(w, nameBuffer, &nameBufferUsed, nameBufferSize);
+	}
+
+	if ( nameBufferUsed >= nameBufferSize )
+		nameBufferUsed = nameBufferSize - 1;
+	nameBuffer[nameBufferUsed] = 0;
+
+	SkipBytes(ctx, (nameCharCnt - idx + ( isNullTerminated ? 1 : 0 ))*2);
+
+	return true;
+}
+
+static bool	ReadName(ParseContext* ctx, char* nameBuffer, size_t nameBufferSize)
+{
+	uint16_t	nameHash;
+	uint32_t	chunkOffset;
+	uint32_t	d;
+	ParseContext	temporaryCtx(*ctx->chunkContext);
+	ParseContext*	ctxPtr		=	ctx;
+
+	if ( nameBufferSize < 2 )
+		return false;
+	nameBuffer[0] = 0;
+	if ( !ReadData(ctx, &chunkOffset) )
+		return false;
+	if ( ctx->offset + ctx->offsetFromChunkStart != chunkOffset )
+	{
+		// printf("!!!!!! %08X %08X\n", chunkOffset, (uint32_t)(ctx->offset + ctx->offsetFromChunkStart));
+		ctxPtr = &temporaryCtx;
+		ctxPtr->offset = chunkOffset;
+	}
+
+	if ( !ReadData(ctxPtr, &d) )
+		return false;
+	if ( !ReadData(ctxPtr, &nameHash) )
+		return false;
+	if ( !ReadPrefixedUnicodeString(ctxPtr, nameBuffer, nameBufferSize, true) )
+		return false;
+
+	return true;
+}
+
+static const char*	GetProperKeyName(ParseContext* ctx)
+{
+	const char*	key;
+	const char*	upperName;
+
+	key = GetName(ctx->parser);
+
+	// printf("Key: %s Upper: %s\n", key, GetUpperName(ctx->parser));
+
+	upperName = GetUpperName(ctx->parser);
+
+	if ( ( upperName != NULL ) &&
+		!strcmp(key, "Data") &&
+		!strcmp(upperName, "EventData") &&
+		ctx->cachedValue[0] != 0 )
+	{
+		key = ctx->cachedValue;
+	}
+
+	return key;
+}
+
+static bool	ParseValueText(ParseContext* ctx)
+{
+	uint8_t		stringType;
+	char		valueBuffer[256];
+	const char*	upperName;
+	const char*	key;
+
+	if ( !ReadData(ctx, &stringType) )
+		return false;
+	if ( !ReadPrefixedUnicodeString(ctx, valueBuffer, sizeof(valueBuffer), false) )
+		return false;
+	// printf("******* %s=%s", GetName(ctx->parser), valueBuffer);
+
+	key = GetProperKeyName(ctx);
+	upperName = GetUpperName(ctx->parser);
+
+	if ( ( key != NULL ) &&
+		( ( upperName == NULL ) ||
+		strcmp(key, "Name") ||
+		strcmp(GetUpperName(ctx->parser), "Data") ) )
+	{
+		RegisterFixedPair(ctx->parser, ctx->currentTemplateIdx, key, valueBuffer);
+	}
+
+	SetState(ctx, StateNormal);
+
+	strncpy(ctx->cachedValue, valueBuffer, sizeof(valueBuffer));
+	ctx->cachedValue[sizeof(ctx->cachedValue)-1] = 0;
+
+	return true;
+}
+
+static bool	ParseAttributes(ParseContext* ctx)
+{
+	char		nameBuffer[256];
+
+	if ( !ReadName(ctx, nameBuffer, sizeof(nameBuffer)) )
+		return false;
+	// printf(" %s", nameBuffer);
+
+	PushName(ctx->parser, nameBuffer);
+	SetState(ctx, StateInAttribute);
+
+	return true;
+}
+
+static bool	ParseOpenStartElement(ParseContext* ctx, bool hasAttributes)
+{
+	uint8_t		b;
+	uint16_t	w;
+	uint32_t	elementLength;
+	uint32_t	attributeListLength	=	0;
+	char		nameBuffer[256];
+
+	if ( !ReadData(ctx, &w) )
+		return false;
+	if ( !ReadData(ctx, &elementLength) )
+		return false;
+	if ( !ReadName(ctx, nameBuffer, sizeof(nameBuffer)) )
+		return false;
+	if ( hasAttributes )
+	{
+		if ( !ReadData(ctx, &attributeListLength) )
+			return false;
+	}
+#ifdef PRINT_TAGS
+	printf("<%s [%08X] ", nameBuffer, attributeListLength);
+	fflush(stdout);
+#endif
+
+	PushName(ctx->parser, nameBuffer);
+
+	return true;
+}
+
+static bool	ParseCloseStartElement(ParseContext* ctx)
+{
+	SetState(ctx, StateNormal);
+#ifdef PRINT_TAGS
+	printf(">");
+	fflush(stdout);
+#endif
+	return true;
+}
+
+static bool	ParseCloseElement(ParseContext* ctx)
+{
+	SetState(ctx, StateNormal);
+	PopName(ctx->parser);
+
+#ifdef PRINT_TAGS
+	printf("</>");
+	fflush(stdout);
+#endif
+	return true;
+}
+
+/*  Registers the template whose GUID, length and body follow in ctx */
+static bool	ParseTemplateDefinition(ParseContext* ctx, uint32_t shortID)
+{
+	uint8_t		longID[16];
+	uint32_t	templateBodyLen;
+	ParseContext	templateCtx;
+
+	if ( !ReadData(ctx, &longID[0], sizeof(longID)) )
+		return false;
+	if ( !ReadData(ctx, &templateBodyLen) )
+		return false;
+	// printf("Template body, len %08X\n", templateBodyLen);
+
+	templateCtx.parser = ctx->parser;
+	templateCtx.data = ctx->data + ctx->offset;
+	templateCtx.dataLen = templateBodyLen; /* mm_min ... */
+	templateCtx.offset = 0;
+	templateCtx.chunkContext = ctx;
+	templateCtx.offsetFromChunkStart = ctx->offset + ctx->offsetFromChunkStart;
+	templateCtx.cachedValue[0] = 0;
+
+	RegisterID(ctx->parser, shortID, &templateCtx.currentTemplateIdx);
+
+	if ( !ParseBinXml(&templateCtx, 0) )
+		return false;
+
+	SkipBytes(ctx, templateBodyLen);
+
+	ctx->currentTemplateIdx = templateCtx.currentTemplateIdx;
+	if ( ctx->parser->visitor.compileTemplate != NULL )
+	{
+		TemplateDescription*	description	=	&ctx->parser->templates[ctx->currentTemplateIdx];
+
+		description->compiled = ctx->parser->visitor.compileTemplate(ctx->parser->visitor.context, description);
+	}
+
+	return true;
+}
+
+/*  Skips a substitution value by its ArgumentSize(), false when it does not
+ *  fit in the record */
+static bool	SkipArgument(ParseContext* ctx, uint16_t argType, uint16_t argLen)
+{
+	size_t	numBytes;
+
+	if ( !ArgumentSize(argType, argLen, &numBytes) || !HaveEnoughData(ctx, numBytes) )
+		return false;
+	SkipBytes(ctx, numBytes);
+	return true;
+}
+
+static bool	ParseTemplateInstance(ParseContext* ctx)
+{
+	struct sEvtxParser*	parser	=	ctx->parser;
+	TemplateDescription*	description;
+	uint8_t		b;
+	uint32_t	numArguments;
+	uint32_t	shortID;
+	uint32_t	tempResLen;
+	bool		result	=	true;
+
+	if ( !ReadData(ctx, &b) )
+		return false;
+	if ( b != 0x01 )
+		return false;
+	if ( !ReadData(ctx, &shortID) )
+		return false;
+	if ( !ReadData(ctx, &tempResLen) )
+		return false;
+
+	STATS_COUNT(templateInstances, 1);
+
+	/* tempResLen is the chunk offset of the definition */
+	if ( !IsKnownID(ctx->parser, shortID, &ctx->currentTemplateIdx) &&
+		ctx->offset + ctx->offsetFromChunkStart != tempResLen )
+	{
+		/* defined by an earlier record, which was not decoded (index lookups) */
+		ParseContext	definitionCtx(*ctx->chunkContext);
+		bool		defined;
+
+		definitionCtx.offset = tempResLen + sizeof(uint32_t);
+		STATS_COUNT(templateDefinitions, 1);
+		STATS_ENTER(StatsTemplates, statsCaller);
+		defined = ParseTemplateDefinition(&definitionCtx, shortID);
+		STATS_LEAVE(statsCaller);
+		if ( !defined )
+			return false;
+		ctx->currentTemplateIdx = definitionCtx.currentTemplateIdx;
+	}
+
+	if ( !ReadData(ctx, &numArguments) )
+		return false;
+
+	// printf("OK, template %08X\n", shortID);
+
+	if ( !IsKnownID(ctx->parser, shortID, &ctx->currentTemplateIdx) )
+	//if ( numArguments == 0x00000000 )
+	{
+		/* template definition follows */
+		bool	defined;
+
+		STATS_COUNT(templateDefinitions, 1);
+		STATS_ENTER(StatsTemplates, statsCaller);
+		defined = ParseTemplateDefinition(ctx, shortID);
+		STATS_LEAVE(statsCaller);
+		if ( !defined )
+			return false;
+
+		if ( !ReadData(ctx, &numArguments) )
+			return false;
+	}
+
+	// printf("Number of arguments: %08X\n", numArguments);
+
+	description = &parser->templates[ctx->currentTemplateIdx];
+	for ( TemplateFixedPair* ptr = description->fixedRoot.next; ptr != NULL; ptr = ptr->next )
+		AddRecordField(&parser->record, ptr->key, EVTX_TYPE_ANSI_STRING, (const uint8_t*)ptr->value, strlen(ptr->value));
+
+	size_t		argumentMapCount	=	numArguments * 2;
+	uint16_t*	argumentMap		=	(uint16_t*)malloc(sizeof(*argumentMap)*argumentMapCount);
+
+	if ( argumentMap == NULL || !ReadData(ctx, argumentMap, argumentMapCount) )
+	{
+		parser->error = EvtxErrorArguments;
+		free(argumentMap);
+		return false;
+	}
+
+	STATS_ENTER(StatsArguments, statsCaller);
+	if ( description->compiled != NULL && parser->visitor.templateInstance != NULL )
+	{
+		parser->visitor.templateInstance(parser->visitor.context, description->compiled,
+				ctx->data + ctx->offset, ctx->dataLen - ctx->offset, argumentMap, numArguments);
+	}
+
+	for (uint64_t argumentIdx = 0; argumentIdx < numArguments; argumentIdx++)
+	{
+		uint16_t		argLen		=	argumentMap[argumentIdx*2];
+		uint16_t		argType		=	argumentMap[argumentIdx*2 + 1];
+		TemplateArgPair*	argPair		=	NULL;
+
+		for ( TemplateArgPair* ptr = description->argsRoot.next; ptr != NULL; ptr = ptr->next )
+		{
+			if ( ptr->argIdx == argumentIdx )
+			{
+				argPair = ptr;
+				break;
+			}
+		}
+
+		if ( argPair != NULL && HaveEnoughData(ctx, argLen) )
+		{
+			AddRecordField(&parser->record, argPair->key, argType, ctx->data + ctx->offset, argLen);
+
+			if ( argType == EVTX_TYPE_BINXML )
+			{
+				/*  its fields follow this one, its damage is not the record's */
+				ParseContext	temporaryCtx(*ctx);
+				EvtxParseError	error		=	parser->error;
+
+				temporaryCtx.dataLen = temporaryCtx.offset + argLen;
+				STATS_ENTER(StatsTokenize, statsArguments);
+				ParseBinXml(&temporaryCtx, 0);
+				STATS_LEAVE(statsArguments);
+				parser->error = error;
+			}
+		}
+
+		/*  unused values too, RulesEvaluate() finds the values the same way */
+		if ( !SkipArgument(ctx, argType, argLen) )
+		{
+			parser->error = EvtxErrorArguments;
+			result = false;
+			break;
+		}
+	}
+	STATS_LEAVE(statsCaller);
+
+	free(argumentMap);
+
+	return result;
+}
+
+
+static bool	ParseOptionalSubstitution(ParseContext* ctx)
+{
+	uint16_t	substitutionID;
+	uint8_t		valueType;
+
+	if ( !ReadData(ctx, &substitutionID) )
+		return false;
+	if ( !ReadData(ctx, &valueType) )
+		return false;
+	if ( valueType == 0x00 )
+	{
+		if ( !ReadData(ctx, &valueType) )
+			return false;
+	}
+
+	// printf("******* %s=<<param %X/type %X>> ", GetName(ctx->parser), substitutionID, valueType);
+	RegisterArgPair(ctx->parser, ctx->currentTemplateIdx, GetProperKeyName(ctx), valueType, substitutionID);
+	SetState(ctx, StateNormal);
+
+	return true;
+}
+
+static bool	ParseBinXmlPre(struct sEvtxParser* parser, const uint8_t* data, size_t dataLen, size_t inFileOffset, size_t inChunkOffset)
+{
+	ParseContext	ctx;
+
+	ctx.parser = parser;
+	ctx.data = data;
+	ctx.dataLen = dataLen;
+	ctx.offset = inChunkOffset;
+	ctx.currentTemplateIdx = INVALID_TEMPLATE_IDX;
+	ctx.chunkContext = &ctx;
+	ctx.offsetFromChunkStart = 0;
+	ctx.cachedValue[0] = 0;
+
+	return ParseBinXml(&ctx, inFileOffset);
+}
+
+static bool	ParseBinXml(ParseContext* ctx, size_t inFileOffset)
+{
+	bool	result	=	true;
+
+	ctx->state = StateNormal;
+
+	// printf("ParseBinXml(%08X, %08X)\n", (uint32_t)ctx->offset, (uint32_t)ctx->dataLen);
+
+	while ( result && ( ctx->offset < ctx->dataLen ) )
+	{
+		uint8_t	tag	=	ctx->data[ctx->offset++];
+
+		// printf("%08zX: %02X ", inFileOffset + ctx->offset, tag);
+		// fflush(stdout);
+		// printf("%08zX: %02X %02X %02X", inFileOffset + ctx->offset, tag, ctx->data[ctx->offset], ctx->data[ctx->offset+1]);
+
+		switch(tag)
+		{
+		case 0x00:	/*  EOF */
+			ctx->offset = ctx->dataLen;
+			break;
+		case 0x01:	/*  OpenStartElementToken */
+			result = ParseOpenStartElement(ctx, false);
+			break;
+		case 0x41:
+			result = ParseOpenStartElement(ctx, true);
+			break;
+		case 0x02:	/* CloseStartElementToken */
+			result = ParseCloseStartElement(ctx);
+			break;
+		case 0x03:	/*  CloseEmptyElementToken */
+		case 0x04:	/*  CloseElementToken */
+			result = ParseCloseElement(ctx);
+			break;
+		case 0x05:	/*  ValueTextToken */
+		case 0x45:
+			result = ParseValueText(ctx);
+			break;
+		case 0x06:	/*  AttributeToken */
+		case 0x46:
+			result = ParseAttributes(ctx);
+			break;
+		case 0x07:	/* CDATASectionToken */
+		case 0x47:
+			break;
+		case 0x08:	/* CharRefToken */
+		case 0x48:
+			break;
+		case 0x09:	/*  EntityRefToken */
+		case 0x49:
+			break;
+		case 0x0A:	/*  PITargetToken */
+			break;
+		case 0x0B:	/*  PIDataToken */
+			break;
+		case 0x0C: /*  TemplateInstanceToken */
+			result = ParseTemplateInstance(ctx);
+			break;
+		case 0x0D:	/*  NormalSubstitutionToken */
+		case 0x0E:	/*  OptionalSubstitutionToken */
+			result = ParseOptionalSubstitution(ctx);
+			break;
+		case 0x0F: /*  FragmentHeaderToken */
+			SkipBytes(ctx, 3);
+			break;
+
+		default:
+			result = false;
+			break;
+		}
+
+		// printf("\n");
+	}
+
+	return result;
+}
+
+struct sEvtxParser*	EvtxParserCreate(const EvtxVisitor* visitor)
+{
+	struct sEvtxParser*	parser	=	(struct sEvtxParser*)calloc(1, sizeof(*parser));
+
+	if ( parser == NULL )
+		return NULL;
+	if ( visitor != NULL )
+		parser->visitor = *visitor;
+	for (size_t idx = 0; idx < MAX_IDS; idx++)
+		InitTemplateDescription(&parser->templates[idx]);
+	parser->nameStackPtr = INVALID_STACK_DEPTH;
+	return parser;
+}
+
+void	EvtxParserFree(struct sEvtxParser* parser)
+{
+	if ( parser == NULL )
+		return;
+	ResetTemplates(parser);
+	free(parser);
+}
+
+void	EvtxParserBeginChunk(struct sEvtxParser* parser)
+{
+	ResetTemplates(parser);
+}
+
+EvtxRecordResult	EvtxParseRecord(struct sEvtxParser* parser, const uint8_t* chunk, uint64_t chunkOffset, uint64_t inChunkOffset)
+{
+	const EvtxChunkHeader*	chunkHeader	=	(const EvtxChunkHeader*)chunk;
+	const EvtxRecordHeader*	recordHeader	=	(const EvtxRecordHeader*)(chunk + inChunkOffset);
+	bool			parsed;
+
+	if ( inChunkOffset + sizeof(*recordHeader) > EVTX_CHUNK_SIZE )
+		return EvtxRecordLast;
+
+	if ( recordHeader->magic != EVTX_RECORD_MAGIC )
+	{
+#ifdef PRINT_TAGS
+		printf("Record header mismatch at %08X\n", (uint32_t)(chunkOffset + inChunkOffset));
+#endif
+		return EvtxRecordLast;
+	}
+
+	if ( parser->visitor.beginRecord != NULL )
+	{
+		bool	begun;
+
+		TRACE_BEGIN(traceStart);
+		STATS_ENTER(StatsVisitor, statsCaller);
+		begun = parser->visitor.beginRecord(parser->visitor.context, recordHeader->number, recordHeader->timestamp);
+		STATS_LEAVE(statsCaller);
+		TRACE_ADD(parser->visitorTime, traceStart);
+		if ( !begun )
+		{
+			STATS_COUNT(failedRecords, 1);
+			return EvtxRecordFailed;
+		}
+	}
+
+	ResetRecord(&parser->record, recordHeader->number, recordHeader->timestamp);
+	parser->error = EvtxErrorFormat;
+
+	STATS_ENTER(StatsTokenize, statsCaller);
+	parsed = ParseBinXmlPre(parser,
+				chunk,
+				EVTX_CHUNK_SIZE,
+				chunkOffset + inChunkOffset + sizeof(*recordHeader),
+				inChunkOffset + sizeof(*recordHeader) );
+	STATS_LEAVE(statsCaller);
+
+	if ( !parsed )
+	{
+		if ( parser->visitor.brokenRecord != NULL )
+		{
+			TRACE_BEGIN(traceStart);
+			STATS_ENTER(StatsVisitor, statsBroken);
+			parser->visitor.brokenRecord(parser->visitor.context, &parser->record, parser->error);
+			STATS_LEAVE(statsBroken);
+			TRACE_ADD(parser->visitorTime, traceStart);
+		}
+		if ( recordHeader->number >= chunkHeader->firstRecordNumber &&
+				recordHeader->number <= chunkHeader->lastRecordNumber )
+		{
+			STATS_COUNT(failedRecords, 1);
+			return EvtxRecordFailed;
+		}
+		return EvtxRecordLast;
+	}
+
+	STATS_COUNT(records, 1);
+	if ( parser->visitor.record != NULL )
+	{
+		TRACE_BEGIN(traceStart);
+		STATS_ENTER(StatsVisitor, statsRecord);
+		parser->visitor.record(parser->visitor.context, &parser->record, chunkOffset, (uint32_t)inChunkOffset);
+		STATS_LEAVE(statsRecord);
+		TRACE_ADD(parser->visitorTime, traceStart);
+	}
+
+	return EvtxRecordParsed;
+}
+
+bool	EvtxParseChunk(struct sEvtxParser* parser, const uint8_t* chunk, uint64_t chunkOffset)
+{
+	uint64_t		inRecordOff;
+	bool			result		=	true;
+	uint64_t		startTime	=	STATS_CLOCK();
+	uint64_t		numRecords	=	0;
+	TRACE_BEGIN(traceStart);
+
+	ResetTemplates(parser);
+	parser->visitorTime = 0;
+
+	inRecordOff = sizeof(EvtxChunkHeader);
+
+	for (;;)
+	{
+		EvtxRecordResult	recordResult	=	EvtxParseRecord(parser, chunk, chunkOffset, inRecordOff);
+
+		if ( recordResult == EvtxRecordFailed )
+			result = false;
+		if ( recordResult != EvtxRecordParsed )
+			break;
+		numRecords++;
+
+		inRecordOff += ((const EvtxRecordHeader*)(chunk + inRecordOff))->size;
+	}
+
+	if ( inRecordOff > chunkOffset + EVTX_CHUNK_SIZE )
+		result = false;
+
+	STATS_CHUNK_LATENCY(startTime);
+	TRACE_END_ARGS("decode", traceStart, "records", numRecords, "format_us", parser->visitorTime / 1000);
+	return result;
+}
+
+bool	EvtxReadFileHeader(struct sChunkReader* reader)
+{
+	const uint8_t*	headerData;
+	EvtxHeader	header;
+	bool		headerRead;
+
+	STATS_ENTER(StatsIo, statsCaller);
+	headerRead = ChunkReaderReadHeader(reader, &headerData);
+	STATS_LEAVE(statsCaller);
+	if ( !headerRead )
+		return false;
+	STATS_COUNT(bytesRead, sizeof(header));
+	memcpy(&header, headerData, sizeof(header));
+	if ( header.version != 0x00030001)
+		return false;
+
+#ifdef PRINT_TAGS
+	printf("Number of chunks: %" PRIu64 " %" PRIu64 " header sz %zu\n", header.numberOfChunksAllocated, header.numberOfChunksUsed, sizeof(header));
+#endif
+
+	return true;
+}
+
+bool	EvtxReadChunk(struct sChunkReader* reader, const uint8_t** chunk, bool* endOfFile)
+{
+	const EvtxChunkHeader*	chunkHeader;
+	bool			chunkRead;
+	TRACE_BEGIN(traceStart);
+
+	STATS_ENTER(StatsIo, statsCaller);
+	chunkRead = ChunkReaderNextChunk(reader, chunk, endOfFile);
+	STATS_LEAVE(statsCaller);
+	TRACE_END("read", traceStart);
+	if ( !chunkRead )
+		return false;
+	if ( *endOfFile )
+		return true;
+	STATS_COUNT(bytesRead, EVTX_CHUNK_SIZE);
+
+	chunkHeader = (const EvtxChunkHeader*)*chunk;
+	if ( memcmp(chunkHeader->magic, EVTX_CHUNK_HEADER_MAGIC, sizeof(EVTX_CHUNK_HEADER_MAGIC)) )
+	{
+		// return false;
+		*endOfFile = true;
+		return true;
+	}
+	STATS_COUNT(chunks, 1);
+
+	return true;
+}
+
+bool	EvtxParseLog(struct sEvtxParser* parser, struct sChunkReader* reader)
+{
+	uint64_t	off	=	sizeof(EvtxHeader);
+	const uint8_t*	chunk;
+	bool		endOfFile	=	false;
+
+	if ( !EvtxReadFileHeader(reader) )
+		return false;
+
+	while ( !endOfFile )
+	{
+		if ( !EvtxReadChunk(reader, &chunk, &endOfFile) )
+			return false;
+		if ( !endOfFile && !EvtxParseChunk(parser, chunk, off) )
+			return false;
+		off += EVTX_CHUNK_SIZE;
+	}
+	return true;
+}
@@ -0,0 +1,125 @@
+/*
+ * =====================================================================================
+ *       Filename:  evtx_parser.h
+ *    Description:  EVTX decoding library (libevtxparse): visitor API
+ *
+ *                  The parser walks the records of a chunk, decodes their BinXml
+ *                  against the templates the chunk defines and hands every record
+ *                  to the visitor as typed field views (see evtx_record.h) that
+ *                  point into the chunk and the templates: nothing is formatted
+ *                  or copied.  Templates are compiled once per chunk; a visitor
+ *                  can attach data of its own to them and be called back with
+ *                  the raw substitution values of every instance.
+ * =====================================================================================
+ */
+
+#ifndef evtx_parser_h_included
+#define evtx_parser_h_included
+
+#include <stdint.h>
+#include <stddef.h>
+#include "evtx_record.h"
+#include "evtx_template.h"
+#include "chunk_reader.h"
+
+#pragma pack(push, 1)
+
+#define EVTX_HEADER_MAGIC	"ElfFile"
+
+typedef struct
+{
+	char		magic[8];
+	uint64_t	numberOfChunksAllocated;
+	uint64_t	numberOfChunksUsed;
+	uint64_t	checksum;
+	uint32_t	flags;
+	uint32_t	version;
+	uint64_t	fileSize;
+	uint8_t		reserved[0x1000 - 0x30];
+}
+EvtxHeader;
+
+#define EVTX_CHUNK_HEADER_MAGIC	"ElfChnk"
+
+typedef struct
+{
+	char		magic[8];
+	uint64_t	firstRecordNumber;
+	uint64_t	lastRecordNumber;
+	uint64_t	firstRecordNumber2;
+	uint64_t	lastRecordNumber2;
+	uint32_t	chunkHeaderSize;
+	uint8_t		reserved[0x80 - 0x2C];
+	uint8_t		reserved2[0x200 - 0x80];
+}
+EvtxChunkHeader;
+
+#define EVTX_RECORD_MAGIC	0x00002a2a
+
+typedef struct
+{
+	uint32_t	magic;
+	uint32_t	size;
+	uint64_t	number;
+	uint64_t	timestamp;
+}
+EvtxRecordHeader;
+
+#pragma pack(pop)
+
+typedef enum
+{
+	EvtxErrorFormat,		/*  damaged BinXml */
+	EvtxErrorArguments		/*  the substitution values could not be read */
+}
+EvtxParseError;
+
+typedef enum
+{
+	EvtxRecordParsed,
+	EvtxRecordLast,			/*  no record at the offset, the chunk is done */
+	EvtxRecordFailed
+}
+EvtxRecordResult;
+
+/*  Any callback may be NULL; record field views are valid during the call only */
+typedef struct
+{
+	void*	context;
+
+	/*  Before the record is decoded, false fails it */
+	bool	(*beginRecord)(void* context, uint64_t number, uint64_t timestamp);
+	/*  The record decoded, fields in document order */
+	void	(*record)(void* context, const EvtxRecord* record, uint64_t chunkOffset, uint32_t inChunkOffset);
+	/*  A record that could not be decoded, with the fields read before the damage */
+	void	(*brokenRecord)(void* context, const EvtxRecord* record, EvtxParseError error);
+
+	/*  Once per template defined in a chunk, the result is kept with the template */
+	void*	(*compileTemplate)(void* context, const TemplateDescription* description);
+	void	(*releaseTemplate)(void* context, void* compiled);
+	/*  Every instance of a template compiled to non-NULL, with its raw values */
+	void	(*templateInstance)(void* context, const void* compiled, const uint8_t* values, size_t valuesLen,
+					const uint16_t* argumentMap, uint32_t numArguments);
+}
+EvtxVisitor;
+
+struct sEvtxParser;
+
+struct sEvtxParser*	EvtxParserCreate(const EvtxVisitor* visitor);
+void	EvtxParserFree(struct sEvtxParser* parser);
+
+/*  Forgets the templates, needed before EvtxParseRecord() on a new chunk */
+void	EvtxParserBeginChunk(struct sEvtxParser* parser);
+/*  Decodes the record at inChunkOffset of the chunk at chunkOffset of the file */
+EvtxRecordResult	EvtxParseRecord(struct sEvtxParser* parser, const uint8_t* chunk, uint64_t chunkOffset, uint64_t inChunkOffset);
+/*  Decodes every record of the chunk, false when one of them failed */
+bool	EvtxParseChunk(struct sEvtxParser* parser, const uint8_t* chunk, uint64_t chunkOffset);
+
+/*  Reads and checks the file header */
+bool	EvtxReadFileHeader(struct sChunkReader* reader);
+/*  False on I/O errors; a short read or a missing chunk magic sets *endOfFile */
+bool	EvtxReadChunk(struct sChunkReader* reader, const uint8_t** chunk, bool* endOfFile);
+/*  Decodes the whole log */
+bool	EvtxParseLog(struct sEvtxParser* parser, struct sChunkReader* reader);
+
+#endif
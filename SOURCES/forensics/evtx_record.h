@@ -0,0 +1,371 @@
+/*
+ * =====================================================================================
+ *       Filename:  evtx_record.h
+ *    Description:  Decoded EVTX record: field views into the chunk being parsed
+ * =====================================================================================
+ */
+
+#ifndef evtx_record_h_included
+#define evtx_record_h_included
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <utils/win_types.h>
+#include <tools/wintime.h>
+#include "text_kernels.h"
+
+/*  BinXml value types */
+#define EVTX_TYPE_NULL		0x00
+#define EVTX_TYPE_STRING	0x01	/*  UTF-16LE, not terminated */
+#define EVTX_TYPE_ANSI_STRING	0x02	/*  fixed template values, UTF-8, zero terminated */
+#define EVTX_TYPE_UINT8		0x04
+#define EVTX_TYPE_UINT16	0x06
+#define EVTX_TYPE_UINT32	0x08
+#define EVTX_TYPE_UINT64	0x0A
+#define EVTX_TYPE_BINARY	0x0E
+#define EVTX_TYPE_GUID		0x0F
+#define EVTX_TYPE_FILETIME	0x11
+#define EVTX_TYPE_SID		0x13
+#define EVTX_TYPE_HEXINT32	0x14
+#define EVTX_TYPE_HEXINT64	0x15
+#define EVTX_TYPE_BINXML	0x21
+
+#define MAX_RECORD_FIELDS	256
+#define MAX_LOGON_TYPE		11
+
+extern const char*	logonTypes[];
+
+typedef struct
+{
+	const char*	key;
+	uint16_t	type;
+	const uint8_t*	data;		/*  points into the chunk or into the template, valid until the next record */
+	size_t		dataLen;
+}
+EvtxField;
+
+typedef struct
+{
+	uint64_t	number;
+	uint64_t	timestamp;	/*  FILETIME from the record header */
+	size_t		numFields;
+	EvtxField	fields[MAX_RECORD_FIELDS];
+}
+EvtxRecord;
+
+static void	UTF16ToUTF8(uint16_t w, char* buffer, size_t* bufferUsed, size_t bufferSize)
+{
+	uint32_t	charLength	=	1;
+	uint8_t		msb		=	0;
+	uint8_t		mask		=	0;
+
+	if ( w > 0x7F )
+	{
+		charLength++;
+		msb |= 0x80 + 0x40;
+		mask = 0xFF;
+	}
+	if ( w > 0x7FF )
+	{
+		charLength++;
+		msb |= 0x20;
+		mask = 0x1F;
+	}
+	if ( w > 0xFFFF )
+	{
+		charLength++;
+		msb |= 0x10;
+		mask = 0x0F;
+	}
+
+	if ( *bufferUsed + charLength >= bufferSize )
+		return;	/*  no buffer overruns */
+
+	if ( charLength == 1 )
+	{
+		buffer[*bufferUsed] = w;
+		(*bufferUsed)++;
+		return;
+	}
+
+	// printf("\n%04X -> ", (uint16_t)w);
+
+	for (uint32_t charIndex = charLength - 1; charIndex > 0; charIndex--)
+	{
+		buffer[*bufferUsed + charIndex] = 0x80 | ( w & 0x3F );
+		// printf(" ... [%X] %02X ", charIndex, buffer[*bufferUsed + charIndex]);
+		w >>= 6;
+	}
+
+	buffer[*bufferUsed] = msb | ( w & mask );
+
+#if 0
+	for (uint32_t idx = 0; idx < charLength; idx++)
+		printf("%02X ", (uint8_t)buffer[*bufferUsed + idx]);
+	printf("\n");
+#endif
+
+	*bufferUsed += charLength;
+}
+
+static void	ResetRecord(EvtxRecord* record, uint64_t number, uint64_t timestamp)
+{
+	record->number = number;
+	record->timestamp = timestamp;
+	record->numFields = 0;
+}
+
+static void	AddRecordField(EvtxRecord* record, const char* key, uint16_t type, const uint8_t* data, size_t dataLen)
+{
+	EvtxField*	field;
+
+	if ( record->numFields >= MAX_RECORD_FIELDS )
+		return;
+
+	field = &record->fields[record->numFields++];
+	field->key = key;
+	field->type = type;
+	field->data = data;
+	field->dataLen = dataLen;
+}
+
+/*  The bytes a substitution value takes in the argument area, the parser and
+ *  the rules step through it the same way: fixed size types take their size
+ *  whatever the declared length, strings whole characters, SIDs whole
+ *  sub-authorities; false for a SID too short for its header */
+static bool	ArgumentSize(uint16_t argType, uint16_t argLen, size_t* numBytes)
+{
+	*numBytes = argLen;
+	switch(argType)
+	{
+	case EVTX_TYPE_STRING:
+		*numBytes = argLen & ~1;
+		break;
+	case EVTX_TYPE_UINT8:
+		*numBytes = sizeof(uint8_t);
+		break;
+	case EVTX_TYPE_UINT16:
+		*numBytes = sizeof(uint16_t);
+		break;
+	case EVTX_TYPE_UINT32:
+	case EVTX_TYPE_HEXINT32:
+		*numBytes = sizeof(uint32_t);
+		break;
+	case EVTX_TYPE_UINT64:
+	case EVTX_TYPE_HEXINT64:
+	case EVTX_TYPE_FILETIME:
+		*numBytes = sizeof(uint64_t);
+		break;
+	case EVTX_TYPE_GUID:
+		*numBytes = 16;
+		break;
+	case EVTX_TYPE_SID:
+		if ( argLen < 8 )
+			return false;
+		*numBytes = 8 + ( argLen - 8 ) / 4 * 4;
+		break;
+	default:
+		/*  binary, BinXml, null and unknown types */
+		break;
+	}
+	return true;
+}
+
+static const EvtxField*	FindRecordField(const EvtxRecord* record, const char* key)
+{
+	for (size_t idx = 0; idx < record->numFields; idx++)
+	{
+		if ( !strcmp(record->fields[idx].key, key) )
+			return &record->fields[idx];
+	}
+	return NULL;
+}
+
+static bool	FieldToUInt64(const EvtxField* field, uint64_t* value)
+{
+	uint8_t		v_b;
+	uint16_t	v_w;
+	uint32_t	v_d;
+	char*		endPtr	=	NULL;
+
+	if ( field == NULL )
+		return false;
+
+	switch(field->type)
+	{
+	case EVTX_TYPE_ANSI_STRING:
+		*value = strtoull((const char*)field->data, &endPtr, 0);
+		return ( endPtr != (const char*)field->data );
+	case EVTX_TYPE_UINT8:
+		if ( field->dataLen < sizeof(v_b) )
+			return false;
+		memcpy(&v_b, field->data, sizeof(v_b));
+		*value = v_b;
+		return true;
+	case EVTX_TYPE_UINT16:
+		if ( field->dataLen < sizeof(v_w) )
+			return false;
+		memcpy(&v_w, field->data, sizeof(v_w));
+		*value = v_w;
+		return true;
+	case EVTX_TYPE_UINT32:
+	case EVTX_TYPE_HEXINT32:
+		if ( field->dataLen < sizeof(v_d) )
+			return false;
+		memcpy(&v_d, field->data, sizeof(v_d));
+		*value = v_d;
+		return true;
+	case EVTX_TYPE_UINT64:
+	case EVTX_TYPE_HEXINT64:
+	case EVTX_TYPE_FILETIME:
+		if ( field->dataLen < sizeof(*value) )
+			return false;
+		memcpy(value, field->data, sizeof(*value));
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*  Only string values are converted; returns false for other types */
+static bool	FieldToString(const EvtxField* field, char* buffer, size_t bufferSize)
+{
+	size_t		bufferUsed	=	0;
+	uint16_t	w;
+
+	if ( ( field == NULL ) || ( bufferSize == 0 ) )
+		return false;
+
+	switch(field->type)
+	{
+	case EVTX_TYPE_ANSI_STRING:
+		strncpy(buffer, (const char*)field->data, bufferSize);
+		buffer[bufferSize - 1] = 0;
+		return true;
+	case EVTX_TYPE_STRING:
+		bufferUsed = Utf16AsciiPrefix(field->data, field->dataLen / 2 < bufferSize - 1 ? field->dataLen / 2 : bufferSize - 1, buffer);
+		for (size_t idx = bufferUsed * 2; idx + 1 < field->dataLen; idx += 2)
+		{
+			memcpy(&w, field->data + idx, sizeof(w));
+			if ( w == 0 )
+				break;
+			UTF16ToUTF8(w, buffer, &bufferUsed, bufferSize);
+		}
+		buffer[bufferUsed] = 0;
+		return true;
+	default:
+		return false;
+	}
+}
+
+static uint32_t	HashString(const char* str)
+{
+	uint32_t	hash	=	0x811C9DC5;
+
+	for (; *str != 0; str++)
+	{
+		hash ^= (uint8_t)*str;
+		hash *= 0x01000193;
+	}
+	return hash;
+}
+
+static void	FormatFileTime(uint64_t fileTime, char* buffer, size_t bufferSize)
+{
+	time_t		unixTimestamp	=	UnixTimeFromFileTime(fileTime);
+	struct tm	localtm;
+	struct tm*	t		=	gmtime_r(&unixTimestamp, &localtm);
+
+	if ( t == NULL )
+		snprintf(buffer, bufferSize, "%016" PRIX64, fileTime);
+	else
+		snprintf(buffer, bufferSize, "%04u.%02u.%02u-%02u:%02u:%02u",
+				t->tm_year+1900, t->tm_mon+1, t->tm_mday, t->tm_hour, t->tm_min, t->tm_sec);
+}
+
+/*  Renders any value as text; integers are printed without padding */
+static bool	FormatFieldValue(const EvtxField* field, char* buffer, size_t bufferSize)
+{
+	uint64_t	v_q	=	0;
+	size_t		used	=	0;
+
+	if ( ( field == NULL ) || ( bufferSize == 0 ) )
+		return false;
+	buffer[0] = 0;
+
+	switch(field->type)
+	{
+	case EVTX_TYPE_STRING:
+	case EVTX_TYPE_ANSI_STRING:
+		return FieldToString(field, buffer, bufferSize);
+	case EVTX_TYPE_UINT8:
+	case EVTX_TYPE_UINT16:
+	case EVTX_TYPE_UINT32:
+	case EVTX_TYPE_UINT64:
+		if ( !FieldToUInt64(field, &v_q) )
+			return false;
+		snprintf(buffer, bufferSize, "%" PRIu64, v_q);
+		return true;
+	case EVTX_TYPE_HEXINT32:
+		if ( !FieldToUInt64(field, &v_q) )
+			return false;
+		snprintf(buffer, bufferSize, "%08" PRIX64, v_q);
+		return true;
+	case EVTX_TYPE_HEXINT64:
+		if ( !FieldToUInt64(field, &v_q) )
+			return false;
+		snprintf(buffer, bufferSize, "%016" PRIX64, v_q);
+		return true;
+	case EVTX_TYPE_FILETIME:
+		if ( !FieldToUInt64(field, &v_q) )
+			return false;
+		FormatFileTime(v_q, buffer, bufferSize);
+		return true;
+	case EVTX_TYPE_GUID:
+		if ( field->dataLen < 16 )
+			return false;
+		{
+			uint32_t	d1;
+			uint16_t	w1;
+			uint16_t	w2;
+			const uint8_t*	b1	=	field->data + 8;
+
+			memcpy(&d1, field->data, sizeof(d1));
+			memcpy(&w1, field->data + 4, sizeof(w1));
+			memcpy(&w2, field->data + 6, sizeof(w2));
+			snprintf(buffer, bufferSize, "%08X-%02X-%02X-%02X%02X%02X%02X%02X%02X%02X%02X",
+					d1, w1, w2, b1[0], b1[1], b1[2], b1[3], b1[4], b1[5], b1[6], b1[7]);
+		}
+		return true;
+	case EVTX_TYPE_SID:
+		if ( field->dataLen < 8 )
+			return false;
+		for (size_t idx = 0; idx < 6; idx++)
+		{
+			v_q <<= 8;
+			v_q |= field->data[2+idx];
+		}
+		used = snprintf(buffer, bufferSize, "S-%u-%" PRIu64, field->data[0], v_q);
+		for (size_t idx = 8; idx + 4 <= field->dataLen && used < bufferSize; idx += 4)
+		{
+			uint32_t	v_d;
+
+			memcpy(&v_d, field->data + idx, sizeof(v_d));
+			used += snprintf(buffer + used, bufferSize - used, "-%u", v_d);
+		}
+		return true;
+	case EVTX_TYPE_BINARY:
+		used = ( field->dataLen < ( bufferSize - 1 ) / 2 ) ? field->dataLen : ( bufferSize - 1 ) / 2;
+		HexEncode(field->data, used, buffer);
+		buffer[used * 2] = 0;
+		return true;
+	default:
+		return false;
+	}
+}
+
+#endif
@@ -0,0 +1,158 @@
+/*
+ * =====================================================================================
+ *       Filename:  evtx_stats.cpp
+ *    Description:  Throughput counters and stage timings of the decoder (libevtxparse)
+ * =====================================================================================
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include "evtx_stats.h"
+
+static const char*	stageNames[NUM_STATS_STAGES]	=	{ "other", "I/O", "tokenizing", "templates", "arguments", "formatting" };
+
+#ifdef EVTX_STATS
+
+bool		statsEnabled	=	false;
+EvtxStats	statsCurrent;
+StatsStage	statsStage	=	StatsOther;
+uint64_t	statsStageStart	=	0;
+
+static EvtxStats	statsTotal;
+static uint64_t		fileStart	=	0;
+static uint64_t		totalTime	=	0;
+
+void	StatsAddChunkLatency(uint64_t ns)
+{
+	size_t	bucket	=	0;
+
+	for (uint64_t limit = 16000; ns >= limit && bucket + 1 < STATS_LATENCY_BUCKETS; limit <<= 1)
+		bucket++;
+	statsCurrent.chunkLatency[bucket]++;
+}
+
+#endif
+
+static void	PrintCounters(FILE* f, const char* name, const EvtxStats* stats, uint64_t wallTime)
+{
+	double	seconds	=	(double)wallTime / 1e9;
+	double	rate	=	seconds > 0 ? 1.0 / seconds : 0;
+
+	fprintf(f, "Stats %s: %" PRIu64 " bytes, %" PRIu64 " chunks, %" PRIu64 " records (%" PRIu64 " failed), "
+			"%.3f s, %.0f records/s, %.1f MB/s\n",
+			name, stats->bytesRead, stats->chunks, stats->records, stats->failedRecords,
+			seconds, (double)stats->records * rate, (double)stats->bytesRead * rate / 1e6);
+	fprintf(f, "  time:");
+	for (size_t stage = StatsIo; stage < NUM_STATS_STAGES; stage++)
+		fprintf(f, " %s %.1f%%,", stageNames[stage], wallTime > 0 ? 100.0 * (double)stats->stageTime[stage] / (double)wallTime : 0.0);
+	fprintf(f, " %s %.1f%%\n", stageNames[StatsOther], wallTime > 0 ? 100.0 * (double)stats->stageTime[StatsOther] / (double)wallTime : 0.0);
+}
+
+bool	EvtxStatsEnable(void)
+{
+#ifdef EVTX_STATS
+	memset(&statsCurrent, 0, sizeof(statsCurrent));
+	memset(&statsTotal, 0, sizeof(statsTotal));
+	statsStage = StatsOther;
+	statsStageStart = StatsClock();
+	fileStart = statsStageStart;
+	statsEnabled = true;
+	return true;
+#else
+	return false;
+#endif
+}
+
+void	EvtxStatsBeginFile(void)
+{
+#ifdef EVTX_STATS
+	if ( !statsEnabled )
+		return;
+	StatsSwitch(statsStage);
+	memset(&statsCurrent, 0, sizeof(statsCurrent));
+	fileStart = statsStageStart;
+#endif
+}
+
+void	EvtxStatsEndFile(const char* name, FILE* f)
+{
+#ifdef EVTX_STATS
+	uint64_t	wallTime;
+
+	if ( !statsEnabled )
+		return;
+	StatsSwitch(statsStage);
+	wallTime = statsStageStart - fileStart;
+	if ( name != NULL )
+		PrintCounters(f, name, &statsCurrent, wallTime);
+
+	statsTotal.bytesRead += statsCurrent.bytesRead;
+	statsTotal.chunks += statsCurrent.chunks;
+	statsTotal.records += statsCurrent.records;
+	statsTotal.failedRecords += statsCurrent.failedRecords;
+	statsTotal.templateInstances += statsCurrent.templateInstances;
+	statsTotal.templateDefinitions += statsCurrent.templateDefinitions;
+	for (size_t stage = 0; stage < NUM_STATS_STAGES; stage++)
+		statsTotal.stageTime[stage] += statsCurrent.stageTime[stage];
+	for (size_t bucket = 0; bucket < STATS_LATENCY_BUCKETS; bucket++)
+		statsTotal.chunkLatency[bucket] += statsCurrent.chunkLatency[bucket];
+	totalTime += wallTime;
+
+	memset(&statsCurrent, 0, sizeof(statsCurrent));
+	fileStart = statsStageStart;
+#endif
+}
+
+void	EvtxStatsPrintTotal(FILE* f)
+{
+#ifdef EVTX_STATS
+	uint64_t	hits;
+	const char*	separator	=	" ";
+
+	if ( !statsEnabled )
+		return;
+	/*  what was decoded outside of a file */
+	EvtxStatsEndFile(NULL, f);
+
+	PrintCounters(f, "total", &statsTotal, totalTime);
+	hits = statsTotal.templateInstances - statsTotal.templateDefinitions;
+	fprintf(f, "  templates: %" PRIu64 " instances, %" PRIu64 " definitions read, %.1f%% cache hit rate\n",
+			statsTotal.templateInstances, statsTotal.templateDefinitions,
+			statsTotal.templateInstances > 0 ? 100.0 * (double)hits / (double)statsTotal.templateInstances : 0.0);
+	fprintf(f, "  chunk decode latency:");
+	for (size_t bucket = 0; bucket < STATS_LATENCY_BUCKETS; bucket++)
+	{
+		if ( statsTotal.chunkLatency[bucket] == 0 )
+			continue;
+		if ( bucket + 1 < STATS_LATENCY_BUCKETS )
+			fprintf(f, "%s<%" PRIu64 "us %" PRIu64, separator, (uint64_t)16 << bucket, statsTotal.chunkLatency[bucket]);
+		else
+			fprintf(f, "%s>=%" PRIu64 "us %" PRIu64, separator, (uint64_t)16 << ( bucket - 1 ), statsTotal.chunkLatency[bucket]);
+		separator = ", ";
+	}
+	fprintf(f, "\n");
+#endif
+}
+
+bool	EvtxStatsGetTotal(EvtxStats* stats, uint64_t* wallTime)
+{
+#ifdef EVTX_STATS
+	if ( !statsEnabled )
+		return false;
+	EvtxStatsEndFile(NULL, NULL);
+	*stats = statsTotal;
+	*wallTime = totalTime;
+	return true;
+#else
+	return false;
+#endif
+}
+
+void	EvtxStatsDisable(void)
+{
+#ifdef EVTX_STATS
+	statsEnabled = false;
+#endif
+}
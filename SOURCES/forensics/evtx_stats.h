@@ -0,0 +1,106 @@
+/*
+ * =====================================================================================
+ *       Filename:  evtx_stats.h
+ *    Description:  Throughput counters and stage timings of the decoder (libevtxparse)
+ *
+ *                  The time of the decoding thread is charged to one stage at a
+ *                  time: STATS_ENTER switches to a stage and STATS_LEAVE back to
+ *                  the one it interrupted, so nested stages are not counted
+ *                  twice.  The clock is read on switches only, and only after
+ *                  EvtxStatsEnable().  The counters are not synchronized: one
+ *                  thread decodes.  Built without EVTX_STATS the macros are empty.
+ * =====================================================================================
+ */
+
+#ifndef evtx_stats_h_included
+#define evtx_stats_h_included
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+typedef enum
+{
+	StatsOther,
+	StatsIo,		/*  waiting for the header and chunk reads */
+	StatsTokenize,		/*  BinXml of the records */
+	StatsTemplates,		/*  template definitions and their compilation by the visitor */
+	StatsArguments,		/*  substitution values */
+	StatsVisitor,		/*  the record callbacks: formatting and what follows */
+	NUM_STATS_STAGES
+}
+StatsStage;
+
+#define STATS_LATENCY_BUCKETS	16	/*  powers of two from 16 us */
+
+typedef struct
+{
+	uint64_t	bytesRead;
+	uint64_t	chunks;
+	uint64_t	records;
+	uint64_t	failedRecords;
+	uint64_t	templateInstances;
+	uint64_t	templateDefinitions;
+	uint64_t	stageTime[NUM_STATS_STAGES];	/*  ns */
+	uint64_t	chunkLatency[STATS_LATENCY_BUCKETS];
+}
+EvtxStats;
+
+#ifdef EVTX_STATS
+
+#include <time.h>
+
+extern bool		statsEnabled;
+extern EvtxStats	statsCurrent;
+extern StatsStage	statsStage;
+extern uint64_t		statsStageStart;
+
+static inline uint64_t	StatsClock(void)
+{
+	struct timespec	now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+static inline StatsStage	StatsSwitch(StatsStage stage)
+{
+	uint64_t	now		=	StatsClock();
+	StatsStage	previous	=	statsStage;
+
+	statsCurrent.stageTime[statsStage] += now - statsStageStart;
+	statsStageStart = now;
+	statsStage = stage;
+	return previous;
+}
+
+#define STATS_ENTER(stage, saved)	StatsStage saved = statsEnabled ? StatsSwitch(stage) : StatsOther
+#define STATS_LEAVE(saved)		do { if ( statsEnabled ) StatsSwitch(saved); } while (0)
+#define STATS_COUNT(counter, n)		do { if ( statsEnabled ) statsCurrent.counter += (n); } while (0)
+#define STATS_CLOCK()			( statsEnabled ? StatsClock() : 0 )
+#define STATS_CHUNK_LATENCY(start)	do { if ( statsEnabled ) StatsAddChunkLatency(StatsClock() - (start)); } while (0)
+
+void	StatsAddChunkLatency(uint64_t ns);
+
+#else
+
+#define STATS_ENTER(stage, saved)
+#define STATS_LEAVE(saved)
+#define STATS_COUNT(counter, n)
+#define STATS_CLOCK()			0
+#define STATS_CHUNK_LATENCY(start)
+
+#endif
+
+/*  False when built without EVTX_STATS */
+bool	EvtxStatsEnable(void);
+/*  Starts the counters of a file, or of inputs decoded together */
+void	EvtxStatsBeginFile(void);
+/*  Prints the counters of the file and adds them to the total */
+void	EvtxStatsEndFile(const char* name, FILE* f);
+void	EvtxStatsPrintTotal(FILE* f);
+/*  The total so far, the file being decoded included; false when not enabled */
+bool	EvtxStatsGetTotal(EvtxStats* stats, uint64_t* wallTime);
+void	EvtxStatsDisable(void);
+
+#endif
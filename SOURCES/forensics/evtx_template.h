@@ -0,0 +1,39 @@
+/*
+ * =====================================================================================
+ *       Filename:  evtx_template.h
+ *    Description:  Template descriptions collected from BinXml template definitions
+ * =====================================================================================
+ */
+
+#ifndef evtx_template_h_included
+#define evtx_template_h_included
+
+#include <stdint.h>
+
+typedef struct sTemplateArgPair
+{
+	sTemplateArgPair*	next;
+	char*			key;
+	uint16_t		type;
+	uint16_t		argIdx;
+}
+TemplateArgPair;
+
+typedef struct	sTemplateFixedPair
+{
+	sTemplateFixedPair*	next;
+	char*			key;
+	char*			value;
+}
+TemplateFixedPair;
+
+typedef struct
+{
+	uint32_t		shortID;
+	TemplateFixedPair	fixedRoot;
+	TemplateArgPair		argsRoot;
+	void*			compiled;	/*  by the parser visitor, e.g. detection rules; may be NULL */
+}
+TemplateDescription;
+
+#endif
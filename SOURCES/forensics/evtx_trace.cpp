@@ -0,0 +1,275 @@
+/*
+ * =====================================================================================
+ *       Filename:  evtx_trace.cpp
+ *    Description:  Spans and counters of the decoder and its threads in a Chrome
+ *                  trace-event file (chrome://tracing, ui.perfetto.dev)
+ *
+ *                  A ring is registered by the first event of a thread, under a
+ *                  lock taken once per thread.  The thread moves the head, the
+ *                  drain thread the tail.  The rings outlive their threads and
+ *                  the session: a thread that passed the test of traceEnabled
+ *                  before EvtxTraceClose() may still write to its ring, so they
+ *                  are only handed to the threads of a later session, which see
+ *                  the generation change and register anew.
+ * =====================================================================================
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <pthread.h>
+#include "evtx_trace.h"
+
+typedef struct
+{
+	const char*	name;
+	const char*	argName;
+	const char*	argName2;
+	uint64_t	start;		/*  ns */
+	uint64_t	duration;
+	int64_t		arg;
+	int64_t		arg2;
+	char		phase;		/*  'X' span, 'C' counter */
+}
+TraceEvent;
+
+typedef struct
+{
+	TraceEvent	events[TRACE_RING_EVENTS];
+	uint64_t	head;		/*  moved by the thread */
+	uint64_t	tail;		/*  moved by the drain thread */
+	uint64_t	dropped;
+	unsigned int	tid;
+	char		name[64];
+}
+TraceRing;
+
+bool			traceEnabled	=	false;
+
+static FILE*		traceFile	=	NULL;
+static pthread_t	drainThread;
+static pthread_mutex_t	traceLock	=	PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	traceCond	=	PTHREAD_COND_INITIALIZER;
+static bool		stopDrain	=	false;
+static TraceRing*	rings[MAX_TRACE_THREADS];	/*  past numRings, those of earlier sessions */
+static unsigned int	numRings	=	0;
+static unsigned int	traceGeneration	=	0;
+static uint64_t		traceStart	=	0;
+static uint64_t		lostThreads	=	0;	/*  past MAX_TRACE_THREADS */
+
+static __thread TraceRing*	threadRing		=	NULL;
+static __thread unsigned int	threadGeneration	=	0;
+
+static TraceRing*	ThreadRing(void)
+{
+	unsigned int	generation	=	__atomic_load_n(&traceGeneration, __ATOMIC_ACQUIRE);
+
+	if ( threadGeneration != generation )
+	{
+		TraceRing*	ring	=	NULL;
+
+		pthread_mutex_lock(&traceLock);
+		if ( numRings < MAX_TRACE_THREADS )
+		{
+			ring = rings[numRings];
+			if ( ring == NULL )
+				ring = (TraceRing*)calloc(1, sizeof(*ring));
+			else
+			{
+				ring->head = 0;
+				ring->tail = 0;
+				ring->dropped = 0;
+				ring->name[0] = 0;
+			}
+		}
+		if ( ring != NULL )
+		{
+			ring->tid = numRings + 1;
+			rings[numRings++] = ring;
+		}
+		else
+			lostThreads++;
+		pthread_mutex_unlock(&traceLock);
+		threadRing = ring;
+		threadGeneration = generation;
+	}
+	return threadRing;
+}
+
+static void	PushEvent(const TraceEvent* event)
+{
+	TraceRing*	ring	=	ThreadRing();
+	uint64_t	head;
+
+	if ( ring == NULL )
+		return;
+	head = ring->head;
+	if ( head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= TRACE_RING_EVENTS )
+	{
+		ring->dropped++;
+		return;
+	}
+	ring->events[head & ( TRACE_RING_EVENTS - 1 )] = *event;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void	TraceSpan(const char* name, uint64_t start, const char* argName, int64_t arg, const char* argName2, int64_t arg2)
+{
+	TraceEvent	event;
+
+	event.name = name;
+	event.argName = argName;
+	event.argName2 = argName2;
+	event.start = start;
+	event.duration = TraceClock() - start;
+	event.arg = arg;
+	event.arg2 = arg2;
+	event.phase = 'X';
+	PushEvent(&event);
+}
+
+void	TraceCounter(const char* name, const char* argName, int64_t value)
+{
+	TraceEvent	event;
+
+	event.name = name;
+	event.argName = argName;
+	event.argName2 = NULL;
+	event.start = TraceClock();
+	event.duration = 0;
+	event.arg = value;
+	event.arg2 = 0;
+	event.phase = 'C';
+	PushEvent(&event);
+}
+
+static void	WriteEvent(const TraceRing* ring, const TraceEvent* event)
+{
+	fprintf(traceFile, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":1,\"tid\":%u,\"ts\":%.3f",
+			event->name, event->phase, ring->tid, (double)( event->start - traceStart ) / 1e3);
+	if ( event->phase == 'X' )
+		fprintf(traceFile, ",\"dur\":%.3f", (double)event->duration / 1e3);
+	if ( event->argName != NULL )
+	{
+		fprintf(traceFile, ",\"args\":{\"%s\":%" PRId64, event->argName, event->arg);
+		if ( event->argName2 != NULL )
+			fprintf(traceFile, ",\"%s\":%" PRId64, event->argName2, event->arg2);
+		fprintf(traceFile, "}");
+	}
+	fprintf(traceFile, "}");
+}
+
+static void	DrainRing(TraceRing* ring)
+{
+	uint64_t	head	=	__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	uint64_t	tail	=	ring->tail;
+
+	for (; tail != head; tail++)
+		WriteEvent(ring, &ring->events[tail & ( TRACE_RING_EVENTS - 1 )]);
+	__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+}
+
+static void*	DrainThread(void* arg)
+{
+	pthread_mutex_lock(&traceLock);
+	while ( !stopDrain )
+	{
+		struct timespec	deadline;
+		unsigned int	ringsNow;
+
+		/*  pthread_cond_timedwait() counts on the realtime clock */
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += TRACE_DRAIN_INTERVAL_MS * 1000000L;
+		if ( deadline.tv_nsec >= 1000000000L )
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&traceCond, &traceLock, &deadline);
+
+		ringsNow = numRings;
+		pthread_mutex_unlock(&traceLock);
+		for (unsigned int idx = 0; idx < ringsNow; idx++)
+			DrainRing(rings[idx]);
+		pthread_mutex_lock(&traceLock);
+	}
+	pthread_mutex_unlock(&traceLock);
+	return NULL;
+}
+
+bool	EvtxTraceOpen(const char* fileName)
+{
+	traceFile = fopen(fileName, "w");
+	if ( traceFile == NULL )
+	{
+		printf("Cannot create %s\n", fileName);
+		return false;
+	}
+	fprintf(traceFile, "{\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"parse_evtx\"}}");
+
+	__atomic_add_fetch(&traceGeneration, 1, __ATOMIC_RELEASE);
+	traceStart = TraceClock();
+	numRings = 0;
+	lostThreads = 0;
+	stopDrain = false;
+	__atomic_store_n(&traceEnabled, true, __ATOMIC_RELEASE);
+	if ( pthread_create(&drainThread, NULL, DrainThread, NULL) != 0 )
+	{
+		__atomic_store_n(&traceEnabled, false, __ATOMIC_RELEASE);
+		fclose(traceFile);
+		traceFile = NULL;
+		return false;
+	}
+	return true;
+}
+
+bool	EvtxTraceClose(void)
+{
+	uint64_t	dropped	=	0;
+	bool		result;
+
+	if ( traceFile == NULL )
+		return true;
+
+	__atomic_store_n(&traceEnabled, false, __ATOMIC_RELEASE);
+	pthread_mutex_lock(&traceLock);
+	stopDrain = true;
+	pthread_cond_broadcast(&traceCond);
+	pthread_mutex_unlock(&traceLock);
+	pthread_join(drainThread, NULL);
+
+	for (unsigned int idx = 0; idx < numRings; idx++)
+	{
+		TraceRing*	ring	=	rings[idx];
+
+		DrainRing(ring);
+		dropped += ring->dropped;
+		fprintf(traceFile, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+				ring->tid, ring->name[0] != 0 ? ring->name : "thread");
+	}
+	pthread_mutex_lock(&traceLock);
+	numRings = 0;
+	pthread_mutex_unlock(&traceLock);
+	fprintf(traceFile, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+	result = ( ferror(traceFile) == 0 );
+	if ( fclose(traceFile) != 0 )
+		result = false;
+	traceFile = NULL;
+
+	if ( dropped > 0 || lostThreads > 0 )
+		fprintf(stderr, "Trace: %" PRIu64 " events dropped on full rings, %" PRIu64 " threads not traced\n", dropped, lostThreads);
+	return result;
+}
+
+void	EvtxTraceThreadName(const char* name)
+{
+	TraceRing*	ring;
+
+	if ( !TRACE_ENABLED() )
+		return;
+	ring = ThreadRing();
+	if ( ring != NULL )
+		snprintf(ring->name, sizeof(ring->name), "%s", name);
+}
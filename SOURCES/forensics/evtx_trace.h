@@ -0,0 +1,61 @@
+/*
+ * =====================================================================================
+ *       Filename:  evtx_trace.h
+ *    Description:  Spans and counters of the decoder and its threads in a Chrome
+ *                  trace-event file (chrome://tracing, ui.perfetto.dev)
+ *
+ *                  Every thread records into a ring of its own that only it
+ *                  writes and a drain thread empties into the file, neither
+ *                  takes a lock.  An event that finds its ring full is dropped
+ *                  and counted.  Without EvtxTraceOpen() a trace point costs a
+ *                  test of traceEnabled, an atomic load: threads that are still
+ *                  running may pass it just before EvtxTraceClose() clears it.
+ * =====================================================================================
+ */
+
+#ifndef evtx_trace_h_included
+#define evtx_trace_h_included
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+#define TRACE_RING_EVENTS	8192		/*  per thread, a power of two */
+#define MAX_TRACE_THREADS	256
+#define TRACE_DRAIN_INTERVAL_MS	10
+
+extern bool	traceEnabled;		/*  read and written with __atomic builtins */
+
+#define TRACE_ENABLED()		__atomic_load_n(&traceEnabled, __ATOMIC_RELAXED)
+
+static inline uint64_t	TraceClock(void)
+{
+	struct timespec	now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+/*  name and argName must be string constants, they are formatted by the drain thread */
+void	TraceSpan(const char* name, uint64_t start, const char* argName, int64_t arg, const char* argName2, int64_t arg2);
+void	TraceCounter(const char* name, const char* argName, int64_t value);
+
+#define TRACE_BEGIN(start)				uint64_t start = TRACE_ENABLED() ? TraceClock() : 0
+#define TRACE_END(name, start)				do { if ( TRACE_ENABLED() ) TraceSpan(name, start, NULL, 0, NULL, 0); } while (0)
+#define TRACE_END_ARG(name, start, argName, arg)	do { if ( TRACE_ENABLED() ) TraceSpan(name, start, argName, (int64_t)(arg), NULL, 0); } while (0)
+#define TRACE_END_ARGS(name, start, argName, arg, argName2, arg2) \
+	do { if ( TRACE_ENABLED() ) TraceSpan(name, start, argName, (int64_t)(arg), argName2, (int64_t)(arg2)); } while (0)
+#define TRACE_COUNTER(name, argName, value)		do { if ( TRACE_ENABLED() ) TraceCounter(name, argName, (int64_t)(value)); } while (0)
+/*  Time too finely cut for spans of its own, reported as an argument */
+#define TRACE_ADD(total, start)				do { if ( TRACE_ENABLED() ) (total) += TraceClock() - (start); } while (0)
+
+/*  Starts the drain thread; false when the file cannot be created */
+bool	EvtxTraceOpen(const char* fileName);
+/*  Drains the rings and ends the file, the events dropped are reported to
+ *  stderr; false when a write failed.  Events of threads still running are
+ *  lost, their rings stay allocated for the next session. */
+bool	EvtxTraceClose(void);
+/*  Names the calling thread in the trace */
+void	EvtxTraceThreadName(const char* name);
+
+#endif
@@ -0,0 +1,315 @@
+/*
+ * =====================================================================================
+ *       Filename:  logon_sessions.cpp
+ *    Description:  Streaming logon session reconstruction (4624/4634/4647/4672)
+ *
+ *                  Sessions are tracked by (Computer, TargetLogonId) in a bounded
+ *                  open addressing table.  When the table is full the least recently
+ *                  touched session is emitted as 'evicted' to make room.
+ * =====================================================================================
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "logon_sessions.h"
+#include "output_sink.h"
+
+#define EVENT_LOGON		4624
+#define EVENT_LOGOFF		4634
+#define EVENT_USER_LOGOFF	4647
+#define EVENT_SPECIAL_PRIVILEGES	4672
+
+#define SESSION_PRIVILEGED	0x01
+#define SESSION_USER_LOGOFF	0x02
+#define SESSION_LOGON_SEEN	0x04
+
+#define INVALID_SESSION_IDX	((uint32_t)-1)
+
+typedef struct
+{
+	uint64_t	logonId;
+	uint32_t	computerHash;
+	uint32_t	flags;
+	uint64_t	logonTime;
+	uint64_t	logoffTime;
+	uint32_t	logonType;
+	uint32_t	prevIdx;
+	uint32_t	nextIdx;
+	char		computer[64];
+	char		userName[96];
+	char		domainName[64];
+	char		ipAddress[48];
+}
+LogonSession;
+
+static LogonSession*	sessions	=	NULL;
+static uint32_t*	slots		=	NULL;	/*  session index + 1, 0 for an empty slot */
+static uint32_t*	freeList	=	NULL;
+static size_t		numFree		=	0;
+static size_t		slotMask	=	0;
+static uint32_t		lruHead		=	INVALID_SESSION_IDX;
+static uint32_t		lruTail		=	INVALID_SESSION_IDX;
+
+static size_t	SlotForKey(uint64_t logonId, uint32_t computerHash)
+{
+	uint64_t	h	=	logonId ^ ( (uint64_t)computerHash << 32 );
+
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	return (size_t)h & slotMask;
+}
+
+bool	LogonSessionsInit(size_t numSessions)
+{
+	size_t	numSlots	=	1;
+
+	if ( numSessions == 0 )
+		numSessions = DEFAULT_MAX_SESSIONS;
+	while ( numSlots < numSessions * 2 )
+		numSlots <<= 1;
+
+	sessions = (LogonSession*)malloc(sizeof(*sessions) * numSessions);
+	slots = (uint32_t*)calloc(numSlots, sizeof(*slots));
+	freeList = (uint32_t*)malloc(sizeof(*freeList) * numSessions);
+	if ( sessions == NULL || slots == NULL || freeList == NULL )
+	{
+		free(sessions);
+		free(slots);
+		free(freeList);
+		sessions = NULL;
+		slots = NULL;
+		freeList = NULL;
+		return false;
+	}
+
+	for (size_t idx = 0; idx < numSessions; idx++)
+		freeList[idx] = numSessions - 1 - idx;
+	numFree = numSessions;
+	slotMask = numSlots - 1;
+	lruHead = INVALID_SESSION_IDX;
+	lruTail = INVALID_SESSION_IDX;
+
+	return true;
+}
+
+static void	LruUnlink(uint32_t idx)
+{
+	LogonSession*	s	=	&sessions[idx];
+
+	if ( s->prevIdx != INVALID_SESSION_IDX )
+		sessions[s->prevIdx].nextIdx = s->nextIdx;
+	else
+		lruHead = s->nextIdx;
+	if ( s->nextIdx != INVALID_SESSION_IDX )
+		sessions[s->nextIdx].prevIdx = s->prevIdx;
+	else
+		lruTail = s->prevIdx;
+}
+
+static void	LruAppend(uint32_t idx)
+{
+	sessions[idx].prevIdx = lruTail;
+	sessions[idx].nextIdx = INVALID_SESSION_IDX;
+	if ( lruTail != INVALID_SESSION_IDX )
+		sessions[lruTail].nextIdx = idx;
+	else
+		lruHead = idx;
+	lruTail = idx;
+}
+
+static bool	FindSlot(uint64_t logonId, uint32_t computerHash, size_t* slotIdx)
+{
+	size_t	pos	=	SlotForKey(logonId, computerHash);
+
+	while ( slots[pos] != 0 )
+	{
+		LogonSession*	s	=	&sessions[slots[pos] - 1];
+		if ( s->logonId == logonId && s->computerHash == computerHash )
+		{
+			*slotIdx = pos;
+			return true;
+		}
+		pos = ( pos + 1 ) & slotMask;
+	}
+
+	*slotIdx = pos;
+	return false;
+}
+
+/*  Backward shift deletion keeps probe sequences intact without tombstones */
+static void	RemoveSession(size_t slotIdx)
+{
+	uint32_t	idx	=	slots[slotIdx] - 1;
+	size_t		hole	=	slotIdx;
+	size_t		pos	=	slotIdx;
+
+	LruUnlink(idx);
+	freeList[numFree++] = idx;
+
+	for (;;)
+	{
+		size_t	home;
+
+		pos = ( pos + 1 ) & slotMask;
+		if ( slots[pos] == 0 )
+			break;
+		home = SlotForKey(sessions[slots[pos] - 1].logonId, sessions[slots[pos] - 1].computerHash);
+		if ( ( ( pos - home ) & slotMask ) >= ( ( pos - hole ) & slotMask ) )
+		{
+			slots[hole] = slots[pos];
+			hole = pos;
+		}
+	}
+	slots[hole] = 0;
+}
+
+static void	PrintSession(const LogonSession* s, const char* state)
+{
+	char	logonTime[32]	=	"-";
+	char	logoffTime[32]	=	"-";
+
+	if ( s->flags & SESSION_LOGON_SEEN )
+		FormatFileTime(s->logonTime, logonTime, sizeof(logonTime));
+	if ( s->logoffTime != 0 )
+		FormatFileTime(s->logoffTime, logoffTime, sizeof(logoffTime));
+
+	SinkPrintf("Session 'Computer':'%s', 'TargetLogonId':%016" PRIX64 ", 'LogonTime':%s, 'LogoffTime':%s, ",
+			s->computer, s->logonId, logonTime, logoffTime);
+	if ( ( s->flags & SESSION_LOGON_SEEN ) && s->logoffTime >= s->logonTime )
+		SinkPrintf("'Duration':%" PRIu64 ", ", ( s->logoffTime - s->logonTime ) / 10000000);
+	else
+		SinkPrintf("'Duration':-, ");
+	if ( s->logonType <= MAX_LOGON_TYPE && logonTypes[s->logonType] != NULL )
+		SinkPrintf("'LogonType':%08u (%s), ", s->logonType, logonTypes[s->logonType]);
+	else
+		SinkPrintf("'LogonType':%08u, ", s->logonType);
+	SinkPrintf("'TargetUserName':'%s', 'TargetDomainName':'%s', 'IpAddress':'%s', 'Privileged':%u, 'UserLogoff':%u, 'State':'%s'\n",
+			s->userName, s->domainName, s->ipAddress,
+			( s->flags & SESSION_PRIVILEGED ) ? 1 : 0,
+			( s->flags & SESSION_USER_LOGOFF ) ? 1 : 0,
+			state);
+	SinkEndRecord();
+}
+
+static uint32_t	AddSession(uint64_t logonId, uint32_t computerHash, const char* computer, size_t* slotIdx)
+{
+	uint32_t	idx;
+	LogonSession*	s;
+
+	if ( numFree == 0 )
+	{
+		size_t	victimSlot;
+
+		/*  memory pressure: flush the least recently touched session */
+		if ( !FindSlot(sessions[lruHead].logonId, sessions[lruHead].computerHash, &victimSlot) )
+			return INVALID_SESSION_IDX;
+		PrintSession(&sessions[lruHead], "evicted");
+		RemoveSession(victimSlot);
+		/*  the removal may have shifted our free slot */
+		FindSlot(logonId, computerHash, slotIdx);
+	}
+
+	idx = freeList[--numFree];
+	s = &sessions[idx];
+	memset(s, 0, sizeof(*s));
+	s->logonId = logonId;
+	s->computerHash = computerHash;
+	strncpy(s->computer, computer, sizeof(s->computer));
+	s->computer[sizeof(s->computer) - 1] = 0;
+	slots[*slotIdx] = idx + 1;
+	LruAppend(idx);
+
+	return idx;
+}
+
+void	LogonSessionsOnRecord(const EvtxRecord* record)
+{
+	uint64_t	eventID;
+	uint64_t	logonId;
+	uint64_t	v_q;
+	uint32_t	computerHash;
+	char		computer[64]	=	"";
+	size_t		slotIdx;
+	uint32_t	idx;
+	LogonSession*	s;
+
+	if ( sessions == NULL )
+		return;
+	if ( !FieldToUInt64(FindRecordField(record, "EventID"), &eventID) )
+		return;
+	if ( eventID != EVENT_LOGON &&
+		eventID != EVENT_LOGOFF &&
+		eventID != EVENT_USER_LOGOFF &&
+		eventID != EVENT_SPECIAL_PRIVILEGES )
+	{
+		return;
+	}
+
+	if ( !FieldToUInt64(FindRecordField(record, eventID == EVENT_SPECIAL_PRIVILEGES ? "SubjectLogonId" : "TargetLogonId"), &logonId) )
+		return;
+	FieldToString(FindRecordField(record, "Computer"), computer, sizeof(computer));
+	computerHash = HashString(computer);
+
+	if ( FindSlot(logonId, computerHash, &slotIdx) )
+	{
+		idx = slots[slotIdx] - 1;
+		LruUnlink(idx);
+		LruAppend(idx);
+	}
+	else
+	{
+		idx = AddSession(logonId, computerHash, computer, &slotIdx);
+		if ( idx == INVALID_SESSION_IDX )
+			return;
+	}
+	s = &sessions[idx];
+
+	switch(eventID)
+	{
+	case EVENT_LOGON:
+		s->flags |= SESSION_LOGON_SEEN;
+		s->logonTime = record->timestamp;
+		if ( FieldToUInt64(FindRecordField(record, "LogonType"), &v_q) )
+			s->logonType = (uint32_t)v_q;
+		FieldToString(FindRecordField(record, "TargetUserName"), s->userName, sizeof(s->userName));
+		FieldToString(FindRecordField(record, "TargetDomainName"), s->domainName, sizeof(s->domainName));
+		FieldToString(FindRecordField(record, "IpAddress"), s->ipAddress, sizeof(s->ipAddress));
+		break;
+	case EVENT_SPECIAL_PRIVILEGES:
+		/*  4672 is logged right before the matching 4624 */
+		s->flags |= SESSION_PRIVILEGED;
+		break;
+	case EVENT_USER_LOGOFF:
+		s->flags |= SESSION_USER_LOGOFF;
+		s->logoffTime = record->timestamp;
+		break;
+	case EVENT_LOGOFF:
+		s->logoffTime = record->timestamp;
+		if ( s->userName[0] == 0 )
+			FieldToString(FindRecordField(record, "TargetUserName"), s->userName, sizeof(s->userName));
+		if ( s->domainName[0] == 0 )
+			FieldToString(FindRecordField(record, "TargetDomainName"), s->domainName, sizeof(s->domainName));
+		if ( !( s->flags & SESSION_LOGON_SEEN ) && FieldToUInt64(FindRecordField(record, "LogonType"), &v_q) )
+			s->logonType = (uint32_t)v_q;
+		PrintSession(s, "closed");
+		RemoveSession(slotIdx);
+		break;
+	}
+}
+
+void	LogonSessionsFlush(void)
+{
+	if ( sessions == NULL )
+		return;
+
+	for (uint32_t idx = lruHead; idx != INVALID_SESSION_IDX; idx = sessions[idx].nextIdx)
+		PrintSession(&sessions[idx], "open");
+
+	free(sessions);
+	free(slots);
+	free(freeList);
+	sessions = NULL;
+	slots = NULL;
+	freeList = NULL;
+}
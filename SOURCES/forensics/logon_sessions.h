@@ -0,0 +1,20 @@
+/*
+ * =====================================================================================
+ *       Filename:  logon_sessions.h
+ *    Description:  Streaming logon session reconstruction (4624/4634/4647/4672)
+ * =====================================================================================
+ */
+
+#ifndef logon_sessions_h_included
+#define logon_sessions_h_included
+
+#include "evtx_record.h"
+
+#define DEFAULT_MAX_SESSIONS	65536
+
+bool	LogonSessionsInit(size_t maxSessions);
+void	LogonSessionsOnRecord(const EvtxRecord* record);
+/*  Emits every session still open and releases the table */
+void	LogonSessionsFlush(void);
+
+#endif
@@ -0,0 +1,569 @@
+/*
+ * =====================================================================================
+ *       Filename:  main_bench_parse_evtx.cpp
+ *    Description:  Decoder benchmarks on synthetic or given EVTX logs
+ *
+ *                  decode      libevtxparse with a visitor that only counts
+ *                  tokenize, templates, arguments
+ *                              the decoder stages of a --stats run, in ns per
+ *                              record only: their bytes are not their own
+ *                  utf16       the string values to UTF-8 (FieldToString)
+ *                  format      the fields as parse_evtx prints them
+ *                              (PrintRecordFields), into a batch
+ *                  end_to_end  parse_evtx with its output to /dev/null
+ *
+ *                  The fastest of --repeat runs counts.  --json writes one
+ *                  result per line so files of two builds can be diffed, and
+ *                  --baseline compares with such a file.
+ * =====================================================================================
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <utils/win_types.h>
+#ifndef _WIN32
+#include <sys/wait.h>
+#endif
+#include "evtx_parser.h"
+#include "evtx_stats.h"
+#include "evtx_corpus.h"
+#include "record_text.h"
+#include "record_batch.h"
+#include "cpu_dispatch.h"
+
+#define DEFAULT_BENCH_RECORDS	50000
+#define DEFAULT_BENCH_REPEAT	3
+#define DEFAULT_BENCH_THRESHOLD	5.0	/*  percent */
+#define MAX_BENCH_RESULTS	256
+#define BENCH_TEXT_SIZE		0x10000
+#define BENCH_BATCH_SIZE	0x100000	/*  text kept before the batch is cleared */
+
+typedef struct
+{
+	char		corpus[64];
+	char		benchmark[32];
+	uint64_t	numRecords;
+	uint64_t	numBytes;	/*  read, transcoded or formatted */
+	uint64_t	time;		/*  ns */
+	bool		stage;		/*  a part of the decode time, only ns/record tells */
+}
+BenchResult;
+
+typedef struct
+{
+	const char*	name;
+	unsigned int	numTemplates;
+	unsigned int	fieldsPerTemplate;
+	const char*	types;
+	unsigned int	minStringLength;
+	unsigned int	maxStringLength;
+}
+BenchCorpus;
+
+static const BenchCorpus	corpora[]	=
+{
+	{ "mixed",	32,	8,	"all",		4,	48 },
+	{ "strings",	32,	16,	"string",	64,	512 },
+	{ "templates",	1024,	8,	"all",		4,	48 },
+	{ "binxml",	32,	8,	"binxml,int",	4,	48 },
+};
+
+typedef enum
+{
+	VisitCount,
+	VisitUTF16,
+	VisitFormat
+}
+BenchVisit;
+
+typedef struct
+{
+	BenchVisit	visit;
+	uint64_t	numRecords;
+	uint64_t	numBytes;
+	uint64_t	time;
+	char		text[BENCH_TEXT_SIZE];
+}
+BenchContext;
+
+static BenchResult	results[MAX_BENCH_RESULTS];
+static size_t		numResults	=	0;
+static unsigned int	repeat		=	DEFAULT_BENCH_REPEAT;
+static const char*	cpuTierName	=	NULL;
+static RecordBatch	formatBatch;
+
+static uint64_t	Clock(void)
+{
+	struct timespec	now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+static void	FormatPrintf(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+static void	FormatPrintf(const char* format, ...)
+{
+	va_list	args;
+
+	va_start(args, format);
+	BatchAppendV(&formatBatch, format, args);
+	va_end(args);
+}
+
+static void	OnRecord(void* context, const EvtxRecord* record, uint64_t chunkOffset, uint32_t inChunkOffset)
+{
+	BenchContext*	bench	=	(BenchContext*)context;
+	uint64_t	start;
+
+	bench->numRecords++;
+	if ( bench->visit == VisitCount )
+		return;
+
+	start = Clock();
+	if ( bench->visit == VisitUTF16 )
+	{
+		for (size_t idx = 0; idx < record->numFields; idx++)
+		{
+			const EvtxField*	field	=	&record->fields[idx];
+
+			if ( field->type != EVTX_TYPE_STRING )
+				continue;
+			FieldToString(field, bench->text, sizeof(bench->text));
+			bench->numBytes += field->dataLen;
+		}
+	}
+	else
+	{
+		size_t	textLen	=	formatBatch.textUsed;
+
+		if ( textLen > BENCH_BATCH_SIZE )
+		{
+			ClearBatch(&formatBatch);
+			textLen = 0;
+		}
+		PrintRecordFields(record, FormatPrintf);
+		bench->numBytes += formatBatch.textUsed - textLen;
+	}
+	bench->time += Clock() - start;
+}
+
+static void	AddResult(const char* corpus, const char* benchmark, uint64_t numRecords, uint64_t numBytes, uint64_t time)
+{
+	BenchResult*	result;
+
+	if ( numResults >= MAX_BENCH_RESULTS )
+		return;
+	result = &results[numResults++];
+	snprintf(result->corpus, sizeof(result->corpus), "%s", corpus);
+	snprintf(result->benchmark, sizeof(result->benchmark), "%s", benchmark);
+	result->numRecords = numRecords;
+	result->numBytes = numBytes;
+	result->time = time > 0 ? time : 1;
+	result->stage = false;
+
+	printf("%-12s %-11s %12.0f records/s %9.1f MB/s %9.1f ns/record\n", result->corpus, result->benchmark,
+			(double)numRecords * 1e9 / (double)result->time, (double)numBytes * 1e3 / (double)result->time,
+			numRecords > 0 ? (double)result->time / (double)numRecords : 0.0);
+	fflush(stdout);
+}
+
+/*  A decoder stage: its time is spread over the records, the bytes were read
+ *  for all the stages together */
+static void	AddStageResult(const char* corpus, const char* benchmark, uint64_t numRecords, uint64_t time)
+{
+	BenchResult*	result;
+
+	if ( numResults >= MAX_BENCH_RESULTS )
+		return;
+	result = &results[numResults++];
+	snprintf(result->corpus, sizeof(result->corpus), "%s", corpus);
+	snprintf(result->benchmark, sizeof(result->benchmark), "%s", benchmark);
+	result->numRecords = numRecords;
+	result->numBytes = 0;
+	result->time = time > 0 ? time : 1;
+	result->stage = true;
+
+	printf("%-12s %-11s %12s           %9s      %9.1f ns/record\n", result->corpus, result->benchmark, "-", "-",
+			numRecords > 0 ? (double)result->time / (double)numRecords : 0.0);
+	fflush(stdout);
+}
+
+/*  One pass of the decoder over the file, false when it fails */
+static bool	DecodeFile(const char* fileName, struct sEvtxParser* parser, uint64_t* fileSize)
+{
+	int			f	=	open(fileName, O_RDONLY|O_BINARY);
+	struct sChunkReader*	reader;
+	bool			result;
+
+	if ( f < 0 )
+		return false;
+	reader = ChunkReaderOpenFile(f);
+	result = ( reader != NULL && EvtxParseLog(parser, reader) );
+	if ( reader != NULL )
+		*fileSize = reader->offset;
+	ChunkReaderClose(reader);
+	close(f);
+	return result;
+}
+
+static bool	BenchDecoder(const char* corpus, const char* fileName)
+{
+	static BenchContext	bench;
+	EvtxVisitor		visitor;
+	struct sEvtxParser*	parser;
+	uint64_t		fileSize	=	0;
+	uint64_t		best[3]		=	{ UINT64_MAX, UINT64_MAX, UINT64_MAX };
+	uint64_t		numBytes[3]	=	{ 0, 0, 0 };
+	uint64_t		numRecords	=	0;
+	EvtxStats		stats;
+	uint64_t		wallTime;
+
+	memset(&visitor, 0, sizeof(visitor));
+	visitor.context = &bench;
+	visitor.record = OnRecord;
+	parser = EvtxParserCreate(&visitor);
+	if ( parser == NULL )
+		return false;
+
+	/*  one pass to warm the page cache */
+	bench.visit = VisitCount;
+	if ( !DecodeFile(fileName, parser, &fileSize) )
+	{
+		printf("Failed on %s\n", fileName);
+		EvtxParserFree(parser);
+		return false;
+	}
+
+	for (unsigned int run = 0; run < repeat; run++)
+	{
+		for (int visit = VisitCount; visit <= VisitFormat; visit++)
+		{
+			uint64_t	start	=	Clock();
+			uint64_t	time;
+
+			bench.visit = (BenchVisit)visit;
+			bench.numRecords = 0;
+			bench.numBytes = 0;
+			bench.time = 0;
+			DecodeFile(fileName, parser, &fileSize);
+			time = ( visit == VisitCount ) ? Clock() - start : bench.time;
+			if ( time < best[visit] )
+				best[visit] = time;
+			numBytes[visit] = ( visit == VisitCount ) ? fileSize : bench.numBytes;
+			numRecords = bench.numRecords;
+		}
+	}
+	AddResult(corpus, "decode", numRecords, numBytes[VisitCount], best[VisitCount]);
+
+	/*  apart, the timers have a cost of their own */
+	bench.visit = VisitCount;
+	if ( EvtxStatsEnable() )
+	{
+		DecodeFile(fileName, parser, &fileSize);
+		EvtxStatsGetTotal(&stats, &wallTime);
+		EvtxStatsDisable();
+		AddStageResult(corpus, "tokenize", stats.records, stats.stageTime[StatsTokenize]);
+		AddStageResult(corpus, "templates", stats.records, stats.stageTime[StatsTemplates]);
+		AddStageResult(corpus, "arguments", stats.records, stats.stageTime[StatsArguments]);
+	}
+
+	AddResult(corpus, "utf16", numRecords, numBytes[VisitUTF16], best[VisitUTF16]);
+	AddResult(corpus, "format", numRecords, numBytes[VisitFormat], best[VisitFormat]);
+
+	FreeBatch(&formatBatch);
+	EvtxParserFree(parser);
+	return true;
+}
+
+/*  decode is the result of BenchDecoder() on the file */
+static bool	BenchEndToEnd(const char* corpus, const char* fileName, const char* parseEvtx, const BenchResult* decode)
+{
+#ifdef _WIN32
+	return true;
+#else
+	uint64_t	best	=	UINT64_MAX;
+
+	for (unsigned int run = 0; run < repeat; run++)
+	{
+		uint64_t	start	=	Clock();
+		uint64_t	time;
+		int		status;
+		pid_t		pid	=	fork();
+
+		if ( pid == 0 )
+		{
+			int	devNull	=	open("/dev/null", O_WRONLY);
+
+			if ( devNull >= 0 )
+				dup2(devNull, STDOUT_FILENO);
+			if ( cpuTierName != NULL )
+				execl(parseEvtx, parseEvtx, "--cpu-tier", cpuTierName, fileName, (char*)NULL);
+			else
+				execl(parseEvtx, parseEvtx, fileName, (char*)NULL);
+			_exit(127);
+		}
+		if ( pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0 )
+		{
+			printf("Failed on %s %s\n", parseEvtx, fileName);
+			return false;
+		}
+		time = Clock() - start;
+		if ( time < best )
+			best = time;
+	}
+	AddResult(corpus, "end_to_end", decode->numRecords, decode->numBytes, best);
+	return true;
+#endif
+}
+
+static void	WriteDouble(FILE* f, const char* name, double value)
+{
+	fprintf(f, ",\"%s\":%.3f", name, value);
+}
+
+static bool	WriteResults(const char* fileName)
+{
+	FILE*	f	=	fopen(fileName, "w");
+	bool	result;
+
+	if ( f == NULL )
+	{
+		printf("Cannot create %s\n", fileName);
+		return false;
+	}
+	fprintf(f, "{\"tool\":\"bench_parse_evtx\",\"version\":1,\"cpu_tier\":\"%s\",\"results\":[\n", CpuTierName(CpuActiveTier()));
+	for (size_t idx = 0; idx < numResults; idx++)
+	{
+		const BenchResult*	r	=	&results[idx];
+
+		fprintf(f, "{\"corpus\":\"%s\",\"benchmark\":\"%s\",\"records\":%" PRIu64 ",\"bytes\":%" PRIu64 ",\"ns\":%" PRIu64,
+				r->corpus, r->benchmark, r->numRecords, r->numBytes, r->time);
+		if ( !r->stage )
+		{
+			WriteDouble(f, "records_per_s", (double)r->numRecords * 1e9 / (double)r->time);
+			WriteDouble(f, "mb_per_s", (double)r->numBytes * 1e3 / (double)r->time);
+		}
+		WriteDouble(f, "ns_per_record", r->numRecords > 0 ? (double)r->time / (double)r->numRecords : 0.0);
+		fprintf(f, "}%s\n", idx + 1 < numResults ? "," : "");
+	}
+	fprintf(f, "]}\n");
+	result = ( ferror(f) == 0 );
+	return ( fclose(f) == 0 && result );
+}
+
+/*  The value of "name": in a line written by WriteResults() */
+static bool	FindValue(const char* line, const char* name, char* value, size_t valueSize)
+{
+	char		key[64];
+	const char*	start;
+	size_t		len;
+
+	snprintf(key, sizeof(key), "\"%s\":", name);
+	start = strstr(line, key);
+	if ( start == NULL )
+		return false;
+	start += strlen(key);
+	if ( *start == '"' )
+		start++;
+	len = strcspn(start, "\",}");
+	if ( len >= valueSize )
+		return false;
+	memcpy(value, start, len);
+	value[len] = 0;
+	return true;
+}
+
+/*  Returns the number of benchmarks slower than threshold percent, -1 on errors */
+static int	CompareBaseline(const char* fileName, double threshold)
+{
+	FILE*	f	=	fopen(fileName, "r");
+	char	line[1024];
+	int	numSlower	=	0;
+
+	if ( f == NULL )
+	{
+		printf("Cannot open %s\n", fileName);
+		return -1;
+	}
+	printf("\n%-12s %-11s %12s %12s %8s\n", "corpus", "benchmark", "baseline ns", "now ns", "change");
+	while ( fgets(line, sizeof(line), f) != NULL )
+	{
+		char	corpus[64];
+		char	benchmark[32];
+		char	value[32];
+		double	baseline;
+
+		if ( !FindValue(line, "corpus", corpus, sizeof(corpus)) ||
+			!FindValue(line, "benchmark", benchmark, sizeof(benchmark)) ||
+			!FindValue(line, "ns_per_record", value, sizeof(value)) )
+		{
+			continue;
+		}
+		baseline = strtod(value, NULL);
+		for (size_t idx = 0; idx < numResults; idx++)
+		{
+			const BenchResult*	r	=	&results[idx];
+			double			now;
+			double			change;
+
+			if ( strcmp(r->corpus, corpus) || strcmp(r->benchmark, benchmark) || r->numRecords == 0 || baseline <= 0 )
+				continue;
+			now = (double)r->time / (double)r->numRecords;
+			change = 100.0 * ( now - baseline ) / baseline;
+			printf("%-12s %-11s %12.1f %12.1f %+7.1f%%%s\n", corpus, benchmark, baseline, now, change,
+					change > threshold ? "  slower" : "");
+			if ( change > threshold )
+				numSlower++;
+		}
+	}
+	fclose(f);
+	return numSlower;
+}
+
+static bool	GenerateCorpus(const BenchCorpus* corpus, const char* fileName, uint64_t numRecords)
+{
+	CorpusOptions	options;
+
+	CorpusDefaultOptions(&options);
+	options.numRecords = numRecords;
+	options.numTemplates = corpus->numTemplates;
+	options.fieldsPerTemplate = corpus->fieldsPerTemplate;
+	options.minStringLength = corpus->minStringLength;
+	options.maxStringLength = corpus->maxStringLength;
+	return CorpusParseTypes(corpus->types, &options.typeMask) && CorpusWriteFile(fileName, &options, NULL);
+}
+
+static void	Usage(const char* programName)
+{
+	printf("Usage: %s [options] [file.evtx ...]\n", programName);
+	printf("  without files the corpora mixed, strings, templates and binxml are generated and measured\n");
+	printf("  --records N         records per generated corpus (default %u)\n", DEFAULT_BENCH_RECORDS);
+	printf("  --corpus-dir DIR    keep the generated corpora in DIR (default: temporary files removed after)\n");
+	printf("  --repeat N          runs per benchmark, the fastest counts (default %u)\n", DEFAULT_BENCH_REPEAT);
+	printf("  --json FILE         write the results to FILE, one per line\n");
+	printf("  --baseline FILE     compare ns/record with an earlier --json file, exit code 2 when a benchmark\n");
+	printf("                      is slower by more than the threshold\n");
+	printf("  --threshold PCT     allowed slowdown (default %.0f)\n", DEFAULT_BENCH_THRESHOLD);
+	printf("  --parse-evtx PATH   the parse_evtx for end_to_end (default %s)\n", PARSE_EVTX_PATH);
+	printf("  --no-end-to-end     measure the library only\n");
+	printf("  --cpu-tier TIER     run the kernels, of parse_evtx too, at a lower tier: scalar, sse2, sse4, avx2 or avx512\n");
+}
+
+int main(int argc, char* argv[])
+{
+	uint64_t	numRecords	=	DEFAULT_BENCH_RECORDS;
+	const char*	corpusDir	=	NULL;
+	const char*	jsonName	=	NULL;
+	const char*	baselineName	=	NULL;
+	double		threshold	=	DEFAULT_BENCH_THRESHOLD;
+	const char*	parseEvtx	=	PARSE_EVTX_PATH;
+	bool		endToEnd	=	true;
+	int		numFiles	=	0;
+	int		result		=	0;
+
+	for (int idx = 1; idx < argc; idx++)
+	{
+		if ( !strcmp(argv[idx], "--records") && ( idx + 1 < argc ) )
+			numRecords = strtoull(argv[++idx], NULL, 10);
+		else if ( !strcmp(argv[idx], "--corpus-dir") && ( idx + 1 < argc ) )
+			corpusDir = argv[++idx];
+		else if ( !strcmp(argv[idx], "--repeat") && ( idx + 1 < argc ) )
+			repeat = strtoul(argv[++idx], NULL, 10);
+		else if ( !strcmp(argv[idx], "--json") && ( idx + 1 < argc ) )
+			jsonName = argv[++idx];
+		else if ( !strcmp(argv[idx], "--baseline") && ( idx + 1 < argc ) )
+			baselineName = argv[++idx];
+		else if ( !strcmp(argv[idx], "--threshold") && ( idx + 1 < argc ) )
+			threshold = strtod(argv[++idx], NULL);
+		else if ( !strcmp(argv[idx], "--parse-evtx") && ( idx + 1 < argc ) )
+			parseEvtx = argv[++idx];
+		else if ( !strcmp(argv[idx], "--no-end-to-end") )
+			endToEnd = false;
+		else if ( !strcmp(argv[idx], "--cpu-tier") && ( idx + 1 < argc ) )
+			cpuTierName = argv[++idx];
+		else if ( argv[idx][0] != '-' )
+			argv[1 + numFiles++] = argv[idx];
+		else
+		{
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+	if ( repeat == 0 )
+		repeat = 1;
+	if ( cpuTierName != NULL && !CpuSetTier(cpuTierName) )
+	{
+		printf("--cpu-tier: %s is not one of the tiers of this CPU, up to %s\n", cpuTierName, CpuTierName(CpuBestTier()));
+		return 1;
+	}
+	printf("kernels at the %s tier\n", CpuTierName(CpuActiveTier()));
+	if ( !RecordTextInit() )
+	{
+		printf("Not enough memory for the event descriptions\n");
+		return 1;
+	}
+
+	if ( numFiles > 0 )
+	{
+		for (int idx = 1; idx <= numFiles && result == 0; idx++)
+		{
+			const char*	baseName	=	strrchr(argv[idx], '/');
+			size_t		decode		=	numResults;
+
+			baseName = ( baseName != NULL ) ? baseName + 1 : argv[idx];
+			if ( !BenchDecoder(baseName, argv[idx]) )
+				result = 1;
+			else if ( endToEnd && !BenchEndToEnd(baseName, argv[idx], parseEvtx, &results[decode]) )
+				result = 1;
+		}
+	}
+	else
+	{
+		const char*	dir	=	corpusDir;
+
+		if ( dir == NULL )
+			dir = getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+		for (size_t idx = 0; idx < sizeof(corpora) / sizeof(corpora[0]) && result == 0; idx++)
+		{
+			char	fileName[4096];
+			size_t	decode	=	numResults;
+
+			if ( corpusDir != NULL )
+				snprintf(fileName, sizeof(fileName), "%s/%s.evtx", dir, corpora[idx].name);
+			else
+				snprintf(fileName, sizeof(fileName), "%s/bench_parse_evtx.%d.%s.evtx", dir, (int)getpid(), corpora[idx].name);
+			if ( !GenerateCorpus(&corpora[idx], fileName, numRecords) )
+				result = 1;
+			else if ( !BenchDecoder(corpora[idx].name, fileName) )
+				result = 1;
+			else if ( endToEnd && !BenchEndToEnd(corpora[idx].name, fileName, parseEvtx, &results[decode]) )
+				result = 1;
+			if ( corpusDir == NULL )
+				remove(fileName);
+		}
+	}
+
+	if ( result == 0 && jsonName != NULL && !WriteResults(jsonName) )
+	{
+		printf("Failed on %s\n", jsonName);
+		result = 1;
+	}
+	if ( result == 0 && baselineName != NULL )
+	{
+		int	numSlower	=	CompareBaseline(baselineName, threshold);
+
+		if ( numSlower < 0 )
+			result = 1;
+		else if ( numSlower > 0 )
+			result = 2;
+	}
+	RecordTextFree();
+	return result;
+}
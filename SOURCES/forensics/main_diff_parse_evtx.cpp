@@ -0,0 +1,626 @@
+/*
+ * =====================================================================================
+ *       Filename:  main_diff_parse_evtx.cpp
+ *    Description:  Runs parse_evtx in its reference configuration (serial reads,
+ *                  no cache) and in the configurations that take other paths
+ *                  through the readers and the decoder, then compares the
+ *                  outputs record by record and field by field
+ *
+ *                  The kernels run at the best CPU tier in the reference and at
+ *                  every lower tier in a configuration of its own.  The record
+ *                  cursor of libevtxparse is checked on the same files: a walk is
+ *                  resumed from its saved positions at every chunk boundary.
+ *
+ *                  The reference may be another parse_evtx, a known-good build, so
+ *                  that a change of the decoder shows in every configuration.
+ *
+ *                  The inputs are generated corpora and the files given.  The
+ *                  time of every run is reported with the speedup over the
+ *                  reference, a difference is printed with its record and
+ *                  field and makes the exit code 1.
+ * =====================================================================================
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
+#include "evtx_corpus.h"
+#include "evtx_cursor.h"
+#include "cpu_dispatch.h"
+
+#define DEFAULT_DIFF_RECORDS	20000
+#define CURSOR_CHECK_INTERVAL	1000	/*  records between resumes inside chunks */
+#define CURSOR_SEEK_BACK	4	/*  records into a chunk before seeking back to its start */
+#define DEFAULT_MAX_DIFFS	10
+#define MAX_DIFF_CONFIGS	32
+#define MAX_DIFF_OPTIONS	16
+
+typedef struct
+{
+	const char*	name;
+	const char*	options;	/*  separated by spaces */
+	bool		fromStdin;	/*  the file is read from the standard input, as a pipe */
+}
+DiffConfig;
+
+static DiffConfig	configs[MAX_DIFF_CONFIGS]	=
+{
+	{ "reference",		"",				false },
+	{ "map-window",		"--map-window 16",		false },
+	{ "async-io",		"--async-io 8",			false },
+	{ "async-io-thread",	"--async-io 8 --no-io-uring",	false },
+	{ "stdin",		"",				true },
+	{ "output-thread",	"--output -",			false },
+	{ "cache-cold",		"--cache %CACHE%",		false },
+	{ "cache-warm",		"--cache %CACHE%",		false },
+};
+static size_t		numConfigs	=	8;
+
+typedef struct
+{
+	const char*	name;
+	unsigned int	numTemplates;
+	unsigned int	fieldsPerTemplate;
+	const char*	types;
+	unsigned int	minStringLength;
+	unsigned int	maxStringLength;
+}
+DiffCorpus;
+
+static const DiffCorpus	corpora[]	=
+{
+	{ "mixed",	32,	8,	"all",		4,	48 },
+	{ "strings",	32,	16,	"string",	64,	512 },
+	{ "templates",	1024,	8,	"all",		4,	48 },
+	{ "binxml",	32,	8,	"binxml,int",	4,	48 },
+};
+
+static char		tierConfigs[NUM_CPU_TIERS][2][32];	/*  name and options */
+static const char*	parseEvtx	=	PARSE_EVTX_PATH;
+static const char*	referenceEvtx	=	NULL;	/*  runs the reference, parseEvtx when NULL */
+static char		tempDir[1024];
+static unsigned int	maxDiffs	=	DEFAULT_MAX_DIFFS;
+
+static uint64_t	Clock(void)
+{
+	struct timespec	now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+/*  parse_evtx with the options of config on fileName, its output to outputName;
+ *  false when it cannot be run or fails */
+static bool	RunConfig(const DiffConfig* config, const char* fileName, const char* outputName, uint64_t* time)
+{
+	char		options[1024];
+	char		cacheDir[4096];
+	const char*	args[MAX_DIFF_OPTIONS + 3];
+	size_t		numArgs		=	0;
+	const char*	program		=	( config == &configs[0] && referenceEvtx != NULL ) ? referenceEvtx : parseEvtx;
+	uint64_t	start;
+	int		status;
+	pid_t		pid;
+
+	snprintf(cacheDir, sizeof(cacheDir), "%s/cache", tempDir);
+	snprintf(options, sizeof(options), "%s", config->options);
+	args[numArgs++] = program;
+	for (char* option = strtok(options, " "); option != NULL && numArgs < MAX_DIFF_OPTIONS + 1; option = strtok(NULL, " "))
+		args[numArgs++] = strcmp(option, "%CACHE%") ? option : cacheDir;
+	args[numArgs++] = config->fromStdin ? "-" : fileName;
+	args[numArgs] = NULL;
+
+	start = Clock();
+	pid = fork();
+	if ( pid == 0 )
+	{
+		int	output	=	open(outputName, O_WRONLY|O_CREAT|O_TRUNC, 0600);
+		int	input	=	config->fromStdin ? open(fileName, O_RDONLY) : 0;
+
+		if ( output < 0 || input < 0 )
+			_exit(127);
+		dup2(output, STDOUT_FILENO);
+		if ( config->fromStdin )
+		{
+			/*  through a pipe, so that the stream reader is used */
+			int	fds[2];
+
+			if ( pipe(fds) != 0 )
+				_exit(127);
+			if ( fork() == 0 )
+			{
+				char	buffer[0x10000];
+				ssize_t	len;
+
+				close(fds[0]);
+				while ( ( len = read(input, buffer, sizeof(buffer)) ) > 0 )
+				{
+					if ( write(fds[1], buffer, len) != len )
+						break;
+				}
+				_exit(0);
+			}
+			dup2(fds[0], STDIN_FILENO);
+			close(fds[0]);
+			close(fds[1]);
+			close(input);
+		}
+		execv(program, (char* const*)args);
+		_exit(127);
+	}
+	if ( pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0 )
+	{
+		printf("Failed on %s %s %s\n", program, config->options, fileName);
+		return false;
+	}
+	*time = Clock() - start;
+	return true;
+}
+
+/*  True when text starts a field, "'Key':" with a key of any characters but
+ *  quotes; a ", '" inside a string value is not followed by one */
+static bool	FieldStartsAt(const char* text)
+{
+	size_t	keyLen;
+
+	if ( *text != '\'' )
+		return false;
+	keyLen = strcspn(text + 1, "'\r\n");
+	return ( text[1 + keyLen] == '\'' && text[2 + keyLen] == ':' );
+}
+
+/*  The field of line that starts at *pos, "'Key':value"; fields end at the
+ *  ", " before the next field, the separator after the last one and the end
+ *  of the line are left out */
+static const char*	NextField(const char* line, size_t* pos, size_t* len)
+{
+	const char*	start	=	line + *pos;
+	const char*	end;
+
+	if ( *start == 0 )
+		return NULL;
+	end = strstr(start, ", '");
+	while ( end != NULL && !FieldStartsAt(end + 2) )
+		end = strstr(end + 1, ", '");
+	*len = ( end != NULL ) ? (size_t)( end - start ) : strlen(start);
+	*pos += *len + ( end != NULL ? 2 : 0 );
+	if ( end == NULL )
+	{
+		while ( *len > 0 && strchr("\r\n", start[*len - 1]) )
+			(*len)--;
+		if ( *len >= 2 && !memcmp(start + *len - 2, ", ", 2) )
+			*len -= 2;
+		if ( *len == 0 )
+			return NULL;
+	}
+	return start;
+}
+
+static void	PrintField(const char* prefix, const char* field, size_t len)
+{
+	printf("    %s %.*s%s\n", prefix, (int)( len > 200 ? 200 : len ), field, len > 200 ? "..." : "");
+}
+
+/*  Prints where the two lines of a record part */
+static void	DiffRecord(uint64_t lineNumber, const char* expected, const char* actual)
+{
+	size_t	expectedPos	=	0;
+	size_t	actualPos	=	0;
+
+	printf("  line %" PRIu64 ":\n", lineNumber);
+	for (unsigned int fieldIdx = 0; ; fieldIdx++)
+	{
+		size_t		expectedLen	=	0;
+		size_t		actualLen	=	0;
+		const char*	expectedField	=	NextField(expected, &expectedPos, &expectedLen);
+		const char*	actualField	=	NextField(actual, &actualPos, &actualLen);
+
+		if ( expectedField == NULL && actualField == NULL )
+			break;
+		if ( expectedField != NULL && actualField != NULL && expectedLen == actualLen && !memcmp(expectedField, actualField, expectedLen) )
+			continue;
+		printf("    field %u\n", fieldIdx + 1);
+		if ( expectedField != NULL )
+			PrintField("reference:", expectedField, expectedLen);
+		else
+			printf("    reference: (no more fields)\n");
+		if ( actualField != NULL )
+			PrintField("this:     ", actualField, actualLen);
+		else
+			printf("    this:      (no more fields)\n");
+		break;
+	}
+}
+
+/*  Compares two outputs line by line; returns the number of different lines,
+ *  *numRecords the lines of the reference */
+static uint64_t	DiffOutputs(const char* expectedName, const char* actualName, uint64_t* numRecords)
+{
+	FILE*		expected	=	fopen(expectedName, "r");
+	FILE*		actual		=	fopen(actualName, "r");
+	char*		expectedLine	=	NULL;
+	char*		actualLine	=	NULL;
+	size_t		expectedSize	=	0;
+	size_t		actualSize	=	0;
+	uint64_t	numDiffs	=	0;
+
+	*numRecords = 0;
+	if ( expected == NULL || actual == NULL )
+	{
+		printf("Cannot open %s\n", expected == NULL ? expectedName : actualName);
+		if ( expected != NULL )
+			fclose(expected);
+		if ( actual != NULL )
+			fclose(actual);
+		return 1;
+	}
+	for (;;)
+	{
+		ssize_t	expectedLen	=	getline(&expectedLine, &expectedSize, expected);
+		ssize_t	actualLen	=	getline(&actualLine, &actualSize, actual);
+
+		if ( expectedLen < 0 && actualLen < 0 )
+			break;
+		if ( expectedLen >= 0 )
+			(*numRecords)++;
+		if ( expectedLen >= 0 && actualLen >= 0 && !strcmp(expectedLine, actualLine) )
+			continue;
+
+		if ( numDiffs++ >= maxDiffs )
+			continue;
+		if ( expectedLen < 0 )
+			printf("  line %" PRIu64 ": only in this output\n", *numRecords + 1);
+		else if ( actualLen < 0 )
+			printf("  line %" PRIu64 ": missing from this output\n", *numRecords);
+		else
+			DiffRecord(*numRecords, expectedLine, actualLine);
+	}
+	free(expectedLine);
+	free(actualLine);
+	fclose(expected);
+	fclose(actual);
+	return numDiffs;
+}
+
+static uint64_t	CountLines(const char* fileName)
+{
+	FILE*		f		=	fopen(fileName, "r");
+	uint64_t	numLines	=	0;
+	int		c;
+
+	if ( f == NULL )
+		return 0;
+	while ( ( c = getc(f) ) != EOF )
+	{
+		if ( c == '\n' )
+			numLines++;
+	}
+	fclose(f);
+	return numLines;
+}
+
+/*  Resumes the second cursor from the position saved as text; true when it
+ *  returns the record the walk returned next, or nothing at the end of both */
+static bool	ResumeCursor(struct sEvtxCursor* resumed, const EvtxPosition* position, const EvtxRecord* expected)
+{
+	char			text[EVTX_POSITION_TEXT_SIZE];
+	EvtxPosition		parsed;
+	const EvtxRecord*	record;
+
+	EvtxPositionFormat(position, text, sizeof(text));
+	if ( !EvtxPositionParse(text, &parsed) || !EvtxCursorSeek(resumed, &parsed) )
+	{
+		printf("  cursor: cannot resume at %s\n", text);
+		return false;
+	}
+	record = EvtxCursorNext(resumed);
+	if ( record == NULL && expected == NULL )
+		return true;
+	if ( record != NULL && expected != NULL && record->number == expected->number &&
+		record->timestamp == expected->timestamp && record->numFields == expected->numFields )
+	{
+		return true;
+	}
+	printf("  cursor: resumed at %s, record %" PRIu64 " instead of %" PRIu64 "\n", text,
+			record != NULL ? record->number : 0, expected != NULL ? expected->number : 0);
+	return false;
+}
+
+typedef struct
+{
+	uint64_t	number;
+	uint64_t	timestamp;
+	size_t		numFields;
+}
+CursorRecord;
+
+static bool	SameRecord(const EvtxRecord* record, const CursorRecord* expected)
+{
+	return ( record != NULL && record->number == expected->number && record->timestamp == expected->timestamp &&
+			record->numFields == expected->numFields );
+}
+
+/*  Seeks the second cursor, which has read records of the chunk, back to the
+ *  first record of the chunk by its number; true when it reads the first two
+ *  records of the chunk again */
+static bool	SeekCursorBack(struct sEvtxCursor* resumed, const CursorRecord first[2])
+{
+	const EvtxRecord*	record;
+
+	if ( !EvtxCursorSeekRecord(resumed, first[0].number) )
+	{
+		printf("  cursor: cannot seek back to record %" PRIu64 "\n", first[0].number);
+		return false;
+	}
+	for (int idx = 0; idx < 2; idx++)
+	{
+		record = EvtxCursorNext(resumed);
+		if ( !SameRecord(record, &first[idx]) )
+		{
+			printf("  cursor: back at record %" PRIu64 ", record %" PRIu64 " with %zu fields instead of %" PRIu64 " with %zu\n",
+					first[0].number, record != NULL ? record->number : 0, record != NULL ? record->numFields : 0,
+					first[idx].number, first[idx].numFields);
+			return false;
+		}
+	}
+	return true;
+}
+
+/*  Walks the log with a cursor, saving the position before every record, and
+ *  resumes a second cursor at each chunk boundary and every
+ *  CURSOR_CHECK_INTERVAL records.  CURSOR_SEEK_BACK records into every chunk
+ *  it also seeks back to the first record of the chunk by number; false
+ *  when a resumed walk goes astray */
+static bool	CheckCursor(const char* fileName)
+{
+	int			f		=	open(fileName, O_RDONLY);
+	int			resumedFile	=	open(fileName, O_RDONLY);
+	struct sChunkReader*	reader		=	f >= 0 ? ChunkReaderOpenFile(f) : NULL;
+	struct sChunkReader*	resumedReader	=	resumedFile >= 0 ? ChunkReaderOpenFile(resumedFile) : NULL;
+	struct sEvtxCursor*	cursor		=	reader != NULL ? EvtxCursorOpen(reader) : NULL;
+	struct sEvtxCursor*	resumed		=	resumedReader != NULL ? EvtxCursorOpen(resumedReader) : NULL;
+	uint64_t		numRecords	=	0;
+	uint64_t		numResumes	=	0;
+	uint64_t		lastChunk	=	0;
+	unsigned int		inChunk		=	0;
+	CursorRecord		first[2];
+	bool			result		=	( cursor != NULL && resumed != NULL );
+
+	while ( result )
+	{
+		EvtxPosition		position;
+		const EvtxRecord*	record;
+
+		EvtxCursorTell(cursor, &position);
+		record = EvtxCursorNext(cursor);
+		if ( position.chunkOffset != lastChunk || numRecords % CURSOR_CHECK_INTERVAL == 0 || record == NULL )
+		{
+			result = ResumeCursor(resumed, &position, record);
+			numResumes++;
+		}
+		/*  the end of the previous chunk, where a record filling it leaves the walk */
+		if ( result && position.chunkOffset != lastChunk && lastChunk != 0 )
+		{
+			EvtxPosition	chunkEnd	=	{ lastChunk, EVTX_CHUNK_SIZE, 0 };
+
+			result = ResumeCursor(resumed, &chunkEnd, record);
+			numResumes++;
+		}
+		if ( position.chunkOffset != lastChunk )
+			inChunk = 0;
+		lastChunk = position.chunkOffset;
+		if ( record == NULL )
+			break;
+
+		if ( inChunk < 2 )
+		{
+			first[inChunk].number = record->number;
+			first[inChunk].timestamp = record->timestamp;
+			first[inChunk].numFields = record->numFields;
+		}
+		else if ( inChunk == CURSOR_SEEK_BACK && result )
+		{
+			result = ( ResumeCursor(resumed, &position, record) && SeekCursorBack(resumed, first) );
+			numResumes += 2;
+		}
+		inChunk++;
+		numRecords++;
+	}
+	if ( cursor != NULL && EvtxCursorFailed(cursor) )
+		result = false;
+
+	printf("  %-18s %10" PRIu64 " records %10" PRIu64 " resumes %s\n", "cursor-resume", numRecords, numResumes,
+			result ? "same" : "DIFFERENT");
+	EvtxCursorClose(cursor);
+	EvtxCursorClose(resumed);
+	ChunkReaderClose(reader);
+	ChunkReaderClose(resumedReader);
+	if ( f >= 0 )
+		close(f);
+	if ( resumedFile >= 0 )
+		close(resumedFile);
+	return result;
+}
+
+/*  All configurations on one file; false when an output differs or a run failed */
+static bool	DiffFile(const char* fileName)
+{
+	char		referenceName[4096];
+	char		outputName[4096];
+	char		cacheDir[4096];
+	uint64_t	referenceTime	=	0;
+	bool		result		=	true;
+
+	snprintf(referenceName, sizeof(referenceName), "%s/reference.out", tempDir);
+	snprintf(outputName, sizeof(outputName), "%s/config.out", tempDir);
+	snprintf(cacheDir, sizeof(cacheDir), "%s/cache", tempDir);
+
+	printf("%s\n", fileName);
+	for (size_t idx = 0; idx < numConfigs; idx++)
+	{
+		uint64_t	time;
+		uint64_t	numRecords;
+		uint64_t	numDiffs	=	0;
+		bool		reference	=	( idx == 0 );
+
+		if ( !RunConfig(&configs[idx], fileName, reference ? referenceName : outputName, &time) )
+		{
+			result = false;
+			continue;
+		}
+		if ( reference )
+		{
+			referenceTime = time;
+			numRecords = CountLines(referenceName);
+		}
+		else
+		{
+			numDiffs = DiffOutputs(referenceName, outputName, &numRecords);
+		}
+		printf("  %-18s %10" PRIu64 " records %12.0f records/s  x%5.2f  %s\n", configs[idx].name, numRecords,
+				(double)numRecords * 1e9 / (double)( time > 0 ? time : 1 ), (double)referenceTime / (double)( time > 0 ? time : 1 ),
+				numDiffs == 0 ? "same" : "DIFFERENT");
+		if ( numDiffs > 0 )
+		{
+			printf("  %" PRIu64 " lines differ\n", numDiffs);
+			result = false;
+		}
+		fflush(stdout);
+	}
+
+	if ( !CheckCursor(fileName) )
+		result = false;
+	fflush(stdout);
+
+	/*  a cache of this file must not be replayed for the next one */
+	{
+		char	command[4200];
+
+		snprintf(command, sizeof(command), "rm -rf '%s'", cacheDir);
+		if ( system(command) != 0 )
+			printf("Cannot remove %s\n", cacheDir);
+	}
+	remove(referenceName);
+	remove(outputName);
+	return result;
+}
+
+static bool	GenerateCorpus(const DiffCorpus* corpus, const char* fileName, uint64_t numRecords)
+{
+	CorpusOptions	options;
+
+	CorpusDefaultOptions(&options);
+	options.numRecords = numRecords;
+	options.numTemplates = corpus->numTemplates;
+	options.fieldsPerTemplate = corpus->fieldsPerTemplate;
+	options.minStringLength = corpus->minStringLength;
+	options.maxStringLength = corpus->maxStringLength;
+	return CorpusParseTypes(corpus->types, &options.typeMask) && CorpusWriteFile(fileName, &options, NULL);
+}
+
+static void	Usage(const char* programName)
+{
+	printf("Usage: %s [options] [file.evtx ...]\n", programName);
+	printf("  compares the output of parse_evtx in the configurations below with the reference, on the\n");
+	printf("  generated corpora mixed, strings, templates and binxml and the files given\n");
+	printf("  and checks that a walk with the record cursor resumes from its saved positions\n");
+	for (size_t idx = 0; idx < numConfigs; idx++)
+		printf("    %-18s %s%s\n", configs[idx].name, configs[idx].options, configs[idx].fromStdin ? "(file piped to standard input)" : "");
+	printf("  --records N         records per generated corpus (default %u)\n", DEFAULT_DIFF_RECORDS);
+	printf("  --no-corpus         only the files given\n");
+	printf("  --config NAME=OPTIONS  add a configuration: parse_evtx options separated by spaces\n");
+	printf("  --max-diffs N       differences printed per configuration and file (default %u)\n", DEFAULT_MAX_DIFFS);
+	printf("  --parse-evtx PATH   the parse_evtx to run (default %s)\n", PARSE_EVTX_PATH);
+	printf("  --reference PATH    the parse_evtx that runs the reference, a known-good build (default the one above)\n");
+}
+
+/*  --cpu-tier for the tiers below the best of this CPU */
+static void	AddTierConfigs(void)
+{
+	for (int tier = CpuTierScalar; tier < CpuBestTier() && numConfigs < MAX_DIFF_CONFIGS; tier++)
+	{
+		snprintf(tierConfigs[tier][0], sizeof(tierConfigs[tier][0]), "cpu-%s", CpuTierName((CpuTier)tier));
+		snprintf(tierConfigs[tier][1], sizeof(tierConfigs[tier][1]), "--cpu-tier %s", CpuTierName((CpuTier)tier));
+		configs[numConfigs].name = tierConfigs[tier][0];
+		configs[numConfigs].options = tierConfigs[tier][1];
+		configs[numConfigs].fromStdin = false;
+		numConfigs++;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	uint64_t	numRecords	=	DEFAULT_DIFF_RECORDS;
+	bool		generate	=	true;
+	int		numFiles	=	0;
+	int		result		=	0;
+	const char*	tmp		=	getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+
+	AddTierConfigs();
+	for (int idx = 1; idx < argc; idx++)
+	{
+		if ( !strcmp(argv[idx], "--records") && ( idx + 1 < argc ) )
+			numRecords = strtoull(argv[++idx], NULL, 10);
+		else if ( !strcmp(argv[idx], "--no-corpus") )
+			generate = false;
+		else if ( !strcmp(argv[idx], "--config") && ( idx + 1 < argc ) && ( numConfigs < MAX_DIFF_CONFIGS ) && strchr(argv[idx + 1], '=') )
+		{
+			char*	spec	=	argv[++idx];
+
+			*strchr(spec, '=') = 0;
+			configs[numConfigs].name = spec;
+			configs[numConfigs].options = spec + strlen(spec) + 1;
+			configs[numConfigs].fromStdin = false;
+			numConfigs++;
+		}
+		else if ( !strcmp(argv[idx], "--max-diffs") && ( idx + 1 < argc ) )
+			maxDiffs = strtoul(argv[++idx], NULL, 10);
+		else if ( !strcmp(argv[idx], "--parse-evtx") && ( idx + 1 < argc ) )
+			parseEvtx = argv[++idx];
+		else if ( !strcmp(argv[idx], "--reference") && ( idx + 1 < argc ) )
+			referenceEvtx = argv[++idx];
+		else if ( argv[idx][0] != '-' )
+			argv[1 + numFiles++] = argv[idx];
+		else
+		{
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+	if ( !generate && numFiles == 0 )
+	{
+		Usage(argv[0]);
+		return 1;
+	}
+
+	snprintf(tempDir, sizeof(tempDir), "%s/diff_parse_evtx.XXXXXX", tmp);
+	if ( mkdtemp(tempDir) == NULL )
+	{
+		printf("Cannot create %s\n", tempDir);
+		return 1;
+	}
+
+	for (size_t idx = 0; generate && idx < sizeof(corpora) / sizeof(corpora[0]); idx++)
+	{
+		char	fileName[4200];
+
+		snprintf(fileName, sizeof(fileName), "%s/%s.evtx", tempDir, corpora[idx].name);
+		if ( !GenerateCorpus(&corpora[idx], fileName, numRecords) || !DiffFile(fileName) )
+			result = 1;
+		remove(fileName);
+	}
+	for (int idx = 1; idx <= numFiles; idx++)
+	{
+		if ( !DiffFile(argv[idx]) )
+			result = 1;
+	}
+
+	rmdir(tempDir);
+	printf("%s\n", result == 0 ? "all outputs are the same" : "outputs differ or runs failed");
+	return result;
+}
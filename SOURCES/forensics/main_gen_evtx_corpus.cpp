@@ -0,0 +1,96 @@
+/*
+ * =====================================================================================
+ *       Filename:  main_gen_evtx_corpus.cpp
+ *    Description:  Writes synthetic EVTX logs for bench_parse_evtx and for testing
+ * =====================================================================================
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include "evtx_corpus.h"
+
+static void	Usage(const char* programName)
+{
+	CorpusOptions	defaults;
+
+	CorpusDefaultOptions(&defaults);
+	printf("Usage: %s [options] out.evtx\n", programName);
+	printf("  --records N         records to write (default %" PRIu64 ", 0 to fill --size)\n", defaults.numRecords);
+	printf("  --size MB           stop before the file grows past MB\n");
+	printf("  --templates N       distinct templates, one event id each (default %u)\n", defaults.numTemplates);
+	printf("  --fields N          EventData values per template, up to %u (default %u)\n", MAX_CORPUS_FIELDS, defaults.fieldsPerTemplate);
+	printf("  --types LIST        value types to draw from: string, sid, guid, filetime, binary, binxml, int\n");
+	printf("                      or all (default all)\n");
+	printf("  --string-length MIN[:MAX]  characters of strings, bytes of binary values (default %u:%u)\n",
+			defaults.minStringLength, defaults.maxStringLength);
+	printf("  --seed N            the same seed and options give the same file (default %" PRIu64 ")\n", defaults.seed);
+}
+
+int main(int argc, char* argv[])
+{
+	CorpusOptions	options;
+	CorpusSummary	summary;
+	const char*	fileName	=	NULL;
+
+	CorpusDefaultOptions(&options);
+	for (int idx = 1; idx < argc; idx++)
+	{
+		if ( !strcmp(argv[idx], "--records") && ( idx + 1 < argc ) )
+		{
+			options.numRecords = strtoull(argv[++idx], NULL, 10);
+		}
+		else if ( !strcmp(argv[idx], "--size") && ( idx + 1 < argc ) )
+		{
+			options.fileSize = strtoull(argv[++idx], NULL, 10) << 20;
+		}
+		else if ( !strcmp(argv[idx], "--templates") && ( idx + 1 < argc ) )
+		{
+			options.numTemplates = strtoul(argv[++idx], NULL, 10);
+		}
+		else if ( !strcmp(argv[idx], "--fields") && ( idx + 1 < argc ) )
+		{
+			options.fieldsPerTemplate = strtoul(argv[++idx], NULL, 10);
+		}
+		else if ( !strcmp(argv[idx], "--types") && ( idx + 1 < argc ) )
+		{
+			if ( !CorpusParseTypes(argv[++idx], &options.typeMask) )
+			{
+				printf("Unknown type in %s\n", argv[idx]);
+				return 1;
+			}
+		}
+		else if ( !strcmp(argv[idx], "--string-length") && ( idx + 1 < argc ) )
+		{
+			char*	end;
+
+			options.minStringLength = strtoul(argv[++idx], &end, 10);
+			options.maxStringLength = ( *end == ':' ) ? strtoul(end + 1, NULL, 10) : options.minStringLength;
+		}
+		else if ( !strcmp(argv[idx], "--seed") && ( idx + 1 < argc ) )
+		{
+			options.seed = strtoull(argv[++idx], NULL, 10);
+		}
+		else if ( argv[idx][0] != '-' && fileName == NULL )
+		{
+			fileName = argv[idx];
+		}
+		else
+		{
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+	if ( fileName == NULL )
+	{
+		Usage(argv[0]);
+		return 1;
+	}
+
+	if ( !CorpusWriteFile(fileName, &options, &summary) )
+		return 1;
+	printf("%s: %" PRIu64 " records in %" PRIu64 " chunks, %" PRIu64 " bytes\n",
+			fileName, summary.numRecords, summary.numChunks, summary.fileSize);
+	return 0;
+}
@@ -13,1133 +13,1517 @@
 #include <stdint.h>
 #include <inttypes.h>
 #include <string.h>
+#include <errno.h>
 #include <time.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <sys/resource.h>
+#endif
 #include <utils/win_types.h>
-#include "eventlist.h"
-
-// #define PRINT_TAGS
-
-#include <tools/wintime.h>
-
-#pragma pack(push, 1)
-
-#define EVTX_HEADER_MAGIC	"ElfFile"
-
-typedef struct
+#include "evtx_record.h"
+#include "record_text.h"
+#include "evtx_template.h"
+#include "logon_sessions.h"
+#include "detection_rules.h"
+#include "record_batch.h"
+#include "time_merge.h"
+#include "time_sort.h"
+#include "temp_file.h"
+#include "raw_grep.h"
+#include "chunk_index.h"
+#include "value_index.h"
+#include "chunk_cache.h"
+#include "record_dedup.h"
+#include "chunk_hash.h"
+#include "chunk_reader.h"
+#include "archive_reader.h"
+#include "async_reader.h"
+#include "evtx_parser.h"
+#include "parse_daemon.h"
+#include "output_sink.h"
+#include "evtx_stats.h"
+#include "evtx_trace.h"
+#include "cpu_dispatch.h"
+#include "text_kernels.h"
+
+static struct sEvtxParser*	parser	=	NULL;
+static RecordBatch*	captureBatch		=	NULL;	/*  formatted records go here instead of stdout */
+static bool		printRecords		=	true;
+static bool		trackSessions		=	false;
+static struct sGrepPattern*	grepPattern	=	NULL;
+static bool		buildIndex		=	false;
+static bool		buildValueIndex		=	false;
+static struct sChunkIndex*	queryIndex	=	NULL;
+static const char*	queryValue		=	NULL;
+static uint64_t		queryHash		=	0;
+static bool		selectRecords		=	true;	/*  off while filling the chunk cache */
+static RecordBatch	cacheBatch;
+static bool		dedupRecords		=	false;
+static bool		hashRecords		=	false;
+static char*		lookupField		=	NULL;	/*  "field=value" split in place */
+static const char*	lookupValue		=	NULL;
+static unsigned int	mapWindowChunks		=	0;	/*  read() into a buffer when 0 */
+
+static void	OutPrintf(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+static void	OutPrintf(const char* format, ...)
 {
-	char		magic[8];
-	uint64_t	numberOfChunksAllocated;
-	uint64_t	numberOfChunksUsed;
-	uint64_t	checksum;
-	uint32_t	flags;
-	uint32_t	version;
-	uint64_t	fileSize;
-	uint8_t		reserved[0x1000 - 0x30];
-}
-EvtxHeader;
+	va_list	args;
 
-#define EVTX_CHUNK_HEADER_MAGIC	"ElfChnk"
+	if ( !printRecords )
+		return;
+	va_start(args, format);
+	if ( captureBatch != NULL )
+		BatchAppendV(captureBatch, format, args);
+	else
+		SinkVPrintf(format, args);
+	va_end(args);
+}
 
-typedef struct
+static bool	RecordFilterActive(void)
 {
-	char		magic[8];
-	uint64_t	firstRecordNumber;
-	uint64_t	lastRecordNumber;
-	uint64_t	firstRecordNumber2;
-	uint64_t	lastRecordNumber2;
-	uint32_t	chunkHeaderSize;
-	uint8_t		reserved[0x80 - 0x2C];
-	uint8_t		reserved2[0x200 - 0x80];
+	return ( grepPattern != NULL || queryValue != NULL || dedupRecords );
 }
-EvtxChunkHeader;
 
-#define EVTX_CHUNK_SIZE		0x10000
-
-typedef struct
+/*  The cache holds formatted text only, it cannot feed field consumers
+ *  and has no digests */
+static bool	ChunkCacheUsable(void)
 {
-	uint32_t	magic;
-	uint32_t	size;
-	uint64_t	number;
-	uint64_t	timestamp;
+	return ( ChunkCacheEnabled() && printRecords && queryValue == NULL && !dedupRecords && !hashRecords );
 }
-EvtxRecordHeader;
 
-
-typedef struct
+/*  Checks the record just captured in batch against --grep, --query and --lookup */
+static bool	RecordSelected(const RecordBatch* batch, const EvtxRecord* evtxRecord)
 {
-	uint32_t	d1;
-	uint16_t	w1;
-	uint16_t	w2;
-	uint8_t		b1[8];
+	const BatchRecord*	record	=	&batch->records[batch->numRecords - 1];
+
+	if ( grepPattern != NULL && !GrepText(grepPattern, batch->text + record->textOffset, record->textLen) )
+		return false;
+	if ( queryValue != NULL && !ChunkIndexRecordMatches(evtxRecord, queryValue) )
+		return false;
+	if ( lookupField != NULL && !ValueIndexRecordMatches(evtxRecord, lookupField, lookupValue) )
+		return false;
+	return true;
 }
-EvtxGUID;
-#pragma pack(pop)
 
-typedef enum
+static void	PrintFields(const EvtxRecord* record)
 {
-	StateNormal		=	1,
-	StateInAttribute	=	2,
+	if ( printRecords )
+		PrintRecordFields(record, OutPrintf);
 }
-XmlParseState;
 
-typedef struct sParseContext
+static bool	OnBeginRecord(void* context, uint64_t number, uint64_t timestamp)
 {
-	sParseContext*	chunkContext;
-	const uint8_t*	data;
-	size_t		dataLen;
-	size_t		offset;
-	size_t		offsetFromChunkStart;
-	XmlParseState	state;
-	unsigned int	currentTemplateIdx;
-	char		cachedValue[256];
-}
-ParseContext;
+	time_t		unixTimestamp	=	UnixTimeFromFileTime(timestamp);
+	struct tm	localtm;
+	struct tm*	t		=	gmtime_r(&unixTimestamp, &localtm);
 
-static bool	ParseBinXml(ParseContext* ctx, size_t inFileOffset);
+	if ( t == NULL )
+		return false;
 
-static bool	HaveEnoughData(ParseContext* ctx, size_t numBytes)
-{
-	return ( ctx->offset + numBytes <= ctx->dataLen );
+	if ( captureBatch != NULL && !BatchBeginRecord(captureBatch, number, timestamp) )
+		return false;
+
+	OutPrintf("Record #%" PRIu64 " %04u.%02u.%02u-%02u:%02u:%02u ", number, t->tm_year+1900, t->tm_mon+1, t->tm_mday, t->tm_hour, t->tm_min, t->tm_sec);
+	RulesBeginRecord();
+	return true;
 }
 
-static void	SkipBytes(ParseContext* ctx, size_t numBytes)
+static void	OnBrokenRecord(void* context, const EvtxRecord* record, EvtxParseError error)
 {
-	ctx->offset += numBytes;
+	PrintFields(record);
+	if ( error == EvtxErrorArguments )
+		OutPrintf("Failed to read the arguments\n");
+	if ( captureBatch != NULL )
+		BatchEndRecord(captureBatch);
+	else if ( printRecords )
+		SinkEndRecord();
 }
 
-template<class c>
-static bool	ReadData(ParseContext* ctx, c* result, size_t count = 1)
+static void	OnRecord(void* context, const EvtxRecord* record, uint64_t chunkOffset, uint32_t inChunkOffset)
 {
-	if ( !HaveEnoughData(ctx, sizeof(*result) * count) )
-		return false;
-	for (size_t idx = 0; idx < count; idx++)
+	PrintFields(record);
+	if ( hashRecords && printRecords )
 	{
-		result[idx] = *(c*)(ctx->data + ctx->offset);
-		ctx->offset += sizeof(*result);
+		uint8_t	digest[SHA256_DIGEST_SIZE];
+		char	hex[SHA256_HEX_SIZE];
+
+		if ( HashRecordDigest(inChunkOffset, digest) )
+		{
+			Sha256ToHex(digest, hex);
+			OutPrintf("'RecordSHA256':'%s', ", hex);
+		}
+	}
+	OutPrintf("\n");
+	if ( captureBatch == NULL && printRecords )
+		SinkEndRecord();
+	if ( dedupRecords && DedupRecordSeen(record) )
+	{
+		if ( captureBatch != NULL )
+		{
+			BatchEndRecord(captureBatch);
+			BatchDropRecord(captureBatch);
+		}
+		return;
+	}
+	if ( captureBatch != NULL )
+	{
+		BatchEndRecord(captureBatch);
+		if ( selectRecords && !RecordSelected(captureBatch, record) )
+			BatchDropRecord(captureBatch);
 	}
-	return true;
-}
 
-#define MAX_IDS			256
-#define MAX_NUM_ARGS		256
-#define INVALID_TEMPLATE_IDX	((unsigned int)-1)
+	if ( trackSessions )
+		LogonSessionsOnRecord(record);
+	if ( buildIndex )
+		ChunkIndexAddRecord(record);
+	if ( buildValueIndex )
+		ValueIndexAddRecord(record, chunkOffset + inChunkOffset);
+	RulesEmitHits(record);
+}
 
-typedef struct sTemplateArgPair
+/*  Detection rules ride on the template hooks of the parser */
+static void*	OnCompileTemplate(void* context, const TemplateDescription* description)
 {
-	sTemplateArgPair*	next;
-	char*			key;
-	uint16_t		type;
-	uint16_t		argIdx;
+	return RulesCompileTemplate(description);
 }
-TemplateArgPair;
 
-typedef struct	sTemplateFixedPair
+static void	OnReleaseTemplate(void* context, void* compiled)
 {
-	sTemplateFixedPair*	next;
-	char*			key;
-	char*			value;
+	RulesFreeCompiled((struct sCompiledRules*)compiled);
 }
-TemplateFixedPair;
 
-typedef struct
+static void	OnTemplateInstance(void* context, const void* compiled, const uint8_t* values, size_t valuesLen,
+				const uint16_t* argumentMap, uint32_t numArguments)
 {
-	uint32_t		shortID;
-	TemplateFixedPair	fixedRoot;
-	TemplateArgPair		argsRoot;
+	RulesEvaluate((const struct sCompiledRules*)compiled, values, valuesLen, argumentMap, numArguments);
 }
-TemplateDescription;
 
-template <class c>
-static void InitRoot(c* root)
+static struct sEvtxParser*	CreateParser(void)
 {
-	root->next = NULL;
+	EvtxVisitor	visitor;
+
+	memset(&visitor, 0, sizeof(visitor));
+	visitor.beginRecord = OnBeginRecord;
+	visitor.record = OnRecord;
+	visitor.brokenRecord = OnBrokenRecord;
+	visitor.compileTemplate = OnCompileTemplate;
+	visitor.releaseTemplate = OnReleaseTemplate;
+	visitor.templateInstance = OnTemplateInstance;
+	return EvtxParserCreate(&visitor);
 }
 
-template<class c>
-static c* AddPair(c* root)
+/*  Takes the records of the chunk from the cache or decodes and caches
+ *  them, then appends the ones matching --grep to batch */
+static bool	ReplayChunk(const uint8_t* chunk, uint64_t off, RecordBatch* batch)
 {
-	c*	item	=	(c*)malloc(sizeof(c));
-	if ( item != NULL )
+	ChunkCacheKey	key;
+	bool		result	=	true;
+
+	ChunkCacheKeyOf(chunk, EVTX_CHUNK_SIZE, &key);
+	ClearBatch(&cacheBatch);
+	if ( !ChunkCacheLoad(&key, &cacheBatch) )
 	{
-		item->next = root->next;
-		root->next = item;
+		selectRecords = false;
+		captureBatch = &cacheBatch;
+		result = EvtxParseChunk(parser, chunk, off);
+		captureBatch = NULL;
+		selectRecords = true;
+		if ( result )
+			ChunkCacheStore(&key, &cacheBatch);
 	}
-	return item;
-}
 
-static void	FreePair(TemplateFixedPair* item)
-{
-	free(item->key);
-	free(item->value);
-	free(item);
-}
+	for (size_t idx = 0; idx < cacheBatch.numRecords; idx++)
+	{
+		const BatchRecord*	record	=	&cacheBatch.records[idx];
+		const char*		text	=	cacheBatch.text + record->textOffset;
 
-static void	FreePair(TemplateArgPair* item)
-{
-	free(item->key);
-	free(item);
+		if ( grepPattern != NULL && !GrepText(grepPattern, text, record->textLen) )
+			continue;
+		if ( !BatchBeginRecord(batch, record->number, record->timestamp) || !BatchAppend(batch, text, record->textLen) )
+			return false;
+		BatchEndRecord(batch);
+	}
+
+	return result;
 }
 
-template <class c>
-static void ResetRoot(c* root)
+/*  Decodes the chunk only if the index and the raw bytes allow a match
+ *  and keeps its selected records in batch */
+static bool	CaptureChunk(const uint8_t* chunk, uint64_t off, int indexFileIdx, RecordBatch* batch)
 {
-	c*	nextItem	=	NULL;
+	bool	result;
 
-	for (c* ptr = root->next; ptr != NULL; ptr = nextItem)
+	if ( queryIndex != NULL && indexFileIdx >= 0 &&
+		!ChunkIndexChunkMayContain(queryIndex, (uint32_t)indexFileIdx, off, queryHash) )
 	{
-		nextItem = ptr->next;
-		FreePair(ptr);
+		return true;
 	}
+	if ( grepPattern != NULL && !GrepRawChunk(grepPattern, chunk, EVTX_CHUNK_SIZE) )
+		return true;
+	if ( ChunkCacheUsable() )
+		return ReplayChunk(chunk, off, batch);
 
-	root->next = NULL;
-}
+	captureBatch = batch;
+	result = EvtxParseChunk(parser, chunk, off);
+	captureBatch = NULL;
 
-static void InitTemplateDescription(TemplateDescription* item)
-{
-	InitRoot(&item->fixedRoot);
-	InitRoot(&item->argsRoot);
-	item->shortID = 0;
+	return result;
 }
 
-static void ResetTemplateDescription(TemplateDescription* item)
+/*  Hands the chunk and the records found by walking their headers to the hash workers */
+static void	HashChunkRecords(const uint8_t* chunk)
 {
-	ResetRoot(&item->fixedRoot);
-	ResetRoot(&item->argsRoot);
-	item->shortID = 0;
-}
+	static HashSpan	spans[EVTX_CHUNK_SIZE / sizeof(EvtxRecordHeader)];
+	size_t		numSpans	=	0;
+	uint64_t	inRecordOff	=	sizeof(EvtxChunkHeader);
 
-static uint32_t			knownIDs[MAX_IDS] 	=	{ 0 };
-static TemplateDescription	templates[MAX_IDS];
-static unsigned int		numIDs			=	0;
+	while ( inRecordOff + sizeof(EvtxRecordHeader) <= EVTX_CHUNK_SIZE )
+	{
+		const EvtxRecordHeader*	recordHeader	=	(const EvtxRecordHeader*)(chunk + inRecordOff);
 
-#define MAX_NAME_STACK_DEPTH	20
-#define INVALID_STACK_DEPTH 	((ssize_t)-1)
+		if ( recordHeader->magic != 0x00002a2a || recordHeader->size < sizeof(*recordHeader) ||
+			recordHeader->size > EVTX_CHUNK_SIZE - inRecordOff )
+		{
+			break;
+		}
+		spans[numSpans].offset = (uint32_t)inRecordOff;
+		spans[numSpans].size = recordHeader->size;
+		spans[numSpans].number = recordHeader->number;
+		numSpans++;
+		inRecordOff += recordHeader->size;
+	}
+	HashChunkBegin(chunk, EVTX_CHUNK_SIZE, spans, numSpans);
+}
 
-typedef struct
+static bool	ParseEVTXInt(const char* fileName, struct sChunkReader* reader, int indexFileIdx)
 {
-	char	name[256];
-}
-NameStackElement;
+	uint64_t	off	=	0;
+	const uint8_t*	chunk;
+	bool		result	=	true;
+	RecordBatch	filterBatch;
 
+	if ( !EvtxReadFileHeader(reader) )
+		return false;
 
-#define countof(arr) ( sizeof(arr) / sizeof(*arr) )
+	off = sizeof(EvtxHeader);
 
-static void	InitTemplates(void)
-{
-	for (size_t idx = 0; idx < countof(templates); idx++)
-		InitTemplateDescription(&templates[idx]);
-}
+	InitBatch(&filterBatch);
 
-static ssize_t		nameStackPtr	=	INVALID_STACK_DEPTH;
-static NameStackElement	nameStack[MAX_NAME_STACK_DEPTH];
+	while ( result )
+	{
+		bool	endOfFile;
 
-const char**	eventDescriptionHashTable	=	NULL;
-const char*	logonTypes[]	= { NULL, NULL, "Interactive", "Network", "Batch", "Service", NULL, "Unlock", "NetworkCleartext", "NewCredentials", "RemoteInteractive", "CachedInteractive"};
+		if ( !EvtxReadChunk(reader, &chunk, &endOfFile) )
+		{
+			result = false;
+			break;
+		}
+		if ( endOfFile )
+			break;
 
-static void	RegisterFixedPair(unsigned int templateIdx, const char* key, const char* value)
-{
-	TemplateFixedPair*	newPair	=	AddPair(&templates[templateIdx].fixedRoot);
-	if ( newPair == NULL )
-		return;
-	newPair->key = strdup(key);
-	newPair->value = strdup(value);
-}
+		if ( buildIndex && !ChunkIndexBeginChunk(off) )
+		{
+			result = false;
+			break;
+		}
 
+		if ( hashRecords )
+			HashChunkRecords(chunk);
+		if ( RecordFilterActive() || ChunkCacheUsable() )
+		{
+			ClearBatch(&filterBatch);
+			result = CaptureChunk(chunk, off, indexFileIdx, &filterBatch);
+			for (size_t idx = 0; idx < filterBatch.numRecords; idx++)
+				SinkWriteRecord(filterBatch.text + filterBatch.records[idx].textOffset, filterBatch.records[idx].textLen);
+		}
+		else
+		{
+			result = EvtxParseChunk(parser, chunk, off);
+		}
+		if ( hashRecords )
+			HashChunkEnd(fileName, off);
 
-static void	RegisterArgPair(unsigned int templateIdx, const char* key, uint16_t type, uint16_t argIdx)
-{
-	TemplateArgPair*	newPair	=	AddPair(&templates[templateIdx].argsRoot);
-	if ( newPair == NULL )
-		return;
-	// broken record 3420028194 (security.evtx)
-	newPair->key = strdup(key == NULL ? "" : key);
-	newPair->type = type;
-	newPair->argIdx = argIdx;
-}
+		off += EVTX_CHUNK_SIZE;
+	}
 
+	FreeBatch(&filterBatch);
 
-static void	PushName(const char* name)
-{
-	if ( nameStackPtr >= MAX_NAME_STACK_DEPTH )
-		return;
-	nameStackPtr++;
-	strncpy(nameStack[nameStackPtr].name, name, sizeof(nameStack[nameStackPtr].name));
-	nameStack[nameStackPtr].name[ sizeof(nameStack[nameStackPtr].name) - 1 ]  = 0;
+	return result;
 }
 
-static void	PopName(void)
+/*  Looks the file up in the index, returns false when it cannot contain the queried value */
+static bool	IndexLookupFile(const char* fileName, uint64_t fileSize, int* indexFileIdx)
 {
-	if ( nameStackPtr > INVALID_STACK_DEPTH )
-		nameStackPtr--;
-}
+	*indexFileIdx = -1;
 
-static const char*	GetName(void)
-{
-	if ( nameStackPtr <= INVALID_STACK_DEPTH )
-		return NULL;
-	return nameStack[nameStackPtr].name;
+	if ( buildIndex )
+		ChunkIndexBeginFile(fileName, fileSize);
+	if ( buildValueIndex )
+		ValueIndexBeginFile(fileName, fileSize);
+	if ( queryIndex != NULL )
+	{
+		*indexFileIdx = ChunkIndexFindFile(queryIndex, fileName, fileSize);
+		if ( *indexFileIdx >= 0 && !ChunkIndexFileMayContain(queryIndex, (uint32_t)*indexFileIdx, queryHash) )
+			return false;
+	}
+	return true;
 }
 
-
-static const char*	GetUpperName(void)
+static uint64_t	FileSize(int f)
 {
-	if ( nameStackPtr <= INVALID_STACK_DEPTH )
-		return NULL;
-	if ( nameStackPtr < 1 )
-		return NULL;
+	uint64_t	size;
 
-	return nameStack[nameStackPtr - 1].name;
+	if ( !ChunkReaderFileSize(f, &size) )
+		return 0;
+	return size;
 }
 
-static bool	IsKnownID(uint32_t	id, unsigned int* templateIdx)
+/*  "-" is the standard input, a pipe or a socket as often as a file */
+static int	OpenInput(const char* fileName)
 {
-	for (unsigned int idx = 0; idx < numIDs; idx++)
-	{
-		if ( knownIDs[idx] == id )
-		{
-			if ( templateIdx != NULL )
-				*templateIdx = idx;
-			return true;
-		}
-	}
-	return false;
+	if ( strcmp(fileName, "-") )
+		return open(fileName, O_RDONLY|O_BINARY);
+#ifdef _WIN32
+	_setmode(STDIN_FILENO, _O_BINARY);
+#endif
+	return dup(STDIN_FILENO);
 }
 
-static bool	RegisterID(uint32_t	id, unsigned int* templateIdx)
+/*  Pipes are read front to back, files from any offset, mapped with --map-window
+ *  or ahead of the parser with --async-io */
+static struct sChunkReader*	OpenLogReader(int f, const uint8_t* prefix, size_t prefixLen)
 {
-	if ( numIDs >= MAX_IDS )
-		return false;
-	knownIDs[numIDs] = id;
-	templates[numIDs].shortID = id;
-	*templateIdx = numIDs;
-	numIDs++;
-	return true;
+	struct sChunkReader*	reader;
+
+	if ( !ChunkReaderSeekable(f) )
+		return ChunkReaderOpenStream(f, prefix, prefixLen);
+	if ( mapWindowChunks > 0 && ( reader = ChunkReaderOpenMapped(f, mapWindowChunks) ) != NULL )
+		return reader;
+	if ( AsyncIoActive() && ( reader = ChunkReaderOpenAsync(f) ) != NULL )
+		return reader;
+	return ChunkReaderOpenFile(f);
 }
 
-static void	ResetTemplates(void)
+/*  Reads the first bytes of the file to tell archives from logs */
+static size_t	ReadPrefix(int f, uint8_t* prefix, size_t prefixSize)
 {
-	for (size_t idx = 0; idx < numIDs; idx++)
-		ResetTemplateDescription(&templates[idx]);
+	size_t	prefixLen	=	0;
+
+	while ( prefixLen < prefixSize )
+	{
+		ssize_t	numRead	=	read(f, prefix + prefixLen, prefixSize - prefixLen);
 
-	numIDs = 0;
+		if ( numRead <= 0 )
+			break;
+		prefixLen += numRead;
+	}
+	return prefixLen;
 }
 
-static void	SetState(ParseContext* ctx, XmlParseState newState)
+/*  Members are named <archive>:<member>, the caller frees the name */
+static char*	MemberFileName(const char* archiveName, const char* memberName)
 {
-	if ( newState == ctx->state )
-		return;
+	size_t	nameSize	=	strlen(archiveName) + strlen(memberName) + 2;
+	char*	name		=	(char*)malloc(nameSize);
 
-	if ( ctx->state == StateInAttribute )
-		PopName();
-
-	ctx->state = newState;
+	if ( name != NULL )
+		snprintf(name, nameSize, "%s:%s", archiveName, memberName);
+	return name;
 }
 
-static void	UTF16ToUTF8(uint16_t w, char* buffer, size_t* bufferUsed, size_t bufferSize)
+static bool	ParseEVTXArchive(const char* fileName, int f, const uint8_t* prefix, size_t prefixLen)
 {
-	uint32_t	charLength	=	1;
-	uint8_t		msb		=	0;
-	uint8_t		mask		=	0;
+	struct sArchive*	archive	=	ArchiveOpen(fileName, f, prefix, prefixLen);
+	struct sChunkReader*	reader;
+	const char*		memberName;
+	uint64_t		memberSize;
+	bool			result	=	true;
 
-	if ( w > 0x7F )
+	if ( archive == NULL )
 	{
-		charLength++;
-		msb |= 0x80 + 0x40;
-		mask = 0xFF;
+		printf("Failed on %s\n", fileName);
+		return false;
 	}
-	if ( w > 0x7FF )
+
+	while ( ( reader = ArchiveNextMember(archive, &memberName, &memberSize) ) != NULL )
 	{
-		charLength++;
-		msb |= 0x20;
-		mask = 0x1F;
+		char*	name	=	MemberFileName(fileName, memberName);
+		int	indexFileIdx;
+
+		if ( name == NULL )
+		{
+			result = false;
+			break;
+		}
+		if ( IndexLookupFile(name, memberSize, &indexFileIdx) && !ParseEVTXInt(name, reader, indexFileIdx) )
+		{
+			printf("Failed on %s\n", name);
+			result = false;
+		}
+		free(name);
 	}
-	if ( w > 0xFFFF )
+	if ( ArchiveFailed(archive) )
 	{
-		charLength++;
-		msb |= 0x10;
-		mask = 0x0F;
+		printf("Failed on %s\n", fileName);
+		result = false;
 	}
+	ArchiveClose(archive);
 
-	if ( *bufferUsed + charLength >= bufferSize )
-		return;	/*  no buffer overruns */
+	return result;
+}
 
-	if ( charLength == 1 )
+static bool	ParseEVTX(const char* fileName)
+{
+	bool			result;
+	int			indexFileIdx;
+	uint8_t			prefix[ARCHIVE_SNIFF_SIZE];
+	size_t			prefixLen;
+	struct sChunkReader*	reader;
+	int			f	=	OpenInput(fileName);
+	if ( f < 0 )
 	{
-		buffer[*bufferUsed] = w;
-		(*bufferUsed)++;
-		return;
+		printf("Cannot open %s: %s\n", fileName, strerror(errno));
+		return false;
 	}
 
-	// printf("\n%04X -> ", (uint16_t)w);
+	prefixLen = ReadPrefix(f, prefix, sizeof(prefix));
+	if ( ArchiveDetect(prefix, prefixLen) )
+	{
+		/*  --query and --lookup reopen the indexed logs by name and seek in
+		 *  them, which archive members do not allow */
+		if ( buildIndex || buildValueIndex )
+		{
+			printf("Cannot index %s: archives are not indexed, extract the logs first\n", fileName);
+			close(f);
+			return false;
+		}
+		return ParseEVTXArchive(fileName, f, prefix, prefixLen);
+	}
 
-	for (uint32_t charIndex = charLength - 1; charIndex > 0; charIndex--)
+	if ( !IndexLookupFile(fileName, FileSize(f), &indexFileIdx) )
 	{
-		buffer[*bufferUsed + charIndex] = 0x80 | ( w & 0x3F );
-		// printf(" ... [%X] %02X ", charIndex, buffer[*bufferUsed + charIndex]);
-		w >>= 6;
+		close(f);
+		return true;
 	}
 
-	buffer[*bufferUsed] = msb | ( w & mask );
+	reader = OpenLogReader(f, prefix, prefixLen);
+	result = ( reader != NULL && ParseEVTXInt(fileName, reader, indexFileIdx) );
+	if ( !result )
+		printf("Failed on %s\n", fileName);
+	ChunkReaderClose(reader);
+	close(f);
+	return result;
+}
 
-#if 0
-	for (uint32_t idx = 0; idx < charLength; idx++)
-		printf("%02X ", (uint8_t)buffer[*bufferUsed + idx]);
-	printf("\n");
-#endif
+static size_t	maxSessions	=	DEFAULT_MAX_SESSIONS;
+static bool	mergeByTime	=	false;
+static size_t	reorderWindow	=	DEFAULT_REORDER_WINDOW;
+static bool	sortByTime	=	false;
+static size_t	sortMemory	=	(size_t)DEFAULT_SORT_MEMORY_MB << 20;
+static const char*	tempDir	=	NULL;
+static const char*	buildIndexName	=	NULL;
+static const char*	queryIndexName	=	NULL;
+static const char*	buildValueIndexName	=	NULL;
+static const char*	valueIndexName	=	NULL;
+static const char*	cacheDirectory	=	NULL;
+static uint64_t		cacheSize	=	(uint64_t)DEFAULT_CHUNK_CACHE_MB << 20;
+static bool		cacheStats	=	false;
+static uint64_t		dedupMemory	=	(uint64_t)DEFAULT_DEDUP_MEMORY_MB << 20;
+static const char*	hashManifestName	=	NULL;
+static unsigned int	hashThreads	=	0;	/*  one per CPU left to the decoder */
+static unsigned int	asyncIoDepth	=	0;
+static bool		asyncIoUring	=	true;
+static const char*	daemonSocket	=	NULL;
+static unsigned int	maxJobs		=	0;	/*  one per CPU */
+static const char*	outputSpec	=	NULL;
+static unsigned int	outputQueueBlocks	=	DEFAULT_SINK_QUEUE_BLOCKS;
+static const char*	compressMethod	=	NULL;
+static unsigned int	compressThreads	=	0;	/*  one per CPU left to the decoder */
+static bool		printStats	=	false;
+static const char*	traceFileName	=	NULL;
+static const char*	cpuTierName	=	NULL;	/*  NULL: the best of this CPU */
+static bool		printCpuFeatures	=	false;
 
-	*bufferUsed += charLength;
+typedef struct
+{
+	char*			fileName;
+	int			f;		/*  -1 for archive members */
+	char*			copyName;	/*  a member copied to a temporary file */
+	struct sChunkReader*	reader;
+	uint64_t		off;
+	int			indexFileIdx;
 }
+EvtxSource;
+
+/*  Takes the source over */
+typedef bool	(*VisitSourceFunc)(void* context, EvtxSource* evtxSource);
+
+static size_t	numMemberCopies	=	0;
+
+#define MERGE_RESERVED_FILES	16
 
-static bool	ReadPrefixedUnicodeString(ParseContext* ctx, char* nameBuffer, size_t nameBufferSize, bool isNullTerminated)
+static bool	DecodeSourceChunk(void* source, RecordBatch* batch, bool* endOfSource)
 {
-	uint16_t	nameCharCnt;
-	size_t		nameBufferUsed	=	0;
-	size_t		idx		=	0;
+	EvtxSource*	evtxSource	=	(EvtxSource*)source;
+	const uint8_t*	chunk;
+	bool		result;
 
-	if ( !ReadData(ctx, &nameCharCnt) )
+	if ( !EvtxReadChunk(evtxSource->reader, &chunk, endOfSource) )
+	{
+		printf("Failed on %s\n", evtxSource->fileName);
 		return false;
+	}
+	if ( *endOfSource )
+		return true;
 
-	// TODO : convert UTF-16 to UTF-8
-	for (idx = 0; idx < nameCharCnt && idx*2 < ( nameBufferSize - 1 ) ; idx ++)
+	if ( hashRecords )
+		HashChunkRecords(chunk);
+	if ( RecordFilterActive() || ChunkCacheUsable() )
 	{
-		uint16_t	w;
-
-		if ( !ReadData(ctx, &w) )
-			return false;
-		UTF16ToUTF8(w, nameBuffer, &nameBufferUsed, nameBufferSize);
+		result = CaptureChunk(chunk, evtxSource->off, evtxSource->indexFileIdx, batch);
 	}
+	else
+	{
+		captureBatch = batch;
+		result = EvtxParseChunk(parser, chunk, evtxSource->off);
+		captureBatch = NULL;
+	}
+	if ( hashRecords )
+		HashChunkEnd(evtxSource->fileName, evtxSource->off);
 
-	if ( nameBufferUsed >= nameBufferSize )
-		nameBufferUsed = nameBufferSize - 1;
-	nameBuffer[nameBufferUsed] = 0;
-
-	SkipBytes(ctx, (nameCharCnt - idx + ( isNullTerminated ? 1 : 0 ))*2);
+	evtxSource->off += EVTX_CHUNK_SIZE;
 
-	return true;
+	if ( !result )
+		printf("Failed on %s\n", evtxSource->fileName);
+	return result;
 }
 
-static bool	ReadName(ParseContext* ctx, char* nameBuffer, size_t nameBufferSize)
+static void	CloseEvtxSource(EvtxSource* evtxSource)
 {
-	uint16_t	nameHash;
-	uint32_t	chunkOffset;
-	uint32_t	d;
-	ParseContext	temporaryCtx(*ctx->chunkContext);
-	ParseContext*	ctxPtr		=	ctx;
+	ChunkReaderClose(evtxSource->reader);
+	evtxSource->reader = NULL;
+	if ( evtxSource->f >= 0 )
+		close(evtxSource->f);
+	evtxSource->f = -1;
+	CloseTempFile(NULL, evtxSource->copyName);
+	evtxSource->copyName = NULL;
+	free(evtxSource->fileName);
+	evtxSource->fileName = NULL;
+}
 
-	if ( nameBufferSize < 2 )
-		return false;
-	nameBuffer[0] = 0;
-	if ( !ReadData(ctx, &chunkOffset) )
-		return false;
-	if ( ctx->offset + ctx->offsetFromChunkStart != chunkOffset )
+/*  Reads the file header, closes the source when it cannot be read */
+static bool	StartEvtxSource(EvtxSource* evtxSource)
+{
+	evtxSource->off = sizeof(EvtxHeader);
+	if ( !EvtxReadFileHeader(evtxSource->reader) )
 	{
-		// printf("!!!!!! %08X %08X\n", chunkOffset, (uint32_t)(ctx->offset + ctx->offsetFromChunkStart));
-		ctxPtr = &temporaryCtx;
-		ctxPtr->offset = chunkOffset;
-	}
-
-	if ( !ReadData(ctxPtr, &d) )
+		printf("Failed on %s\n", evtxSource->fileName);
+		CloseEvtxSource(evtxSource);
 		return false;
-	if ( !ReadData(ctxPtr, &nameHash) )
-		return false;
-	if ( !ReadPrefixedUnicodeString(ctxPtr, nameBuffer, nameBufferSize, true) )
-		return false;
-
+	}
 	return true;
 }
 
-static const char*	GetProperKeyName(ParseContext* ctx)
+/*  Hands the source to visit unless the index rules it out */
+static bool	VisitEvtxSource(EvtxSource* evtxSource, uint64_t fileSize, VisitSourceFunc visit, void* context)
 {
-	const char*	key;
-	const char*	upperName;
-
-	key = GetName();
-
-	// printf("Key: %s Upper: %s\n", key, GetUpperName());
-
-	upperName = GetUpperName();
-
-	if ( ( upperName != NULL ) &&
-		!strcmp(key, "Data") &&
-		!strcmp(upperName, "EventData") &&
-		ctx->cachedValue[0] != 0 )
+	if ( evtxSource->fileName == NULL || evtxSource->reader == NULL )
 	{
-		key = ctx->cachedValue;
+		printf("Failed on %s\n", evtxSource->fileName != NULL ? evtxSource->fileName : "?");
+		CloseEvtxSource(evtxSource);
+		return false;
 	}
-
-	return key;
+	if ( !IndexLookupFile(evtxSource->fileName, fileSize, &evtxSource->indexFileIdx) )
+	{
+		CloseEvtxSource(evtxSource);
+		return true;
+	}
+	return visit(context, evtxSource);
 }
 
-static bool	ParseValueText(ParseContext* ctx)
+/*  Hands the log, or every log of an archive, to visit.  An archive is read
+ *  once front to back, the reader of a member is valid until visit returns.
+ *  False when the file or one of its logs could not be read. */
+static bool	VisitEvtxSources(const char* fileName, VisitSourceFunc visit, void* context)
 {
-	uint8_t		stringType;
-	char		valueBuffer[256];
-	const char*	upperName;
-	const char*	key;
+	uint8_t			prefix[ARCHIVE_SNIFF_SIZE];
+	size_t			prefixLen;
+	struct sArchive*	archive;
+	struct sChunkReader*	reader;
+	const char*		memberName;
+	uint64_t		memberSize;
+	EvtxSource		evtxSource;
+	bool			result	=	true;
+	int			f	=	OpenInput(fileName);
 
-	if ( !ReadData(ctx, &stringType) )
-		return false;
-	if ( !ReadPrefixedUnicodeString(ctx, valueBuffer, sizeof(valueBuffer), false) )
+	if ( f < 0 )
+	{
+		printf("Cannot open %s: %s\n", fileName, strerror(errno));
 		return false;
-	// printf("******* %s=%s", GetName(), valueBuffer);
-
-	key = GetProperKeyName(ctx);
-	upperName = GetUpperName();
+	}
+	memset(&evtxSource, 0, sizeof(evtxSource));
+	prefixLen = ReadPrefix(f, prefix, sizeof(prefix));
 
-	if ( ( key != NULL ) &&
-		( ( upperName == NULL ) ||
-		strcmp(key, "Name") ||
-		strcmp(GetUpperName(), "Data") ) )
+	if ( !ArchiveDetect(prefix, prefixLen) )
 	{
-		RegisterFixedPair(ctx->currentTemplateIdx, key, valueBuffer);
+		evtxSource.fileName = strdup(fileName);
+		evtxSource.f = f;
+		evtxSource.reader = OpenLogReader(f, prefix, prefixLen);
+		return VisitEvtxSource(&evtxSource, FileSize(f), visit, context);
 	}
 
-	SetState(ctx, StateNormal);
-
-	strncpy(ctx->cachedValue, valueBuffer, sizeof(valueBuffer));
-	ctx->cachedValue[sizeof(ctx->cachedValue)-1] = 0;
+	archive = ArchiveOpen(fileName, f, prefix, prefixLen);
+	if ( archive == NULL )
+	{
+		printf("Failed on %s\n", fileName);
+		return false;
+	}
+	while ( ( reader = ArchiveNextMember(archive, &memberName, &memberSize) ) != NULL )
+	{
+		memset(&evtxSource, 0, sizeof(evtxSource));
+		evtxSource.fileName = MemberFileName(fileName, memberName);
+		evtxSource.f = -1;
+		evtxSource.reader = reader;
+		if ( !VisitEvtxSource(&evtxSource, memberSize, visit, context) )
+			result = false;
+	}
+	if ( ArchiveFailed(archive) )
+	{
+		printf("Failed on %s\n", fileName);
+		result = false;
+	}
+	ArchiveClose(archive);
 
-	return true;
+	return result;
 }
 
-static bool	ParseAttributes(ParseContext* ctx)
+/*  Copies an archive member to a temporary file and reads it from there, so
+ *  that the merge holds a plain file per member instead of a stream of the
+ *  archive */
+static bool	CopyMember(EvtxSource* evtxSource)
 {
-	char		nameBuffer[256];
+	size_t	blockSize	=	EVTX_FILE_HEADER_SIZE;
+	bool	result		=	true;
+	FILE*	copy		=	OpenTempFile(tempDir, "member", numMemberCopies++, &evtxSource->copyName);
 
-	if ( !ReadName(ctx, nameBuffer, sizeof(nameBuffer)) )
+	if ( copy == NULL )
 		return false;
-	// printf(" %s", nameBuffer);
+	for (;;)
+	{
+		const uint8_t*	data;
+		size_t		dataLen;
 
-	PushName(nameBuffer);
-	SetState(ctx, StateInAttribute);
+		if ( !evtxSource->reader->read(evtxSource->reader, blockSize, &data, &dataLen) )
+		{
+			printf("Failed on %s\n", evtxSource->fileName);
+			result = false;
+			break;
+		}
+		if ( fwrite(data, 1, dataLen, copy) != dataLen || dataLen < blockSize )
+			break;
+		blockSize = EVTX_CHUNK_SIZE;
+	}
+	if ( !FinishTempFile(&copy) && result )
+	{
+		printf("Cannot write the temporary file %s\n", evtxSource->copyName);
+		result = false;
+	}
+	ChunkReaderClose(evtxSource->reader);
+	evtxSource->reader = NULL;
+	if ( !result )
+		return false;
 
-	return true;
+	evtxSource->f = open(evtxSource->copyName, O_RDONLY|O_BINARY);
+	if ( evtxSource->f < 0 )
+	{
+		printf("Cannot open %s: %s\n", evtxSource->copyName, strerror(errno));
+		return false;
+	}
+	evtxSource->reader = OpenLogReader(evtxSource->f, NULL, 0);
+	return ( evtxSource->reader != NULL );
 }
 
-static bool	ParseOpenStartElement(ParseContext* ctx, bool hasAttributes)
+/*  Adds the log to the sort shared by all files, or sorts it on its own
+ *  when the sort is NULL */
+static bool	SortSource(void* context, EvtxSource* evtxSource)
 {
-	uint8_t		b;
-	uint16_t	w;
-	uint32_t	elementLength;
-	uint32_t	attributeListLength	=	0;
-	char		nameBuffer[256];
+	struct sTimeSort*	sort	=	(struct sTimeSort*)context;
+	bool			result;
 
-	if ( !ReadData(ctx, &w) )
-		return false;
-	if ( !ReadData(ctx, &elementLength) )
+	if ( !StartEvtxSource(evtxSource) )
 		return false;
-	if ( !ReadName(ctx, nameBuffer, sizeof(nameBuffer)) )
-		return false;
-	if ( hasAttributes )
+	if ( sort != NULL )
 	{
-		if ( !ReadData(ctx, &attributeListLength) )
-			return false;
+		result = TimeSortAdd(sort, evtxSource, DecodeSourceChunk);
 	}
-#ifdef PRINT_TAGS
-	printf("<%s [%08X] ", nameBuffer, attributeListLength);
-	fflush(stdout);
-#endif
-
-	PushName(nameBuffer);
-
-	return true;
+	else
+	{
+		sort = TimeSortBegin(sortMemory, tempDir);
+		result = ( sort != NULL && TimeSortAdd(sort, evtxSource, DecodeSourceChunk) );
+		if ( sort != NULL && !TimeSortEnd(sort, WriteRecordToStdout, NULL) )
+			result = false;
+	}
+	CloseEvtxSource(evtxSource);
+	return result;
 }
 
-static bool	ParseCloseStartElement(ParseContext* ctx)
+typedef struct
 {
-	SetState(ctx, StateNormal);
-#ifdef PRINT_TAGS
-	printf(">");
-	fflush(stdout);
-#endif
-	return true;
+	EvtxSource*	sources;
+	size_t		numSources;
+	size_t		maxSources;
+	size_t		openLimit;
+	bool		tooMany;	/*  a short merge is not printed */
 }
+MergeSources;
 
-static bool	ParseCloseElement(ParseContext* ctx)
+/*  How many logs the merge may keep open: the limit of open files less a
+ *  few for the output, the archive being read and the other options */
+static size_t	MergeOpenLimit(void)
 {
-	SetState(ctx, StateNormal);
-	PopName();
+#ifndef _WIN32
+	struct rlimit	limit;
 
-#ifdef PRINT_TAGS
-	printf("</>");
-	fflush(stdout);
+	if ( getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY )
+		return limit.rlim_cur > MERGE_RESERVED_FILES ? (size_t)( limit.rlim_cur - MERGE_RESERVED_FILES ) : 0;
 #endif
-	return true;
+	return SIZE_MAX;
 }
 
-static void	DumpTemplateContents(ParseContext* ctx, unsigned int templateIdx)
+/*  Keeps the log open for the merge */
+static bool	AddMergeSource(void* context, EvtxSource* evtxSource)
 {
-	return ;
+	MergeSources*	merge	=	(MergeSources*)context;
 
-	printf("********************* TEMPLATE BEGIN ************************\n");
-	printf("Short ID: %08X\n", templates[templateIdx].shortID);
-	for ( TemplateFixedPair* ptr = templates[templateIdx].fixedRoot.next; ptr != NULL; ptr = ptr->next )
+	if ( merge->numSources >= merge->openLimit )
 	{
-		printf(" %s = %s\n", ptr->key, ptr->value);
+		if ( !merge->tooMany )
+			printf("Cannot merge more than %zu logs with this limit of open files (ulimit -n), "
+				"--sort time opens one at a time\n", merge->openLimit);
+		merge->tooMany = true;
+		CloseEvtxSource(evtxSource);
+		return false;
+	}
+	if ( evtxSource->f < 0 && !CopyMember(evtxSource) )
+	{
+		CloseEvtxSource(evtxSource);
+		return false;
 	}
-	for ( TemplateArgPair* ptr = templates[templateIdx].argsRoot.next; ptr != NULL; ptr = ptr->next )
+	if ( !StartEvtxSource(evtxSource) )
+		return false;
+	if ( merge->numSources >= merge->maxSources )
 	{
-		printf(" %s { arg %04X type %04X } \n", ptr->key, ptr->argIdx, ptr->type);
+		size_t		newMax		=	merge->maxSources == 0 ? 16 : merge->maxSources * 2;
+		EvtxSource*	newSources	=	(EvtxSource*)realloc(merge->sources, sizeof(*newSources) * newMax);
+
+		if ( newSources == NULL )
+		{
+			CloseEvtxSource(evtxSource);
+			return false;
+		}
+		merge->sources = newSources;
+		merge->maxSources = newMax;
 	}
-	printf("********************* TEMPLATE END   ************************\n");
+	merge->sources[merge->numSources++] = *evtxSource;
+	return true;
 }
 
-static bool	ParseTemplateInstance(ParseContext* ctx)
+/*  Sorts the files one after another, or all together with --merge-by-time.
+ *  Only one log is open at a time; a log that cannot be read does not stop
+ *  the others, but fails the run. */
+static bool	SortEVTX(char** fileNames, int numFiles)
 {
-	uint8_t		b;
-	uint32_t	numArguments;
-	uint32_t	shortID;
-	uint32_t	tempResLen;
-	uint32_t	totalArgLen		=	0;
+	struct sTimeSort*	sort	=	NULL;
+	bool			result	=	true;
 
-	if ( !ReadData(ctx, &b) )
-		return false;
-	if ( b != 0x01 )
-		return false;
-	if ( !ReadData(ctx, &shortID) )
-		return false;
-	if ( !ReadData(ctx, &tempResLen) )
-		return false;
-	if ( !ReadData(ctx, &numArguments) )
+	if ( mergeByTime && ( sort = TimeSortBegin(sortMemory, tempDir) ) == NULL )
 		return false;
 
-	// printf("OK, template %08X\n", shortID);
-
-	if ( !IsKnownID(shortID, &ctx->currentTemplateIdx) )
-	//if ( numArguments == 0x00000000 )
+	for (int idx = 0; idx < numFiles; idx++)
 	{
-		uint8_t		longID[16];
-		uint32_t	templateBodyLen;
-		ParseContext	templateCtx;
-
-		/* template definition follows */
-		if ( !ReadData(ctx, &longID[0], sizeof(longID)) )
-			return false;
-		if ( !ReadData(ctx, &templateBodyLen) )
-			return false;
-		// printf("Template body, len %08X\n", templateBodyLen);
+		if ( !VisitEvtxSources(fileNames[idx], SortSource, sort) )
+			result = false;
+	}
 
-		templateCtx.data = ctx->data + ctx->offset;
-		templateCtx.dataLen = templateBodyLen; /* mm_min ... */
-		templateCtx.offset = 0;
-		templateCtx.chunkContext = ctx;
-		templateCtx.offsetFromChunkStart = ctx->offset + ctx->offsetFromChunkStart;
-		templateCtx.cachedValue[0] = 0;
+	if ( sort != NULL && !TimeSortEnd(sort, WriteRecordToStdout, NULL) )
+		result = false;
+	return result;
+}
 
-		RegisterID(shortID, &templateCtx.currentTemplateIdx);
+/*  Parses the files in timestamp order: merged (each file must be nearly
+ *  ordered) or fully sorted with spilling to temporary files */
+static bool	ParseEVTXOrdered(char** fileNames, int numFiles)
+{
+	MergeSources	merge;
+	void**		sources;
+	bool		result		=	true;
 
-		if ( !ParseBinXml(&templateCtx, 0) )
-			return false;
+	if ( sortByTime )
+		return SortEVTX(fileNames, numFiles);
 
-		SkipBytes(ctx, templateBodyLen);
-
-		if ( !ReadData(ctx, &numArguments) )
-			return false;
-
-		ctx->currentTemplateIdx = templateCtx.currentTemplateIdx;
-
-		DumpTemplateContents(ctx, ctx->currentTemplateIdx);
+	memset(&merge, 0, sizeof(merge));
+	merge.openLimit = MergeOpenLimit();
+	for (int idx = 0; idx < numFiles && !merge.tooMany; idx++)
+	{
+		if ( !VisitEvtxSources(fileNames[idx], AddMergeSource, &merge) )
+			result = false;
 	}
 
-	// printf("Number of arguments: %08X\n", numArguments);
-
-	for ( TemplateFixedPair* ptr = templates[ctx->currentTemplateIdx].fixedRoot.next; ptr != NULL; ptr = ptr->next )
+	sources = (void**)malloc(sizeof(*sources) * ( merge.numSources + 1 ));
+	if ( sources == NULL || merge.tooMany )
+		result = false;
+	else
 	{
-		bool	alreadyPrinted	=	false;
-
-		if ( !strcmp(ptr->key, "EventID") )
-		{
-			uint16_t	eventID	=	strtoul(ptr->value, NULL, 10);
-			if ( ( eventID != 0 ) && ( eventDescriptionHashTable[eventID] != NULL ) )
-			{
-				printf("'%s':%u (%s), ", ptr->key, eventID, eventDescriptionHashTable[eventID]);
-				alreadyPrinted = true;
-			}
-		}
-
-		if ( !alreadyPrinted )
-			printf("'%s':'%s', ", ptr->key, ptr->value);
+		for (size_t idx = 0; idx < merge.numSources; idx++)
+			sources[idx] = &merge.sources[idx];
+		if ( !MergeByTime(sources, merge.numSources, DecodeSourceChunk, reorderWindow, WriteRecordToStdout, NULL) )
+			result = false;
 	}
 
-	// printf("\n");
+	for (size_t idx = 0; idx < merge.numSources; idx++)
+		CloseEvtxSource(&merge.sources[idx]);
+	free(merge.sources);
+	free(sources);
 
-	size_t		argumentMapCount	=	numArguments * 2;
-	uint16_t*	argumentMap		=	(uint16_t*)malloc(sizeof(*argumentMap)*argumentMapCount);
+	return result;
+}
 
-	if ( !ReadData(ctx, argumentMap, argumentMapCount) )
+/*  Decodes only the records the inverted index lists for the value; false
+ *  when an indexed file is missing, changed or cannot be read */
+static bool	LookupIndexedValue(const struct sValueIndex* index)
+{
+	ValuePosting*	postings;
+	size_t		numPostings	=	ValueIndexLookup(index, lookupField, lookupValue, &postings);
+	const uint8_t*	chunk		=	NULL;
+	RecordBatch	batch;
+	int		f		=	-1;
+	struct sChunkReader*	reader	=	NULL;
+	uint32_t	fileIdx		=	0;
+	uint64_t	chunkOff	=	0;
+	bool		chunkLoaded	=	false;
+	const char*	hashedFile	=	NULL;	/*  of the chunk with digests pending */
+	bool		result		=	true;
+
+	InitBatch(&batch);
+
+	for (size_t idx = 0; idx < numPostings; idx++)
 	{
-		printf("Failed to read the arguments\n");
-		free(argumentMap);
-		return false;
-	}
+		const ValuePosting*	posting	=	&postings[idx];
+		uint64_t		off	=	sizeof(EvtxHeader) +
+							( ( posting->recordOffset - sizeof(EvtxHeader) ) & ~(uint64_t)( EVTX_CHUNK_SIZE - 1 ) );
 
-	for (uint64_t argumentIdx = 0; argumentIdx < numArguments; argumentIdx++)
-	{
-		uint16_t		argLen		=	argumentMap[argumentIdx*2];
-		uint16_t		argType		=	argumentMap[argumentIdx*2 + 1];
-		TemplateArgPair*	argPair		=	NULL;
-
-	//	printf("\n %08X : [%02X %02X %02X] Arg %" PRIX64" type %08X len %08X\n",
-	//			(uint32_t)ctx->offset, ctx->data[ctx->offset], ctx->data[ctx->offset+1], ctx->data[ctx->offset+2],
-	//			argumentIdx, argType, argLen);
-		for ( TemplateArgPair* ptr = templates[ctx->currentTemplateIdx].argsRoot.next; ptr != NULL; ptr = ptr->next )
+		if ( idx == 0 || posting->fileIdx != fileIdx )
 		{
-			if ( ptr->argIdx == argumentIdx )
+			const char*	fileName	=	ValueIndexFileName(index, posting->fileIdx);
+
+			if ( hashedFile != NULL )
+			{
+				HashChunkEnd(hashedFile, chunkOff);
+				hashedFile = NULL;
+			}
+			ChunkReaderClose(reader);
+			reader = NULL;
+			if ( f >= 0 )
+				close(f);
+			fileIdx = posting->fileIdx;
+			chunkLoaded = false;
+			f = open(fileName, O_RDONLY|O_BINARY);
+			if ( f < 0 )
+			{
+				printf("Cannot open %s: %s\n", fileName, strerror(errno));
+				result = false;
+				continue;
+			}
+			if ( FileSize(f) != ValueIndexFileSize(index, fileIdx) )
+			{
+				fprintf(stderr, "Skipped %s, changed since indexing\n", fileName);
+				close(f);
+				f = -1;
+				result = false;
+				continue;
+			}
+			reader = ChunkReaderOpenFile(f);
+			if ( reader == NULL )
 			{
-				argPair = ptr;
-				break;
+				printf("Failed on %s\n", fileName);
+				result = false;
 			}
 		}
-
-		if ( argPair == NULL )
+		if ( reader == NULL )
+			continue;
+		if ( posting->recordOffset < sizeof(EvtxHeader) )
 		{
-			// printf("Argument not found\n");
-			SkipBytes(ctx, argLen);
+			printf("Failed on %s\n", ValueIndexFileName(index, fileIdx));
+			result = false;
+			continue;
 		}
-		else
+
+		if ( !chunkLoaded || off != chunkOff )
 		{
-			uint8_t		v_b;
-			uint16_t	v_w;
-			uint32_t	v_d;
-			uint64_t	v_q;
-			time_t		unixTimestamp;
-			struct tm	localtm;
-			struct tm*	t;
-			uint8_t		sid[2+6];
-			EvtxGUID	guid;
-			char*		stringBuffer;
-			size_t		stringNumUsed	=	0;
-			size_t		stringSize	=	0;
-
-			switch(argType)
+			bool	endOfFile;
+
+			if ( hashedFile != NULL )
 			{
-			//// case 0x00:	/*  void */
-				//break;
-			case 0x01:	/*  String */
-				stringSize = argLen*2+2;
-				stringBuffer = (char*)malloc(stringSize);
-				if ( stringBuffer == NULL )
-					return false;
-				for (size_t idx = 0; idx < argLen/2; idx++)
-				{
-					if ( !ReadData(ctx, &v_w) )
-						return false;
-					UTF16ToUTF8(v_w, stringBuffer, &stringNumUsed, stringSize);
-				}
-				if ( stringNumUsed >= stringSize )
-					stringNumUsed = stringSize - 1;
-				stringBuffer[stringNumUsed] = 0;
-				printf("'%s':'%s', ", argPair->key, stringBuffer);
-				free(stringBuffer);
-				break;
-			case 0x04:	/*  uint8_t */
-				if ( !ReadData(ctx, &v_b) )
-					return false;
-				printf("'%s':%02u, ", argPair->key, v_b);
-				break;
-			case 0x06:	/*  uint16_t */
-				if ( !ReadData(ctx, &v_w) )
-					return false;
-
-				if ( !strcmp(argPair->key, "EventID") && ( eventDescriptionHashTable[v_w] != NULL ))
-					printf("'%s':%04u (%s), ", argPair->key, v_w, eventDescriptionHashTable[v_w]);
-				else
-					printf("'%s':%04u, ", argPair->key, v_w);
-				break;
-			case 0x08:	/*  uint32_t */
-				if ( !ReadData(ctx, &v_d) )
-					return false;
-
-				if ( !strcmp(argPair->key, "LogonType") && ( v_d <= 11 ) && ( logonTypes[v_d] != NULL ))
-					printf("'%s':%08u (%s), ", argPair->key, v_d, logonTypes[v_d]);
-				else
-					printf("'%s':%08u, ", argPair->key, v_d);
-				break;
-			case 0x0A:	/*  uint64_t */
-				if ( !ReadData(ctx, &v_q) )
-					return false;
-				printf("'%s':%016" PRIu64 ", ", argPair->key, v_q);
-				break;
-			case 0x0E:	/*  binary */
-				printf("'%s':", argPair->key);
-				for (size_t idx = 0; idx < argLen; idx++)
-				{
-					if ( !ReadData(ctx, &v_b) )
-						return false;
-					printf("%02X", v_b);
-				}
-				printf(", ");
-				break;
-			case 0x0F:	/* GUID */
-				if ( !ReadData(ctx, &guid) )
-					return false;
-				printf("'%s':%08X-%02X-%02X-%02X%02X%02X%02X%02X%02X%02X%02X, ", argPair->key,
-						guid.d1, guid.w1, guid.w2,
-						guid.b1[0], guid.b1[1], guid.b1[2], guid.b1[3],
-						guid.b1[4], guid.b1[5], guid.b1[6], guid.b1[7]);
-				break;
-			case 0x14:	/*  HexInt32 */
-				if ( !ReadData(ctx, &v_d) )
-					return false;
-				printf("'%s':%08" PRIX32", ", argPair->key, v_d);
-				break;
-
-			case 0x15:	/*  HexInt64 */
-				if ( !ReadData(ctx, &v_q) )
-					return false;
-				printf("'%s':%016" PRIX64 ", ", argPair->key, v_q);
-				break;
-			case 0x11:	/*  FileTime */
-				if ( !ReadData(ctx, &v_q) )
-					return false;
-				unixTimestamp = UnixTimeFromFileTime(v_q);
-				t = gmtime_r(&unixTimestamp, &localtm);
-				if ( t == NULL )
-					printf("'%s':%016" PRIX64 ", ", argPair->key, v_q);
-				else
-					printf("'%s':%04u.%02u.%02u-%02u:%02u:%02u, ",
-							argPair->key,
-							t->tm_year+1900, t->tm_mon+1, t->tm_mday, t->tm_hour, t->tm_min, t->tm_sec);
-				break;
-			case 0x13:	/*  SID */
-				if ( argLen < sizeof(sid) )
-					return false;
-				if ( !ReadData(ctx, sid, sizeof(sid)) )
-					return false;
-				v_q = 0;
-				for (size_t idx = 0; idx < 6; idx++)
-				{
-					v_q <<= 8;
-					v_q |= sid[2+idx];
-				}
-				printf("'%s':S-%u-%" PRIu64 "", argPair->key, sid[0], v_q);
-				for (size_t idx = sizeof(sid); idx + 4 <= argLen; idx += 4)
-				{
-					if ( !ReadData(ctx, &v_d) )
-						return false;
-					printf("-%u", v_d);
-				}
-				printf(", ");
-				break;
-			case 0x21:	/*  BinXml */
-				{
-					ParseContext	temporaryCtx(*ctx);
-					temporaryCtx.dataLen = temporaryCtx.offset + argLen;
-					if ( !ParseBinXml(&temporaryCtx, 0) )
-						;//return false;
-					// printf("=====<<<<< %08X\n", argLen);
-					SkipBytes(ctx, argLen);
-				}
-				break;
-			default:
-				if ( argType != 0x00 )
-					printf("'%s':'...//%04X[%04X]', ", argPair->key, argPair->type, argLen);
-				SkipBytes(ctx, argLen);
-				break;
+				HashChunkEnd(hashedFile, chunkOff);
+				hashedFile = NULL;
+			}
+			chunkLoaded = ( ChunkReaderSeek(reader, off) && EvtxReadChunk(reader, &chunk, &endOfFile) && !endOfFile );
+			chunkOff = off;
+			if ( !chunkLoaded )
+			{
+				printf("Failed on %s\n", ValueIndexFileName(index, fileIdx));
+				result = false;
+				continue;
+			}
+			EvtxParserBeginChunk(parser);
+			if ( hashRecords )
+			{
+				HashChunkRecords(chunk);
+				hashedFile = ValueIndexFileName(index, fileIdx);
 			}
 		}
 
-		totalArgLen += argLen;
+		ClearBatch(&batch);
+		captureBatch = &batch;
+		EvtxParseRecord(parser, chunk, off, posting->recordOffset - off);
+		captureBatch = NULL;
+		for (size_t recordIdx = 0; recordIdx < batch.numRecords; recordIdx++)
+			SinkWriteRecord(batch.text + batch.records[recordIdx].textOffset, batch.records[recordIdx].textLen);
 	}
 
-	free(argumentMap);
-
-	return true;
+	if ( hashedFile != NULL )
+		HashChunkEnd(hashedFile, chunkOff);
+	ChunkReaderClose(reader);
+	if ( f >= 0 )
+		close(f);
+	FreeBatch(&batch);
+	free(postings);
+	return result;
 }
 
+#ifdef _WIN32
 
-static bool	ParseOptionalSubstitution(ParseContext* ctx)
+#ifndef __MINGW64_VERSION_MAJOR
+
+extern "C"
 {
-	uint16_t	substitutionID;
-	uint8_t		valueType;
+BOOL (WINAPI *Wow64DisableWow64FsRedirection)(
+  PVOID *OldValue
+)	= (BOOL(WINAPI*)(PVOID*))GetProcAddress(GetModuleHandle(L"KERNEL32.DLL"), "Wow64DisableWow64FsRedirection");
 
-	if ( !ReadData(ctx, &substitutionID) )
-		return false;
-	if ( !ReadData(ctx, &valueType) )
-		return false;
-	if ( valueType == 0x00 )
-	{
-		if ( !ReadData(ctx, &valueType) )
-			return false;
-	}
+BOOL (WINAPI * Wow64RevertWow64FsRedirection)(
+  PVOID OldValue )
+	= (BOOL(WINAPI*)(PVOID))GetProcAddress(GetModuleHandle(L"KERNEL32.DLL"), "Wow64RevertWow64FsRedirection");
+}
 
-	// printf("******* %s=<<param %X/type %X>> ", GetName(), substitutionID, valueType);
-	RegisterArgPair(ctx->currentTemplateIdx, GetProperKeyName(ctx), valueType, substitutionID);
-	SetState(ctx, StateNormal);
+#endif
 
-	return true;
-}
+#endif
 
-static bool	ParseBinXmlPre(const uint8_t* data, size_t dataLen, size_t inFileOffset, size_t inChunkOffset)
-{
-	ParseContext	ctx;
 
-	ctx.data = data;
-	ctx.dataLen = dataLen;
-	ctx.offset = inChunkOffset;
-	ctx.currentTemplateIdx = INVALID_TEMPLATE_IDX;
-	ctx.chunkContext = &ctx;
-	ctx.offsetFromChunkStart = 0;
-	ctx.cachedValue[0] = 0;
 
-	return ParseBinXml(&ctx, inFileOffset);
+static void	Usage(const char* programName)
+{
+	printf("Usage: %s [options] file.evtx ...\n", programName);
+	printf("  a file named - is read from the standard input; pipes are read front to back without seeking\n");
+	printf("  --sessions          print reconstructed logon sessions instead of records\n");
+	printf("  --max-sessions N    sessions kept in memory before the oldest is flushed (default %u)\n", DEFAULT_MAX_SESSIONS);
+	printf("  --rules FILE        print only the records matching detection rules, with rule ids\n");
+	printf("  --merge-by-time     interleave the records of all files by timestamp\n");
+	printf("  --reorder-window N  records buffered per file to fix local disorder (default %u)\n", DEFAULT_REORDER_WINDOW);
+	printf("  --sort time         print the records of each file (of all files with --merge-by-time) sorted by time\n");
+	printf("  --sort-memory MB    memory used for sorting before spilling runs to disk (default %u)\n", DEFAULT_SORT_MEMORY_MB);
+	printf("  --temp-dir DIR      directory for the sort runs (default: system temporary directory)\n");
+	printf("  --grep TEXT         print only the records containing TEXT (ASCII case ignored), chunks without\n");
+	printf("                      TEXT stored as a string are skipped undecoded, also for --sessions and --rules\n");
+	printf("  --build-index FILE  write a per-chunk Bloom filter index of the files instead of printing records,\n");
+	printf("                      archives are refused\n");
+	printf("  --index-fields LIST comma separated fields to index (default %s)\n", DEFAULT_INDEX_FIELDS);
+	printf("  --cache DIR         replay the records of chunks seen before from a cache in DIR\n");
+	printf("  --cache-size MB     size limit of the cache, least recently used chunks go first (default %u)\n", DEFAULT_CHUNK_CACHE_MB);
+	printf("  --cache-stats       print the cache hit rate to stderr at exit\n");
+	printf("  --dedup             drop records already seen in any input (same computer, channel, number,\n");
+	printf("                      time and values), the number removed is reported to stderr\n");
+	printf("  --dedup-memory MB   memory for the seen records, above it repeats may slip through (default %u)\n", DEFAULT_DEDUP_MEMORY_MB);
+	printf("  --hash              add the SHA-256 of the raw record bytes to every record as 'RecordSHA256'\n");
+	printf("  --hash-manifest FILE  also write the SHA-256 of every chunk and record read to FILE (implies --hash)\n");
+	printf("  --hash-threads N    hashing threads (default: number of CPUs less one)\n");
+	printf("  --map-window N      decode the chunks in place from a view of N chunks of each file (%u is a good\n", DEFAULT_MAP_WINDOW_CHUNKS);
+	printf("                      start) moved along with the parse, also for large files on 32-bit builds\n");
+	printf("  --async-io N        keep N chunk reads in flight ahead of the parser (%u is a good start), through\n", DEFAULT_ASYNC_IO_DEPTH);
+	printf("                      io_uring where the kernel has it and an I/O thread otherwise\n");
+	printf("  --no-io-uring       with --async-io, always read on the I/O thread\n");
+	printf("  --index FILE        with --query, decode only the chunks the index marks as candidates\n");
+	printf("  --query VALUE       print only the records with an indexed field equal to VALUE (ASCII case ignored);\n");
+	printf("                      integers are given without leading zeros; without file names the files\n");
+	printf("                      recorded in the index are searched\n");
+	printf("  --build-value-index FILE  write an inverted index of the --index-fields values of the files,\n");
+	printf("                      archives are refused\n");
+	printf("  --value-index FILE  with --lookup, the inverted index to use\n");
+	printf("  --lookup FIELD=VALUE  decode and print only the indexed records where FIELD equals VALUE\n");
+	printf("  --output DEST       write the output on a thread to DEST: - (stdout), a file, unix:SOCKET or\n");
+	printf("                      shards:N:PREFIX for the files PREFIX.000 .. and PREFIX.manifest\n");
+	printf("  --output-queue N    %u MiB blocks buffered for --output before decoding waits (default %u)\n", SINK_BLOCK_SIZE >> 20, DEFAULT_SINK_QUEUE_BLOCKS);
+	printf("  --compress METHOD   gzip or zstd, with :LEVEL if wanted, a member or frame per block of --output\n");
+	printf("                      (stdout without it); the decode and compression CPU times go to stderr\n");
+	printf("  --compress-threads N  compression threads (default: number of CPUs less one)\n");
+	printf("  --stats             report bytes, chunks, records, throughput and the time spent reading,\n");
+	printf("                      tokenizing, on templates, arguments and formatting to stderr, per file and in total\n");
+	printf("  --trace FILE        write the chunk reads, decoding, output writes and queue depths of every\n");
+	printf("                      thread to FILE as Chrome trace events (chrome://tracing, ui.perfetto.dev)\n");
+	printf("  --daemon SOCKET     serve jobs on a Unix socket: a line of tab separated options and files in,\n");
+	printf("                      their output back, ending with a \"" DAEMON_STATUS_PREFIX "<code>\" line; the other\n");
+	printf("                      options given with --daemon apply to every job\n");
+	printf("  --max-jobs N        with --daemon, jobs run at a time (default: number of CPUs)\n");
+	printf("  --cpu-features      print the CPU features, the instruction set tiers and the kernels in use\n");
+	printf("  --cpu-tier TIER     run the kernels at a lower tier: scalar, sse2, sse4, avx2 or avx512\n");
 }
 
-static bool	ParseBinXml(ParseContext* ctx, size_t inFileOffset)
+/*  Options are removed from argv, file names are moved to argv[1 .. *numFiles] */
+static bool	ParseOptions(int argc, char* argv[], int* numFiles)
 {
-	bool	result	=	true;
-
-	ctx->state = StateNormal;
+	*numFiles = 0;
 
-	// printf("ParseBinXml(%08X, %08X)\n", (uint32_t)ctx->offset, (uint32_t)ctx->dataLen);
-
-	while ( result && ( ctx->offset < ctx->dataLen ) )
+	for (int idx = 1; idx < argc; idx++)
 	{
-		uint8_t	tag	=	ctx->data[ctx->offset++];
-
-		// printf("%08zX: %02X ", inFileOffset + ctx->offset, tag);
-		// fflush(stdout);
-		// printf("%08zX: %02X %02X %02X", inFileOffset + ctx->offset, tag, ctx->data[ctx->offset], ctx->data[ctx->offset+1]);
-
-		switch(tag)
+		if ( !strcmp(argv[idx], "--sessions") )
 		{
-		case 0x00:	/*  EOF */
-			ctx->offset = ctx->dataLen;
-			break;
-		case 0x01:	/*  OpenStartElementToken */
-			result = ParseOpenStartElement(ctx, false);
-			break;
-		case 0x41:
-			result = ParseOpenStartElement(ctx, true);
-			break;
-		case 0x02:	/* CloseStartElementToken */
-			result = ParseCloseStartElement(ctx);
-			break;
-		case 0x03:	/*  CloseEmptyElementToken */
-		case 0x04:	/*  CloseElementToken */
-			result = ParseCloseElement(ctx);
-			break;
-		case 0x05:	/*  ValueTextToken */
-		case 0x45:
-			result = ParseValueText(ctx);
-			break;
-		case 0x06:	/*  AttributeToken */
-		case 0x46:
-			result = ParseAttributes(ctx);
-			break;
-		case 0x07:	/* CDATASectionToken */
-		case 0x47:
-			break;
-		case 0x08:	/* CharRefToken */
-		case 0x48:
-			break;
-		case 0x09:	/*  EntityRefToken */
-		case 0x49:
-			break;
-		case 0x0A:	/*  PITargetToken */
-			break;
-		case 0x0B:	/*  PIDataToken */
-			break;
-		case 0x0C: /*  TemplateInstanceToken */
-			result = ParseTemplateInstance(ctx);
-			break;
-		case 0x0D:	/*  NormalSubstitutionToken */
-		case 0x0E:	/*  OptionalSubstitutionToken */
-			result = ParseOptionalSubstitution(ctx);
-			break;
-		case 0x0F: /*  FragmentHeaderToken */
-			SkipBytes(ctx, 3);
-			break;
-
-		default:
-			result = false;
-			break;
+			trackSessions = true;
+			printRecords = false;
+		}
+		else if ( !strcmp(argv[idx], "--max-sessions") && ( idx + 1 < argc ) )
+		{
+			maxSessions = strtoul(argv[++idx], NULL, 10);
+		}
+		else if ( !strcmp(argv[idx], "--rules") && ( idx + 1 < argc ) )
+		{
+			if ( !RulesLoad(argv[++idx]) )
+				return false;
+			printRecords = false;
+		}
+		else if ( !strcmp(argv[idx], "--merge-by-time") )
+		{
+			mergeByTime = true;
+		}
+		else if ( !strcmp(argv[idx], "--reorder-window") && ( idx + 1 < argc ) )
+		{
+			reorderWindow = strtoul(argv[++idx], NULL, 10);
+		}
+		else if ( !strcmp(argv[idx], "--sort") && ( idx + 1 < argc ) )
+		{
+			if ( strcmp(argv[++idx], "time") )
+				return false;
+			sortByTime = true;
+		}
+		else if ( !strcmp(argv[idx], "--sort-memory") && ( idx + 1 < argc ) )
+		{
+			sortMemory = (size_t)strtoul(argv[++idx], NULL, 10) << 20;
+		}
+		else if ( !strcmp(argv[idx], "--temp-dir") && ( idx + 1 < argc ) )
+		{
+			tempDir = argv[++idx];
+		}
+		else if ( !strcmp(argv[idx], "--grep") && ( idx + 1 < argc ) )
+		{
+			GrepFree(grepPattern);
+			grepPattern = GrepCompile(argv[++idx]);
+			if ( grepPattern == NULL )
+				return false;
+		}
+		else if ( !strcmp(argv[idx], "--build-index") && ( idx + 1 < argc ) )
+		{
+			buildIndexName = argv[++idx];
+			buildIndex = true;
+			printRecords = false;
+		}
+		else if ( !strcmp(argv[idx], "--index-fields") && ( idx + 1 < argc ) )
+		{
+			if ( !ChunkIndexSetFields(argv[++idx]) )
+				return false;
+		}
+		else if ( !strcmp(argv[idx], "--build-value-index") && ( idx + 1 < argc ) )
+		{
+			buildValueIndexName = argv[++idx];
+			buildValueIndex = true;
+			printRecords = false;
+		}
+		else if ( !strcmp(argv[idx], "--value-index") && ( idx + 1 < argc ) )
+		{
+			valueIndexName = argv[++idx];
+		}
+		else if ( !strcmp(argv[idx], "--lookup") && ( idx + 1 < argc ) )
+		{
+			char*	separator;
+
+			lookupField = argv[++idx];
+			separator = strchr(lookupField, '=');
+			if ( separator == NULL )
+				return false;
+			*separator = 0;
+			lookupValue = separator + 1;
+		}
+		else if ( !strcmp(argv[idx], "--cache") && ( idx + 1 < argc ) )
+		{
+			cacheDirectory = argv[++idx];
+		}
+		else if ( !strcmp(argv[idx], "--cache-size") && ( idx + 1 < argc ) )
+		{
+			cacheSize = (uint64_t)strtoull(argv[++idx], NULL, 10) << 20;
+		}
+		else if ( !strcmp(argv[idx], "--cache-stats") )
+		{
+			cacheStats = true;
+		}
+		else if ( !strcmp(argv[idx], "--dedup") )
+		{
+			dedupRecords = true;
+		}
+		else if ( !strcmp(argv[idx], "--dedup-memory") && ( idx + 1 < argc ) )
+		{
+			dedupMemory = (uint64_t)strtoull(argv[++idx], NULL, 10) << 20;
+		}
+		else if ( !strcmp(argv[idx], "--hash") )
+		{
+			hashRecords = true;
+		}
+		else if ( !strcmp(argv[idx], "--hash-manifest") && ( idx + 1 < argc ) )
+		{
+			hashManifestName = argv[++idx];
+			hashRecords = true;
+		}
+		else if ( !strcmp(argv[idx], "--hash-threads") && ( idx + 1 < argc ) )
+		{
+			hashThreads = strtoul(argv[++idx], NULL, 10);
+		}
+		else if ( !strcmp(argv[idx], "--map-window") && ( idx + 1 < argc ) )
+		{
+			mapWindowChunks = strtoul(argv[++idx], NULL, 10);
+		}
+		else if ( !strcmp(argv[idx], "--async-io") && ( idx + 1 < argc ) )
+		{
+			asyncIoDepth = strtoul(argv[++idx], NULL, 10);
+		}
+		else if ( !strcmp(argv[idx], "--no-io-uring") )
+		{
+			asyncIoUring = false;
+		}
+		else if ( !strcmp(argv[idx], "--index") && ( idx + 1 < argc ) )
+		{
+			queryIndexName = argv[++idx];
+		}
+		else if ( !strcmp(argv[idx], "--query") && ( idx + 1 < argc ) )
+		{
+			queryValue = argv[++idx];
+		}
+		else if ( !strcmp(argv[idx], "--output") && ( idx + 1 < argc ) )
+		{
+			outputSpec = argv[++idx];
+		}
+		else if ( !strcmp(argv[idx], "--output-queue") && ( idx + 1 < argc ) )
+		{
+			outputQueueBlocks = strtoul(argv[++idx], NULL, 10);
+		}
+		else if ( !strcmp(argv[idx], "--compress") && ( idx + 1 < argc ) )
+		{
+			compressMethod = argv[++idx];
+		}
+		else if ( !strcmp(argv[idx], "--compress-threads") && ( idx + 1 < argc ) )
+		{
+			compressThreads = strtoul(argv[++idx], NULL, 10);
+		}
+		else if ( !strcmp(argv[idx], "--stats") )
+		{
+			printStats = true;
+		}
+		else if ( !strcmp(argv[idx], "--trace") && ( idx + 1 < argc ) )
+		{
+			traceFileName = argv[++idx];
+		}
+		else if ( !strcmp(argv[idx], "--daemon") && ( idx + 1 < argc ) )
+		{
+			daemonSocket = argv[++idx];
+		}
+		else if ( !strcmp(argv[idx], "--max-jobs") && ( idx + 1 < argc ) )
+		{
+			maxJobs = strtoul(argv[++idx], NULL, 10);
+		}
+		else if ( !strcmp(argv[idx], "--cpu-features") )
+		{
+			printCpuFeatures = true;
+		}
+		else if ( !strcmp(argv[idx], "--cpu-tier") && ( idx + 1 < argc ) )
+		{
+			cpuTierName = argv[++idx];
+		}
+		else if ( !strncmp(argv[idx], "--", 2) )
+		{
+			return false;
+		}
+		else
+		{
+			argv[1 + (*numFiles)++] = argv[idx];
 		}
-
-		// printf("\n");
 	}
 
-	return result;
+	if ( ( queryIndexName != NULL ) != ( queryValue != NULL ) )
+		return false;
+	if ( ( valueIndexName != NULL ) != ( lookupField != NULL ) )
+		return false;
+	if ( daemonSocket != NULL )
+		return ( *numFiles == 0 );
+	if ( printCpuFeatures )
+		return true;
+	return ( *numFiles > 0 || queryIndexName != NULL || valueIndexName != NULL );
 }
 
-static bool	ParseEVTXInt(int f)
+static unsigned int	NumberOfCPUs(void)
 {
-	EvtxHeader	header;
-	uint64_t	off	=	0;
-	uint8_t*	chunk;
-	bool		result	=	true;
-
-	if ( read(f, &header, sizeof(header)) != sizeof(header) )
-		return false;
-	if ( header.version != 0x00030001)
-		return false;
+#ifdef _WIN32
+	SYSTEM_INFO	systemInfo;
+	long		numCPUs;
 
-#ifdef PRINT_TAGS
-	printf("Number of chunks: %" PRIu64 " %" PRIu64 " header sz %zu\n", header.numberOfChunksAllocated, header.numberOfChunksUsed, sizeof(header));
+	GetSystemInfo(&systemInfo);
+	numCPUs = (long)systemInfo.dwNumberOfProcessors;
+#else
+	long	numCPUs	=	sysconf(_SC_NPROCESSORS_ONLN);
 #endif
 
-	off = sizeof(header);
-
-	chunk = (uint8_t*)malloc(EVTX_CHUNK_SIZE);
-	if ( chunk == NULL )
-		return false;
-
-	while ( result )
-	{
-		EvtxChunkHeader*	chunkHeader	=	(EvtxChunkHeader*)chunk;
-		uint64_t		inRecordOff;
+	return numCPUs > 1 ? (unsigned int)numCPUs : 1;
+}
 
-		ResetTemplates();
+static bool	ApplyCpuTier(void)
+{
+	if ( cpuTierName == NULL || CpuSetTier(cpuTierName) )
+		return true;
+	printf("--cpu-tier: %s is not one of the tiers of this CPU, up to %s\n", cpuTierName, CpuTierName(CpuBestTier()));
+	return false;
+}
 
-		if ( lseek(f, off, SEEK_SET) != off )
-		{
-			result = false;
-			break;
-		}
-		if ( read(f, chunk, EVTX_CHUNK_SIZE) != EVTX_CHUNK_SIZE )
-			break;
+/*  One run over the files named in argv[1 .. numFiles] with the options parsed */
+static int	RunFiles(int numFiles, char* argv[])
+{
+	char**	fileNames	=	argv + 1;
+	struct sValueIndex*	valueIndex	=	NULL;
+	int	result		=	0;
 
-		if ( memcmp(chunkHeader->magic, EVTX_CHUNK_HEADER_MAGIC, sizeof(EVTX_CHUNK_HEADER_MAGIC)) )
+	if ( printStats && !EvtxStatsEnable() )
+	{
+		printf("--stats: built without PARSE_EVTX_STATS\n");
+		return 1;
+	}
+	if ( !ApplyCpuTier() )
+		return 1;
+	if ( traceFileName != NULL )
+	{
+		/*  before the threads start, they name themselves in the trace */
+		if ( !EvtxTraceOpen(traceFileName) )
+			return 1;
+		EvtxTraceThreadName("decoder");
+	}
+	if ( compressMethod != NULL )
+	{
+		if ( compressThreads == 0 )
+			compressThreads = NumberOfCPUs() > 1 ? NumberOfCPUs() - 1 : 1;
+		if ( !SinkSetCompression(compressMethod, compressThreads) )
+			return 1;
+		if ( outputSpec == NULL )
+			outputSpec = "-";
+	}
+	if ( outputSpec != NULL && !SinkOpen(outputSpec, outputQueueBlocks) )
+		return 1;
+	if ( trackSessions && !LogonSessionsInit(maxSessions) )
+	{
+		printf("Not enough memory for %zu sessions\n", maxSessions);
+		return 1;
+	}
+	if ( valueIndexName != NULL )
+	{
+		valueIndex = ValueIndexOpen(valueIndexName);
+		if ( valueIndex == NULL )
+			return 1;
+		if ( !ValueIndexHasField(valueIndex, lookupField) )
 		{
-			// result = false;
-			break;
+			printf("%s is not indexed in %s\n", lookupField, valueIndexName);
+			ValueIndexClose(valueIndex);
+			return 1;
 		}
-
-		// printf("Chunk %" PRIu64 " .. %" PRIu64 "\n", chunkHeader->firstRecordNumber, chunkHeader->lastRecordNumber);
-
-		inRecordOff = sizeof(*chunkHeader);
-
-		while ( result )
+	}
+	if ( cacheDirectory != NULL && !ChunkCacheOpen(cacheDirectory, cacheSize, RECORD_TEXT_VERSION) )
+		return 1;
+	if ( dedupRecords && !DedupInit(dedupMemory) )
+	{
+		printf("Not enough memory for --dedup\n");
+		return 1;
+	}
+	if ( hashRecords )
+	{
+		if ( hashThreads == 0 )
+			hashThreads = NumberOfCPUs() > 1 ? NumberOfCPUs() - 1 : 1;
+		if ( !HashStart(hashThreads, hashManifestName) )
 		{
-			EvtxRecordHeader*	recordHeader	=	(EvtxRecordHeader*)(chunk + inRecordOff);
-			time_t			unixTimestamp;
-			struct tm		localtm;
-			struct tm*		t;
-
-			if ( inRecordOff + sizeof(*recordHeader) > EVTX_CHUNK_SIZE )
-				break;
-
-			if ( recordHeader->magic != 0x00002a2a )
-			{
-#ifdef PRINT_TAGS
-				printf("Record header mismatch at %08X\n", (uint32_t)(off + inRecordOff));
-#endif
-				break;
-			}
-
-			unixTimestamp = UnixTimeFromFileTime(recordHeader->timestamp);
-			t = gmtime_r(&unixTimestamp, &localtm);
-			if ( t == NULL )
-			{
-				result = false;
-				break;
-			}
-
-			// printf("%" PRIX64 ": Record %" PRIu64 " %04u.%02u.%02u-%02u:%02u:%02u ", inRecordOff, recordHeader->number, t->tm_year+1900, t->tm_mon+1, t->tm_mday, t->tm_hour, t->tm_min, t->tm_sec);
-			printf("Record #%" PRIu64 " %04u.%02u.%02u-%02u:%02u:%02u ", recordHeader->number, t->tm_year+1900, t->tm_mon+1, t->tm_mday, t->tm_hour, t->tm_min, t->tm_sec);
-
-			if ( !ParseBinXmlPre(chunk,
-						EVTX_CHUNK_SIZE,
-						off + inRecordOff + sizeof(*recordHeader),
-						inRecordOff + sizeof(*recordHeader) ) )
-			{
-				if ( recordHeader->number >= chunkHeader->firstRecordNumber &&
-						recordHeader->number <= chunkHeader->lastRecordNumber )
-				{
-					result = false;
-				}
-				break;
-			}
-			printf("\n");
-
-			inRecordOff += recordHeader->size;
+			printf("Cannot start the hashing threads\n");
+			return 1;
 		}
+	}
+	if ( asyncIoDepth > 0 && !AsyncIoStart(asyncIoDepth, asyncIoUring) )
+	{
+		printf("Cannot start the asynchronous reads\n");
+		return 1;
+	}
+	if ( buildValueIndex && !ValueIndexBuildBegin(buildValueIndexName, tempDir, NumberOfCPUs() > 1 ? NumberOfCPUs() - 1 : 1) )
+	{
+		printf("Cannot start the value index builder\n");
+		return 1;
+	}
+	if ( queryIndexName != NULL )
+	{
+		queryIndex = ChunkIndexOpen(queryIndexName);
+		if ( queryIndex == NULL )
+			return 1;
+		queryHash = ChunkIndexHashValue(queryValue);
+	}
+	if ( buildIndex && !ChunkIndexBuildBegin(buildIndexName) )
+		return 1;
+	if ( numFiles == 0 && queryIndex != NULL )
+	{
+		/*  search the indexed files, the index outlives fileNames */
+		fileNames = (char**)malloc(sizeof(*fileNames) * ( ChunkIndexNumFiles(queryIndex) + 1 ));
+		if ( fileNames == NULL )
+			return 1;
+		for (uint32_t idx = 0; idx < ChunkIndexNumFiles(queryIndex); idx++)
+			fileNames[numFiles++] = (char*)ChunkIndexFileName(queryIndex, idx);
+	}
 
-		off += EVTX_CHUNK_SIZE;
-
-		if ( inRecordOff > off )
+	if ( valueIndex != NULL )
+	{
+		if ( !LookupIndexedValue(valueIndex) )
+			result = 1;
+	}
+	else if ( ( mergeByTime || sortByTime ) && !buildIndex && !buildValueIndex )
+	{
+		if ( !ParseEVTXOrdered(fileNames, numFiles) )
+			result = 1;
+	}
+	else
+	{
+		for (int idx = 0; idx < numFiles; idx++)
 		{
-			result = false;
-			break;
+			EvtxStatsBeginFile();
+			if ( !ParseEVTX(fileNames[idx]) )
+				result = 1;
+			EvtxStatsEndFile(fileNames[idx], stderr);
 		}
 	}
-
+	if ( buildIndex && !ChunkIndexWrite() )
+		result = 1;
+	if ( buildValueIndex && !ValueIndexWrite() )
+		result = 1;
+	if ( fileNames != argv + 1 )
+		free(fileNames);
+	ChunkIndexClose(queryIndex);
+	ValueIndexClose(valueIndex);
+	if ( cacheDirectory != NULL )
+	{
+		ChunkCacheClose();
+		if ( cacheStats )
+			ChunkCachePrintStats(stderr);
+	}
+	FreeBatch(&cacheBatch);
+	if ( AsyncIoActive() )
+		AsyncIoStop();
+	if ( hashRecords && !HashStop() )
+	{
+		printf("Failed on %s\n", hashManifestName);
+		result = 1;
+	}
+	if ( dedupRecords )
+	{
+		DedupPrintReport(stderr);
+		DedupFree();
+	}
+	if ( trackSessions )
+		LogonSessionsFlush();
+	if ( SinkActive() && !SinkClose() )
+	{
+		printf("Failed on %s\n", outputSpec);
+		result = 1;
+	}
+	if ( !EvtxTraceClose() )
+	{
+		printf("Failed on %s\n", traceFileName);
+		result = 1;
+	}
+	EvtxStatsPrintTotal(stderr);
 	return result;
 }
 
-static bool	ParseEVTX(const char* fileName)
+/*  A --daemon job, forked from the daemon with its options already set */
+static int	DaemonJob(int argc, char* argv[])
 {
-	bool	result;
-	int	f	=	open(fileName, O_RDONLY|O_BINARY);
-	if ( f < 0 )
-		return false;
-
-	result = ParseEVTXInt(f);
-	if ( !result )
-		printf("Failed on %s\n", fileName);
-	close(f);
-	return result;
-}
+	int	numFiles;
 
-static void InitEventDescriptions(void)
-{
-	for (size_t idx = 0; idx < sizeof(eventDescriptions)/sizeof(eventDescriptions[0]); idx++)
+	daemonSocket = NULL;
+	if ( !ParseOptions(argc, argv, &numFiles) || daemonSocket != NULL )
 	{
-		char*		nptr	=	NULL;
-		uint16_t	eventID	=	strtoul(eventDescriptions[idx], &nptr, 10);
-		if ( ( nptr == NULL ) || ( eventID == 0 ) )
-			continue;
-		while (*nptr != ')' && *nptr != 0)
-			nptr++;
-		while (*nptr == ' ' || *nptr == ')')
-			nptr++;
-		// printf("%04u - %s\n", eventID, nptr);
-		eventDescriptionHashTable[eventID] = nptr;
+		Usage(argv[0]);
+		return 1;
 	}
+	return RunFiles(numFiles, argv);
 }
 
-#ifdef _WIN32
-
-#ifndef __MINGW64_VERSION_MAJOR
-
-extern "C"
-{
-BOOL (WINAPI *Wow64DisableWow64FsRedirection)(
-  PVOID *OldValue
-)	= (BOOL(WINAPI*)(PVOID*))GetProcAddress(GetModuleHandle(L"KERNEL32.DLL"), "Wow64DisableWow64FsRedirection");
-
-BOOL (WINAPI * Wow64RevertWow64FsRedirection)(
-  PVOID OldValue )
-	= (BOOL(WINAPI*)(PVOID))GetProcAddress(GetModuleHandle(L"KERNEL32.DLL"), "Wow64RevertWow64FsRedirection");
-}
-
-#endif
-
-#endif
-
-
 int main(int argc, char* argv[])
 {
 	void*	redir;
+	int	numFiles;
+	int	result;
+
+	if ( !ParseOptions(argc, argv, &numFiles) )
+	{
+		Usage(argv[0]);
+		return 1;
+	}
+	if ( printCpuFeatures )
+	{
+		if ( !ApplyCpuTier() )
+			return 1;
+		CpuPrintFeatures(stdout);
+		printf("kernels:  utf16 %s, hex %s, grep %s, sha256 %s\n",
+				Utf16Implementation(), HexImplementation(), GrepImplementation(), Sha256Implementation());
+		return 0;
+	}
 
 #ifdef _WIN32
 	if (Wow64DisableWow64FsRedirection != NULL )
 		Wow64DisableWow64FsRedirection(&redir);
 #endif
 
-	eventDescriptionHashTable = (const char**)malloc(sizeof(const char*) * 65536 );
-	memset(eventDescriptionHashTable, 0, sizeof(const char*)*65536);
-	InitTemplates();
-	InitEventDescriptions();
-	for (int idx = 1; idx < argc; idx++)
-		ParseEVTX(argv[idx]);
-	free(eventDescriptionHashTable);
+	/*  built once, shared by all the jobs of a daemon */
+	parser = CreateParser();
+	if ( parser == NULL || !RecordTextInit() )
+	{
+		printf("Not enough memory for the parser\n");
+		return 1;
+	}
+
+	if ( daemonSocket != NULL )
+		result = DaemonRun(daemonSocket, maxJobs != 0 ? maxJobs : NumberOfCPUs(), DaemonJob) ? 0 : 1;
+	else
+		result = RunFiles(numFiles, argv);
+
+	EvtxParserFree(parser);
+	RulesFree();
+	GrepFree(grepPattern);
+	RecordTextFree();
 
 #ifdef _WIN32
 	if (Wow64RevertWow64FsRedirection != NULL)
 		Wow64RevertWow64FsRedirection(redir);
 #endif
 
-	return 0;
+	return result;
 }
 
@@ -0,0 +1,75 @@
+/*
+ * =====================================================================================
+ *       Filename:  mapped_file.h
+ *    Description:  Read only mapping of a whole file (read into memory on Windows)
+ * =====================================================================================
+ */
+
+#ifndef mapped_file_h_included
+#define mapped_file_h_included
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+#include <utils/win_types.h>
+
+typedef struct
+{
+	uint8_t*	data;
+	size_t		dataSize;
+}
+MappedFile;
+
+static bool	MapFile(const char* fileName, MappedFile* mapped)
+{
+	struct stat	st;
+	int		f	=	open(fileName, O_RDONLY|O_BINARY);
+
+	mapped->data = NULL;
+	mapped->dataSize = 0;
+	if ( f < 0 )
+		return false;
+	if ( fstat(f, &st) != 0 || st.st_size <= 0 )
+	{
+		close(f);
+		return false;
+	}
+	mapped->dataSize = (size_t)st.st_size;
+
+#ifndef _WIN32
+	mapped->data = (uint8_t*)mmap(NULL, mapped->dataSize, PROT_READ, MAP_SHARED, f, 0);
+	if ( mapped->data == MAP_FAILED )
+		mapped->data = NULL;
+#else
+	mapped->data = (uint8_t*)malloc(mapped->dataSize);
+	if ( mapped->data != NULL && read(f, mapped->data, mapped->dataSize) != (int)mapped->dataSize )
+	{
+		free(mapped->data);
+		mapped->data = NULL;
+	}
+#endif
+	close(f);
+
+	return ( mapped->data != NULL );
+}
+
+static void	UnmapFile(MappedFile* mapped)
+{
+	if ( mapped->data != NULL )
+	{
+#ifndef _WIN32
+		munmap(mapped->data, mapped->dataSize);
+#else
+		free(mapped->data);
+#endif
+	}
+	mapped->data = NULL;
+	mapped->dataSize = 0;
+}
+
+#endif
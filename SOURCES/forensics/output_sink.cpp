@@ -0,0 +1,760 @@
+/*
+ * =====================================================================================
+ *       Filename:  output_sink.cpp
+ *    Description:  Where the records go: stdout, a file, a Unix socket or shard files
+ *
+ *                  A single destination gets full SINK_BLOCK_SIZE blocks, records
+ *                  may straddle them, so files are written in large aligned
+ *                  pieces.  Shard blocks end on a record and grow past the block
+ *                  size for a record that does not fit.  With compression every
+ *                  block becomes a gzip member or a zstd frame of its own on one
+ *                  of the compression threads, the writers keep the block order.
+ * =====================================================================================
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <utils/win_types.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+#include "output_sink.h"
+#include "evtx_trace.h"
+
+typedef struct sSinkBlock
+{
+	char*			data;
+	size_t			len;
+	size_t			size;
+	uint64_t		numRecords;	/*  ending in the block */
+	struct sSinkBlock*	next;
+	char*			packed;		/*  the compressed block */
+	size_t			packedLen;
+	size_t			packedSize;
+	bool			ready;		/*  to be written */
+	struct sSinkBlock*	nextJob;
+}
+SinkBlock;
+
+typedef enum
+{
+	CompressNone,
+	CompressGzip,
+	CompressZstd
+}
+CompressMethod;
+
+typedef struct
+{
+	char*		name;		/*  for the manifest, NULL for stdout and sockets */
+	int		f;
+	bool		ownsFile;
+	bool		isSocket;	/*  written with send(), a closed peer is an error, not SIGPIPE */
+	pthread_t	writer;
+	bool		writerStarted;
+	SinkBlock*	head;		/*  waiting to be written */
+	SinkBlock*	tail;
+	uint64_t	numBytes;
+	uint64_t	numRecords;
+	bool		failed;
+}
+SinkDestination;
+
+static pthread_mutex_t	sinkLock	=	PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	sinkCond	=	PTHREAD_COND_INITIALIZER;
+static bool		sinkOpen	=	false;
+static bool		stopWriters	=	false;
+static SinkDestination*	destinations	=	NULL;
+static unsigned int	numDestinations	=	0;
+static unsigned int	nextDestination	=	0;
+static char*		manifestName	=	NULL;
+
+static SinkBlock*	freeBlocks	=	NULL;
+static unsigned int	numBlocks	=	0;
+static unsigned int	maxBlocks	=	0;
+static SinkBlock*	current		=	NULL;	/*  being filled by the decoder */
+static unsigned int	numQueued	=	0;	/*  handed over, not written yet */
+
+static CompressMethod	compressMethod	=	CompressNone;
+static int		compressLevel	=	0;
+static unsigned int	numCompressors	=	0;
+static pthread_t	compressors[MAX_SINK_COMPRESS_THREADS];
+static SinkBlock*	jobHead		=	NULL;	/*  waiting to be compressed */
+static SinkBlock*	jobTail		=	NULL;
+static uint64_t		compressCpuTime	=	0;	/*  ns, all compression threads */
+static uint64_t		bytesIn		=	0;
+static uint64_t		bytesOut	=	0;
+static unsigned int	compressThreads	=	1;
+static uint64_t		decodeStartTime	=	0;	/*  of the thread that opened the sink */
+static uint64_t		decodeCpuTime	=	0;
+
+static uint64_t	ThreadCpuTime(void)
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	struct timespec	now;
+
+	if ( clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now) == 0 )
+		return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+#endif
+	return 0;
+}
+
+static bool	WriteAll(int f, bool isSocket, const char* data, size_t len)
+{
+	while ( len > 0 )
+	{
+		ssize_t	written;
+
+#ifdef MSG_NOSIGNAL
+		if ( isSocket )
+			written = send(f, data, len, MSG_NOSIGNAL);
+		else
+#endif
+			written = write(f, data, len);
+
+		if ( written < 0 && errno == EINTR )
+			continue;
+		if ( written <= 0 )
+			return false;
+		data += written;
+		len -= (size_t)written;
+	}
+	return true;
+}
+
+static void*	SinkWriter(void* arg)
+{
+	SinkDestination*	destination	=	(SinkDestination*)arg;
+
+	EvtxTraceThreadName("output writer");
+	pthread_mutex_lock(&sinkLock);
+	for (;;)
+	{
+		SinkBlock*	block;
+
+		while ( ( destination->head == NULL && !stopWriters ) ||
+			( destination->head != NULL && !destination->head->ready ) )
+		{
+			pthread_cond_wait(&sinkCond, &sinkLock);
+		}
+		if ( destination->head == NULL )
+			break;
+
+		block = destination->head;
+		destination->head = block->next;
+		if ( destination->head == NULL )
+			destination->tail = NULL;
+		pthread_mutex_unlock(&sinkLock);
+		TRACE_BEGIN(traceStart);
+
+		/*  after a failure the blocks are still taken, the decoder must not hang */
+		if ( compressMethod != CompressNone )
+		{
+			if ( !destination->failed && ( block->packed == NULL || !WriteAll(destination->f, destination->isSocket, block->packed, block->packedLen) ) )
+				destination->failed = true;
+		}
+		else if ( !destination->failed && !WriteAll(destination->f, destination->isSocket, block->data, block->len) )
+		{
+			destination->failed = true;
+		}
+
+		TRACE_END_ARG("write", traceStart, "bytes", compressMethod != CompressNone ? block->packedLen : block->len);
+
+		pthread_mutex_lock(&sinkLock);
+		destination->numBytes += block->len;
+		destination->numRecords += block->numRecords;
+		numQueued--;
+		TRACE_COUNTER("output queue", "blocks", numQueued);
+		block->len = 0;
+		block->numRecords = 0;
+		block->next = freeBlocks;
+		freeBlocks = block;
+		pthread_cond_broadcast(&sinkCond);
+	}
+	pthread_mutex_unlock(&sinkLock);
+	return NULL;
+}
+
+/*  A frame of its own for every block, false when out of memory */
+static bool	CompressBlock(SinkBlock* block, void* context)
+{
+	size_t	bound	=	0;
+
+#ifdef HAVE_ZLIB
+	if ( compressMethod == CompressGzip )
+		bound = compressBound((uLong)block->len) + 32;
+#endif
+#ifdef HAVE_ZSTD
+	if ( compressMethod == CompressZstd )
+		bound = ZSTD_compressBound(block->len);
+#endif
+	if ( block->packedSize < bound )
+	{
+		free(block->packed);
+		block->packed = (char*)malloc(bound);
+		block->packedSize = ( block->packed != NULL ) ? bound : 0;
+		if ( block->packed == NULL )
+			return false;
+	}
+	block->packedLen = 0;
+
+#ifdef HAVE_ZLIB
+	if ( compressMethod == CompressGzip )
+	{
+		z_stream*	stream	=	(z_stream*)context;
+
+		/*  a gzip member per block, gzip -d reads them all */
+		if ( deflateReset(stream) != Z_OK )
+			return false;
+		stream->next_in = (Bytef*)block->data;
+		stream->avail_in = (uInt)block->len;
+		stream->next_out = (Bytef*)block->packed;
+		stream->avail_out = (uInt)block->packedSize;
+		if ( deflate(stream, Z_FINISH) != Z_STREAM_END )
+			return false;
+		block->packedLen = block->packedSize - stream->avail_out;
+	}
+#endif
+#ifdef HAVE_ZSTD
+	if ( compressMethod == CompressZstd )
+	{
+		size_t	packedLen	=	ZSTD_compressCCtx((ZSTD_CCtx*)context, block->packed, block->packedSize,
+							block->data, block->len, compressLevel);
+
+		if ( ZSTD_isError(packedLen) )
+			return false;
+		block->packedLen = packedLen;
+	}
+#endif
+	return true;
+}
+
+static void*	SinkCompressor(void* arg)
+{
+	void*		context		=	NULL;
+	uint64_t	startTime	=	ThreadCpuTime();
+
+	EvtxTraceThreadName("compressor");
+#ifdef HAVE_ZLIB
+	z_stream	stream;
+
+	if ( compressMethod == CompressGzip )
+	{
+		memset(&stream, 0, sizeof(stream));
+		if ( deflateInit2(&stream, compressLevel, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK )
+			context = &stream;
+	}
+#endif
+#ifdef HAVE_ZSTD
+	if ( compressMethod == CompressZstd )
+		context = ZSTD_createCCtx();
+#endif
+
+	pthread_mutex_lock(&sinkLock);
+	for (;;)
+	{
+		SinkBlock*	block;
+
+		while ( jobHead == NULL && !stopWriters )
+			pthread_cond_wait(&sinkCond, &sinkLock);
+		if ( jobHead == NULL )
+			break;
+
+		block = jobHead;
+		jobHead = block->nextJob;
+		if ( jobHead == NULL )
+			jobTail = NULL;
+		pthread_mutex_unlock(&sinkLock);
+
+		TRACE_BEGIN(traceStart);
+		/*  a block that failed has no packed data, its writer fails */
+		if ( context == NULL || !CompressBlock(block, context) )
+		{
+			free(block->packed);
+			block->packed = NULL;
+			block->packedSize = 0;
+		}
+		TRACE_END_ARG("compress", traceStart, "bytes", block->len);
+
+		pthread_mutex_lock(&sinkLock);
+		bytesIn += block->len;
+		bytesOut += block->packedLen;
+		block->ready = true;
+		pthread_cond_broadcast(&sinkCond);
+	}
+	compressCpuTime += ThreadCpuTime() - startTime;
+	pthread_mutex_unlock(&sinkLock);
+
+#ifdef HAVE_ZLIB
+	if ( compressMethod == CompressGzip && context != NULL )
+		deflateEnd(&stream);
+#endif
+#ifdef HAVE_ZSTD
+	if ( compressMethod == CompressZstd )
+		ZSTD_freeCCtx((ZSTD_CCtx*)context);
+#endif
+	return NULL;
+}
+
+/*  Waits for a free block when the pool is used up */
+static SinkBlock*	TakeBlock(void)
+{
+	SinkBlock*	block	=	NULL;
+	bool		waited	=	false;
+	TRACE_BEGIN(traceStart);
+
+	pthread_mutex_lock(&sinkLock);
+	while ( freeBlocks == NULL && numBlocks >= maxBlocks )
+	{
+		pthread_cond_wait(&sinkCond, &sinkLock);
+		waited = true;
+	}
+	if ( freeBlocks != NULL )
+	{
+		block = freeBlocks;
+		freeBlocks = block->next;
+	}
+	else
+	{
+		block = (SinkBlock*)calloc(1, sizeof(*block));
+		if ( block != NULL )
+		{
+			block->data = (char*)malloc(SINK_BLOCK_SIZE);
+			block->size = SINK_BLOCK_SIZE;
+			if ( block->data == NULL )
+			{
+				free(block);
+				block = NULL;
+			}
+			else
+			{
+				numBlocks++;
+			}
+		}
+	}
+	pthread_mutex_unlock(&sinkLock);
+	/*  the writers are behind */
+	if ( waited )
+		TRACE_END("output wait", traceStart);
+	return block;
+}
+
+static void	HandOver(SinkBlock* block)
+{
+	SinkDestination*	destination	=	&destinations[nextDestination];
+
+	nextDestination = ( nextDestination + 1 ) % numDestinations;
+	block->next = NULL;
+	block->nextJob = NULL;
+	block->ready = ( compressMethod == CompressNone );
+	pthread_mutex_lock(&sinkLock);
+	if ( destination->tail != NULL )
+		destination->tail->next = block;
+	else
+		destination->head = block;
+	destination->tail = block;
+	numQueued++;
+	TRACE_COUNTER("output queue", "blocks", numQueued);
+	if ( !block->ready )
+	{
+		if ( jobTail != NULL )
+			jobTail->nextJob = block;
+		else
+			jobHead = block;
+		jobTail = block;
+	}
+	pthread_cond_broadcast(&sinkCond);
+	pthread_mutex_unlock(&sinkLock);
+}
+
+static bool	ConnectUnixSocket(const char* path, int* f)
+{
+#ifdef _WIN32
+	printf("Unix socket output is not available on Windows\n");
+	return false;
+#else
+	struct sockaddr_un	address;
+
+	if ( strlen(path) >= sizeof(address.sun_path) )
+		return false;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path);
+
+	*f = socket(AF_UNIX, SOCK_STREAM, 0);
+	if ( *f < 0 )
+		return false;
+	if ( connect(*f, (const struct sockaddr*)&address, sizeof(address)) != 0 )
+	{
+		close(*f);
+		return false;
+	}
+	return true;
+#endif
+}
+
+static bool	OpenDestinations(const char* spec)
+{
+	unsigned int	numShards	=	1;
+	const char*	prefix		=	NULL;
+	char*		end;
+
+	if ( !strncmp(spec, "shards:", 7) )
+	{
+		numShards = strtoul(spec + 7, &end, 10);
+		if ( *end != ':' || numShards == 0 || numShards > MAX_SINK_SHARDS )
+			return false;
+		prefix = end + 1;
+	}
+
+	destinations = (SinkDestination*)calloc(numShards, sizeof(*destinations));
+	if ( destinations == NULL )
+		return false;
+	numDestinations = numShards;
+
+	if ( prefix != NULL )
+	{
+		size_t	nameSize	=	strlen(prefix) + 20;
+		const char*	suffix	=	( compressMethod == CompressGzip ) ? ".gz" : ( compressMethod == CompressZstd ) ? ".zst" : "";
+
+		manifestName = (char*)malloc(nameSize);
+		if ( manifestName == NULL )
+			return false;
+		snprintf(manifestName, nameSize, "%s.manifest", prefix);
+		for (unsigned int idx = 0; idx < numShards; idx++)
+		{
+			destinations[idx].name = (char*)malloc(nameSize);
+			if ( destinations[idx].name == NULL )
+				return false;
+			snprintf(destinations[idx].name, nameSize, "%s.%03u%s", prefix, idx, suffix);
+			destinations[idx].f = open(destinations[idx].name, O_WRONLY|O_CREAT|O_TRUNC|O_BINARY, 0644);
+			if ( destinations[idx].f < 0 )
+				return false;
+			destinations[idx].ownsFile = true;
+		}
+	}
+	else if ( !strcmp(spec, "-") )
+	{
+		fflush(stdout);
+		destinations[0].f = STDOUT_FILENO;
+	}
+	else if ( !strncmp(spec, "unix:", 5) )
+	{
+		if ( !ConnectUnixSocket(spec + 5, &destinations[0].f) )
+			return false;
+		destinations[0].ownsFile = true;
+		destinations[0].isSocket = true;
+	}
+	else
+	{
+		if ( !strncmp(spec, "file:", 5) )
+			spec += 5;
+		destinations[0].f = open(spec, O_WRONLY|O_CREAT|O_TRUNC|O_BINARY, 0644);
+		if ( destinations[0].f < 0 )
+			return false;
+		destinations[0].ownsFile = true;
+	}
+	return true;
+}
+
+static bool	WriteManifest(void)
+{
+	FILE*	f	=	fopen(manifestName, "w");
+	bool	result;
+
+	if ( f == NULL )
+		return false;
+	fprintf(f, "# parse_evtx output shards: file, records, bytes before compression\n");
+	for (unsigned int idx = 0; idx < numDestinations; idx++)
+	{
+		fprintf(f, "shard\t%s\t%" PRIu64 "\t%" PRIu64 "\n", destinations[idx].name,
+				destinations[idx].numRecords, destinations[idx].numBytes);
+	}
+	result = ( ferror(f) == 0 );
+	return ( fclose(f) == 0 && result );
+}
+
+static void	FreeSink(void)
+{
+	for (unsigned int idx = 0; idx < numDestinations; idx++)
+	{
+		if ( destinations[idx].ownsFile )
+			close(destinations[idx].f);
+		free(destinations[idx].name);
+	}
+	free(destinations);
+	destinations = NULL;
+	numDestinations = 0;
+	nextDestination = 0;
+	free(manifestName);
+	manifestName = NULL;
+	while ( freeBlocks != NULL )
+	{
+		SinkBlock*	block	=	freeBlocks;
+
+		freeBlocks = block->next;
+		free(block->data);
+		free(block->packed);
+		free(block);
+	}
+	numBlocks = 0;
+	numQueued = 0;
+	current = NULL;
+	numCompressors = 0;
+	compressCpuTime = 0;
+	bytesIn = 0;
+	bytesOut = 0;
+}
+
+bool	SinkSetCompression(const char* method, unsigned int numThreads)
+{
+	const char*	levelText	=	strchr(method, ':');
+	size_t		methodLen	=	( levelText != NULL ) ? (size_t)( levelText - method ) : strlen(method);
+
+	if ( methodLen == 4 && !strncmp(method, "gzip", 4) )
+	{
+#ifndef HAVE_ZLIB
+		printf("--compress gzip: built without zlib\n");
+		return false;
+#endif
+		compressMethod = CompressGzip;
+		compressLevel = DEFAULT_GZIP_LEVEL;
+	}
+	else if ( methodLen == 4 && !strncmp(method, "zstd", 4) )
+	{
+#ifndef HAVE_ZSTD
+		printf("--compress zstd: built without libzstd\n");
+		return false;
+#endif
+		compressMethod = CompressZstd;
+		compressLevel = DEFAULT_ZSTD_LEVEL;
+	}
+	else
+	{
+		printf("Unsupported compression %s\n", method);
+		return false;
+	}
+	if ( levelText != NULL )
+		compressLevel = (int)strtol(levelText + 1, NULL, 10);
+
+	if ( numThreads == 0 )
+		numThreads = 1;
+	if ( numThreads > MAX_SINK_COMPRESS_THREADS )
+		numThreads = MAX_SINK_COMPRESS_THREADS;
+	compressThreads = numThreads;
+	return true;
+}
+
+bool	SinkOpen(const char* spec, unsigned int queueBlocks)
+{
+	if ( !OpenDestinations(spec) )
+	{
+		printf("Failed on %s\n", spec);
+		FreeSink();
+		return false;
+	}
+
+	/*  one block being filled, one being written per destination and one being
+	 *  compressed per thread, the rest queued */
+	maxBlocks = numDestinations + 1;
+	if ( compressMethod != CompressNone )
+		maxBlocks += compressThreads;
+	if ( queueBlocks > maxBlocks )
+		maxBlocks = queueBlocks;
+	stopWriters = false;
+	decodeStartTime = ThreadCpuTime();
+	for (unsigned int idx = 0; idx < numDestinations; idx++)
+	{
+		if ( pthread_create(&destinations[idx].writer, NULL, SinkWriter, &destinations[idx]) != 0 )
+		{
+			SinkClose();
+			return false;
+		}
+		destinations[idx].writerStarted = true;
+	}
+	if ( compressMethod != CompressNone )
+	{
+		for (; numCompressors < compressThreads; numCompressors++)
+		{
+			if ( pthread_create(&compressors[numCompressors], NULL, SinkCompressor, NULL) != 0 )
+			{
+				SinkClose();
+				return false;
+			}
+		}
+	}
+	sinkOpen = true;
+	return true;
+}
+
+bool	SinkClose(void)
+{
+	bool	result	=	true;
+
+	if ( current != NULL )
+	{
+		if ( current->len > 0 )
+		{
+			HandOver(current);
+		}
+		else
+		{
+			free(current->data);
+			free(current);
+		}
+		current = NULL;
+	}
+
+	decodeCpuTime = ThreadCpuTime() - decodeStartTime;
+	pthread_mutex_lock(&sinkLock);
+	stopWriters = true;
+	pthread_cond_broadcast(&sinkCond);
+	pthread_mutex_unlock(&sinkLock);
+	/*  the compressors drain their queue before they stop */
+	for (unsigned int idx = 0; idx < numCompressors; idx++)
+		pthread_join(compressors[idx], NULL);
+	for (unsigned int idx = 0; idx < numDestinations; idx++)
+	{
+		if ( destinations[idx].writerStarted )
+			pthread_join(destinations[idx].writer, NULL);
+		if ( destinations[idx].failed )
+			result = false;
+	}
+	if ( manifestName != NULL && !WriteManifest() )
+		result = false;
+	if ( compressMethod != CompressNone )
+	{
+		fprintf(stderr, "Output: %" PRIu64 " bytes compressed to %" PRIu64 " (%.1f%%), decode CPU %.2f s, compress CPU %.2f s on %u thread%s\n",
+				bytesIn, bytesOut, bytesIn != 0 ? 100.0 * (double)bytesOut / (double)bytesIn : 0.0,
+				(double)decodeCpuTime / 1e9, (double)compressCpuTime / 1e9, numCompressors, numCompressors != 1 ? "s" : "");
+	}
+
+	sinkOpen = false;
+	FreeSink();
+	return result;
+}
+
+bool	SinkActive(void)
+{
+	return sinkOpen;
+}
+
+void	SinkWrite(const char* text, size_t textLen)
+{
+	if ( !sinkOpen )
+	{
+		fwrite(text, 1, textLen, stdout);
+		return;
+	}
+
+	while ( textLen > 0 )
+	{
+		size_t	part;
+
+		if ( current == NULL )
+		{
+			current = TakeBlock();
+			if ( current == NULL )
+				return;
+		}
+
+		if ( numDestinations > 1 && current->len + textLen > current->size )
+		{
+			/*  shard blocks end on a record */
+			size_t	newSize	=	current->len + textLen;
+			char*	newData	=	(char*)realloc(current->data, newSize);
+
+			if ( newData == NULL )
+				return;
+			current->data = newData;
+			current->size = newSize;
+		}
+
+		part = current->size - current->len;
+		if ( part > textLen )
+			part = textLen;
+		memcpy(current->data + current->len, text, part);
+		current->len += part;
+		text += part;
+		textLen -= part;
+
+		if ( numDestinations == 1 && current->len == current->size )
+		{
+			HandOver(current);
+			current = NULL;
+		}
+	}
+}
+
+void	SinkVPrintf(const char* format, va_list args)
+{
+	char	buffer[1024];
+	char*	text;
+	va_list	argsCopy;
+	int	len;
+
+	if ( !sinkOpen )
+	{
+		vprintf(format, args);
+		return;
+	}
+
+	va_copy(argsCopy, args);
+	len = vsnprintf(buffer, sizeof(buffer), format, argsCopy);
+	va_end(argsCopy);
+	if ( len < 0 )
+		return;
+	if ( (size_t)len < sizeof(buffer) )
+	{
+		SinkWrite(buffer, (size_t)len);
+		return;
+	}
+
+	text = (char*)malloc((size_t)len + 1);
+	if ( text == NULL )
+		return;
+	vsnprintf(text, (size_t)len + 1, format, args);
+	SinkWrite(text, (size_t)len);
+	free(text);
+}
+
+void	SinkPrintf(const char* format, ...)
+{
+	va_list	args;
+
+	va_start(args, format);
+	SinkVPrintf(format, args);
+	va_end(args);
+}
+
+void	SinkEndRecord(void)
+{
+	if ( !sinkOpen || current == NULL )
+		return;
+	current->numRecords++;
+	if ( numDestinations > 1 && current->len >= SINK_BLOCK_SIZE )
+	{
+		HandOver(current);
+		current = NULL;
+	}
+}
+
+void	SinkWriteRecord(const char* text, size_t textLen)
+{
+	SinkWrite(text, textLen);
+	SinkEndRecord();
+}
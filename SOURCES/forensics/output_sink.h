@@ -0,0 +1,47 @@
+/*
+ * =====================================================================================
+ *       Filename:  output_sink.h
+ *    Description:  Where the records go: stdout, a file, a Unix socket or shard files
+ *
+ *                  The decoder fills blocks of text that writer threads, one per
+ *                  destination, drain.  The blocks come from a bounded pool: when
+ *                  all of them wait for a slow destination, the decoder waits too
+ *                  instead of buffering without limit.  Shards get whole blocks in
+ *                  turn, a block is only handed over at the end of a record, and
+ *                  <prefix>.manifest lists their files with the records and bytes.
+ *                  Without a sink everything goes to stdout through stdio.
+ * =====================================================================================
+ */
+
+#ifndef output_sink_h_included
+#define output_sink_h_included
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+
+#define SINK_BLOCK_SIZE			(1 << 20)
+#define DEFAULT_SINK_QUEUE_BLOCKS	8
+#define MAX_SINK_SHARDS			256
+#define MAX_SINK_COMPRESS_THREADS	64
+#define DEFAULT_GZIP_LEVEL		6
+#define DEFAULT_ZSTD_LEVEL		3
+
+/*  "gzip" or "zstd", optionally followed by ":level"; before SinkOpen().  The
+ *  decode and compression CPU times are reported to stderr on SinkClose() */
+bool	SinkSetCompression(const char* method, unsigned int numThreads);
+/*  "-" for stdout, "unix:PATH", "shards:N:PREFIX", "file:PATH" or a file name */
+bool	SinkOpen(const char* spec, unsigned int queueBlocks);
+/*  Writes what is left, stops the writers; false when a write failed */
+bool	SinkClose(void);
+bool	SinkActive(void);
+
+/*  Part of a record */
+void	SinkWrite(const char* text, size_t textLen);
+void	SinkVPrintf(const char* format, va_list args);
+void	SinkPrintf(const char* format, ...) __attribute__((format(printf, 1, 2)));
+/*  The text written so far ends on a record, shards may switch here */
+void	SinkEndRecord(void);
+void	SinkWriteRecord(const char* text, size_t textLen);
+
+#endif
@@ -0,0 +1,292 @@
+/*
+ * =====================================================================================
+ *       Filename:  parse_daemon.cpp
+ *    Description:  parse_evtx jobs served on a Unix socket
+ *
+ *                  The daemon only accepts and forks; the request is read by the
+ *                  job process so a slow client holds up nobody.  A job watches
+ *                  its connection on a thread of its own and exits as soon as
+ *                  the client cancels; a client that went away fails the next
+ *                  write, and SIGPIPE ends the job.
+ * =====================================================================================
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "parse_daemon.h"
+
+#ifdef _WIN32
+
+bool	DaemonRun(const char* socketPath, unsigned int maxJobs, DaemonJobFunction job)
+{
+	printf("--daemon needs Unix sockets\n");
+	return false;
+}
+
+#else
+
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+static volatile sig_atomic_t	stopDaemon	=	0;
+
+static void	OnStopSignal(int signalNumber)
+{
+	stopDaemon = 1;
+}
+
+static void	OnChildSignal(int signalNumber)
+{
+	/*  only wakes poll() up */
+}
+
+static void*	WatchConnection(void* arg)
+{
+	int	f	=	(int)(intptr_t)arg;
+
+	for (;;)
+	{
+		uint8_t	byte;
+		ssize_t	numRead	=	recv(f, &byte, 1, 0);
+
+		if ( numRead < 0 && errno == EINTR )
+			continue;
+		/*  a shutdown after the request, or an error the writes will see */
+		if ( numRead <= 0 )
+			break;
+		if ( byte == DAEMON_CANCEL )
+			_exit(2);
+	}
+	return NULL;
+}
+
+/*  Reads up to the end of the first line, the line is terminated in place */
+static bool	ReadRequest(int f, char* request, size_t requestSize, size_t* requestLen)
+{
+	*requestLen = 0;
+	while ( *requestLen + 1 < requestSize )
+	{
+		ssize_t	numRead	=	recv(f, request + *requestLen, 1, 0);
+
+		if ( numRead < 0 && errno == EINTR )
+			continue;
+		if ( numRead <= 0 )
+			return false;
+		if ( request[*requestLen] == '\n' )
+		{
+			request[*requestLen] = 0;
+			return true;
+		}
+		(*requestLen)++;
+	}
+	return false;
+}
+
+static void	RunJob(int listenSocket, int f, DaemonJobFunction job)
+{
+	static char	request[DAEMON_MAX_REQUEST];
+	static char*	argv[DAEMON_MAX_ARGUMENTS + 1];
+	size_t		requestLen;
+	int		argc	=	0;
+	pthread_t	watcher;
+	struct timeval	timeout;
+	int		result;
+
+	close(listenSocket);
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGCHLD, SIG_DFL);
+
+	/*  one byte at a time, what follows the line is for the watcher; the
+	 *  timeout goes once the request is in, the watcher waits for good */
+	timeout.tv_sec = DAEMON_REQUEST_TIMEOUT;
+	timeout.tv_usec = 0;
+	if ( setsockopt(f, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0 )
+		_exit(1);
+	if ( !ReadRequest(f, request, sizeof(request), &requestLen) )
+		_exit(1);
+	timeout.tv_sec = 0;
+	if ( setsockopt(f, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0 )
+		_exit(1);
+
+	argv[argc++] = (char*)"parse_evtx";
+	for (char* arg = request; arg != NULL && argc < DAEMON_MAX_ARGUMENTS; )
+	{
+		char*	separator	=	strchr(arg, '\t');
+
+		if ( separator != NULL )
+			*separator = 0;
+		if ( *arg != 0 )
+			argv[argc++] = arg;
+		arg = ( separator != NULL ) ? separator + 1 : NULL;
+	}
+	argv[argc] = NULL;
+
+	/*  stderr stays with the daemon, the records are not mixed with reports */
+	if ( dup2(f, STDOUT_FILENO) < 0 )
+		_exit(1);
+	if ( pthread_create(&watcher, NULL, WatchConnection, (void*)(intptr_t)f) != 0 )
+		_exit(1);
+	pthread_detach(watcher);
+
+	result = job(argc, argv);
+	printf("%s%d\n", DAEMON_STATUS_PREFIX, result);
+	exit(result);
+}
+
+/*  A socket left behind by a daemon that is gone is removed; anything else
+ *  at the path, or a socket a daemon still serves, is left alone */
+static bool	ClearSocketPath(const char* socketPath, const struct sockaddr_un* address)
+{
+	struct stat	st;
+	int		probe;
+	bool		stale;
+
+	if ( lstat(socketPath, &st) != 0 )
+	{
+		if ( errno == ENOENT )
+			return true;
+		printf("Cannot open %s: %s\n", socketPath, strerror(errno));
+		return false;
+	}
+	if ( !S_ISSOCK(st.st_mode) )
+	{
+		printf("%s exists and is not a socket\n", socketPath);
+		return false;
+	}
+
+	probe = socket(AF_UNIX, SOCK_STREAM, 0);
+	if ( probe < 0 )
+		return false;
+	stale = ( connect(probe, (const struct sockaddr*)address, sizeof(*address)) != 0 && errno == ECONNREFUSED );
+	close(probe);
+	if ( !stale )
+	{
+		printf("%s is in use by another daemon\n", socketPath);
+		return false;
+	}
+	return ( unlink(socketPath) == 0 || errno == ENOENT );
+}
+
+static bool	ListenOn(const char* socketPath, int* listenSocket)
+{
+	struct sockaddr_un	address;
+
+	if ( strlen(socketPath) >= sizeof(address.sun_path) )
+	{
+		printf("Socket path too long: %s\n", socketPath);
+		return false;
+	}
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socketPath);
+
+	if ( !ClearSocketPath(socketPath, &address) )
+		return false;
+	*listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+	if ( *listenSocket < 0 )
+		return false;
+	if ( bind(*listenSocket, (const struct sockaddr*)&address, sizeof(address)) != 0 ||
+		listen(*listenSocket, SOMAXCONN) != 0 )
+	{
+		printf("Failed on %s\n", socketPath);
+		close(*listenSocket);
+		return false;
+	}
+	return true;
+}
+
+static void	SetSignalHandler(int signalNumber, void (*handler)(int))
+{
+	struct sigaction	action;
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = handler;
+	sigemptyset(&action.sa_mask);
+	/*  no SA_RESTART: poll() must return */
+	sigaction(signalNumber, &action, NULL);
+}
+
+bool	DaemonRun(const char* socketPath, unsigned int maxJobs, DaemonJobFunction job)
+{
+	int		listenSocket;
+	pid_t*		jobs;
+	unsigned int	numJobs		=	0;
+
+	if ( maxJobs == 0 )
+		maxJobs = 1;
+	jobs = (pid_t*)malloc(sizeof(*jobs) * maxJobs);
+	if ( jobs == NULL )
+		return false;
+	if ( !ListenOn(socketPath, &listenSocket) )
+	{
+		free(jobs);
+		return false;
+	}
+
+	SetSignalHandler(SIGINT, OnStopSignal);
+	SetSignalHandler(SIGTERM, OnStopSignal);
+	SetSignalHandler(SIGCHLD, OnChildSignal);
+	signal(SIGPIPE, SIG_IGN);
+	fflush(stdout);
+	fflush(stderr);
+
+	while ( !stopDaemon )
+	{
+		struct pollfd	pollFd;
+		pid_t		pid;
+
+		while ( ( pid = waitpid(-1, NULL, WNOHANG) ) > 0 )
+		{
+			for (unsigned int idx = 0; idx < numJobs; idx++)
+			{
+				if ( jobs[idx] == pid )
+				{
+					jobs[idx] = jobs[--numJobs];
+					break;
+				}
+			}
+		}
+
+		/*  at the limit only child exits and signals wake us up */
+		pollFd.fd = listenSocket;
+		pollFd.events = ( numJobs < maxJobs ) ? POLLIN : 0;
+		pollFd.revents = 0;
+		if ( poll(&pollFd, 1, 1000) <= 0 || ( pollFd.revents & POLLIN ) == 0 )
+			continue;
+
+		int	f	=	accept(listenSocket, NULL, NULL);
+
+		if ( f < 0 )
+			continue;
+		pid = fork();
+		if ( pid == 0 )
+		{
+			signal(SIGPIPE, SIG_DFL);
+			RunJob(listenSocket, f, job);
+		}
+		if ( pid > 0 )
+			jobs[numJobs++] = pid;
+		close(f);
+	}
+
+	for (unsigned int idx = 0; idx < numJobs; idx++)
+		kill(jobs[idx], SIGTERM);
+	while ( numJobs > 0 && waitpid(-1, NULL, 0) > 0 )
+		numJobs--;
+	close(listenSocket);
+	unlink(socketPath);
+	free(jobs);
+	return true;
+}
+
+#endif
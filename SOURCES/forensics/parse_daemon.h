@@ -0,0 +1,44 @@
+/*
+ * =====================================================================================
+ *       Filename:  parse_daemon.h
+ *    Description:  parse_evtx jobs served on a Unix socket
+ *
+ *                  A client connects, sends the command line of the job as one
+ *                  line of tab separated arguments and reads the output until
+ *                  the daemon closes the connection.  The last line of a job
+ *                  that ran to its end is DAEMON_STATUS_PREFIX and its exit code;
+ *                  without it the job was cancelled or crashed.  Each job runs in
+ *                  a process forked from the daemon, which shares the lookup
+ *                  tables built at start-up.  Sending DAEMON_CANCEL, or going away
+ *                  so that a write fails, cancels the job; the client may shut its
+ *                  side down after the request.  The reports a job prints on
+ *                  stderr go to the stderr of the daemon, not to the client.
+ *                  Relative file names are taken from the directory of the daemon.
+ *                  A client that sends no request line within
+ *                  DAEMON_REQUEST_TIMEOUT seconds is dropped, so idle
+ *                  connections do not hold the job slots.  The socket path must
+ *                  be free or a socket no daemon listens on any more.
+ * =====================================================================================
+ */
+
+#ifndef parse_daemon_h_included
+#define parse_daemon_h_included
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define DAEMON_MAX_REQUEST	65536
+#define DAEMON_MAX_ARGUMENTS	1024
+#define DAEMON_CANCEL		0x18	/*  ASCII CAN */
+#define DAEMON_STATUS_PREFIX	"#parse_evtx exit "
+#define DAEMON_REQUEST_TIMEOUT	30	/*  seconds for the request line to arrive */
+
+/*  Runs in the job process with the output going to the client, argv[0]
+ *  included; the result is the exit code of the process */
+typedef int	(*DaemonJobFunction)(int argc, char* argv[]);
+
+/*  Serves until SIGINT or SIGTERM with up to maxJobs jobs at a time, more
+ *  clients wait in the listen queue */
+bool	DaemonRun(const char* socketPath, unsigned int maxJobs, DaemonJobFunction job);
+
+#endif
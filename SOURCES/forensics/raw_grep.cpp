@@ -0,0 +1,311 @@
+/*
+ * =====================================================================================
+ *       Filename:  raw_grep.cpp
+ *    Description:  Substring search in raw chunks and formatted records
+ *
+ *                  The vector kernels compare 16, 32 or 64 positions at once
+ *                  against the first and the last significant byte of the needle
+ *                  (ORed with 0x20 for letters) and verify only the positions
+ *                  where both hit; the CPU tier picks the width.
+ * =====================================================================================
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "cpu_dispatch.h"
+#ifdef HAVE_X86_KERNELS
+#include <immintrin.h>
+#endif
+#include "raw_grep.h"
+
+typedef struct
+{
+	uint8_t*	bytes;		/*  ASCII letters lowercased */
+	size_t		len;
+	size_t		lastIdx;	/*  last non-zero byte, the high bytes of UTF-16 ASCII are useless filters */
+}
+GrepNeedle;
+
+struct sGrepPattern
+{
+	GrepNeedle	text;
+	GrepNeedle	utf16;
+};
+
+static uint8_t	FoldByte(uint8_t c)
+{
+	if ( c >= 'A' && c <= 'Z' )
+		return c + ( 'a' - 'A' );
+	return c;
+}
+
+static bool	IsLetter(uint8_t c)
+{
+	return ( c >= 'a' && c <= 'z' );
+}
+
+static bool	InitNeedle(GrepNeedle* needle, const uint8_t* bytes, size_t len)
+{
+	needle->bytes = (uint8_t*)malloc(len);
+	if ( needle->bytes == NULL )
+		return false;
+	for (size_t idx = 0; idx < len; idx++)
+		needle->bytes[idx] = FoldByte(bytes[idx]);
+	needle->len = len;
+	needle->lastIdx = len - 1;
+	while ( needle->lastIdx > 0 && needle->bytes[needle->lastIdx] == 0 )
+		needle->lastIdx--;
+	return true;
+}
+
+/*  Returns the number of UTF-16LE bytes written to out (at least 2 * strlen(in) bytes) */
+static size_t	UTF8ToUTF16(const uint8_t* in, size_t inLen, uint8_t* out)
+{
+	size_t	outLen	=	0;
+
+	for (size_t idx = 0; idx < inLen; )
+	{
+		uint32_t	c	=	in[idx];
+		size_t		extra	=	0;
+
+		if ( c >= 0xF0 && c < 0xF8 )
+		{
+			c &= 0x07;
+			extra = 3;
+		}
+		else if ( c >= 0xE0 )
+		{
+			c &= 0x0F;
+			extra = 2;
+		}
+		else if ( c >= 0xC0 )
+		{
+			c &= 0x1F;
+			extra = 1;
+		}
+		idx++;
+		for (; extra > 0 && idx < inLen; extra--, idx++)
+			c = ( c << 6 ) | ( in[idx] & 0x3F );
+
+		if ( c >= 0x10000 )
+		{
+			c -= 0x10000;
+			out[outLen++] = (uint8_t)( ( 0xD800 | ( c >> 10 ) ) & 0xFF );
+			out[outLen++] = (uint8_t)( ( 0xD800 | ( c >> 10 ) ) >> 8 );
+			c = 0xDC00 | ( c & 0x3FF );
+		}
+		out[outLen++] = (uint8_t)( c & 0xFF );
+		out[outLen++] = (uint8_t)( c >> 8 );
+	}
+
+	return outLen;
+}
+
+struct sGrepPattern*	GrepCompile(const char* needle)
+{
+	size_t			len	=	strlen(needle);
+	struct sGrepPattern*	pattern;
+	uint8_t*		utf16;
+	size_t			utf16Len;
+
+	if ( len == 0 )
+		return NULL;
+	pattern = (struct sGrepPattern*)calloc(1, sizeof(*pattern));
+	utf16 = (uint8_t*)malloc(len * 2);
+	if ( pattern == NULL || utf16 == NULL )
+	{
+		free(pattern);
+		free(utf16);
+		return NULL;
+	}
+
+	utf16Len = UTF8ToUTF16((const uint8_t*)needle, len, utf16);
+	if ( !InitNeedle(&pattern->text, (const uint8_t*)needle, len) ||
+		!InitNeedle(&pattern->utf16, utf16, utf16Len) )
+	{
+		free(utf16);
+		GrepFree(pattern);
+		return NULL;
+	}
+	free(utf16);
+
+	return pattern;
+}
+
+void	GrepFree(struct sGrepPattern* pattern)
+{
+	if ( pattern == NULL )
+		return;
+	free(pattern->text.bytes);
+	free(pattern->utf16.bytes);
+	free(pattern);
+}
+
+static bool	MatchAt(const uint8_t* data, const GrepNeedle* needle)
+{
+	for (size_t idx = 0; idx < needle->len; idx++)
+	{
+		if ( FoldByte(data[idx]) != needle->bytes[idx] )
+			return false;
+	}
+	return true;
+}
+
+static bool	SearchScalar(const uint8_t* data, size_t dataLen, size_t start, const GrepNeedle* needle)
+{
+	for (size_t pos = start; pos + needle->len <= dataLen; pos++)
+	{
+		if ( FoldByte(data[pos]) == needle->bytes[0] && MatchAt(data + pos, needle) )
+			return true;
+	}
+	return false;
+}
+
+#ifdef HAVE_X86_KERNELS
+
+__attribute__((target("sse2")))
+static bool	SearchSSE2(const uint8_t* data, size_t dataLen, const GrepNeedle* needle)
+{
+	const uint8_t	first		=	needle->bytes[0];
+	const uint8_t	last		=	needle->bytes[needle->lastIdx];
+	const __m128i	firstByte	=	_mm_set1_epi8((char)first);
+	const __m128i	lastByte	=	_mm_set1_epi8((char)last);
+	const __m128i	firstFold	=	_mm_set1_epi8(IsLetter(first) ? 0x20 : 0);
+	const __m128i	lastFold	=	_mm_set1_epi8(IsLetter(last) ? 0x20 : 0);
+	size_t		pos		=	0;
+
+	for (; pos + needle->len + 15 <= dataLen; pos += 16)
+	{
+		__m128i		blockFirst	=	_mm_loadu_si128((const __m128i*)( data + pos ));
+		__m128i		blockLast	=	_mm_loadu_si128((const __m128i*)( data + pos + needle->lastIdx ));
+		unsigned int	mask;
+
+		blockFirst = _mm_cmpeq_epi8(_mm_or_si128(blockFirst, firstFold), firstByte);
+		blockLast = _mm_cmpeq_epi8(_mm_or_si128(blockLast, lastFold), lastByte);
+		mask = (unsigned int)_mm_movemask_epi8(_mm_and_si128(blockFirst, blockLast));
+
+		while ( mask != 0 )
+		{
+			unsigned int	bit	=	__builtin_ctz(mask);
+			if ( MatchAt(data + pos + bit, needle) )
+				return true;
+			mask &= mask - 1;
+		}
+	}
+	return SearchScalar(data, dataLen, pos, needle);
+}
+
+__attribute__((target("avx2")))
+static bool	SearchAVX2(const uint8_t* data, size_t dataLen, const GrepNeedle* needle)
+{
+	const uint8_t	first		=	needle->bytes[0];
+	const uint8_t	last		=	needle->bytes[needle->lastIdx];
+	const __m256i	firstByte	=	_mm256_set1_epi8((char)first);
+	const __m256i	lastByte	=	_mm256_set1_epi8((char)last);
+	const __m256i	firstFold	=	_mm256_set1_epi8(IsLetter(first) ? 0x20 : 0);
+	const __m256i	lastFold	=	_mm256_set1_epi8(IsLetter(last) ? 0x20 : 0);
+	size_t		pos		=	0;
+
+	for (; pos + needle->len + 31 <= dataLen; pos += 32)
+	{
+		__m256i		blockFirst	=	_mm256_loadu_si256((const __m256i*)( data + pos ));
+		__m256i		blockLast	=	_mm256_loadu_si256((const __m256i*)( data + pos + needle->lastIdx ));
+		uint32_t	mask;
+
+		blockFirst = _mm256_cmpeq_epi8(_mm256_or_si256(blockFirst, firstFold), firstByte);
+		blockLast = _mm256_cmpeq_epi8(_mm256_or_si256(blockLast, lastFold), lastByte);
+		mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(blockFirst, blockLast));
+
+		while ( mask != 0 )
+		{
+			unsigned int	bit	=	__builtin_ctz(mask);
+			if ( MatchAt(data + pos + bit, needle) )
+				return true;
+			mask &= mask - 1;
+		}
+	}
+	return SearchScalar(data, dataLen, pos, needle);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static bool	SearchAVX512(const uint8_t* data, size_t dataLen, const GrepNeedle* needle)
+{
+	const uint8_t	first		=	needle->bytes[0];
+	const uint8_t	last		=	needle->bytes[needle->lastIdx];
+	const __m512i	firstByte	=	_mm512_set1_epi8((char)first);
+	const __m512i	lastByte	=	_mm512_set1_epi8((char)last);
+	const __m512i	firstFold	=	_mm512_set1_epi8(IsLetter(first) ? 0x20 : 0);
+	const __m512i	lastFold	=	_mm512_set1_epi8(IsLetter(last) ? 0x20 : 0);
+	size_t		pos		=	0;
+
+	for (; pos + needle->len + 63 <= dataLen; pos += 64)
+	{
+		__m512i		blockFirst	=	_mm512_loadu_si512((const void*)( data + pos ));
+		__m512i		blockLast	=	_mm512_loadu_si512((const void*)( data + pos + needle->lastIdx ));
+		uint64_t	mask;
+
+		mask = _mm512_cmpeq_epi8_mask(_mm512_or_si512(blockFirst, firstFold), firstByte) &
+			_mm512_cmpeq_epi8_mask(_mm512_or_si512(blockLast, lastFold), lastByte);
+
+		while ( mask != 0 )
+		{
+			unsigned int	bit	=	__builtin_ctzll(mask);
+			if ( MatchAt(data + pos + bit, needle) )
+				return true;
+			mask &= mask - 1;
+		}
+	}
+	return SearchScalar(data, dataLen, pos, needle);
+}
+
+#endif
+
+static bool	Search(const uint8_t* data, size_t dataLen, const GrepNeedle* needle)
+{
+	if ( dataLen < needle->len )
+		return false;
+
+#ifdef HAVE_X86_KERNELS
+	switch ( CpuActiveTier() )
+	{
+	case CpuTierAVX512:
+		return SearchAVX512(data, dataLen, needle);
+	case CpuTierAVX2:
+		return SearchAVX2(data, dataLen, needle);
+	case CpuTierSSE4:
+	case CpuTierSSE2:
+		return SearchSSE2(data, dataLen, needle);
+	default:
+		break;
+	}
+#endif
+	return SearchScalar(data, dataLen, 0, needle);
+}
+
+bool	GrepRawChunk(const struct sGrepPattern* pattern, const uint8_t* data, size_t dataLen)
+{
+	return ( Search(data, dataLen, &pattern->utf16) || Search(data, dataLen, &pattern->text) );
+}
+
+bool	GrepText(const struct sGrepPattern* pattern, const char* text, size_t textLen)
+{
+	return Search((const uint8_t*)text, textLen, &pattern->text);
+}
+
+const char*	GrepImplementation(void)
+{
+#ifdef HAVE_X86_KERNELS
+	switch ( CpuActiveTier() )
+	{
+	case CpuTierAVX512:
+		return "avx512bw";
+	case CpuTierAVX2:
+		return "avx2";
+	case CpuTierSSE4:
+	case CpuTierSSE2:
+		return "sse2";
+	default:
+		break;
+	}
+#endif
+	return "scalar";
+}
@@ -0,0 +1,35 @@
+/*
+ * =====================================================================================
+ *       Filename:  raw_grep.h
+ *    Description:  Substring search in raw chunks and formatted records
+ *
+ *                  The needle is searched in the raw chunk both as UTF-16LE and as
+ *                  8-bit text, ignoring ASCII case, so chunks without it are skipped
+ *                  before any BinXml parsing.  Values that are stored as numbers
+ *                  (event ids, SIDs, integers) are not text in the raw chunk and
+ *                  cannot be found this way.
+ * =====================================================================================
+ */
+
+#ifndef raw_grep_h_included
+#define raw_grep_h_included
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct sGrepPattern;
+
+/*  needle is UTF-8 */
+struct sGrepPattern*	GrepCompile(const char* needle);
+void	GrepFree(struct sGrepPattern* pattern);
+
+/*  May give false positives, never false negatives for text values */
+bool	GrepRawChunk(const struct sGrepPattern* pattern, const uint8_t* data, size_t dataLen);
+
+/*  Exact check of a formatted (UTF-8) record */
+bool	GrepText(const struct sGrepPattern* pattern, const char* text, size_t textLen);
+
+/*  The version the CPU tier runs: "scalar", "sse2", "avx2" or "avx512bw" */
+const char*	GrepImplementation(void);
+
+#endif
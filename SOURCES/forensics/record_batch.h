@@ -0,0 +1,141 @@
+/*
+ * =====================================================================================
+ *       Filename:  record_batch.h
+ *    Description:  Formatted records captured in memory instead of being printed
+ * =====================================================================================
+ */
+
+#ifndef record_batch_h_included
+#define record_batch_h_included
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef struct
+{
+	uint64_t	timestamp;
+	uint64_t	number;
+	size_t		textOffset;
+	size_t		textLen;
+}
+BatchRecord;
+
+typedef struct
+{
+	char*		text;
+	size_t		textUsed;
+	size_t		textSize;
+	BatchRecord*	records;
+	size_t		numRecords;
+	size_t		maxRecords;
+}
+RecordBatch;
+
+static void	InitBatch(RecordBatch* batch)
+{
+	memset(batch, 0, sizeof(*batch));
+}
+
+static void	ClearBatch(RecordBatch* batch)
+{
+	batch->textUsed = 0;
+	batch->numRecords = 0;
+}
+
+static void	FreeBatch(RecordBatch* batch)
+{
+	free(batch->text);
+	free(batch->records);
+	InitBatch(batch);
+}
+
+static bool	ReserveBatchText(RecordBatch* batch, size_t numBytes)
+{
+	size_t	newSize	=	batch->textSize == 0 ? 0x10000 : batch->textSize;
+	char*	newText;
+
+	if ( batch->textUsed + numBytes < batch->textSize )
+		return true;
+	while ( newSize <= batch->textUsed + numBytes )
+		newSize *= 2;
+	newText = (char*)realloc(batch->text, newSize);
+	if ( newText == NULL )
+		return false;
+	batch->text = newText;
+	batch->textSize = newSize;
+	return true;
+}
+
+static bool	BatchAppend(RecordBatch* batch, const char* data, size_t dataLen)
+{
+	if ( !ReserveBatchText(batch, dataLen) )
+		return false;
+	memcpy(batch->text + batch->textUsed, data, dataLen);
+	batch->textUsed += dataLen;
+	return true;
+}
+
+static bool	BatchAppendV(RecordBatch* batch, const char* format, va_list args)
+{
+	va_list	argsCopy;
+	int	len;
+
+	va_copy(argsCopy, args);
+	len = vsnprintf(batch->text + batch->textUsed, batch->textSize - batch->textUsed, format, argsCopy);
+	va_end(argsCopy);
+	if ( len < 0 )
+		return false;
+
+	if ( batch->textUsed + len >= batch->textSize )
+	{
+		if ( !ReserveBatchText(batch, len + 1) )
+			return false;
+		vsnprintf(batch->text + batch->textUsed, batch->textSize - batch->textUsed, format, args);
+	}
+	batch->textUsed += len;
+	return true;
+}
+
+static bool	BatchBeginRecord(RecordBatch* batch, uint64_t number, uint64_t timestamp)
+{
+	BatchRecord*	record;
+
+	if ( batch->numRecords >= batch->maxRecords )
+	{
+		size_t		newMax		=	batch->maxRecords == 0 ? 256 : batch->maxRecords * 2;
+		BatchRecord*	newRecords	=	(BatchRecord*)realloc(batch->records, sizeof(*newRecords) * newMax);
+		if ( newRecords == NULL )
+			return false;
+		batch->records = newRecords;
+		batch->maxRecords = newMax;
+	}
+
+	record = &batch->records[batch->numRecords++];
+	record->number = number;
+	record->timestamp = timestamp;
+	record->textOffset = batch->textUsed;
+	record->textLen = 0;
+	return true;
+}
+
+static void	BatchEndRecord(RecordBatch* batch)
+{
+	BatchRecord*	record;
+
+	if ( batch->numRecords == 0 )
+		return;
+	record = &batch->records[batch->numRecords - 1];
+	record->textLen = batch->textUsed - record->textOffset;
+}
+
+static void	BatchDropRecord(RecordBatch* batch)
+{
+	if ( batch->numRecords == 0 )
+		return;
+	batch->textUsed = batch->records[--batch->numRecords].textOffset;
+}
+
+#endif
@@ -0,0 +1,235 @@
+/*
+ * =====================================================================================
+ *       Filename:  record_dedup.cpp
+ *    Description:  Drops records seen before in any input (backups, snapshots, re-exports)
+ *
+ *                  The Bloom filter is blocked: all bits of a fingerprint fall in
+ *                  one 64 byte line, so a new record costs a single cache miss.
+ *                  It takes an eighth of the memory, the exact set (open
+ *                  addressing, linear probing) grows into the rest.
+ * =====================================================================================
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "record_dedup.h"
+
+#define BLOOM_BLOCK_BYTES	64
+#define BLOOM_HASHES		6
+#define MIN_SET_SLOTS		0x10000
+#define MAX_VALUE_SIZE		1024
+
+static uint8_t*			bloom		=	NULL;
+static size_t			bloomBlocks	=	0;
+static DedupFingerprint*	slots		=	NULL;	/*  all zero is an empty slot */
+static size_t			numSlots	=	0;
+static size_t			numEntries	=	0;
+static size_t			maxSlots	=	0;
+
+static uint64_t		numRecords	=	0;
+static uint64_t		numDuplicates	=	0;
+static uint64_t		numUnconfirmed	=	0;
+
+static uint64_t	HashBytes(uint64_t h, const void* data, size_t dataLen)
+{
+	const uint8_t*	bytes	=	(const uint8_t*)data;
+
+	for (size_t idx = 0; idx < dataLen; idx++)
+	{
+		h ^= bytes[idx];
+		h *= 0x100000001B3ULL;
+	}
+	return h;
+}
+
+static uint64_t	Mix(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+bool	DedupInit(uint64_t maxBytes)
+{
+	uint64_t	bloomBytes	=	maxBytes / 8;
+
+	bloomBlocks = bloomBytes / BLOOM_BLOCK_BYTES;
+	if ( bloomBlocks == 0 )
+		bloomBlocks = 1;
+	maxSlots = MIN_SET_SLOTS;
+	while ( (uint64_t)maxSlots * 2 * sizeof(*slots) <= maxBytes - bloomBytes )
+		maxSlots *= 2;
+
+	bloom = (uint8_t*)calloc(bloomBlocks, BLOOM_BLOCK_BYTES);
+	numSlots = MIN_SET_SLOTS;
+	slots = (DedupFingerprint*)calloc(numSlots, sizeof(*slots));
+	if ( bloom == NULL || slots == NULL )
+	{
+		DedupFree();
+		return false;
+	}
+	return true;
+}
+
+void	DedupFree(void)
+{
+	free(bloom);
+	free(slots);
+	bloom = NULL;
+	slots = NULL;
+	bloomBlocks = 0;
+	numSlots = 0;
+	numEntries = 0;
+}
+
+static void	FieldText(const EvtxRecord* record, const char* key, char* buffer, size_t bufferSize)
+{
+	if ( !FormatFieldValue(FindRecordField(record, key), buffer, bufferSize) )
+		buffer[0] = 0;
+}
+
+void	DedupFingerprintOf(const EvtxRecord* record, DedupFingerprint* fingerprint)
+{
+	char		value[MAX_VALUE_SIZE];
+	uint64_t	identity	=	0xCBF29CE484222325ULL;
+	uint64_t	payload		=	0x84222325CBF29CE4ULL;
+
+	/*  formatted, the same text whether the template fixed the value or not */
+	FieldText(record, "Computer", value, sizeof(value));
+	identity = HashBytes(identity, value, strlen(value) + 1);
+	FieldText(record, "Channel", value, sizeof(value));
+	identity = HashBytes(identity, value, strlen(value) + 1);
+	identity = HashBytes(identity, &record->number, sizeof(record->number));
+	identity = HashBytes(identity, &record->timestamp, sizeof(record->timestamp));
+
+	for (size_t idx = 0; idx < record->numFields; idx++)
+	{
+		const EvtxField*	field	=	&record->fields[idx];
+		uint64_t		dataLen	=	field->dataLen;
+
+		payload = HashBytes(payload, field->key, strlen(field->key) + 1);
+		payload = HashBytes(payload, &field->type, sizeof(field->type));
+		payload = HashBytes(payload, &dataLen, sizeof(dataLen));
+		payload = HashBytes(payload, field->data, field->dataLen);
+	}
+
+	fingerprint->low = Mix(identity ^ Mix(payload));
+	fingerprint->high = Mix(identity * 0x9E3779B97F4A7C15ULL + payload);
+	if ( fingerprint->low == 0 && fingerprint->high == 0 )
+		fingerprint->low = 1;
+}
+
+static uint64_t*	BloomBlock(const DedupFingerprint* fingerprint)
+{
+	return (uint64_t*)( bloom + ( fingerprint->high % bloomBlocks ) * BLOOM_BLOCK_BYTES );
+}
+
+/*  Sets the bits of the fingerprint, returns true when all were set before */
+static bool	BloomTestAndAdd(const DedupFingerprint* fingerprint)
+{
+	uint64_t*	block	=	BloomBlock(fingerprint);
+	uint64_t	bits	=	fingerprint->low;
+	bool		present	=	true;
+
+	for (unsigned int idx = 0; idx < BLOOM_HASHES; idx++, bits >>= 9)
+	{
+		uint64_t*	word	=	&block[( bits >> 6 ) & 7];
+		uint64_t	mask	=	1ULL << ( bits & 63 );
+
+		if ( !( *word & mask ) )
+		{
+			present = false;
+			*word |= mask;
+		}
+	}
+	return present;
+}
+
+static DedupFingerprint*	FindSlot(DedupFingerprint* table, size_t tableSlots, const DedupFingerprint* fingerprint)
+{
+	size_t	idx	=	(size_t)( fingerprint->low & ( tableSlots - 1 ) );
+
+	for (;; idx = ( idx + 1 ) & ( tableSlots - 1 ))
+	{
+		DedupFingerprint*	slot	=	&table[idx];
+
+		if ( ( slot->low == fingerprint->low && slot->high == fingerprint->high ) ||
+			( slot->low == 0 && slot->high == 0 ) )
+		{
+			return slot;
+		}
+	}
+}
+
+static bool	GrowSet(void)
+{
+	size_t			newNumSlots	=	numSlots * 2;
+	DedupFingerprint*	newSlots;
+
+	if ( newNumSlots > maxSlots )
+		return false;
+	newSlots = (DedupFingerprint*)calloc(newNumSlots, sizeof(*newSlots));
+	if ( newSlots == NULL )
+	{
+		maxSlots = numSlots;
+		return false;
+	}
+	for (size_t idx = 0; idx < numSlots; idx++)
+	{
+		if ( slots[idx].low != 0 || slots[idx].high != 0 )
+			*FindSlot(newSlots, newNumSlots, &slots[idx]) = slots[idx];
+	}
+	free(slots);
+	slots = newSlots;
+	numSlots = newNumSlots;
+	return true;
+}
+
+/*  Returns false once the set cannot take more fingerprints */
+static bool	SetInsert(const DedupFingerprint* fingerprint)
+{
+	if ( numEntries + 1 > numSlots / 4 * 3 && !GrowSet() )
+		return false;
+	*FindSlot(slots, numSlots, fingerprint) = *fingerprint;
+	numEntries++;
+	return true;
+}
+
+bool	DedupRecordSeen(const EvtxRecord* record)
+{
+	DedupFingerprint	fingerprint;
+	DedupFingerprint*	slot;
+
+	if ( bloom == NULL )
+		return false;
+
+	numRecords++;
+	DedupFingerprintOf(record, &fingerprint);
+	if ( !BloomTestAndAdd(&fingerprint) )
+	{
+		SetInsert(&fingerprint);
+		return false;
+	}
+
+	slot = FindSlot(slots, numSlots, &fingerprint);
+	if ( slot->low != 0 || slot->high != 0 )
+	{
+		numDuplicates++;
+		return true;
+	}
+	if ( !SetInsert(&fingerprint) )
+		numUnconfirmed++;
+	return false;
+}
+
+void	DedupPrintReport(FILE* f)
+{
+	fprintf(f, "Dedup: %" PRIu64 " records, %" PRIu64 " duplicates removed, %" PRIu64 " unique",
+			numRecords, numDuplicates, numRecords - numDuplicates);
+	if ( numUnconfirmed > 0 )
+		fprintf(f, ", %" PRIu64 " possible duplicates kept (exact set full, raise --dedup-memory)", numUnconfirmed);
+	fprintf(f, "\n");
+}
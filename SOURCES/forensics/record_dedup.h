@@ -0,0 +1,38 @@
+/*
+ * =====================================================================================
+ *       Filename:  record_dedup.h
+ *    Description:  Drops records seen before in any input (backups, snapshots, re-exports)
+ *
+ *                  A record is identified by its computer, channel, record number,
+ *                  timestamp and a hash of all its decoded field values, folded into
+ *                  a 128 bit fingerprint.  A Bloom filter answers for new records,
+ *                  an exact set of fingerprints confirms the repeated ones.
+ * =====================================================================================
+ */
+
+#ifndef record_dedup_h_included
+#define record_dedup_h_included
+
+#include "evtx_record.h"
+
+#define DEFAULT_DEDUP_MEMORY_MB	256
+
+typedef struct
+{
+	uint64_t	low;
+	uint64_t	high;
+}
+DedupFingerprint;
+
+/*  maxBytes bounds the filter and the exact set together */
+bool	DedupInit(uint64_t maxBytes);
+void	DedupFree(void);
+
+void	DedupFingerprintOf(const EvtxRecord* record, DedupFingerprint* fingerprint);
+/*  Remembers the record, true when it was seen before.  Once the exact set
+ *  is full, filter hits cannot be confirmed and the record is kept. */
+bool	DedupRecordSeen(const EvtxRecord* record);
+
+void	DedupPrintReport(FILE* f);
+
+#endif
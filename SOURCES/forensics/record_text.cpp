@@ -0,0 +1,178 @@
+/*
+ * =====================================================================================
+ *       Filename:  record_text.cpp
+ *    Description:  The fields of a record as text, the way parse_evtx prints them
+ * =====================================================================================
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include "eventlist.h"
+#include "record_text.h"
+#include "text_kernels.h"
+
+const char**	eventDescriptionHashTable	=	NULL;
+const char*	logonTypes[]	= { NULL, NULL, "Interactive", "Network", "Batch", "Service", NULL, "Unlock", "NetworkCleartext", "NewCredentials", "RemoteInteractive", "CachedInteractive"};
+
+bool	RecordTextInit(void)
+{
+	if ( eventDescriptionHashTable != NULL )
+		return true;
+	eventDescriptionHashTable = (const char**)calloc(65536, sizeof(const char*));
+	if ( eventDescriptionHashTable == NULL )
+		return false;
+	for (size_t idx = 0; idx < sizeof(eventDescriptions)/sizeof(eventDescriptions[0]); idx++)
+	{
+		char*		nptr	=	NULL;
+		uint16_t	eventID	=	strtoul(eventDescriptions[idx], &nptr, 10);
+		if ( ( nptr == NULL ) || ( eventID == 0 ) )
+			continue;
+		while (*nptr != ')' && *nptr != 0)
+			nptr++;
+		while (*nptr == ' ' || *nptr == ')')
+			nptr++;
+		// printf("%04u - %s\n", eventID, nptr);
+		eventDescriptionHashTable[eventID] = nptr;
+	}
+	return true;
+}
+
+void	RecordTextFree(void)
+{
+	free(eventDescriptionHashTable);
+	eventDescriptionHashTable = NULL;
+}
+
+static void	PrintSid(const EvtxField* field, RecordPrintFunc print)
+{
+	uint64_t	v_q	=	0;
+	uint32_t	v_d;
+
+	if ( field->dataLen < 8 )
+		return;
+	for (size_t idx = 0; idx < 6; idx++)
+	{
+		v_q <<= 8;
+		v_q |= field->data[2+idx];
+	}
+	print("'%s':S-%u-%" PRIu64 "", field->key, field->data[0], v_q);
+	for (size_t idx = 8; idx + 4 <= field->dataLen; idx += 4)
+	{
+		memcpy(&v_d, field->data + idx, sizeof(v_d));
+		print("-%u", v_d);
+	}
+	print(", ");
+}
+
+static void	PrintBinary(const EvtxField* field, RecordPrintFunc print)
+{
+	char*	hex	=	(char*)malloc(field->dataLen * 2 + 1);
+
+	if ( hex == NULL )
+		return;
+	HexEncode(field->data, field->dataLen, hex);
+	hex[field->dataLen * 2] = 0;
+	print("'%s':%s, ", field->key, hex);
+	free(hex);
+}
+
+void	PrintRecordFields(const EvtxRecord* record, RecordPrintFunc print)
+{
+	for (size_t fieldIdx = 0; fieldIdx < record->numFields; fieldIdx++)
+	{
+		const EvtxField*	field	=	&record->fields[fieldIdx];
+		uint64_t		v_q	=	0;
+		uint32_t		v_d;
+		uint16_t		v_w1;
+		uint16_t		v_w2;
+		char			timeBuffer[32];
+		char*			stringBuffer;
+		size_t			stringSize;
+
+		switch(field->type)
+		{
+		case EVTX_TYPE_ANSI_STRING:
+			{
+				uint16_t	eventID	=	!strcmp(field->key, "EventID") ? strtoul((const char*)field->data, NULL, 10) : 0;
+
+				if ( ( eventID != 0 ) && ( eventDescriptionHashTable[eventID] != NULL ) )
+					print("'%s':%u (%s), ", field->key, eventID, eventDescriptionHashTable[eventID]);
+				else
+					print("'%s':'%s', ", field->key, (const char*)field->data);
+			}
+			break;
+		case EVTX_TYPE_STRING:
+			stringSize = field->dataLen*2+2;
+			stringBuffer = (char*)malloc(stringSize);
+			if ( stringBuffer == NULL )
+				break;
+			FieldToString(field, stringBuffer, stringSize);
+			print("'%s':'%s', ", field->key, stringBuffer);
+			free(stringBuffer);
+			break;
+		case EVTX_TYPE_UINT8:
+			if ( FieldToUInt64(field, &v_q) )
+				print("'%s':%02u, ", field->key, (unsigned int)v_q);
+			break;
+		case EVTX_TYPE_UINT16:
+			if ( !FieldToUInt64(field, &v_q) )
+				break;
+			if ( !strcmp(field->key, "EventID") && ( eventDescriptionHashTable[v_q] != NULL ))
+				print("'%s':%04u (%s), ", field->key, (unsigned int)v_q, eventDescriptionHashTable[v_q]);
+			else
+				print("'%s':%04u, ", field->key, (unsigned int)v_q);
+			break;
+		case EVTX_TYPE_UINT32:
+			if ( !FieldToUInt64(field, &v_q) )
+				break;
+			if ( !strcmp(field->key, "LogonType") && ( v_q <= 11 ) && ( logonTypes[v_q] != NULL ))
+				print("'%s':%08u (%s), ", field->key, (unsigned int)v_q, logonTypes[v_q]);
+			else
+				print("'%s':%08u, ", field->key, (unsigned int)v_q);
+			break;
+		case EVTX_TYPE_UINT64:
+			if ( FieldToUInt64(field, &v_q) )
+				print("'%s':%016" PRIu64 ", ", field->key, v_q);
+			break;
+		case EVTX_TYPE_BINARY:
+			PrintBinary(field, print);
+			break;
+		case EVTX_TYPE_GUID:
+			if ( field->dataLen < 16 )
+				break;
+			memcpy(&v_d, field->data, sizeof(v_d));
+			memcpy(&v_w1, field->data + 4, sizeof(v_w1));
+			memcpy(&v_w2, field->data + 6, sizeof(v_w2));
+			print("'%s':%08X-%02X-%02X-%02X%02X%02X%02X%02X%02X%02X%02X, ", field->key,
+					v_d, v_w1, v_w2,
+					field->data[8], field->data[9], field->data[10], field->data[11],
+					field->data[12], field->data[13], field->data[14], field->data[15]);
+			break;
+		case EVTX_TYPE_HEXINT32:
+			if ( FieldToUInt64(field, &v_q) )
+				print("'%s':%08" PRIX32", ", field->key, (uint32_t)v_q);
+			break;
+		case EVTX_TYPE_HEXINT64:
+			if ( FieldToUInt64(field, &v_q) )
+				print("'%s':%016" PRIX64 ", ", field->key, v_q);
+			break;
+		case EVTX_TYPE_FILETIME:
+			if ( !FieldToUInt64(field, &v_q) )
+				break;
+			FormatFileTime(v_q, timeBuffer, sizeof(timeBuffer));
+			print("'%s':%s, ", field->key, timeBuffer);
+			break;
+		case EVTX_TYPE_SID:
+			PrintSid(field, print);
+			break;
+		case EVTX_TYPE_NULL:
+		case EVTX_TYPE_BINXML:
+			break;
+		default:
+			print("'%s':'...//%04X[%04X]', ", field->key, field->type, (unsigned int)field->dataLen);
+			break;
+		}
+	}
+}
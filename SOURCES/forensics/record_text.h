@@ -0,0 +1,30 @@
+/*
+ * =====================================================================================
+ *       Filename:  record_text.h
+ *    Description:  The fields of a record as text, the way parse_evtx prints them
+ *
+ *                  The text goes through a printf-like function, to the output
+ *                  or into a batch; the benchmarks time the same code.
+ * =====================================================================================
+ */
+
+#ifndef record_text_h_included
+#define record_text_h_included
+
+#include "evtx_record.h"
+
+/*  The text PrintRecordFields() (and the value formatters of evtx_record.h)
+ *  produce; the chunk cache keys its entries with it, so bump it along with
+ *  any change to what a record prints as */
+#define RECORD_TEXT_VERSION	1
+
+typedef void	(*RecordPrintFunc)(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+/*  The table of event descriptions, built once */
+bool	RecordTextInit(void);
+void	RecordTextFree(void);
+
+/*  'key':value, for every field */
+void	PrintRecordFields(const EvtxRecord* record, RecordPrintFunc print);
+
+#endif
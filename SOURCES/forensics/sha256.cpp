@@ -0,0 +1,258 @@
+/*
+ * =====================================================================================
+ *       Filename:  sha256.cpp
+ *    Description:  SHA-256 (FIPS 180-4), with the SHA extensions when the CPU has them
+ *
+ *                  The block function is picked from the CPU tier: SHA-NI does
+ *                  four rounds per sha256rnds2 pair and needs the sse4 tier, the
+ *                  portable version is used on other CPUs and architectures.
+ * =====================================================================================
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "cpu_dispatch.h"
+#include "sha256.h"
+
+#ifdef HAVE_X86_KERNELS
+#define HAVE_SHA_NI
+#include <immintrin.h>
+#endif
+
+typedef void	(*BlockFunction)(uint32_t state[8], const uint8_t* data, size_t numBlocks);
+
+static const uint32_t	K256[64]	=
+{
+	0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+	0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+	0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+	0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+	0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+	0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+	0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+	0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+static uint32_t	RotateRight(uint32_t v, unsigned int bits)
+{
+	return ( v >> bits ) | ( v << ( 32 - bits ) );
+}
+
+static uint32_t	LoadBigEndian32(const uint8_t* p)
+{
+	return ( (uint32_t)p[0] << 24 ) | ( (uint32_t)p[1] << 16 ) | ( (uint32_t)p[2] << 8 ) | p[3];
+}
+
+static void	BlocksPortable(uint32_t state[8], const uint8_t* data, size_t numBlocks)
+{
+	uint32_t	w[64];
+
+	for (; numBlocks > 0; numBlocks--, data += SHA256_BLOCK_SIZE)
+	{
+		uint32_t	a	=	state[0];
+		uint32_t	b	=	state[1];
+		uint32_t	c	=	state[2];
+		uint32_t	d	=	state[3];
+		uint32_t	e	=	state[4];
+		uint32_t	f	=	state[5];
+		uint32_t	g	=	state[6];
+		uint32_t	h	=	state[7];
+
+		for (unsigned int idx = 0; idx < 16; idx++)
+			w[idx] = LoadBigEndian32(data + idx * 4);
+		for (unsigned int idx = 16; idx < 64; idx++)
+		{
+			uint32_t	s0	=	RotateRight(w[idx-15], 7) ^ RotateRight(w[idx-15], 18) ^ ( w[idx-15] >> 3 );
+			uint32_t	s1	=	RotateRight(w[idx-2], 17) ^ RotateRight(w[idx-2], 19) ^ ( w[idx-2] >> 10 );
+
+			w[idx] = w[idx-16] + s0 + w[idx-7] + s1;
+		}
+
+		for (unsigned int idx = 0; idx < 64; idx++)
+		{
+			uint32_t	s1	=	RotateRight(e, 6) ^ RotateRight(e, 11) ^ RotateRight(e, 25);
+			uint32_t	ch	=	( e & f ) ^ ( ~e & g );
+			uint32_t	t1	=	h + s1 + ch + K256[idx] + w[idx];
+			uint32_t	s0	=	RotateRight(a, 2) ^ RotateRight(a, 13) ^ RotateRight(a, 22);
+			uint32_t	maj	=	( a & b ) ^ ( a & c ) ^ ( b & c );
+
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + s0 + maj;
+		}
+
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
+	}
+}
+
+#ifdef HAVE_SHA_NI
+
+/*  The state is kept as ABEF and CDGH, the layout sha256rnds2 works on */
+__attribute__((target("sha,sse4.1,ssse3")))
+static void	BlocksShaNi(uint32_t state[8], const uint8_t* data, size_t numBlocks)
+{
+	const __m128i	byteSwap	=	_mm_set_epi64x(0x0C0D0E0F08090A0BULL, 0x0405060700010203ULL);
+	__m128i		tmp		=	_mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[0]), 0xB1);
+	__m128i		state1		=	_mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[4]), 0x1B);
+	__m128i		state0		=	_mm_alignr_epi8(tmp, state1, 8);
+
+	state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+	for (; numBlocks > 0; numBlocks--, data += SHA256_BLOCK_SIZE)
+	{
+		__m128i	saved0	=	state0;
+		__m128i	saved1	=	state1;
+		__m128i	msg[4];
+
+		for (unsigned int idx = 0; idx < 4; idx++)
+			msg[idx] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)( data + idx * 16 )), byteSwap);
+
+		for (unsigned int group = 0; group < 16; group++)
+		{
+			__m128i	wk	=	_mm_add_epi32(msg[group & 3], _mm_loadu_si128((const __m128i*)&K256[group * 4]));
+
+			state1 = _mm_sha256rnds2_epu32(state1, state0, wk);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(wk, 0x0E));
+
+			/*  W[t..t+3] for t = 4 * group + 16 replaces W[t-16..t-13] */
+			if ( group < 12 )
+			{
+				__m128i	next	=	_mm_sha256msg1_epu32(msg[group & 3], msg[( group + 1 ) & 3]);
+
+				next = _mm_add_epi32(next, _mm_alignr_epi8(msg[( group + 3 ) & 3], msg[( group + 2 ) & 3], 4));
+				msg[group & 3] = _mm_sha256msg2_epu32(next, msg[( group + 3 ) & 3]);
+			}
+		}
+
+		state0 = _mm_add_epi32(state0, saved0);
+		state1 = _mm_add_epi32(state1, saved1);
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1B);
+	state1 = _mm_shuffle_epi32(state1, 0xB1);
+	_mm_storeu_si128((__m128i*)&state[0], _mm_blend_epi16(tmp, state1, 0xF0));
+	_mm_storeu_si128((__m128i*)&state[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+
+#endif
+
+static BlockFunction	GetBlockFunction(void)
+{
+#ifdef HAVE_SHA_NI
+	if ( CpuActiveTier() >= CpuTierSSE4 && ( CpuFeatures() & CPU_FEATURE_SHA ) )
+		return BlocksShaNi;
+#endif
+	return BlocksPortable;
+}
+
+const char*	Sha256Implementation(void)
+{
+#ifdef HAVE_SHA_NI
+	if ( GetBlockFunction() == BlocksShaNi )
+		return "sha-ni";
+#endif
+	return "scalar";
+}
+
+void	Sha256Init(Sha256Context* ctx)
+{
+	static const uint32_t	initialState[8]	=
+	{
+		0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+	};
+
+	memcpy(ctx->state, initialState, sizeof(ctx->state));
+	ctx->totalLen = 0;
+	ctx->blockUsed = 0;
+}
+
+void	Sha256Update(Sha256Context* ctx, const void* data, size_t dataLen)
+{
+	const uint8_t*	bytes	=	(const uint8_t*)data;
+	BlockFunction	blocks	=	GetBlockFunction();
+
+	ctx->totalLen += dataLen;
+	if ( ctx->blockUsed > 0 )
+	{
+		size_t	numBytes	=	SHA256_BLOCK_SIZE - ctx->blockUsed;
+
+		if ( numBytes > dataLen )
+			numBytes = dataLen;
+		memcpy(ctx->block + ctx->blockUsed, bytes, numBytes);
+		ctx->blockUsed += numBytes;
+		bytes += numBytes;
+		dataLen -= numBytes;
+		if ( ctx->blockUsed < SHA256_BLOCK_SIZE )
+			return;
+		blocks(ctx->state, ctx->block, 1);
+		ctx->blockUsed = 0;
+	}
+
+	if ( dataLen >= SHA256_BLOCK_SIZE )
+	{
+		blocks(ctx->state, bytes, dataLen / SHA256_BLOCK_SIZE);
+		bytes += dataLen & ~(size_t)( SHA256_BLOCK_SIZE - 1 );
+		dataLen &= SHA256_BLOCK_SIZE - 1;
+	}
+	memcpy(ctx->block, bytes, dataLen);
+	ctx->blockUsed = dataLen;
+}
+
+void	Sha256Final(Sha256Context* ctx, uint8_t digest[SHA256_DIGEST_SIZE])
+{
+	uint64_t	bitLen	=	ctx->totalLen * 8;
+	BlockFunction	blocks	=	GetBlockFunction();
+
+	ctx->block[ctx->blockUsed++] = 0x80;
+	if ( ctx->blockUsed > SHA256_BLOCK_SIZE - 8 )
+	{
+		memset(ctx->block + ctx->blockUsed, 0, SHA256_BLOCK_SIZE - ctx->blockUsed);
+		blocks(ctx->state, ctx->block, 1);
+		ctx->blockUsed = 0;
+	}
+	memset(ctx->block + ctx->blockUsed, 0, SHA256_BLOCK_SIZE - 8 - ctx->blockUsed);
+	for (unsigned int idx = 0; idx < 8; idx++)
+		ctx->block[SHA256_BLOCK_SIZE - 1 - idx] = (uint8_t)( bitLen >> ( idx * 8 ) );
+	blocks(ctx->state, ctx->block, 1);
+
+	for (unsigned int idx = 0; idx < 8; idx++)
+	{
+		digest[idx * 4] = (uint8_t)( ctx->state[idx] >> 24 );
+		digest[idx * 4 + 1] = (uint8_t)( ctx->state[idx] >> 16 );
+		digest[idx * 4 + 2] = (uint8_t)( ctx->state[idx] >> 8 );
+		digest[idx * 4 + 3] = (uint8_t)ctx->state[idx];
+	}
+}
+
+void	Sha256(const void* data, size_t dataLen, uint8_t digest[SHA256_DIGEST_SIZE])
+{
+	Sha256Context	ctx;
+
+	Sha256Init(&ctx);
+	Sha256Update(&ctx, data, dataLen);
+	Sha256Final(&ctx, digest);
+}
+
+void	Sha256ToHex(const uint8_t digest[SHA256_DIGEST_SIZE], char hex[SHA256_HEX_SIZE])
+{
+	static const char	digits[]	=	"0123456789abcdef";
+
+	for (size_t idx = 0; idx < SHA256_DIGEST_SIZE; idx++)
+	{
+		hex[idx * 2] = digits[digest[idx] >> 4];
+		hex[idx * 2 + 1] = digits[digest[idx] & 0x0F];
+	}
+	hex[SHA256_DIGEST_SIZE * 2] = 0;
+}
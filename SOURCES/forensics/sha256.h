@@ -0,0 +1,37 @@
+/*
+ * =====================================================================================
+ *       Filename:  sha256.h
+ *    Description:  SHA-256 (FIPS 180-4), with the SHA extensions when the CPU has them
+ * =====================================================================================
+ */
+
+#ifndef sha256_h_included
+#define sha256_h_included
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA256_DIGEST_SIZE	32
+#define SHA256_BLOCK_SIZE	64
+#define SHA256_HEX_SIZE		( SHA256_DIGEST_SIZE * 2 + 1 )
+
+typedef struct
+{
+	uint32_t	state[8];
+	uint64_t	totalLen;
+	uint8_t		block[SHA256_BLOCK_SIZE];
+	size_t		blockUsed;
+}
+Sha256Context;
+
+void	Sha256Init(Sha256Context* ctx);
+void	Sha256Update(Sha256Context* ctx, const void* data, size_t dataLen);
+void	Sha256Final(Sha256Context* ctx, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+void	Sha256(const void* data, size_t dataLen, uint8_t digest[SHA256_DIGEST_SIZE]);
+void	Sha256ToHex(const uint8_t digest[SHA256_DIGEST_SIZE], char hex[SHA256_HEX_SIZE]);
+
+/*  "sha-ni" or "scalar" */
+const char*	Sha256Implementation(void);
+
+#endif
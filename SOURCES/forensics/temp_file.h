@@ -0,0 +1,79 @@
+/*
+ * =====================================================================================
+ *       Filename:  temp_file.h
+ *    Description:  Temporary files for spilled runs
+ * =====================================================================================
+ */
+
+#ifndef temp_file_h_included
+#define temp_file_h_included
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+/*  TMPDIR, TEMP on Windows, or the usual directory */
+static const char*	SystemTempDir(void)
+{
+#ifdef _WIN32
+	const char*	dir	=	getenv("TEMP");
+
+	return ( dir != NULL ) ? dir : ".";
+#else
+	const char*	dir	=	getenv("TMPDIR");
+
+	return ( dir != NULL && *dir != 0 ) ? dir : "/tmp";
+#endif
+}
+
+/*  Creates <tempDir>/parse_evtx.<pid>.<tag>.<serial>, in the system temporary
+ *  directory without tempDir.  Runs are named so they can be closed after
+ *  they are written and opened again to be merged, the descriptors do not
+ *  grow with their number.  *fileName is set for the caller to remove and free. */
+static FILE*	OpenTempFile(const char* tempDir, const char* tag, size_t serial, char** fileName)
+{
+	FILE*	f;
+
+	if ( tempDir == NULL )
+		tempDir = SystemTempDir();
+	{
+		size_t	nameSize	=	strlen(tempDir) + strlen(tag) + 64;
+
+		*fileName = (char*)malloc(nameSize);
+		if ( *fileName == NULL )
+			return NULL;
+		snprintf(*fileName, nameSize, "%s/parse_evtx.%d.%s.%zu", tempDir, (int)getpid(), tag, serial);
+	}
+	f = fopen(*fileName, "w+b");
+	if ( f == NULL )
+	{
+		printf("Cannot create a temporary file %s: %s\n", *fileName, strerror(errno));
+		free(*fileName);
+		*fileName = NULL;
+	}
+	return f;
+}
+
+/*  Ends the writing of a temporary file; false when it could not be written */
+static bool	FinishTempFile(FILE** f)
+{
+	bool	result	=	( ferror(*f) == 0 );
+
+	if ( fclose(*f) != 0 )
+		result = false;
+	*f = NULL;
+	return result;
+}
+
+static void	CloseTempFile(FILE* f, char* fileName)
+{
+	if ( f != NULL )
+		fclose(f);
+	if ( fileName != NULL )
+		remove(fileName);
+	free(fileName);
+}
+
+#endif
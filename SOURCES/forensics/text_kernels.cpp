@@ -0,0 +1,223 @@
+/*
+ * =====================================================================================
+ *       Filename:  text_kernels.cpp
+ *    Description:  UTF-16 and hex conversions, scalar and per CPU tier
+ *
+ *                  The vector loops handle whole blocks and hand the rest to
+ *                  the scalar version, which also decides where a block with a
+ *                  character that is not ASCII ends.
+ * =====================================================================================
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "cpu_dispatch.h"
+#include "text_kernels.h"
+
+#ifdef HAVE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+static const char	hexDigits[]	=	"0123456789ABCDEF";
+
+static size_t	Utf16AsciiScalar(const uint8_t* data, size_t start, size_t maxChars, char* buffer)
+{
+	size_t	idx;
+
+	for (idx = start; idx < maxChars; idx++)
+	{
+		uint16_t	w	=	data[idx * 2] | ( data[idx * 2 + 1] << 8 );
+
+		if ( w == 0 || w > 0x7F )
+			break;
+		buffer[idx] = (char)w;
+	}
+	return idx;
+}
+
+static void	HexScalar(const uint8_t* data, size_t start, size_t dataLen, char* buffer)
+{
+	for (size_t idx = start; idx < dataLen; idx++)
+	{
+		buffer[idx * 2] = hexDigits[data[idx] >> 4];
+		buffer[idx * 2 + 1] = hexDigits[data[idx] & 0x0F];
+	}
+}
+
+#ifdef HAVE_X86_KERNELS
+
+__attribute__((target("sse2")))
+static size_t	Utf16AsciiSSE2(const uint8_t* data, size_t maxChars, char* buffer)
+{
+	const __m128i	high	=	_mm_set1_epi16((short)0xFF80);
+	const __m128i	zero	=	_mm_setzero_si128();
+	size_t		idx	=	0;
+
+	for (; idx + 8 <= maxChars; idx += 8)
+	{
+		__m128i	chars	=	_mm_loadu_si128((const __m128i*)( data + idx * 2 ));
+		__m128i	ascii	=	_mm_cmpeq_epi16(_mm_and_si128(chars, high), zero);
+		__m128i	nul	=	_mm_cmpeq_epi16(chars, zero);
+
+		if ( _mm_movemask_epi8(_mm_andnot_si128(nul, ascii)) != 0xFFFF )
+			break;
+		_mm_storel_epi64((__m128i*)( buffer + idx ), _mm_packus_epi16(chars, chars));
+	}
+	return Utf16AsciiScalar(data, idx, maxChars, buffer);
+}
+
+__attribute__((target("avx2")))
+static size_t	Utf16AsciiAVX2(const uint8_t* data, size_t maxChars, char* buffer)
+{
+	const __m256i	high	=	_mm256_set1_epi16((short)0xFF80);
+	const __m256i	zero	=	_mm256_setzero_si256();
+	size_t		idx	=	0;
+
+	for (; idx + 16 <= maxChars; idx += 16)
+	{
+		__m256i	chars	=	_mm256_loadu_si256((const __m256i*)( data + idx * 2 ));
+		__m256i	ascii	=	_mm256_cmpeq_epi16(_mm256_and_si256(chars, high), zero);
+		__m256i	nul	=	_mm256_cmpeq_epi16(chars, zero);
+
+		if ( (uint32_t)_mm256_movemask_epi8(_mm256_andnot_si256(nul, ascii)) != 0xFFFFFFFF )
+			break;
+		_mm_storeu_si128((__m128i*)( buffer + idx ),
+				_mm_packus_epi16(_mm256_castsi256_si128(chars), _mm256_extracti128_si256(chars, 1)));
+	}
+	return Utf16AsciiScalar(data, idx, maxChars, buffer);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t	Utf16AsciiAVX512(const uint8_t* data, size_t maxChars, char* buffer)
+{
+	const __m512i	high	=	_mm512_set1_epi16((short)0xFF80);
+	const __m512i	zero	=	_mm512_setzero_si512();
+	size_t		idx	=	0;
+
+	for (; idx + 32 <= maxChars; idx += 32)
+	{
+		__m512i	chars	=	_mm512_loadu_si512((const void*)( data + idx * 2 ));
+
+		if ( _mm512_test_epi16_mask(chars, high) != 0 || _mm512_cmpeq_epi16_mask(chars, zero) != 0 )
+			break;
+		_mm256_storeu_si256((__m256i*)( buffer + idx ), _mm512_cvtepi16_epi8(chars));
+	}
+	return Utf16AsciiScalar(data, idx, maxChars, buffer);
+}
+
+/*  pshufb looks the digits up for 16 nibbles at once */
+__attribute__((target("ssse3")))
+static void	HexSSSE3(const uint8_t* data, size_t dataLen, char* buffer)
+{
+	const __m128i	digits	=	_mm_loadu_si128((const __m128i*)hexDigits);
+	const __m128i	nibble	=	_mm_set1_epi8(0x0F);
+	size_t		idx	=	0;
+
+	for (; idx + 16 <= dataLen; idx += 16)
+	{
+		__m128i	bytes	=	_mm_loadu_si128((const __m128i*)( data + idx ));
+		__m128i	high	=	_mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble));
+		__m128i	low	=	_mm_shuffle_epi8(digits, _mm_and_si128(bytes, nibble));
+
+		_mm_storeu_si128((__m128i*)( buffer + idx * 2 ), _mm_unpacklo_epi8(high, low));
+		_mm_storeu_si128((__m128i*)( buffer + idx * 2 + 16 ), _mm_unpackhi_epi8(high, low));
+	}
+	HexScalar(data, idx, dataLen, buffer);
+}
+
+__attribute__((target("avx2")))
+static void	HexAVX2(const uint8_t* data, size_t dataLen, char* buffer)
+{
+	const __m256i	digits	=	_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)hexDigits));
+	const __m256i	nibble	=	_mm256_set1_epi8(0x0F);
+	size_t		idx	=	0;
+
+	for (; idx + 32 <= dataLen; idx += 32)
+	{
+		__m256i	bytes	=	_mm256_loadu_si256((const __m256i*)( data + idx ));
+		__m256i	high	=	_mm256_shuffle_epi8(digits, _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble));
+		__m256i	low	=	_mm256_shuffle_epi8(digits, _mm256_and_si256(bytes, nibble));
+		/*  the unpacks work within 128-bit lanes */
+		__m256i	first	=	_mm256_unpacklo_epi8(high, low);
+		__m256i	second	=	_mm256_unpackhi_epi8(high, low);
+
+		_mm256_storeu_si256((__m256i*)( buffer + idx * 2 ), _mm256_permute2x128_si256(first, second, 0x20));
+		_mm256_storeu_si256((__m256i*)( buffer + idx * 2 + 32 ), _mm256_permute2x128_si256(first, second, 0x31));
+	}
+	HexScalar(data, idx, dataLen, buffer);
+}
+
+#endif
+
+size_t	Utf16AsciiPrefix(const uint8_t* data, size_t maxChars, char* buffer)
+{
+#ifdef HAVE_X86_KERNELS
+	switch ( CpuActiveTier() )
+	{
+	case CpuTierAVX512:
+		return Utf16AsciiAVX512(data, maxChars, buffer);
+	case CpuTierAVX2:
+		return Utf16AsciiAVX2(data, maxChars, buffer);
+	case CpuTierSSE4:
+	case CpuTierSSE2:
+		return Utf16AsciiSSE2(data, maxChars, buffer);
+	default:
+		break;
+	}
+#endif
+	return Utf16AsciiScalar(data, 0, maxChars, buffer);
+}
+
+void	HexEncode(const uint8_t* data, size_t dataLen, char* buffer)
+{
+#ifdef HAVE_X86_KERNELS
+	switch ( CpuActiveTier() )
+	{
+	case CpuTierAVX512:
+	case CpuTierAVX2:
+		HexAVX2(data, dataLen, buffer);
+		return;
+	case CpuTierSSE4:
+		HexSSSE3(data, dataLen, buffer);
+		return;
+	default:
+		break;
+	}
+#endif
+	HexScalar(data, 0, dataLen, buffer);
+}
+
+const char*	Utf16Implementation(void)
+{
+#ifdef HAVE_X86_KERNELS
+	switch ( CpuActiveTier() )
+	{
+	case CpuTierAVX512:
+		return "avx512bw";
+	case CpuTierAVX2:
+		return "avx2";
+	case CpuTierSSE4:
+	case CpuTierSSE2:
+		return "sse2";
+	default:
+		break;
+	}
+#endif
+	return "scalar";
+}
+
+const char*	HexImplementation(void)
+{
+#ifdef HAVE_X86_KERNELS
+	switch ( CpuActiveTier() )
+	{
+	case CpuTierAVX512:
+	case CpuTierAVX2:
+		return "avx2";
+	case CpuTierSSE4:
+		return "ssse3";
+	default:
+		break;
+	}
+#endif
+	return "scalar";
+}
@@ -0,0 +1,29 @@
+/*
+ * =====================================================================================
+ *       Filename:  text_kernels.h
+ *    Description:  UTF-16 and hex conversions of the value formatters, in a
+ *                  version for every CPU tier (libevtxparse)
+ *
+ *                  Most strings of a log are ASCII: Utf16AsciiPrefix() narrows
+ *                  them a vector at a time and leaves the first other character
+ *                  to UTF16ToUTF8().
+ * =====================================================================================
+ */
+
+#ifndef text_kernels_h_included
+#define text_kernels_h_included
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*  Copies the leading characters 0x01..0x7F of UTF-16LE data, up to maxChars,
+ *  to buffer as bytes; returns how many, the first other character stops it */
+size_t	Utf16AsciiPrefix(const uint8_t* data, size_t maxChars, char* buffer);
+/*  Two upper case digits per byte, not terminated */
+void	HexEncode(const uint8_t* data, size_t dataLen, char* buffer);
+
+/*  The versions the active tier runs: "scalar", "sse2", "ssse3", "avx2", "avx512bw" */
+const char*	Utf16Implementation(void);
+const char*	HexImplementation(void);
+
+#endif
@@ -0,0 +1,329 @@
+/*
+ * =====================================================================================
+ *       Filename:  threshold_windows.cpp
+ *    Description:  Sliding window threshold detections with bounded memory
+ *
+ *                  The window is split into time buckets kept in a ring.  Each bucket
+ *                  holds a count-min sketch of per key counters and, for distinct
+ *                  counting, a Bloom filter of the (key, value) pairs already counted.
+ *                  Memory depends only on the sketch dimensions, never on the number
+ *                  of keys or records.  Estimates can only err upwards.
+ * =====================================================================================
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include "threshold_windows.h"
+#include "output_sink.h"
+
+#define WINDOW_BUCKETS		10
+#define SKETCH_DEPTH		4
+#define SKETCH_WIDTH		4096		/*  power of two */
+#define PAIR_FILTER_BITS	( 1 << 19 )	/*  power of two */
+#define PAIR_FILTER_HASHES	3
+#define MAX_KEY_FIELDS		4
+#define MAX_KEY_TEXT		1024
+#define FILETIME_TICKS_PER_SECOND	10000000ULL
+
+typedef struct
+{
+	uint64_t	bucketId;
+	uint32_t*	counters;	/*  SKETCH_DEPTH rows of SKETCH_WIDTH */
+	uint8_t*	pairFilter;	/*  NULL unless counting distinct values */
+}
+WindowBucket;
+
+struct sThresholdWindow
+{
+	char*		distinctField;
+	char*		keyFields[MAX_KEY_FIELDS];
+	size_t		numKeyFields;
+	uint64_t	limit;
+	uint64_t	bucketTicks;
+	WindowBucket	buckets[WINDOW_BUCKETS];
+};
+
+static uint64_t	HashText64(const char* str, uint64_t seed)
+{
+	uint64_t	hash	=	0xCBF29CE484222325ULL ^ seed;
+
+	for (; *str != 0; str++)
+	{
+		hash ^= (uint8_t)*str;
+		hash *= 0x100000001B3ULL;
+	}
+	hash ^= hash >> 33;
+	hash *= 0xFF51AFD7ED558CCDULL;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+static const char*	SkipSpaces(const char* ptr)
+{
+	while ( isspace((uint8_t)*ptr) )
+		ptr++;
+	return ptr;
+}
+
+static char*	CopyToken(const char* begin, const char* end)
+{
+	char*	token;
+
+	while ( begin < end && isspace((uint8_t)*begin) )
+		begin++;
+	while ( end > begin && isspace((uint8_t)end[-1]) )
+		end--;
+
+	token = (char*)malloc(end - begin + 1);
+	if ( token == NULL )
+		return NULL;
+	memcpy(token, begin, end - begin);
+	token[end - begin] = 0;
+	return token;
+}
+
+ThresholdWindow*	ThresholdParse(const char* spec)
+{
+	ThresholdWindow*	window	=	(ThresholdWindow*)calloc(1, sizeof(ThresholdWindow));
+	const char*		ptr	=	SkipSpaces(spec);
+	const char*		end;
+	char*			endPtr;
+	uint64_t		seconds;
+
+	if ( window == NULL )
+		return NULL;
+
+	if ( strncmp(ptr, "count(", 6) )
+		goto fail;
+	ptr += 6;
+	end = strchr(ptr, ')');
+	if ( end == NULL )
+		goto fail;
+	window->distinctField = CopyToken(ptr, end);
+	if ( window->distinctField == NULL )
+		goto fail;
+	if ( window->distinctField[0] == 0 )
+	{
+		free(window->distinctField);
+		window->distinctField = NULL;
+	}
+
+	ptr = SkipSpaces(end + 1);
+	if ( strncmp(ptr, "by", 2) || !isspace((uint8_t)ptr[2]) )
+		goto fail;
+	ptr += 2;
+	end = strchr(ptr, '>');
+	if ( end == NULL )
+		goto fail;
+	while ( ptr < end )
+	{
+		const char*	comma	=	(const char*)memchr(ptr, ',', end - ptr);
+		const char*	fieldEnd	=	( comma != NULL ) ? comma : end;
+
+		if ( window->numKeyFields >= MAX_KEY_FIELDS )
+			goto fail;
+		window->keyFields[window->numKeyFields] = CopyToken(ptr, fieldEnd);
+		if ( window->keyFields[window->numKeyFields] == NULL || window->keyFields[window->numKeyFields][0] == 0 )
+			goto fail;
+		window->numKeyFields++;
+		ptr = ( comma != NULL ) ? comma + 1 : end;
+	}
+	if ( window->numKeyFields == 0 )
+		goto fail;
+
+	ptr = end + 1;
+	if ( *ptr == '=' )
+	{
+		ptr++;
+		window->limit = strtoull(ptr, &endPtr, 10);
+		if ( window->limit == 0 )
+			goto fail;
+		window->limit--;
+	}
+	else
+	{
+		window->limit = strtoull(ptr, &endPtr, 10);
+	}
+	if ( endPtr == ptr )
+		goto fail;
+
+	ptr = SkipSpaces(endPtr);
+	if ( strncmp(ptr, "within", 6) )
+		goto fail;
+	ptr += 6;
+	seconds = strtoull(ptr, &endPtr, 10);
+	if ( endPtr == ptr || seconds == 0 )
+		goto fail;
+	switch(*endPtr)
+	{
+	case 'h':	seconds *= 3600;	break;
+	case 'm':	seconds *= 60;		break;
+	default:				break;
+	}
+
+	window->bucketTicks = ( seconds * FILETIME_TICKS_PER_SECOND + WINDOW_BUCKETS - 1 ) / WINDOW_BUCKETS;
+
+	for (size_t idx = 0; idx < WINDOW_BUCKETS; idx++)
+	{
+		WindowBucket*	bucket	=	&window->buckets[idx];
+
+		bucket->counters = (uint32_t*)calloc(SKETCH_DEPTH * SKETCH_WIDTH, sizeof(*bucket->counters));
+		if ( bucket->counters == NULL )
+			goto fail;
+		if ( window->distinctField != NULL )
+		{
+			bucket->pairFilter = (uint8_t*)calloc(PAIR_FILTER_BITS / 8, 1);
+			if ( bucket->pairFilter == NULL )
+				goto fail;
+		}
+	}
+
+	return window;
+
+fail:
+	printf("Bad aggregation: %s\n", spec);
+	ThresholdFree(window);
+	return NULL;
+}
+
+void	ThresholdFree(ThresholdWindow* window)
+{
+	if ( window == NULL )
+		return;
+
+	free(window->distinctField);
+	for (size_t idx = 0; idx < window->numKeyFields; idx++)
+		free(window->keyFields[idx]);
+	for (size_t idx = 0; idx < WINDOW_BUCKETS; idx++)
+	{
+		free(window->buckets[idx].counters);
+		free(window->buckets[idx].pairFilter);
+	}
+	free(window);
+}
+
+static bool	InWindow(const WindowBucket* bucket, uint64_t bucketId)
+{
+	return ( bucket->bucketId <= bucketId && bucket->bucketId + WINDOW_BUCKETS > bucketId );
+}
+
+static uint64_t	EstimateCount(const ThresholdWindow* window, uint64_t keyHash, uint64_t bucketId)
+{
+	uint64_t	estimate	=	(uint64_t)-1;
+	uint32_t	h1		=	(uint32_t)keyHash;
+	uint32_t	h2		=	(uint32_t)( keyHash >> 32 ) | 1;
+
+	for (uint32_t row = 0; row < SKETCH_DEPTH; row++)
+	{
+		size_t		column	=	( h1 + row * h2 ) & ( SKETCH_WIDTH - 1 );
+		uint64_t	sum	=	0;
+
+		for (size_t idx = 0; idx < WINDOW_BUCKETS; idx++)
+		{
+			const WindowBucket*	bucket	=	&window->buckets[idx];
+			if ( InWindow(bucket, bucketId) )
+				sum += bucket->counters[row * SKETCH_WIDTH + column];
+		}
+		if ( sum < estimate )
+			estimate = sum;
+	}
+	return estimate;
+}
+
+static void	IncrementCount(WindowBucket* bucket, uint64_t keyHash)
+{
+	uint32_t	h1	=	(uint32_t)keyHash;
+	uint32_t	h2	=	(uint32_t)( keyHash >> 32 ) | 1;
+
+	for (uint32_t row = 0; row < SKETCH_DEPTH; row++)
+		bucket->counters[row * SKETCH_WIDTH + ( ( h1 + row * h2 ) & ( SKETCH_WIDTH - 1 ) )]++;
+}
+
+static bool	PairSeen(const uint8_t* filter, uint64_t pairHash)
+{
+	uint32_t	h1	=	(uint32_t)pairHash;
+	uint32_t	h2	=	(uint32_t)( pairHash >> 32 ) | 1;
+
+	for (uint32_t idx = 0; idx < PAIR_FILTER_HASHES; idx++)
+	{
+		uint32_t	bit	=	( h1 + idx * h2 ) & ( PAIR_FILTER_BITS - 1 );
+		if ( !( filter[bit / 8] & ( 1 << ( bit % 8 ) ) ) )
+			return false;
+	}
+	return true;
+}
+
+static void	PairAdd(uint8_t* filter, uint64_t pairHash)
+{
+	uint32_t	h1	=	(uint32_t)pairHash;
+	uint32_t	h2	=	(uint32_t)( pairHash >> 32 ) | 1;
+
+	for (uint32_t idx = 0; idx < PAIR_FILTER_HASHES; idx++)
+	{
+		uint32_t	bit	=	( h1 + idx * h2 ) & ( PAIR_FILTER_BITS - 1 );
+		filter[bit / 8] |= ( 1 << ( bit % 8 ) );
+	}
+}
+
+void	ThresholdOnRecord(ThresholdWindow* window, const char* ruleId, const EvtxRecord* record)
+{
+	char		keyText[MAX_KEY_TEXT];
+	char		value[MAX_KEY_TEXT];
+	size_t		keyUsed		=	0;
+	uint64_t	bucketId	=	record->timestamp / window->bucketTicks;
+	WindowBucket*	bucket		=	&window->buckets[bucketId % WINDOW_BUCKETS];
+	uint64_t	keyHash;
+	uint64_t	before;
+	uint64_t	after;
+	char		timeBuffer[32];
+
+	if ( bucket->bucketId != bucketId )
+	{
+		if ( bucket->bucketId > bucketId )
+			return;		/*  older than the window, the slot was already reused */
+		bucket->bucketId = bucketId;
+		memset(bucket->counters, 0, SKETCH_DEPTH * SKETCH_WIDTH * sizeof(*bucket->counters));
+		if ( bucket->pairFilter != NULL )
+			memset(bucket->pairFilter, 0, PAIR_FILTER_BITS / 8);
+	}
+
+	for (size_t idx = 0; idx < window->numKeyFields; idx++)
+	{
+		if ( !FormatFieldValue(FindRecordField(record, window->keyFields[idx]), value, sizeof(value)) )
+			strcpy(value, "-");
+		keyUsed += snprintf(keyText + keyUsed, sizeof(keyText) - keyUsed, "%s'%s':'%s'",
+				idx == 0 ? "" : ", ", window->keyFields[idx], value);
+		if ( keyUsed >= sizeof(keyText) )
+			keyUsed = sizeof(keyText) - 1;
+	}
+	keyHash = HashText64(keyText, 0);
+
+	if ( window->distinctField != NULL )
+	{
+		uint64_t	pairHash;
+
+		if ( !FormatFieldValue(FindRecordField(record, window->distinctField), value, sizeof(value)) )
+			return;
+		pairHash = HashText64(value, keyHash);
+		for (size_t idx = 0; idx < WINDOW_BUCKETS; idx++)
+		{
+			if ( InWindow(&window->buckets[idx], bucketId) && PairSeen(window->buckets[idx].pairFilter, pairHash) )
+				return;
+		}
+		PairAdd(bucket->pairFilter, pairHash);
+	}
+
+	before = EstimateCount(window, keyHash, bucketId);
+	IncrementCount(bucket, keyHash);
+	after = EstimateCount(window, keyHash, bucketId);
+
+	/*  report the crossing only, not every record above the limit */
+	if ( before <= window->limit && after > window->limit )
+	{
+		FormatFileTime(record->timestamp, timeBuffer, sizeof(timeBuffer));
+		SinkPrintf("Record #%" PRIu64 " %s 'Rule':'%s', %s, 'Count':%" PRIu64 "\n",
+				record->number, timeBuffer, ruleId, keyText, after);
+		SinkEndRecord();
+	}
+}
@@ -0,0 +1,27 @@
+/*
+ * =====================================================================================
+ *       Filename:  threshold_windows.h
+ *    Description:  Sliding window threshold detections with bounded memory
+ *
+ *                  Aggregation spec, appended to a rule line after '|':
+ *
+ *                      count([<distinct field>]) by <field>[,<field>...] > <N> within <T>[s|m|h]
+ *
+ *                  count() counts matching records per key, count(field) counts
+ *                  distinct values of the field per key.
+ * =====================================================================================
+ */
+
+#ifndef threshold_windows_h_included
+#define threshold_windows_h_included
+
+#include "evtx_record.h"
+
+typedef struct sThresholdWindow ThresholdWindow;
+
+ThresholdWindow*	ThresholdParse(const char* spec);
+void			ThresholdFree(ThresholdWindow* window);
+/*  Counts a matching record and prints an alert when the key crosses the limit */
+void			ThresholdOnRecord(ThresholdWindow* window, const char* ruleId, const EvtxRecord* record);
+
+#endif
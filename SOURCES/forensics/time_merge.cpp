@@ -0,0 +1,166 @@
+/*
+ * =====================================================================================
+ *       Filename:  time_merge.cpp
+ *    Description:  K-way merge of several record streams by timestamp
+ *
+ *                  Each source is a cursor holding its current decoded chunk and a
+ *                  small min-heap of pending records (the reorder buffer).  Cursors
+ *                  sit in a second heap keyed by their earliest pending record.
+ *                  Memory is proportional to the number of sources only.
+ * =====================================================================================
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "time_merge.h"
+#include "output_sink.h"
+#include "binary_heap.h"
+
+typedef struct
+{
+	uint64_t	timestamp;
+	uint64_t	number;
+	char*		text;
+	size_t		textLen;
+}
+PendingRecord;
+
+typedef struct
+{
+	void*		source;
+	size_t		sourceIdx;
+	RecordBatch	batch;
+	size_t		nextInBatch;
+	bool		exhausted;
+	PendingRecord*	pending;	/*  min-heap */
+	size_t		numPending;
+}
+MergeCursor;
+
+static bool	PendingLess(const PendingRecord& a, const PendingRecord& b)
+{
+	if ( a.timestamp != b.timestamp )
+		return ( a.timestamp < b.timestamp );
+	return ( a.number < b.number );
+}
+
+static bool	CursorLess(const MergeCursor* a, const MergeCursor* b)
+{
+	if ( PendingLess(a->pending[0], b->pending[0]) )
+		return true;
+	if ( PendingLess(b->pending[0], a->pending[0]) )
+		return false;
+	return ( a->sourceIdx < b->sourceIdx );
+}
+
+/*  Tops the reorder buffer up to reorderWindow records */
+static bool	FillCursor(MergeCursor* cursor, DecodeChunkFunc decodeChunk, size_t reorderWindow)
+{
+	while ( cursor->numPending < reorderWindow )
+	{
+		const BatchRecord*	record;
+		PendingRecord		item;
+
+		if ( cursor->nextInBatch >= cursor->batch.numRecords )
+		{
+			if ( cursor->exhausted )
+				break;
+			ClearBatch(&cursor->batch);
+			cursor->nextInBatch = 0;
+			/*  records decoded before a failure are still merged */
+			if ( !decodeChunk(cursor->source, &cursor->batch, &cursor->exhausted) )
+				cursor->exhausted = true;
+			continue;
+		}
+
+		record = &cursor->batch.records[cursor->nextInBatch++];
+		item.timestamp = record->timestamp;
+		item.number = record->number;
+		item.textLen = record->textLen;
+		item.text = (char*)malloc(record->textLen + 1);
+		if ( item.text == NULL )
+			return false;
+		memcpy(item.text, cursor->batch.text + record->textOffset, record->textLen);
+		HeapPush(cursor->pending, &cursor->numPending, item, PendingLess);
+	}
+
+	/*  the decoded chunk is no longer needed once the source is drained */
+	if ( cursor->exhausted && cursor->nextInBatch >= cursor->batch.numRecords )
+		FreeBatch(&cursor->batch);
+
+	return true;
+}
+
+bool	WriteRecordToStdout(void* context, uint64_t timestamp, uint64_t number, const char* text, size_t textLen)
+{
+	SinkWriteRecord(text, textLen);
+	return true;
+}
+
+bool	MergeByTime(void** sources, size_t numSources, DecodeChunkFunc decodeChunk, size_t reorderWindow,
+			WriteRecordFunc writeRecord, void* writeContext)
+{
+	MergeCursor*	cursors;
+	MergeCursor**	heap;
+	size_t		heapCount	=	0;
+	bool		result		=	true;
+
+	if ( reorderWindow == 0 )
+		reorderWindow = 1;
+
+	cursors = (MergeCursor*)calloc(numSources, sizeof(*cursors));
+	heap = (MergeCursor**)malloc(sizeof(*heap) * ( numSources + 1 ));
+	if ( cursors == NULL || heap == NULL )
+	{
+		free(cursors);
+		free(heap);
+		return false;
+	}
+
+	for (size_t idx = 0; idx < numSources && result; idx++)
+	{
+		MergeCursor*	cursor	=	&cursors[idx];
+
+		cursor->source = sources[idx];
+		cursor->sourceIdx = idx;
+		InitBatch(&cursor->batch);
+		cursor->pending = (PendingRecord*)malloc(sizeof(*cursor->pending) * reorderWindow);
+		if ( cursor->pending == NULL || !FillCursor(cursor, decodeChunk, reorderWindow) )
+		{
+			result = false;
+			break;
+		}
+		if ( cursor->numPending > 0 )
+			HeapPush(heap, &heapCount, cursor, CursorLess);
+	}
+
+	while ( result && heapCount > 0 )
+	{
+		MergeCursor*	cursor	=	heap[0];
+		PendingRecord*	item	=	&cursor->pending[0];
+
+		if ( !writeRecord(writeContext, item->timestamp, item->number, item->text, item->textLen) )
+			result = false;
+		free(item->text);
+
+		HeapPop(heap, &heapCount, CursorLess);
+		HeapPop(cursor->pending, &cursor->numPending, PendingLess);
+
+		if ( !FillCursor(cursor, decodeChunk, reorderWindow) )
+			result = false;
+		if ( cursor->numPending > 0 )
+			HeapPush(heap, &heapCount, cursor, CursorLess);
+	}
+
+	for (size_t idx = 0; idx < numSources; idx++)
+	{
+		for (size_t pendingIdx = 0; cursors[idx].pending != NULL && pendingIdx < cursors[idx].numPending; pendingIdx++)
+			free(cursors[idx].pending[pendingIdx].text);
+		free(cursors[idx].pending);
+		FreeBatch(&cursors[idx].batch);
+	}
+	free(cursors);
+	free(heap);
+
+	return result;
+}
@@ -0,0 +1,29 @@
+/*
+ * =====================================================================================
+ *       Filename:  time_merge.h
+ *    Description:  K-way merge of several record streams by timestamp
+ * =====================================================================================
+ */
+
+#ifndef time_merge_h_included
+#define time_merge_h_included
+
+#include "record_batch.h"
+
+#define DEFAULT_REORDER_WINDOW	256
+
+/*  Appends the records of the next chunk of the source to batch.
+ *  Returns false on errors, sets *endOfSource once the source is exhausted. */
+typedef bool	(*DecodeChunkFunc)(void* source, RecordBatch* batch, bool* endOfSource);
+
+typedef bool	(*WriteRecordFunc)(void* context, uint64_t timestamp, uint64_t number, const char* text, size_t textLen);
+
+/*  Writes the formatted text to the output sink, stdout without one */
+bool	WriteRecordToStdout(void* context, uint64_t timestamp, uint64_t number, const char* text, size_t textLen);
+
+/*  Every source keeps one decoded chunk and up to reorderWindow pending
+ *  records, so locally unordered records are emitted in order. */
+bool	MergeByTime(void** sources, size_t numSources, DecodeChunkFunc decodeChunk, size_t reorderWindow,
+			WriteRecordFunc writeRecord, void* writeContext);
+
+#endif
@@ -0,0 +1,425 @@
+/*
+ * =====================================================================================
+ *       Filename:  time_sort.cpp
+ *    Description:  External sort of records by timestamp under a memory budget
+ *
+ *                  Records inside a chunk are already in time order, so a run is
+ *                  formed by merging the buffered chunks instead of sorting them.
+ *                  A run whose first record is not older than the end of the
+ *                  previous run is appended to it: a log that wrapped once yields
+ *                  just two runs, whatever its size.
+ *
+ *                  Only the run being written is open while spilling; the runs
+ *                  are opened again to be merged, at most fanIn at a time, so
+ *                  the descriptors needed do not grow with the input.  When the
+ *                  process runs out of them first, the fan-in is lowered to
+ *                  what could be opened and the merge goes on in more passes.
+ * =====================================================================================
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "time_sort.h"
+#include "temp_file.h"
+
+#define RUN_READ_BYTES	0x100000
+
+typedef struct
+{
+	FILE*		f;		/*  open while written or merged */
+	char*		fileName;
+	uint64_t	lastTimestamp;
+	uint64_t	lastNumber;
+}
+SortRun;
+
+typedef struct sTimeSort
+{
+	const char*	tempDir;
+	size_t		memoryBudget;
+	RecordBatch*	chunks;
+	size_t		numChunks;
+	size_t		maxChunks;
+	size_t		memoryUsed;
+	SortRun*	runs;
+	size_t		numRuns;
+	size_t		maxRuns;
+	size_t		nextSerial;
+	size_t		fanIn;
+	bool		failed;		/*  a spill failed, the output would be short */
+}
+SortState;
+
+static bool	RecordLess(const BatchRecord* a, const BatchRecord* b)
+{
+	if ( a->timestamp != b->timestamp )
+		return ( a->timestamp < b->timestamp );
+	return ( a->number < b->number );
+}
+
+static int	CompareBatchRecords(const void* a, const void* b)
+{
+	if ( RecordLess((const BatchRecord*)a, (const BatchRecord*)b) )
+		return -1;
+	if ( RecordLess((const BatchRecord*)b, (const BatchRecord*)a) )
+		return 1;
+	return 0;
+}
+
+/*  Chunks are normally ordered already, this is only a safety net */
+static void	SortBatch(RecordBatch* batch)
+{
+	for (size_t idx = 1; idx < batch->numRecords; idx++)
+	{
+		if ( RecordLess(&batch->records[idx], &batch->records[idx - 1]) )
+		{
+			qsort(batch->records, batch->numRecords, sizeof(*batch->records), CompareBatchRecords);
+			return;
+		}
+	}
+}
+
+static size_t	BatchMemory(const RecordBatch* batch)
+{
+	return batch->textSize + batch->maxRecords * sizeof(*batch->records);
+}
+
+static bool	DecodeBufferedChunk(void* source, RecordBatch* batch, bool* endOfSource)
+{
+	RecordBatch*	buffered	=	(RecordBatch*)source;
+
+	/*  hand the buffered chunk over to the merge cursor */
+	FreeBatch(batch);
+	*batch = *buffered;
+	InitBatch(buffered);
+	*endOfSource = true;
+	return true;
+}
+
+static bool	WriteRunRecord(void* context, uint64_t timestamp, uint64_t number, const char* text, size_t textLen)
+{
+	SortRun*	run	=	(SortRun*)context;
+	uint32_t	len	=	(uint32_t)textLen;
+
+	run->lastTimestamp = timestamp;
+	run->lastNumber = number;
+
+	return ( fwrite(&timestamp, sizeof(timestamp), 1, run->f) == 1 &&
+		fwrite(&number, sizeof(number), 1, run->f) == 1 &&
+		fwrite(&len, sizeof(len), 1, run->f) == 1 &&
+		fwrite(text, 1, len, run->f) == len );
+}
+
+static bool	DecodeRun(void* source, RecordBatch* batch, bool* endOfSource)
+{
+	SortRun*	run	=	(SortRun*)source;
+
+	while ( batch->textUsed < RUN_READ_BYTES )
+	{
+		uint64_t	timestamp;
+		uint64_t	number;
+		uint32_t	len;
+
+		if ( fread(&timestamp, sizeof(timestamp), 1, run->f) != 1 )
+		{
+			*endOfSource = true;
+			break;
+		}
+		if ( fread(&number, sizeof(number), 1, run->f) != 1 ||
+			fread(&len, sizeof(len), 1, run->f) != 1 )
+		{
+			return false;
+		}
+		if ( !BatchBeginRecord(batch, number, timestamp) || !ReserveBatchText(batch, len) )
+			return false;
+		if ( fread(batch->text + batch->textUsed, 1, len, run->f) != len )
+			return false;
+		batch->textUsed += len;
+		BatchEndRecord(batch);
+	}
+
+	return true;
+}
+
+static bool	MergeChunks(SortState* state, WriteRecordFunc writeRecord, void* writeContext)
+{
+	void**	sources	=	(void**)malloc(sizeof(*sources) * ( state->numChunks + 1 ));
+	bool	result;
+
+	if ( sources == NULL )
+		return false;
+	for (size_t idx = 0; idx < state->numChunks; idx++)
+		sources[idx] = &state->chunks[idx];
+
+	result = MergeByTime(sources, state->numChunks, DecodeBufferedChunk, 1, writeRecord, writeContext);
+
+	for (size_t idx = 0; idx < state->numChunks; idx++)
+		FreeBatch(&state->chunks[idx]);
+	state->numChunks = 0;
+	state->memoryUsed = 0;
+	free(sources);
+
+	return result;
+}
+
+static bool	GrowRuns(SortState* state)
+{
+	if ( state->numRuns >= state->maxRuns )
+	{
+		size_t		newMax	=	state->maxRuns == 0 ? 16 : state->maxRuns * 2;
+		SortRun*	newRuns	=	(SortRun*)realloc(state->runs, sizeof(*newRuns) * newMax);
+		if ( newRuns == NULL )
+			return false;
+		state->runs = newRuns;
+		state->maxRuns = newMax;
+	}
+	return true;
+}
+
+static bool	CreateRun(SortState* state, SortRun* run)
+{
+	memset(run, 0, sizeof(*run));
+	run->f = OpenTempFile(state->tempDir, "sort", state->nextSerial++, &run->fileName);
+	return ( run->f != NULL );
+}
+
+/*  Closes the run being written, false when it could not be written out */
+static bool	FinishRun(SortRun* run)
+{
+	if ( run->f == NULL )
+		return true;
+	if ( !FinishTempFile(&run->f) )
+	{
+		printf("Cannot write the temporary file %s\n", run->fileName);
+		return false;
+	}
+	return true;
+}
+
+static SortRun*	OpenRun(SortState* state)
+{
+	if ( !GrowRuns(state) )
+		return NULL;
+	if ( state->numRuns > 0 && !FinishRun(&state->runs[state->numRuns - 1]) )
+		return NULL;
+	if ( !CreateRun(state, &state->runs[state->numRuns]) )
+		return NULL;
+	return &state->runs[state->numRuns++];
+}
+
+static bool	SpillRun(SortState* state)
+{
+	SortRun*	run		=	NULL;
+	BatchRecord*	first		=	NULL;
+
+	for (size_t idx = 0; idx < state->numChunks; idx++)
+	{
+		if ( first == NULL || RecordLess(&state->chunks[idx].records[0], first) )
+			first = &state->chunks[idx].records[0];
+	}
+	if ( first == NULL )
+		return true;
+
+	if ( state->numRuns > 0 )
+	{
+		SortRun*	last	=	&state->runs[state->numRuns - 1];
+		BatchRecord	lastRecord;
+
+		lastRecord.timestamp = last->lastTimestamp;
+		lastRecord.number = last->lastNumber;
+		if ( !RecordLess(first, &lastRecord) )
+			run = last;
+	}
+	if ( run == NULL )
+		run = OpenRun(state);
+	if ( run == NULL )
+		return false;
+
+	return MergeChunks(state, WriteRunRecord, run);
+}
+
+static bool	AddChunk(SortState* state, void* source, DecodeChunkFunc decodeChunk, bool* endOfSource)
+{
+	RecordBatch*	batch;
+	bool		result;
+
+	if ( state->numChunks >= state->maxChunks )
+	{
+		size_t		newMax		=	state->maxChunks == 0 ? 64 : state->maxChunks * 2;
+		RecordBatch*	newChunks	=	(RecordBatch*)realloc(state->chunks, sizeof(*newChunks) * newMax);
+		if ( newChunks == NULL )
+		{
+			state->failed = true;
+			return false;
+		}
+		state->chunks = newChunks;
+		state->maxChunks = newMax;
+	}
+
+	batch = &state->chunks[state->numChunks];
+	InitBatch(batch);
+	result = decodeChunk(source, batch, endOfSource);
+	if ( !result )
+		*endOfSource = true;
+
+	if ( batch->numRecords == 0 )
+	{
+		FreeBatch(batch);
+		return result;
+	}
+
+	SortBatch(batch);
+	state->numChunks++;
+	state->memoryUsed += BatchMemory(batch);
+	return result;
+}
+
+/*  Opens the first count runs to be read; *numOpened tells how far it got */
+static bool	ReopenRuns(SortState* state, size_t count, size_t* numOpened)
+{
+	for (*numOpened = 0; *numOpened < count; (*numOpened)++)
+	{
+		SortRun*	run	=	&state->runs[*numOpened];
+
+		run->f = fopen(run->fileName, "rb");
+		if ( run->f == NULL )
+			return false;
+	}
+	return true;
+}
+
+static void	CloseRuns(SortState* state, size_t count)
+{
+	for (size_t idx = 0; idx < count; idx++)
+	{
+		if ( state->runs[idx].f != NULL )
+			fclose(state->runs[idx].f);
+		state->runs[idx].f = NULL;
+	}
+}
+
+/*  Merges the first count runs into writeRecord and drops them */
+static bool	MergePass(SortState* state, size_t count, WriteRecordFunc writeRecord, void* writeContext)
+{
+	void**	runSources	=	(void**)malloc(sizeof(*runSources) * count);
+	bool	result		=	( runSources != NULL );
+
+	for (size_t idx = 0; result && idx < count; idx++)
+		runSources[idx] = &state->runs[idx];
+	if ( result )
+		result = MergeByTime(runSources, count, DecodeRun, 1, writeRecord, writeContext);
+	free(runSources);
+
+	for (size_t idx = 0; idx < count; idx++)
+	{
+		CloseTempFile(state->runs[idx].f, state->runs[idx].fileName);
+		state->runs[idx].f = NULL;
+		state->runs[idx].fileName = NULL;
+	}
+	state->numRuns -= count;
+	memmove(state->runs, state->runs + count, sizeof(*state->runs) * state->numRuns);
+
+	return result;
+}
+
+/*  Merges the oldest runs into a new one until fanIn runs are left, then
+ *  those into the output */
+static bool	MergeRuns(SortState* state, WriteRecordFunc writeRecord, void* writeContext)
+{
+	while ( state->numRuns > 0 )
+	{
+		size_t		count		=	state->numRuns < state->fanIn ? state->numRuns : state->fanIn;
+		bool		lastPass	=	( count == state->numRuns );
+		SortRun		merged;
+		size_t		numOpened;
+
+		merged.f = NULL;
+		merged.fileName = NULL;
+		if ( !lastPass && !CreateRun(state, &merged) )
+			return false;
+
+		if ( !ReopenRuns(state, count, &numOpened) )
+		{
+			int	error	=	errno;
+
+			CloseRuns(state, numOpened);
+			CloseTempFile(merged.f, merged.fileName);
+			/*  out of descriptors: merge fewer runs at a time */
+			if ( ( error == EMFILE || error == ENFILE ) && numOpened >= 2 )
+			{
+				state->fanIn = numOpened < state->fanIn - 1 ? numOpened : state->fanIn - 1;
+				continue;
+			}
+			printf("Cannot open the temporary file %s: %s\n", state->runs[numOpened].fileName, strerror(error));
+			return false;
+		}
+
+		if ( lastPass )
+			return MergePass(state, count, writeRecord, writeContext);
+
+		if ( !MergePass(state, count, WriteRunRecord, &merged) || !FinishRun(&merged) || !GrowRuns(state) )
+		{
+			CloseTempFile(merged.f, merged.fileName);
+			return false;
+		}
+		state->runs[state->numRuns++] = merged;
+	}
+	return true;
+}
+
+struct sTimeSort*	TimeSortBegin(size_t memoryBudget, const char* tempDir)
+{
+	SortState*	state	=	(SortState*)calloc(1, sizeof(*state));
+
+	if ( state == NULL )
+		return NULL;
+	state->tempDir = tempDir;
+	state->memoryBudget = memoryBudget;
+	state->fanIn = SORT_MERGE_FANIN;
+	return state;
+}
+
+bool	TimeSortAdd(struct sTimeSort* state, void* source, DecodeChunkFunc decodeChunk)
+{
+	bool	endOfSource	=	false;
+	bool	result		=	true;
+
+	while ( !endOfSource && !state->failed )
+	{
+		if ( !AddChunk(state, source, decodeChunk, &endOfSource) )
+			result = false;
+		if ( state->memoryUsed > state->memoryBudget && !SpillRun(state) )
+			state->failed = true;
+	}
+	return ( result && !state->failed );
+}
+
+bool	TimeSortEnd(struct sTimeSort* state, WriteRecordFunc writeRecord, void* writeContext)
+{
+	bool	result	=	!state->failed;
+
+	if ( result )
+	{
+		if ( state->numRuns == 0 )
+		{
+			/*  everything fit in memory */
+			result = MergeChunks(state, writeRecord, writeContext);
+		}
+		else
+		{
+			result = ( SpillRun(state) && FinishRun(&state->runs[state->numRuns - 1]) &&
+				MergeRuns(state, writeRecord, writeContext) );
+		}
+	}
+
+	for (size_t idx = 0; idx < state->numChunks; idx++)
+		FreeBatch(&state->chunks[idx]);
+	for (size_t idx = 0; idx < state->numRuns; idx++)
+		CloseTempFile(state->runs[idx].f, state->runs[idx].fileName);
+	free(state->chunks);
+	free(state->runs);
+	free(state);
+
+	return result;
+}
@@ -0,0 +1,30 @@
+/*
+ * =====================================================================================
+ *       Filename:  time_sort.h
+ *    Description:  External sort of records by timestamp under a memory budget
+ * =====================================================================================
+ */
+
+#ifndef time_sort_h_included
+#define time_sort_h_included
+
+#include "time_merge.h"
+
+#define DEFAULT_SORT_MEMORY_MB	256
+#define SORT_MERGE_FANIN	64
+
+struct sTimeSort;
+
+/*  Starts a sort: sorted runs are spilled to temporary files in tempDir (or
+ *  the system temporary directory when NULL) whenever the decoded chunks held
+ *  in memory exceed memoryBudget bytes.  NULL when out of memory. */
+struct sTimeSort*	TimeSortBegin(size_t memoryBudget, const char* tempDir);
+/*  Decodes the source to its end.  Returns false when it failed, the records
+ *  decoded before still count; a failed spill fails the sort as well. */
+bool	TimeSortAdd(struct sTimeSort* sort, void* source, DecodeChunkFunc decodeChunk);
+/*  Writes the records of all sources added in timestamp order and frees the
+ *  sort.  The runs are merged SORT_MERGE_FANIN at a time, in several passes
+ *  when there are more; false when a spill or a merge failed. */
+bool	TimeSortEnd(struct sTimeSort* sort, WriteRecordFunc writeRecord, void* writeContext);
+
+#endif
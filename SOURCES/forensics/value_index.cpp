@@ -0,0 +1,844 @@
+/*
+ * =====================================================================================
+ *       Filename:  value_index.cpp
+ *    Description:  Inverted (field, value) index with postings of record positions
+ *
+ *                  Postings (key hash, packed position) are collected in runs of
+ *                  VALUE_INDEX_RUN_POSTINGS.  A full run is handed to one of the
+ *                  sorter threads, which sorts it and spills it to a temporary
+ *                  file while the parser fills another buffer; there is one
+ *                  buffer more than sorters.  The spilled runs are closed and
+ *                  k-way merged, VALUE_INDEX_MERGE_FANIN at a time, into posting
+ *                  lists, each a sequence of LEB128 deltas.
+ * =====================================================================================
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <algorithm>
+#include "value_index.h"
+#include "chunk_index.h"
+#include "binary_heap.h"
+#include "mapped_file.h"
+#include "temp_file.h"
+
+#define MAX_VALUE_SIZE		1024
+#define POSITION_FILE_SHIFT	40
+#define RUN_READ_POSTINGS	0x1000
+
+typedef struct
+{
+	uint64_t	keyHash;
+	uint64_t	position;	/*  file index << POSITION_FILE_SHIFT | record offset */
+}
+RunPosting;
+
+typedef struct
+{
+	FILE*		f;		/*  open while written or merged */
+	char*		fileName;
+	uint64_t	numPostings;
+}
+PostingRun;
+
+typedef struct
+{
+	char*		name;
+	uint64_t	fileSize;
+}
+BuilderFile;
+
+typedef struct
+{
+	PostingRun*	run;
+	RunPosting*	buffer;
+	size_t		numBuffered;
+	size_t		nextBuffered;
+	uint64_t	numLeft;
+}
+RunReader;
+
+typedef bool	(*PostingFunc)(void* context, const RunPosting* posting);
+
+struct sValueIndex
+{
+	MappedFile			mapped;
+	const ValueIndexHeader*		header;
+	const ValueIndexFile*		files;
+	const char*			strings;
+	const uint8_t*			postings;
+	const ValueIndexKey*		keys;
+};
+
+static const char*	tempDir			=	NULL;
+static FILE*		builderIndex		=	NULL;
+static char*		builderIndexName	=	NULL;
+static BuilderFile*	builderFiles		=	NULL;
+static size_t		numBuilderFiles		=	0;
+static size_t		maxBuilderFiles		=	0;
+
+static RunPosting*	fillRun			=	NULL;
+static size_t		numFill			=	0;
+
+/*  shared with the sorter threads */
+static pthread_t	sorterThreads[VALUE_INDEX_MAX_SORTERS];
+static unsigned int	numSorters		=	0;
+static pthread_mutex_t	sorterLock		=	PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	sorterCond		=	PTHREAD_COND_INITIALIZER;
+static RunPosting*	sortRun			=	NULL;	/*  pending for a sorter */
+static size_t		numSort			=	0;
+static unsigned int	numSorting		=	0;
+static RunPosting*	spareRuns[VALUE_INDEX_MAX_SORTERS + 1];	/*  sorted and spilled, free for filling */
+static unsigned int	numSpareRuns		=	0;
+static unsigned int	numRunBuffers		=	0;
+static bool		stopSorter		=	false;
+static bool		sorterFailed		=	false;
+static size_t		nextRunSerial		=	0;
+static PostingRun*	runs			=	NULL;
+static size_t		numRuns			=	0;
+static size_t		maxRuns			=	0;
+
+static void	FreeBuilder(void);
+
+static bool	PostingLess(const RunPosting& a, const RunPosting& b)
+{
+	if ( a.keyHash != b.keyHash )
+		return ( a.keyHash < b.keyHash );
+	return ( a.position < b.position );
+}
+
+static uint8_t	FoldByte(uint8_t c)
+{
+	if ( c >= 'A' && c <= 'Z' )
+		return c + ( 'a' - 'A' );
+	return c;
+}
+
+static uint64_t	KeyHash(const char* field, const char* value)
+{
+	uint64_t	h	=	0xCBF29CE484222325ULL;
+
+	for (; *field != 0; field++)
+	{
+		h ^= (uint8_t)*field;
+		h *= 0x100000001B3ULL;
+	}
+	h ^= '=';
+	h *= 0x100000001B3ULL;
+	for (; *value != 0; value++)
+	{
+		h ^= FoldByte((uint8_t)*value);
+		h *= 0x100000001B3ULL;
+	}
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static bool	AddRun(const PostingRun* run)
+{
+	if ( numRuns >= maxRuns )
+	{
+		size_t		newMax	=	maxRuns == 0 ? 16 : maxRuns * 2;
+		PostingRun*	newRuns	=	(PostingRun*)realloc(runs, sizeof(*newRuns) * newMax);
+		if ( newRuns == NULL )
+			return false;
+		runs = newRuns;
+		maxRuns = newMax;
+	}
+	runs[numRuns++] = *run;
+	return true;
+}
+
+/*  Creates a run file named after serial, which the caller reserved */
+static bool	CreateRun(PostingRun* run, size_t serial)
+{
+	run->numPostings = 0;
+	run->f = OpenTempFile(tempDir, "postings", serial, &run->fileName);
+	return ( run->f != NULL );
+}
+
+/*  Closes the run once written, false when it could not be */
+static bool	FinishRun(PostingRun* run)
+{
+	if ( !FinishTempFile(&run->f) )
+	{
+		printf("Cannot write the temporary file %s\n", run->fileName);
+		return false;
+	}
+	return true;
+}
+
+/*  Sorts and spills on a sorter thread, the run is added under sorterLock */
+static bool	SpillRun(RunPosting* postings, size_t count, size_t serial)
+{
+	PostingRun	run;
+	bool		result;
+
+	std::sort(postings, postings + count, PostingLess);
+
+	if ( !CreateRun(&run, serial) )
+		return false;
+	run.numPostings = count;
+	result = ( fwrite(postings, sizeof(*postings), count, run.f) == count );
+	if ( !FinishRun(&run) )
+		result = false;
+
+	pthread_mutex_lock(&sorterLock);
+	if ( result )
+		result = AddRun(&run);
+	pthread_mutex_unlock(&sorterLock);
+	if ( !result )
+		CloseTempFile(NULL, run.fileName);
+	return result;
+}
+
+static void*	SorterThread(void* arg)
+{
+	pthread_mutex_lock(&sorterLock);
+	for (;;)
+	{
+		RunPosting*	postings;
+		size_t		count;
+		size_t		serial;
+		bool		result;
+
+		while ( sortRun == NULL && !stopSorter )
+			pthread_cond_wait(&sorterCond, &sorterLock);
+		if ( sortRun == NULL )
+			break;
+
+		postings = sortRun;
+		count = numSort;
+		serial = nextRunSerial++;
+		sortRun = NULL;
+		numSorting++;
+		pthread_cond_broadcast(&sorterCond);
+		pthread_mutex_unlock(&sorterLock);
+
+		result = SpillRun(postings, count, serial);
+
+		pthread_mutex_lock(&sorterLock);
+		if ( !result )
+			sorterFailed = true;
+		numSorting--;
+		spareRuns[numSpareRuns++] = postings;
+		pthread_cond_broadcast(&sorterCond);
+	}
+	pthread_mutex_unlock(&sorterLock);
+
+	return NULL;
+}
+
+/*  Passes the filled run to the sorters and takes a spare buffer, a new one
+ *  while there are fewer than one per sorter and one to fill */
+static bool	HandOverRun(void)
+{
+	pthread_mutex_lock(&sorterLock);
+	while ( sortRun != NULL )
+		pthread_cond_wait(&sorterCond, &sorterLock);
+	sortRun = fillRun;
+	numSort = numFill;
+	pthread_cond_broadcast(&sorterCond);
+	fillRun = NULL;
+	while ( numSpareRuns == 0 && numRunBuffers > numSorters )
+		pthread_cond_wait(&sorterCond, &sorterLock);
+	if ( numSpareRuns > 0 )
+		fillRun = spareRuns[--numSpareRuns];
+	pthread_mutex_unlock(&sorterLock);
+
+	numFill = 0;
+	if ( fillRun == NULL )
+	{
+		fillRun = (RunPosting*)malloc(sizeof(*fillRun) * VALUE_INDEX_RUN_POSTINGS);
+		if ( fillRun != NULL )
+			numRunBuffers++;
+	}
+	return ( fillRun != NULL );
+}
+
+bool	ValueIndexBuildBegin(const char* indexName, const char* directory, unsigned int sorters)
+{
+	tempDir = directory;
+	builderIndex = fopen(indexName, "wb");
+	if ( builderIndex == NULL )
+	{
+		printf("Cannot create %s\n", indexName);
+		return false;
+	}
+	builderIndexName = strdup(indexName);
+	fillRun = (RunPosting*)malloc(sizeof(*fillRun) * VALUE_INDEX_RUN_POSTINGS);
+	if ( fillRun == NULL || builderIndexName == NULL )
+	{
+		FreeBuilder();
+		return false;
+	}
+	numRunBuffers = 1;
+	stopSorter = false;
+	sorterFailed = false;
+	nextRunSerial = 0;
+	if ( sorters == 0 )
+		sorters = 1;
+	if ( sorters > VALUE_INDEX_MAX_SORTERS )
+		sorters = VALUE_INDEX_MAX_SORTERS;
+	for (numSorters = 0; numSorters < sorters; numSorters++)
+	{
+		if ( pthread_create(&sorterThreads[numSorters], NULL, SorterThread, NULL) != 0 )
+			break;
+	}
+	if ( numSorters == 0 )
+	{
+		FreeBuilder();
+		return false;
+	}
+	return true;
+}
+
+bool	ValueIndexBeginFile(const char* fileName, uint64_t fileSize)
+{
+	BuilderFile*	file;
+
+	if ( numBuilderFiles >= maxBuilderFiles )
+	{
+		size_t		newMax		=	maxBuilderFiles == 0 ? 64 : maxBuilderFiles * 2;
+		BuilderFile*	newFiles	=	(BuilderFile*)realloc(builderFiles, sizeof(*newFiles) * newMax);
+		if ( newFiles == NULL )
+			return false;
+		builderFiles = newFiles;
+		maxBuilderFiles = newMax;
+	}
+
+	file = &builderFiles[numBuilderFiles];
+	file->name = strdup(fileName);
+	if ( file->name == NULL )
+		return false;
+	file->fileSize = fileSize;
+	numBuilderFiles++;
+	return true;
+}
+
+void	ValueIndexAddRecord(const EvtxRecord* record, uint64_t recordOffset)
+{
+	char		value[MAX_VALUE_SIZE];
+	uint64_t	position;
+
+	if ( fillRun == NULL || numBuilderFiles == 0 )
+		return;
+	position = ( (uint64_t)( numBuilderFiles - 1 ) << POSITION_FILE_SHIFT ) | recordOffset;
+
+	for (size_t idx = 0; idx < record->numFields; idx++)
+	{
+		const EvtxField*	field	=	&record->fields[idx];
+
+		if ( !ChunkIndexIsIndexedField(field->key) )
+			continue;
+		if ( !FormatFieldValue(field, value, sizeof(value)) || value[0] == 0 )
+			continue;
+
+		fillRun[numFill].keyHash = KeyHash(field->key, value);
+		fillRun[numFill].position = position;
+		if ( ++numFill == VALUE_INDEX_RUN_POSTINGS && !HandOverRun() )
+			return;
+	}
+}
+
+static bool	WriteVarint(FILE* f, uint64_t v, uint64_t* size)
+{
+	uint8_t		bytes[10];
+	size_t		numBytes	=	0;
+
+	do
+	{
+		bytes[numBytes] = (uint8_t)( v & 0x7F );
+		v >>= 7;
+		if ( v != 0 )
+			bytes[numBytes] |= 0x80;
+		numBytes++;
+	}
+	while ( v != 0 );
+
+	*size += numBytes;
+	return ( fwrite(bytes, 1, numBytes, f) == numBytes );
+}
+
+static bool	ReaderLess(const RunReader* a, const RunReader* b)
+{
+	return PostingLess(a->buffer[a->nextBuffered], b->buffer[b->nextBuffered]);
+}
+
+static bool	FillReader(RunReader* reader)
+{
+	size_t	count	=	reader->numLeft < RUN_READ_POSTINGS ? (size_t)reader->numLeft : RUN_READ_POSTINGS;
+
+	reader->nextBuffered = 0;
+	reader->numBuffered = fread(reader->buffer, sizeof(*reader->buffer), count, reader->run->f);
+	reader->numLeft -= count;
+	return ( reader->numBuffered == count );
+}
+
+/*  K-way merges the first count runs, which are open, into onPosting */
+static bool	MergeOpenRuns(size_t count, PostingFunc onPosting, void* context)
+{
+	RunReader*	readers	=	(RunReader*)calloc(count, sizeof(*readers));
+	RunReader**	heap	=	(RunReader**)malloc(sizeof(*heap) * ( count + 1 ));
+	size_t		heapCount	=	0;
+	bool		result		=	( readers != NULL && heap != NULL );
+
+	for (size_t idx = 0; result && idx < count; idx++)
+	{
+		readers[idx].run = &runs[idx];
+		readers[idx].numLeft = runs[idx].numPostings;
+		readers[idx].buffer = (RunPosting*)malloc(sizeof(RunPosting) * RUN_READ_POSTINGS);
+		result = ( readers[idx].buffer != NULL && FillReader(&readers[idx]) );
+		if ( result && readers[idx].numBuffered > 0 )
+			HeapPush(heap, &heapCount, &readers[idx], ReaderLess);
+	}
+
+	while ( result && heapCount > 0 )
+	{
+		RunReader*	reader	=	heap[0];
+
+		result = onPosting(context, &reader->buffer[reader->nextBuffered]);
+
+		HeapPop(heap, &heapCount, ReaderLess);
+		if ( ++reader->nextBuffered >= reader->numBuffered )
+		{
+			if ( reader->numLeft > 0 && !FillReader(reader) )
+				result = false;
+		}
+		if ( reader->nextBuffered < reader->numBuffered )
+			HeapPush(heap, &heapCount, reader, ReaderLess);
+	}
+
+	for (size_t idx = 0; readers != NULL && idx < count; idx++)
+		free(readers[idx].buffer);
+	free(readers);
+	free(heap);
+
+	return result;
+}
+
+/*  Opens the first count runs to be read; *numOpened tells how far it got */
+static bool	ReopenRuns(size_t count, size_t* numOpened)
+{
+	for (*numOpened = 0; *numOpened < count; (*numOpened)++)
+	{
+		runs[*numOpened].f = fopen(runs[*numOpened].fileName, "rb");
+		if ( runs[*numOpened].f == NULL )
+			return false;
+	}
+	return true;
+}
+
+/*  Removes the first count runs */
+static void	DropRuns(size_t count)
+{
+	for (size_t idx = 0; idx < count; idx++)
+		CloseTempFile(runs[idx].f, runs[idx].fileName);
+	numRuns -= count;
+	memmove(runs, runs + count, sizeof(*runs) * numRuns);
+}
+
+static bool	WriteRunPosting(void* context, const RunPosting* posting)
+{
+	PostingRun*	run	=	(PostingRun*)context;
+
+	run->numPostings++;
+	return ( fwrite(posting, sizeof(*posting), 1, run->f) == 1 );
+}
+
+typedef struct
+{
+	FILE*		f;
+	uint64_t*	postingsSize;
+	ValueIndexKey**	keys;
+	uint64_t*	numKeys;
+	size_t		maxKeys;
+	ValueIndexKey*	key;
+	uint64_t	lastPosition;
+}
+PostingListWriter;
+
+static bool	WritePostingList(void* context, const RunPosting* posting)
+{
+	PostingListWriter*	writer	=	(PostingListWriter*)context;
+	ValueIndexKey*		key	=	writer->key;
+
+	if ( key == NULL || key->keyHash != posting->keyHash )
+	{
+		if ( *writer->numKeys >= writer->maxKeys )
+		{
+			size_t		newMax	=	writer->maxKeys == 0 ? 0x10000 : writer->maxKeys * 2;
+			ValueIndexKey*	newKeys	=	(ValueIndexKey*)realloc(*writer->keys, sizeof(*newKeys) * newMax);
+			if ( newKeys == NULL )
+				return false;
+			*writer->keys = newKeys;
+			writer->maxKeys = newMax;
+		}
+		key = writer->key = &(*writer->keys)[(*writer->numKeys)++];
+		key->keyHash = posting->keyHash;
+		key->postingsOffset = *writer->postingsSize;
+		key->numPostings = 0;
+		key->postingsSize = 0;
+		writer->lastPosition = 0;
+	}
+	/*  the same value twice in a record gives one posting */
+	if ( key->numPostings == 0 || posting->position != writer->lastPosition )
+	{
+		if ( !WriteVarint(writer->f, posting->position - writer->lastPosition, &key->postingsSize) )
+			return false;
+		*writer->postingsSize = key->postingsOffset + key->postingsSize;
+		writer->lastPosition = posting->position;
+		key->numPostings++;
+	}
+	return true;
+}
+
+/*  Merges the sorted runs into posting lists, collecting the key table.
+ *  The oldest runs are merged into a new one until fanIn runs are left;
+ *  the fan-in drops to what could be opened when descriptors run out. */
+static bool	MergeRuns(FILE* f, uint64_t* postingsSize, ValueIndexKey** keys, uint64_t* numKeys)
+{
+	PostingListWriter	writer;
+	size_t			fanIn	=	VALUE_INDEX_MERGE_FANIN;
+
+	*postingsSize = 0;
+	*numKeys = 0;
+	*keys = NULL;
+	memset(&writer, 0, sizeof(writer));
+	writer.f = f;
+	writer.postingsSize = postingsSize;
+	writer.keys = keys;
+	writer.numKeys = numKeys;
+
+	while ( numRuns > 0 )
+	{
+		size_t		count		=	numRuns < fanIn ? numRuns : fanIn;
+		bool		lastPass	=	( count == numRuns );
+		PostingRun	merged;
+		size_t		numOpened;
+		bool		result;
+
+		merged.f = NULL;
+		merged.fileName = NULL;
+		if ( !lastPass && !CreateRun(&merged, nextRunSerial++) )
+			return false;
+
+		if ( !ReopenRuns(count, &numOpened) )
+		{
+			int	error	=	errno;
+
+			for (size_t idx = 0; idx < numOpened; idx++)
+			{
+				fclose(runs[idx].f);
+				runs[idx].f = NULL;
+			}
+			CloseTempFile(merged.f, merged.fileName);
+			if ( ( error == EMFILE || error == ENFILE ) && numOpened >= 2 )
+			{
+				fanIn = numOpened < fanIn - 1 ? numOpened : fanIn - 1;
+				continue;
+			}
+			printf("Cannot open the temporary file %s: %s\n", runs[numOpened].fileName, strerror(error));
+			return false;
+		}
+
+		if ( lastPass )
+		{
+			result = MergeOpenRuns(count, WritePostingList, &writer);
+			DropRuns(count);
+			return result;
+		}
+
+		result = MergeOpenRuns(count, WriteRunPosting, &merged);
+		DropRuns(count);
+		if ( !result || !FinishRun(&merged) || !AddRun(&merged) )
+		{
+			CloseTempFile(merged.f, merged.fileName);
+			return false;
+		}
+	}
+	return true;
+}
+
+static void	FreeBuilder(void)
+{
+	if ( builderIndex != NULL )
+		fclose(builderIndex);
+	free(builderIndexName);
+	builderIndex = NULL;
+	builderIndexName = NULL;
+	if ( numSorters > 0 )
+	{
+		pthread_mutex_lock(&sorterLock);
+		stopSorter = true;
+		pthread_cond_broadcast(&sorterCond);
+		pthread_mutex_unlock(&sorterLock);
+		for (unsigned int idx = 0; idx < numSorters; idx++)
+			pthread_join(sorterThreads[idx], NULL);
+		numSorters = 0;
+	}
+	for (size_t idx = 0; idx < numRuns; idx++)
+		CloseTempFile(runs[idx].f, runs[idx].fileName);
+	for (size_t idx = 0; idx < numBuilderFiles; idx++)
+		free(builderFiles[idx].name);
+	free(runs);
+	free(builderFiles);
+	free(fillRun);
+	for (unsigned int idx = 0; idx < numSpareRuns; idx++)
+		free(spareRuns[idx]);
+	runs = NULL;
+	builderFiles = NULL;
+	fillRun = NULL;
+	numSpareRuns = 0;
+	numRunBuffers = 0;
+	numRuns = maxRuns = 0;
+	numBuilderFiles = maxBuilderFiles = 0;
+	numFill = 0;
+}
+
+bool	ValueIndexWrite(void)
+{
+	ValueIndexHeader	header;
+	ValueIndexKey*		keys		=	NULL;
+	FILE*			f		=	builderIndex;
+	bool			result;
+	uint64_t		stringsSize	=	0;
+	const char*		fields		=	ChunkIndexFields();
+
+	/*  the last partial run, then wait for the sorters to drain */
+	result = ( numFill == 0 || HandOverRun() );
+	pthread_mutex_lock(&sorterLock);
+	while ( sortRun != NULL || numSorting > 0 )
+		pthread_cond_wait(&sorterCond, &sorterLock);
+	if ( sorterFailed )
+		result = false;
+	pthread_mutex_unlock(&sorterLock);
+
+	if ( f == NULL )
+	{
+		FreeBuilder();
+		return false;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, VALUE_INDEX_MAGIC, sizeof(header.magic));
+	header.version = VALUE_INDEX_VERSION;
+	header.numFiles = (uint32_t)numBuilderFiles;
+	header.filesOffset = sizeof(header);
+	header.stringsOffset = header.filesOffset + sizeof(ValueIndexFile) * numBuilderFiles;
+	for (size_t idx = 0; idx < numBuilderFiles; idx++)
+		stringsSize += strlen(builderFiles[idx].name) + 1;
+	header.fieldsOffset = stringsSize;
+	header.stringsSize = stringsSize + strlen(fields) + 1;
+	header.postingsOffset = header.stringsOffset + header.stringsSize;
+
+	/*  the header is rewritten once the sizes are known */
+	if ( result )
+		result = ( fwrite(&header, sizeof(header), 1, f) == 1 );
+	stringsSize = 0;
+	for (size_t idx = 0; result && idx < numBuilderFiles; idx++)
+	{
+		ValueIndexFile	file;
+
+		file.nameOffset = stringsSize;
+		file.fileSize = builderFiles[idx].fileSize;
+		stringsSize += strlen(builderFiles[idx].name) + 1;
+		result = ( fwrite(&file, sizeof(file), 1, f) == 1 );
+	}
+	for (size_t idx = 0; result && idx < numBuilderFiles; idx++)
+		result = ( fwrite(builderFiles[idx].name, strlen(builderFiles[idx].name) + 1, 1, f) == 1 );
+	if ( result )
+		result = ( fwrite(fields, strlen(fields) + 1, 1, f) == 1 );
+
+	if ( result )
+		result = MergeRuns(f, &header.postingsSize, &keys, &header.numKeys);
+	if ( result )
+	{
+		header.keysOffset = header.postingsOffset + header.postingsSize;
+		result = ( fwrite(keys, sizeof(*keys), header.numKeys, f) == header.numKeys &&
+			fseek(f, 0, SEEK_SET) == 0 &&
+			fwrite(&header, sizeof(header), 1, f) == 1 );
+	}
+
+	builderIndex = NULL;
+	if ( fclose(f) != 0 )
+		result = false;
+	if ( !result )
+		printf("Failed to write %s\n", builderIndexName);
+
+	free(keys);
+	FreeBuilder();
+	return result;
+}
+
+static bool	ValidateIndex(struct sValueIndex* index)
+{
+	const ValueIndexHeader*	header	=	(const ValueIndexHeader*)index->mapped.data;
+	size_t			dataSize	=	index->mapped.dataSize;
+
+	if ( dataSize < sizeof(*header) ||
+		memcmp(header->magic, VALUE_INDEX_MAGIC, sizeof(header->magic)) ||
+		header->version != VALUE_INDEX_VERSION )
+	{
+		return false;
+	}
+	if ( header->filesOffset > dataSize ||
+		( dataSize - header->filesOffset ) / sizeof(ValueIndexFile) < header->numFiles ||
+		header->stringsOffset > dataSize || dataSize - header->stringsOffset < header->stringsSize ||
+		header->stringsSize == 0 || header->fieldsOffset >= header->stringsSize ||
+		header->postingsOffset > dataSize || dataSize - header->postingsOffset < header->postingsSize ||
+		header->keysOffset > dataSize ||
+		( dataSize - header->keysOffset ) / sizeof(ValueIndexKey) < header->numKeys )
+	{
+		return false;
+	}
+
+	index->header = header;
+	index->files = (const ValueIndexFile*)( index->mapped.data + header->filesOffset );
+	index->strings = (const char*)( index->mapped.data + header->stringsOffset );
+	index->postings = index->mapped.data + header->postingsOffset;
+	index->keys = (const ValueIndexKey*)( index->mapped.data + header->keysOffset );
+
+	if ( index->strings[header->stringsSize - 1] != 0 )
+		return false;
+	for (uint32_t idx = 0; idx < header->numFiles; idx++)
+	{
+		if ( index->files[idx].nameOffset >= header->stringsSize )
+			return false;
+	}
+	return true;
+}
+
+struct sValueIndex*	ValueIndexOpen(const char* indexName)
+{
+	struct sValueIndex*	index	=	(struct sValueIndex*)calloc(1, sizeof(*index));
+
+	if ( index == NULL )
+		return NULL;
+	if ( !MapFile(indexName, &index->mapped) || !ValidateIndex(index) )
+	{
+		printf("Invalid index %s\n", indexName);
+		ValueIndexClose(index);
+		return NULL;
+	}
+	return index;
+}
+
+void	ValueIndexClose(struct sValueIndex* index)
+{
+	if ( index == NULL )
+		return;
+	UnmapFile(&index->mapped);
+	free(index);
+}
+
+const char*	ValueIndexFileName(const struct sValueIndex* index, uint32_t fileIdx)
+{
+	return index->strings + index->files[fileIdx].nameOffset;
+}
+
+uint64_t	ValueIndexFileSize(const struct sValueIndex* index, uint32_t fileIdx)
+{
+	return index->files[fileIdx].fileSize;
+}
+
+bool	ValueIndexHasField(const struct sValueIndex* index, const char* field)
+{
+	const char*	ptr	=	index->strings + index->header->fieldsOffset;
+	size_t		len	=	strlen(field);
+
+	while ( *ptr != 0 )
+	{
+		const char*	end	=	strchr(ptr, ',');
+		size_t		nameLen	=	end != NULL ? (size_t)( end - ptr ) : strlen(ptr);
+
+		if ( nameLen == len && !strncmp(ptr, field, len) )
+			return true;
+		if ( end == NULL )
+			break;
+		ptr = end + 1;
+	}
+	return false;
+}
+
+size_t	ValueIndexLookup(const struct sValueIndex* index, const char* field, const char* value, ValuePosting** postings)
+{
+	uint64_t		keyHash	=	KeyHash(field, value);
+	uint64_t		low	=	0;
+	uint64_t		high	=	index->header->numKeys;
+	const ValueIndexKey*	key;
+	const uint8_t*		data;
+	const uint8_t*		dataEnd;
+	uint64_t		position	=	0;
+	size_t			numPostings	=	0;
+
+	*postings = NULL;
+	while ( low < high )
+	{
+		uint64_t	mid	=	low + ( high - low ) / 2;
+
+		if ( index->keys[mid].keyHash < keyHash )
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	if ( low >= index->header->numKeys || index->keys[low].keyHash != keyHash )
+		return 0;
+
+	key = &index->keys[low];
+	if ( key->postingsOffset > index->header->postingsSize ||
+		index->header->postingsSize - key->postingsOffset < key->postingsSize )
+	{
+		return 0;
+	}
+	*postings = (ValuePosting*)malloc(sizeof(**postings) * key->numPostings);
+	if ( *postings == NULL )
+		return 0;
+
+	data = index->postings + key->postingsOffset;
+	dataEnd = data + key->postingsSize;
+	while ( numPostings < key->numPostings && data < dataEnd )
+	{
+		uint64_t	delta	=	0;
+		unsigned int	shift	=	0;
+
+		do
+		{
+			delta |= (uint64_t)( *data & 0x7F ) << shift;
+			shift += 7;
+		}
+		while ( ( *data++ & 0x80 ) && data < dataEnd && shift < 64 );
+
+		position += delta;
+		if ( ( position >> POSITION_FILE_SHIFT ) >= index->header->numFiles )
+			break;
+		(*postings)[numPostings].fileIdx = (uint32_t)( position >> POSITION_FILE_SHIFT );
+		(*postings)[numPostings].recordOffset = position & ( ( 1ULL << POSITION_FILE_SHIFT ) - 1 );
+		numPostings++;
+	}
+
+	return numPostings;
+}
+
+bool	ValueIndexRecordMatches(const EvtxRecord* record, const char* field, const char* value)
+{
+	char	fieldValue[MAX_VALUE_SIZE];
+
+	for (size_t idx = 0; idx < record->numFields; idx++)
+	{
+		const EvtxField*	recordField	=	&record->fields[idx];
+		size_t			pos;
+
+		if ( strcmp(recordField->key, field) || !FormatFieldValue(recordField, fieldValue, sizeof(fieldValue)) )
+			continue;
+		for (pos = 0; fieldValue[pos] != 0 && FoldByte(fieldValue[pos]) == FoldByte(value[pos]); pos++)
+			;
+		if ( fieldValue[pos] == 0 && value[pos] == 0 )
+			return true;
+	}
+	return false;
+}
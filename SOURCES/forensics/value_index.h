@@ -0,0 +1,95 @@
+/*
+ * =====================================================================================
+ *       Filename:  value_index.h
+ *    Description:  Inverted (field, value) index with postings of record positions
+ *
+ *                  The index file holds, in this order:
+ *
+ *                      ValueIndexHeader
+ *                      ValueIndexFile    [numFiles]
+ *                      strings           (file names, then the indexed fields)
+ *                      posting lists     (varint deltas of packed positions)
+ *                      ValueIndexKey     [numKeys], sorted by keyHash
+ *
+ *                  Keys are 64 bit hashes of the field name and the ASCII case
+ *                  folded value; lookups verify the decoded records, so a hash
+ *                  collision only costs a few extra decodes.
+ * =====================================================================================
+ */
+
+#ifndef value_index_h_included
+#define value_index_h_included
+
+#include "evtx_record.h"
+
+#define VALUE_INDEX_MAGIC		"EVTXVIDX"
+#define VALUE_INDEX_VERSION		2
+#define VALUE_INDEX_RUN_POSTINGS	0x100000
+#define VALUE_INDEX_MAX_SORTERS		4
+#define VALUE_INDEX_MERGE_FANIN		64
+
+typedef struct
+{
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	numFiles;
+	uint64_t	numKeys;
+	uint64_t	filesOffset;
+	uint64_t	stringsOffset;
+	uint64_t	stringsSize;
+	uint64_t	fieldsOffset;	/*  comma separated, relative to the strings */
+	uint64_t	postingsOffset;
+	uint64_t	postingsSize;
+	uint64_t	keysOffset;
+}
+ValueIndexHeader;
+
+typedef struct
+{
+	uint64_t	nameOffset;	/*  zero terminated, relative to the strings */
+	uint64_t	fileSize;
+}
+ValueIndexFile;
+
+typedef struct
+{
+	uint64_t	keyHash;
+	uint64_t	postingsOffset;	/*  relative to the posting lists */
+	uint64_t	numPostings;
+	uint64_t	postingsSize;
+}
+ValueIndexKey;
+
+typedef struct
+{
+	uint32_t	fileIdx;
+	uint64_t	recordOffset;	/*  in the file, below 1 TiB */
+}
+ValuePosting;
+
+/*  Indexes the fields selected by ChunkIndexSetFields() into indexName,
+ *  created at once so that a bad path fails before parsing.  Full posting
+ *  runs are sorted and spilled on up to VALUE_INDEX_MAX_SORTERS threads while
+ *  parsing goes on. */
+bool	ValueIndexBuildBegin(const char* indexName, const char* tempDir, unsigned int sorters);
+bool	ValueIndexBeginFile(const char* fileName, uint64_t fileSize);
+void	ValueIndexAddRecord(const EvtxRecord* record, uint64_t recordOffset);
+/*  Merges the runs into the index and releases the builder */
+bool	ValueIndexWrite(void);
+
+struct sValueIndex;
+
+struct sValueIndex*	ValueIndexOpen(const char* indexName);
+void	ValueIndexClose(struct sValueIndex* index);
+
+const char*	ValueIndexFileName(const struct sValueIndex* index, uint32_t fileIdx);
+uint64_t	ValueIndexFileSize(const struct sValueIndex* index, uint32_t fileIdx);
+/*  False for a field the index was not built with, which no lookup can find */
+bool	ValueIndexHasField(const struct sValueIndex* index, const char* field);
+
+/*  Returns the number of postings in *postings (malloc'ed, ordered by file and offset) */
+size_t	ValueIndexLookup(const struct sValueIndex* index, const char* field, const char* value, ValuePosting** postings);
+
+bool	ValueIndexRecordMatches(const EvtxRecord* record, const char* field, const char* value);
+
+#endif